@@ -0,0 +1,45 @@
+#ifndef PCSC_CENXFS_BRIDGE_Broker_Backend_H
+#define PCSC_CENXFS_BRIDGE_Broker_Backend_H
+
+#pragma once
+
+#include "Broker/Protocol.h"
+
+#include <istream>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace Broker {
+    typedef std::vector<Message> MessageList;
+
+    /// Source des changements d'état des lecteurs surveillés par le courtier.
+    class Backend : private boost::noncopyable {
+    public:
+        virtual ~Backend() {}
+        /** Attend les prochains changements des lecteurs.
+        @param changes
+            Reçoit les messages à diffuser, dans l'ordre.
+        @return
+            `false` si la source est épuisée ou en erreur, le courtier s'arrête alors.
+        */
+        virtual bool wait(MessageList& changes) = 0;
+    };
+
+#ifdef BROKER_WITH_PCSC
+    /// Crée la source surveillant les lecteurs du sous-système PC/SC (Windows ou pcsc-lite).
+    Backend* createPcscBackend();
+#endif
+    /** Crée une source simulée, qui lit les événements dans un flux texte, une commande par ligne :
+    @code
+    add <lecteur>           -- connecte un lecteur vide
+    remove <lecteur>        -- déconnecte le lecteur
+    insert <lecteur> <ATR>  -- insère une carte, ATR en hexadécimal
+    eject <lecteur>         -- retire la carte
+    @endcode
+        Les noms de lecteurs ne contiennent pas d'espaces. La fin du flux arrête le courtier.
+    */
+    Backend* createSimulatedBackend(std::istream& input);
+} // namespace Broker
+
+#endif // PCSC_CENXFS_BRIDGE_Broker_Backend_H
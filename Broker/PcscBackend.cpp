@@ -0,0 +1,149 @@
+#include "Broker/Backend.h"
+
+#include "Utils/Probes.h"
+
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+// PC/CS API (winscard sous Windows, pcsc-lite ailleurs)
+#include <winscard.h>
+
+namespace Broker {
+    /** Source surveillant les lecteurs du sous-système PC/SC, comme `ReaderChangesMonitor` dans
+        le fournisseur de services, mais pour tous les processus de l'hôte.
+    */
+    class PcscBackend : public Backend {
+        typedef std::set<std::string> ReaderSet;
+    private:
+        SCARDCONTEXT hContext;
+        /// Noms des lecteurs, séparés par '\0'. Les éléments de `readers` pointent dedans.
+        std::vector<char> names;
+        /// Le premier élément surveille l'apparition et la disparition des lecteurs.
+        std::vector<SCARD_READERSTATE> readers;
+        /// Lecteurs signalés aux clients.
+        ReaderSet known;
+        /// La liste des lecteurs doit être relue avant la prochaine attente.
+        bool listChanged;
+    public:
+        PcscBackend() : hContext(0), listChanged(true) {
+            establish();
+        }
+        virtual ~PcscBackend() {
+            if (hContext != 0) {
+                SCardReleaseContext(hContext);
+            }
+        }
+
+        virtual bool wait(MessageList& changes) {
+            if (listChanged) {
+                relist(changes);
+                listChanged = false;
+                if (!changes.empty()) {
+                    return true;
+                }
+            }
+            LONG st = PCSC_PROBED_CALL("SCardGetStatusChange", NULL, SCardGetStatusChange(hContext, INFINITE, &readers[0], (DWORD)readers.size()));
+            if (st == SCARD_E_NO_SERVICE || st == SCARD_E_SERVICE_STOPPED || st == SCARD_E_INVALID_HANDLE) {
+                // Windows arrête le service avec le dernier lecteur, pcscd peut être redémarré :
+                // le contexte est recréé, la liste des lecteurs relue.
+                std::clog << "PC/SC service stopped (" << std::hex << st << std::dec << "), reconnecting" << std::endl;
+                SCardReleaseContext(hContext);
+                hContext = 0;
+                boost::this_thread::sleep_for(boost::chrono::seconds(1));
+                establish();
+                listChanged = true;
+                return true;
+            }
+            if (st != SCARD_S_SUCCESS && st != SCARD_E_TIMEOUT) {
+                std::cerr << "SCardGetStatusChange failed: " << std::hex << st << std::dec << std::endl;
+                return false;
+            }
+            for (std::size_t i = 1; i < readers.size(); ++i) {
+                SCARD_READERSTATE& r = readers[i];
+                if (r.dwEventState & SCARD_STATE_CHANGED) {
+                    changes.push_back(state(r));
+                }
+                r.dwCurrentState = r.dwEventState & ~SCARD_STATE_CHANGED;
+            }
+            if (readers[0].dwEventState & SCARD_STATE_CHANGED) {
+                listChanged = true;
+            }
+            readers[0].dwCurrentState = readers[0].dwEventState & ~SCARD_STATE_CHANGED;
+            return true;
+        }
+    private:
+        void establish() {
+            LONG st = PCSC_PROBED_CALL("SCardEstablishContext", NULL, SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &hContext));
+            if (st != SCARD_S_SUCCESS) {
+                std::cerr << "SCardEstablishContext failed: " << std::hex << st << std::dec << std::endl;
+                hContext = 0;
+            }
+        }
+        /** Relit la liste des lecteurs. Les lecteurs disparus sont signalés indisponibles, les nouveaux
+            seront signalés par la prochaine attente. Les lecteurs déjà connus gardent leur état courant.
+        */
+        void relist(MessageList& changes) {
+            // Les noms des lecteurs précédents pointent dans l'ancien tampon, gardé jusqu'à la comparaison.
+            std::vector<SCARD_READERSTATE> previous;
+            std::vector<char> previousNames;
+            previous.swap(readers);
+            previousNames.swap(names);
+
+            DWORD size = 0;
+            if (PCSC_PROBED_CALL("SCardListReaders", NULL, SCardListReaders(hContext, NULL, NULL, &size)) == SCARD_S_SUCCESS && size > 0) {
+                names.resize(size);
+                if (PCSC_PROBED_CALL("SCardListReaders", NULL, SCardListReaders(hContext, NULL, &names[0], &size)) != SCARD_S_SUCCESS) {
+                    names.clear();
+                }
+            }
+            SCARD_READERSTATE pnp = SCARD_READERSTATE();
+            pnp.szReader = "\\\\?PnP?\\Notification";
+            pnp.dwCurrentState = previous.empty() ? SCARD_STATE_UNAWARE : previous[0].dwCurrentState;
+            readers.push_back(pnp);
+
+            ReaderSet current;
+            for (std::size_t i = 0; i < names.size() && names[i] != '\0'; i += std::string(&names[i]).size() + 1) {
+                SCARD_READERSTATE r = SCARD_READERSTATE();
+                r.szReader = &names[i];
+                r.dwCurrentState = SCARD_STATE_UNAWARE;
+                for (std::size_t j = 1; j < previous.size(); ++j) {
+                    if (std::string(previous[j].szReader) == r.szReader) {
+                        r.dwCurrentState = previous[j].dwCurrentState;
+                    }
+                }
+                readers.push_back(r);
+                current.insert(r.szReader);
+            }
+            bool changed = current.size() != known.size();
+            for (ReaderSet::const_iterator it = known.begin(); it != known.end(); ++it) {
+                if (current.count(*it) == 0) {
+                    Message msg(ReaderState, StateUnavailable | StateChanged);
+                    msg.setReader(it->c_str());
+                    changes.push_back(msg);
+                    changed = true;
+                }
+            }
+            known.swap(current);
+            if (changed) {
+                changes.push_back(Message(ReadersChanged, 0));
+            }
+        }
+        static Message state(const SCARD_READERSTATE& r) {
+            Message msg(ReaderState, (boost::uint32_t)r.dwEventState);
+            msg.setReader(r.szReader);
+            msg.cbAtr = r.cbAtr < maxAtr ? (boost::uint32_t)r.cbAtr : (boost::uint32_t)maxAtr;
+            std::memcpy(msg.atr, r.rgbAtr, msg.cbAtr);
+            return msg;
+        }
+    };
+
+    Backend* createPcscBackend() {
+        return new PcscBackend();
+    }
+} // namespace Broker
@@ -0,0 +1,95 @@
+#ifndef PCSC_CENXFS_BRIDGE_Broker_Protocol_H
+#define PCSC_CENXFS_BRIDGE_Broker_Protocol_H
+
+#pragma once
+
+// Pour std::size_t
+#include <cstddef>
+// Pour std::getenv
+#include <cstdlib>
+// Pour std::memset
+#include <cstring>
+#include <string>
+#ifndef _WIN32
+#include <sstream>
+// Pour getuid
+#include <unistd.h>
+#endif
+
+#include <boost/cstdint.hpp>
+
+/** Protocole entre le courtier PC/SC (`PCSCbroker`) et les fournisseurs de services qui s'y abonnent.
+@par
+    Le courtier est le seul processus de l'hôte à surveiller les lecteurs. Chaque client reçoit, dès sa
+    connexion, l'état actuel de tous les lecteurs connus, puis chaque changement. Les messages vont
+    uniquement du courtier vers les clients, ils ont une taille fixe et sont écrits en une seule fois.
+    Ce fichier ne dépend pas des en-têtes Windows, pour pouvoir être utilisé par le courtier sous Linux.
+*/
+namespace Broker {
+    /// Version du protocole, transmise dans le premier message.
+    static const boost::uint32_t protocolVersion = 1;
+    /** Adresse par défaut du courtier : nom du canal nommé sous Windows. Ailleurs, chemin du socket local
+        dans un répertoire propre à l'utilisateur, `$XDG_RUNTIME_DIR/pcsc-cenxfs-bridge` ou, à défaut,
+        `/tmp/pcsc-cenxfs-bridge-<uid>`, que le courtier crée avec les droits 0700.
+    */
+    inline std::string defaultAddress() {
+#ifdef _WIN32
+        return "\\\\.\\pipe\\pcsc-cenxfs-bridge";
+#else
+        const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+        std::ostringstream path;
+        if (runtime != NULL && runtime[0] == '/') {
+            path << runtime << "/pcsc-cenxfs-bridge";
+        } else {
+            path << "/tmp/pcsc-cenxfs-bridge-" << getuid();
+        }
+        path << "/broker.sock";
+        return path.str();
+#endif
+    }
+    /// Longueur maximale du nom d'un lecteur, y compris le zéro final.
+    static const std::size_t maxReaderName = 128;
+    /// Longueur maximale de l'ATR, comme `SCARD_READERSTATE::rgbAtr`.
+    static const std::size_t maxAtr = 36;
+
+    /// Bits de l'état d'un lecteur. Les valeurs sont celles des constantes `SCARD_STATE_*` de PC/SC.
+    enum StateFlags {
+        StateChanged     = 0x0002,
+        StateUnknown     = 0x0004,
+        StateUnavailable = 0x0008,
+        StateEmpty       = 0x0010,
+        StatePresent     = 0x0020
+    };
+    enum MessageKind {
+        /// Premier message envoyé à chaque client, `eventState` contient la version du protocole.
+        Hello = 1,
+        /// Nouvel état d'un lecteur.
+        ReaderState = 2,
+        /// La liste des lecteurs a changé. Les lecteurs retirés ont été signalés avec `StateUnavailable`.
+        ReadersChanged = 3
+    };
+
+    struct Message {
+        boost::uint32_t kind;
+        /// État du lecteur, combinaison de `StateFlags`.
+        boost::uint32_t eventState;
+        boost::uint32_t cbAtr;
+        boost::uint8_t  atr[maxAtr];
+        /// Nom du lecteur, terminé par zéro.
+        char reader[maxReaderName];
+
+        Message() { std::memset(this, 0, sizeof(*this)); }
+        Message(MessageKind kind, boost::uint32_t eventState) {
+            std::memset(this, 0, sizeof(*this));
+            this->kind = kind;
+            this->eventState = eventState;
+        }
+        /// Copie le nom du lecteur, tronqué si nécessaire.
+        void setReader(const char* name) {
+            std::strncpy(reader, name, maxReaderName - 1);
+            reader[maxReaderName - 1] = '\0';
+        }
+    };
+} // namespace Broker
+
+#endif // PCSC_CENXFS_BRIDGE_Broker_Protocol_H
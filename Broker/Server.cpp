@@ -0,0 +1,372 @@
+#include "Broker/Server.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <boost/thread/lock_guard.hpp>
+
+#ifdef _WIN32
+// Pour ConvertStringSecurityDescriptorToSecurityDescriptorA
+#include <sddl.h>
+#pragma comment(lib, "advapi32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace Broker {
+    /// Délai au-delà duquel un client qui ne lit pas ses messages est déconnecté, en ms.
+    static const unsigned sendTimeout = 1000;
+    /// Nombre de messages en attente au-delà duquel un client est considéré comme ne lisant plus.
+    static const std::size_t maxQueue = 1024;
+
+    std::size_t Server::publish(const Message& msg) {
+        ConnectionList closed;
+        std::size_t count = 0;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (msg.kind == ReaderState) {
+                if (msg.eventState & StateUnavailable) {
+                    states.erase(msg.reader);
+                } else {
+                    states[msg.reader] = msg;
+                }
+            }
+            collect(closed);
+            for (ConnectionList::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+                enqueue(**it, msg);
+                if (!(*it)->closed) {
+                    ++count;
+                }
+            }
+        }
+        release(closed);
+        return count;
+    }
+    std::size_t Server::clientCount() {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::size_t count = 0;
+        for (ConnectionList::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+            if (!(*it)->closed) {
+                ++count;
+            }
+        }
+        return count;
+    }
+    void Server::accept(Client client) {
+        ConnectionPtr connection(new Connection(client));
+        ConnectionList closed;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            collect(closed);
+            enqueue(*connection, Message(Hello, protocolVersion));
+            for (StateMap::const_iterator it = states.begin(); it != states.end(); ++it) {
+                enqueue(*connection, it->second);
+            }
+            clients.push_back(connection);
+            connection->thread.reset(new boost::thread(&Server::serve, this, connection));
+            std::clog << "Client connected, " << states.size() << " reader(s) queued, " << clients.size() << " client(s)" << std::endl;
+        }
+        release(closed);
+    }
+    void Server::serve(const ConnectionPtr& connection) {
+        Connection& c = *connection;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!c.closed) {
+            if (c.queue.empty()) {
+                c.changed.wait(lock);
+                continue;
+            }
+            const Message msg = c.queue.front();
+            c.queue.pop_front();
+            // L'envoi se fait hors du verrou : la diffusion et les autres clients ne l'attendent pas.
+            lock.unlock();
+            const bool ok = send(c.client, msg);
+            lock.lock();
+            if (!ok && !c.closed) {
+                std::clog << "Client disconnected" << std::endl;
+                c.closed = true;
+            }
+        }
+    }
+    void Server::enqueue(Connection& connection, const Message& msg) {
+        if (connection.closed) {
+            return;
+        }
+        if (connection.queue.size() >= maxQueue) {
+            std::clog << "Client does not read its messages, disconnected" << std::endl;
+            connection.closed = true;
+        } else {
+            connection.queue.push_back(msg);
+        }
+        connection.changed.notify_one();
+    }
+    void Server::collect(ConnectionList& closed) {
+        for (ConnectionList::iterator it = clients.begin(); it != clients.end();) {
+            // Le thread d'envoi peut encore être dans `send` : le client n'est libéré qu'une fois
+            // ce thread terminé, pour que la diffusion ne l'attende jamais.
+            if ((*it)->closed && (*it)->thread->try_join_for(boost::chrono::milliseconds(0))) {
+                closed.push_back(*it);
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    void Server::release(const ConnectionList& closed) {
+        for (ConnectionList::const_iterator it = closed.begin(); it != closed.end(); ++it) {
+            (*it)->thread->join();
+            // Le thread garde une référence sur sa connexion : la libérer rompt le cycle.
+            (*it)->thread.reset();
+            close((*it)->client);
+        }
+    }
+    void Server::closeAll() {
+        ConnectionList closing;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            for (ConnectionList::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+                (*it)->closed = true;
+                (*it)->changed.notify_one();
+            }
+            closing.swap(clients);
+        }
+        release(closing);
+    }
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#ifdef _WIN32
+    /** Droits du canal : accès complet pour le système, les administrateurs et le propriétaire du canal
+        (le courtier), qui seuls peuvent en créer des instances ; lecture et passage en mode message pour
+        les utilisateurs authentifiés ; aucun accès pour les connexions réseau.
+    */
+    static const char* const pipeSecurity = "D:P(D;;GA;;;NU)(A;;GA;;;SY)(A;;GA;;;BA)(A;;GA;;;OW)(A;;0x120189;;;AU)";
+
+    /** Crée une instance du canal.
+    @param first
+        Si `true`, la création échoue si le canal existe déjà : un autre processus l'a créé avant nous.
+    */
+    static HANDLE createPipe(const std::string& address, bool first) {
+        SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, FALSE };
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(pipeSecurity, SDDL_REVISION_1, &sa.lpSecurityDescriptor, NULL)) {
+            return INVALID_HANDLE_VALUE;
+        }
+        HANDLE hPipe = CreateNamedPipeA(address.c_str(),
+            PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            PIPE_TYPE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, 64 * sizeof(Message), 0, 0, &sa
+        );
+        const DWORD err = GetLastError();
+        LocalFree(sa.lpSecurityDescriptor);
+        SetLastError(err);
+        return hPipe;
+    }
+    Server::Server(const std::string& address)
+        : address(address)
+        , listening(false)
+        , hStop(CreateEvent(NULL, TRUE, FALSE, NULL))
+        , hFirst(createPipe(address, true))
+    {
+        if (hFirst == INVALID_HANDLE_VALUE) {
+            // ERROR_ACCESS_DENIED : le canal existe déjà, un autre courtier (ou un imposteur) l'occupe.
+            std::cerr << "CreateNamedPipe(" << address << ") failed: " << GetLastError() << ", is another broker running?" << std::endl;
+            return;
+        }
+        listening = true;
+        acceptThread.reset(new boost::thread(&Server::run, this));
+    }
+    Server::~Server() {
+        if (acceptThread) {
+            SetEvent(hStop);
+            acceptThread->join();
+        }
+        CloseHandle(hStop);
+        closeAll();
+    }
+    void Server::run() {
+        OVERLAPPED ov = {0};
+        ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        // La première instance a été créée par le constructeur.
+        HANDLE hPipe = hFirst;
+        hFirst = INVALID_HANDLE_VALUE;
+        for (;;) {
+            // Une nouvelle instance du canal par client : les clients sont servis indépendamment.
+            if (hPipe == INVALID_HANDLE_VALUE) {
+                hPipe = createPipe(address, false);
+            }
+            if (hPipe == INVALID_HANDLE_VALUE) {
+                std::cerr << "CreateNamedPipe(" << address << ") failed: " << GetLastError() << std::endl;
+                break;
+            }
+            ResetEvent(ov.hEvent);
+            BOOL connected = ConnectNamedPipe(hPipe, &ov);
+            DWORD err = connected ? ERROR_SUCCESS : GetLastError();
+            if (err == ERROR_IO_PENDING) {
+                HANDLE handles[2] = { ov.hEvent, hStop };
+                if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                    CancelIo(hPipe);
+                    CloseHandle(hPipe);
+                    break;
+                }
+                DWORD dummy;
+                err = GetOverlappedResult(hPipe, &ov, &dummy, FALSE) ? ERROR_SUCCESS : GetLastError();
+            }
+            // Le client s'est connecté entre la création et l'attente.
+            if (err == ERROR_PIPE_CONNECTED) {
+                err = ERROR_SUCCESS;
+            }
+            if (err != ERROR_SUCCESS) {
+                CloseHandle(hPipe);
+            } else {
+                accept(hPipe);
+            }
+            hPipe = INVALID_HANDLE_VALUE;
+        }
+        CloseHandle(ov.hEvent);
+    }
+    bool Server::send(Client client, const Message& msg) {
+        OVERLAPPED ov = {0};
+        ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        DWORD written = 0;
+        BOOL ok = WriteFile(client, &msg, sizeof(msg), NULL, &ov);
+        if (!ok && GetLastError() == ERROR_IO_PENDING) {
+            if (WaitForSingleObject(ov.hEvent, sendTimeout) != WAIT_OBJECT_0) {
+                CancelIo(client);
+            }
+            ok = GetOverlappedResult(client, &ov, &written, TRUE);
+        } else if (ok) {
+            ok = GetOverlappedResult(client, &ov, &written, FALSE);
+        }
+        CloseHandle(ov.hEvent);
+        return ok && written == sizeof(msg);
+    }
+    void Server::close(Client client) {
+        DisconnectNamedPipe(client);
+        CloseHandle(client);
+    }
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#else
+    /** Crée le répertoire du socket avec les droits 0700. Un répertoire existant doit appartenir à
+        l'utilisateur courant et n'être modifiable que par lui : sinon un autre utilisateur pourrait
+        remplacer le socket et se faire passer pour le courtier.
+    */
+    static bool prepareDirectory(const std::string& address) {
+        const std::string::size_type slash = address.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : address.substr(0, slash == 0 ? 1 : slash);
+        if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            std::cerr << "Cannot create " << dir << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            std::cerr << dir << " is not a directory" << std::endl;
+            return false;
+        }
+        if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+            std::cerr << dir << " must be owned by the current user and writable only by them" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    /** Vérifie qu'aucun courtier n'écoute à l'adresse et supprime le socket laissé par une instance
+        arrêtée brutalement.
+    */
+    static bool claimAddress(const sockaddr_un& addr) {
+        struct stat st;
+        if (lstat(addr.sun_path, &st) != 0) {
+            return errno == ENOENT;
+        }
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << addr.sun_path << " exists and is not a socket" << std::endl;
+            return false;
+        }
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool live = fd >= 0 && connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (live) {
+            std::cerr << "Another broker is listening on " << addr.sun_path << std::endl;
+            return false;
+        }
+        unlink(addr.sun_path);
+        return true;
+    }
+    Server::Server(const std::string& address)
+        : address(address), listening(false), listenFd(-1)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Socket path is too long: " << address << std::endl;
+            return;
+        }
+        std::strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        if (!prepareDirectory(address) || !claimAddress(addr)) {
+            return;
+        }
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0
+         || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+         || listen(listenFd, 16) != 0
+        ) {
+            std::cerr << "Cannot listen on " << address << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        listening = true;
+        acceptThread.reset(new boost::thread(&Server::run, this));
+    }
+    Server::~Server() {
+        if (acceptThread) {
+            // Interrompt accept() dans le thread d'acceptation.
+            shutdown(listenFd, SHUT_RDWR);
+            acceptThread->join();
+        }
+        if (listenFd >= 0) {
+            ::close(listenFd);
+        }
+        // Le socket n'est supprimé que s'il est le nôtre, pas celui d'un autre courtier.
+        if (listening) {
+            unlink(address.c_str());
+        }
+        closeAll();
+    }
+    void Server::run() {
+        for (;;) {
+            int fd = ::accept(listenFd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            timeval tv = { sendTimeout / 1000, (sendTimeout % 1000) * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            accept(fd);
+        }
+    }
+    bool Server::send(Client client, const Message& msg) {
+        const char* data = reinterpret_cast<const char*>(&msg);
+        std::size_t left = sizeof(msg);
+        while (left > 0) {
+            ssize_t n = ::send(client, data, left, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            left -= (std::size_t)n;
+        }
+        return true;
+    }
+    void Server::close(Client client) {
+        ::close(client);
+    }
+#endif
+} // namespace Broker
@@ -0,0 +1,116 @@
+#ifndef PCSC_CENXFS_BRIDGE_Broker_Server_H
+#define PCSC_CENXFS_BRIDGE_Broker_Server_H
+
+#pragma once
+
+#include "Broker/Protocol.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace Broker {
+    /** Point d'écoute du courtier : canal nommé sous Windows, socket local ailleurs.
+    @par
+        Le serveur garde le dernier état de chaque lecteur. Un nouveau client reçoit cet état complet
+        sous le même verrou que la diffusion des changements : aucun changement n'est perdu ou reçu
+        deux fois. Chaque client a sa file de messages et son thread d'envoi : la diffusion ne fait que
+        remplir les files, un client lent ne retarde pas les autres. Un client dont la file déborde ou
+        qui n'accepte plus les messages est déconnecté ; il se reconnectera et recevra de nouveau l'état
+        complet.
+    @par
+        Le point d'écoute n'est accessible qu'aux processus locaux : sous Windows, le canal refuse les
+        clients distants et seuls le système, les administrateurs et son propriétaire peuvent en créer
+        des instances ; ailleurs, le socket est créé dans un répertoire accessible à son seul
+        propriétaire. Si un autre courtier écoute déjà à la même adresse, le serveur ne démarre pas.
+    */
+    class Server : private boost::noncopyable {
+#ifdef _WIN32
+        typedef HANDLE Client;
+#else
+        typedef int Client;
+#endif
+        typedef std::map<std::string, Message> StateMap;
+        /// Client abonné et sa file de messages, protégée par `Server::mutex`.
+        struct Connection {
+            Client client;
+            /// Messages en attente d'envoi.
+            std::deque<Message> queue;
+            /// Réveille le thread d'envoi.
+            boost::condition_variable changed;
+            /// `true` si le client doit être déconnecté : le thread d'envoi se termine.
+            bool closed;
+            boost::shared_ptr<boost::thread> thread;
+
+            explicit Connection(Client client) : client(client), closed(false) {}
+        };
+        typedef boost::shared_ptr<Connection> ConnectionPtr;
+        typedef std::vector<ConnectionPtr> ConnectionList;
+    private:
+        const std::string address;
+        /// `false` si le point d'écoute n'a pas pu être créé.
+        bool listening;
+        /// Protège `states`, `clients` et les files des clients.
+        boost::mutex mutex;
+        /// Dernier état de chaque lecteur connecté.
+        StateMap states;
+        /// Clients abonnés, y compris ceux dont le thread d'envoi s'est arrêté et qui restent à libérer.
+        ConnectionList clients;
+#ifdef _WIN32
+        /// Événement signalé pour interrompre l'attente des connexions.
+        HANDLE hStop;
+        /// Première instance du canal, créée par le constructeur, pour refuser une adresse déjà prise.
+        HANDLE hFirst;
+#else
+        /// Socket d'écoute.
+        int listenFd;
+#endif
+        /// Thread acceptant les connexions des clients.
+        boost::shared_ptr<boost::thread> acceptThread;
+    public:
+        /// Crée le point d'écoute et commence à accepter les clients, voir `isListening`.
+        explicit Server(const std::string& address);
+        /// Arrête l'acceptation des connexions et déconnecte tous les clients.
+        ~Server();
+
+        /// @return `false` si le point d'écoute n'a pas pu être créé, notamment si un autre courtier l'occupe.
+        inline bool isListening() const { return listening; }
+        /** Met à jour l'état connu et ajoute le message à la file de chaque client. Ne bloque pas.
+        @return Nombre de clients auxquels le message sera envoyé.
+        */
+        std::size_t publish(const Message& msg);
+        /// Nombre de clients connectés.
+        std::size_t clientCount();
+    private:
+        /// Boucle du thread d'acceptation des connexions.
+        void run();
+        /// Met en file le message d'accueil et l'état de tous les lecteurs pour le nouveau client, puis l'abonne.
+        void accept(Client client);
+        /// Boucle du thread d'envoi d'un client.
+        void serve(const ConnectionPtr& connection);
+        /// Ajoute le message à la file du client, le déconnecte si elle déborde. Appelé sous `mutex`.
+        static void enqueue(Connection& connection, const Message& msg);
+        /// Retire de `clients` ceux qui sont déconnectés. Appelé sous `mutex`, ils sont libérés par `release`.
+        void collect(ConnectionList& closed);
+        /// Attend la fin des threads d'envoi et ferme les clients. Appelé hors de `mutex`.
+        static void release(const ConnectionList& closed);
+        /// Déconnecte tous les clients et attend la fin de leurs threads d'envoi.
+        void closeAll();
+        /// Écrit le message entier, `false` si le client est déconnecté ou ne lit plus.
+        static bool send(Client client, const Message& msg);
+        static void close(Client client);
+    };
+} // namespace Broker
+
+#endif // PCSC_CENXFS_BRIDGE_Broker_Server_H
@@ -0,0 +1,187 @@
+/** Test du serveur du courtier sous Linux, alimenté par la source simulée : refus d'une adresse déjà
+    occupée ou d'un répertoire modifiable par d'autres, reprise d'un socket abandonné, et diffusion
+    qui n'attend pas un client qui ne lit pas.
+@code
+PCSCbrokerTest
+@endcode
+    Retourne 0 si tous les contrôles passent.
+*/
+#include "Broker/Backend.h"
+#include "Broker/Server.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bc = boost::chrono;
+
+static int failures = 0;
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; ++failures; } } while (0)
+
+/// Se connecte au courtier, `-1` en cas d'échec. Une lecture bloquée plus de 5 s échoue.
+static int connectClient(const std::string& address) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+static bool receive(int fd, Broker::Message& msg) {
+    char* data = reinterpret_cast<char*>(&msg);
+    std::size_t left = sizeof(msg);
+    while (left > 0) {
+        ssize_t n = recv(fd, data, left, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        left -= (std::size_t)n;
+    }
+    return true;
+}
+/// Diffuse tous les événements du script, comme le fait le courtier. Retourne le nombre de messages.
+static std::size_t play(Broker::Server& server, const std::string& script, bc::steady_clock::duration& slowest) {
+    std::istringstream input(script);
+    boost::scoped_ptr<Broker::Backend> backend(Broker::createSimulatedBackend(input));
+    Broker::MessageList changes;
+    std::size_t count = 0;
+    while (backend->wait(changes)) {
+        for (Broker::MessageList::const_iterator it = changes.begin(); it != changes.end(); ++it) {
+            const bc::steady_clock::time_point start = bc::steady_clock::now();
+            server.publish(*it);
+            const bc::steady_clock::duration elapsed = bc::steady_clock::now() - start;
+            if (elapsed > slowest) {
+                slowest = elapsed;
+            }
+            ++count;
+        }
+        changes.clear();
+    }
+    return count;
+}
+/// Lit les messages jusqu'à en avoir reçu `expected`, ou jusqu'à l'erreur.
+static void drain(int fd, std::size_t expected, boost::atomic<std::size_t>* received) {
+    Broker::Message msg;
+    while (*received < expected && receive(fd, msg)) {
+        ++*received;
+    }
+}
+
+int main() {
+    char base[] = "/tmp/pcsc-broker-test-XXXXXX";
+    if (mkdtemp(base) == NULL) {
+        std::cerr << "mkdtemp failed: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    const std::string dir = std::string(base) + "/run";
+    const std::string address = dir + "/broker.sock";
+    {
+        Broker::Server server(address);
+        CHECK(server.isListening());
+        struct stat st;
+        CHECK(stat(dir.c_str(), &st) == 0 && (st.st_mode & 0777) == 0700);
+
+        // Un second courtier à la même adresse ne démarre pas et ne supprime pas le socket du premier.
+        {
+            Broker::Server other(address);
+            CHECK(!other.isListening());
+        }
+        CHECK(access(address.c_str(), F_OK) == 0);
+
+        // Le client reçoit l'accueil, puis chaque changement.
+        const int reader = connectClient(address);
+        CHECK(reader >= 0);
+        Broker::Message msg;
+        CHECK(receive(reader, msg) && msg.kind == Broker::Hello && msg.eventState == Broker::protocolVersion);
+        bc::steady_clock::duration slowest = bc::steady_clock::duration::zero();
+        CHECK(play(server, "add R1\ninsert R1 3B0201\n", slowest) == 3);
+        CHECK(receive(reader, msg) && msg.kind == Broker::ReaderState && std::strcmp(msg.reader, "R1") == 0);
+        CHECK(receive(reader, msg) && msg.kind == Broker::ReadersChanged);
+        CHECK(receive(reader, msg) && msg.kind == Broker::ReaderState && (msg.eventState & Broker::StatePresent) && msg.cbAtr == 3);
+
+        // Un client qui ne lit pas ne retarde pas la diffusion et finit déconnecté, l'autre reçoit tout.
+        const int stalled = connectClient(address);
+        CHECK(stalled >= 0);
+        while (server.clientCount() < 2) {
+            boost::this_thread::sleep_for(bc::milliseconds(1));
+        }
+        // La source simulée est neuve : le lecteur est de nouveau annoncé (2 messages). La rafale tient
+        // dans la file d'un client qui lit.
+        std::string script = "add R1\n";
+        for (int i = 0; i < 500; ++i) {
+            script += "eject R1\ninsert R1 3B00\n";
+        }
+        boost::atomic<std::size_t> received(0);
+        boost::thread drainer(&drain, reader, 1002, &received);
+        slowest = bc::steady_clock::duration::zero();
+        CHECK(play(server, script, slowest) == 1002);
+        drainer.join();
+        CHECK(received == 1002);
+        CHECK(slowest < bc::milliseconds(500));
+        // Selon la taille du tampon du socket, la file déborde ou l'envoi dépasse son délai.
+        const bc::steady_clock::time_point deadline = bc::steady_clock::now() + bc::seconds(3);
+        while (server.clientCount() != 1 && bc::steady_clock::now() < deadline) {
+            boost::this_thread::sleep_for(bc::milliseconds(10));
+        }
+        CHECK(server.clientCount() == 1);
+        close(stalled);
+        close(reader);
+    }
+    CHECK(access(address.c_str(), F_OK) != 0);
+    {
+        // Socket laissé par une instance arrêtée brutalement : repris.
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        close(fd);
+        Broker::Server server(address);
+        CHECK(server.isListening());
+    }
+    {
+        // Répertoire modifiable par tous : refusé.
+        const std::string shared = std::string(base) + "/shared";
+        CHECK(mkdir(shared.c_str(), 0700) == 0 && chmod(shared.c_str(), 0777) == 0);
+        Broker::Server server(shared + "/broker.sock");
+        CHECK(!server.isListening());
+        rmdir(shared.c_str());
+    }
+    rmdir(dir.c_str());
+    rmdir(base);
+
+    if (failures != 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::clog << "All checks passed" << std::endl;
+    return 0;
+}
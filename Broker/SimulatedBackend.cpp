@@ -0,0 +1,74 @@
+#include "Broker/Backend.h"
+
+// Pour std::strtoul
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace Broker {
+    /// Source d'événements lus dans un flux texte, pour essayer le courtier sans lecteur ni PC/SC.
+    class SimulatedBackend : public Backend {
+        typedef std::set<std::string> ReaderSet;
+    private:
+        std::istream& input;
+        /// Lecteurs actuellement connectés.
+        ReaderSet readers;
+    public:
+        explicit SimulatedBackend(std::istream& input) : input(input) {}
+
+        virtual bool wait(MessageList& changes) {
+            std::string line;
+            while (changes.empty() && std::getline(input, line)) {
+                parse(line, changes);
+            }
+            return !changes.empty();
+        }
+    private:
+        void parse(const std::string& line, MessageList& changes) {
+            std::istringstream in(line);
+            std::string command;
+            std::string reader;
+            in >> command >> reader;
+            if (command.empty() || command[0] == '#') {
+                return;
+            }
+            if (reader.empty()) {
+                std::cerr << "Missing reader name: " << line << std::endl;
+                return;
+            }
+            const bool known = readers.count(reader) != 0;
+            if (command == "add" && !known) {
+                readers.insert(reader);
+                changes.push_back(state(reader, StateEmpty));
+                changes.push_back(Message(ReadersChanged, 0));
+            } else if (command == "remove" && known) {
+                readers.erase(reader);
+                changes.push_back(state(reader, StateUnavailable));
+                changes.push_back(Message(ReadersChanged, 0));
+            } else if (command == "insert" && known) {
+                std::string atr;
+                in >> atr;
+                Message msg = state(reader, StatePresent);
+                for (std::size_t i = 0; i + 1 < atr.size() && msg.cbAtr < maxAtr; i += 2) {
+                    msg.atr[msg.cbAtr++] = (boost::uint8_t)std::strtoul(atr.substr(i, 2).c_str(), NULL, 16);
+                }
+                changes.push_back(msg);
+            } else if (command == "eject" && known) {
+                changes.push_back(state(reader, StateEmpty));
+            } else {
+                std::cerr << "Ignored command: " << line << std::endl;
+            }
+        }
+        static Message state(const std::string& reader, boost::uint32_t flags) {
+            Message msg(ReaderState, flags | StateChanged);
+            msg.setReader(reader.c_str());
+            return msg;
+        }
+    };
+
+    Backend* createSimulatedBackend(std::istream& input) {
+        return new SimulatedBackend(input);
+    }
+} // namespace Broker
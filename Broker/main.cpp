@@ -0,0 +1,78 @@
+/** Courtier PC/SC : surveille les lecteurs une seule fois pour tous les fournisseurs de services
+    de l'hôte et leur diffuse les changements (voir `Broker/Protocol.h`).
+@code
+PCSCbroker [--address <canal ou socket>] [--simulate [<fichier>]]
+@endcode
+    Avec `--simulate`, les événements sont lus dans le fichier ou sur l'entrée standard au lieu de
+    PC/SC (voir `createSimulatedBackend`).
+*/
+#include "Broker/Backend.h"
+#include "Broker/Server.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+static int usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--address <pipe or socket>] [--simulate [<file>]]" << std::endl;
+    return 2;
+}
+int main(int argc, char* argv[]) {
+    std::string address = Broker::defaultAddress();
+    bool simulate = false;
+    std::string script;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--address") == 0 && i + 1 < argc) {
+            address = argv[++i];
+        } else if (std::strcmp(argv[i], "--simulate") == 0) {
+            simulate = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                script = argv[++i];
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    std::ifstream file;
+    boost::scoped_ptr<Broker::Backend> backend;
+    if (simulate) {
+        if (!script.empty()) {
+            file.open(script.c_str());
+            if (!file) {
+                std::cerr << "Cannot open " << script << std::endl;
+                return 1;
+            }
+        }
+        backend.reset(Broker::createSimulatedBackend(script.empty() ? std::cin : file));
+    } else {
+#ifdef BROKER_WITH_PCSC
+        backend.reset(Broker::createPcscBackend());
+#else
+        std::cerr << "Built without PC/SC support, use --simulate" << std::endl;
+        return 1;
+#endif
+    }
+
+    Broker::Server server(address);
+    if (!server.isListening()) {
+        return 1;
+    }
+    std::clog << "Listening on " << address << std::endl;
+
+    Broker::MessageList changes;
+    while (backend->wait(changes)) {
+        for (Broker::MessageList::const_iterator it = changes.begin(); it != changes.end(); ++it) {
+            std::size_t count = server.publish(*it);
+            std::clog << "Published " << (it->kind == Broker::ReaderState ? it->reader : "<readers changed>")
+                      << " state=0x" << std::hex << it->eventState << std::dec
+                      << " to " << count << " client(s)" << std::endl;
+        }
+        changes.clear();
+    }
+    std::clog << "Backend stopped" << std::endl;
+    return 0;
+}
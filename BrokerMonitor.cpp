@@ -0,0 +1,163 @@
+#include "BrokerMonitor.h"
+
+#include "Manager.h"
+#include "Tracer.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::memcpy
+#include <cstring>
+
+/// Délai entre deux tentatives de connexion au courtier, en ms.
+static const DWORD reconnectDelay = 1000;
+
+BrokerMonitor* BrokerMonitor::connect(Manager& manager, const std::string& address) {
+    const std::string name = address.empty() ? Broker::defaultAddress() : address;
+    HANDLE hPipe = open(name);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        {XFS::Logger() << "BrokerMonitor: broker " << name << " is unreachable (" << GetLastError() << "), monitoring readers locally"; }
+        return NULL;
+    }
+    {XFS::Logger() << "BrokerMonitor: connected to broker " << name; }
+    return new BrokerMonitor(manager, name, hPipe);
+}
+BrokerMonitor::BrokerMonitor(Manager& manager, const std::string& address, HANDLE hPipe)
+    : manager(manager)
+    , address(address)
+    , hPipe(hPipe)
+    , hCancel(CreateEvent(NULL, FALSE, FALSE, NULL))
+    , readPending(false)
+    , stopRequested(false)
+{
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    waitChangesThread.reset(new boost::thread(&BrokerMonitor::run, this));
+}
+BrokerMonitor::~BrokerMonitor() {
+    stopRequested = true;
+    cancel("BrokerMonitor::~BrokerMonitor");
+    waitChangesThread->join();
+    close();
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(hCancel);
+}
+void BrokerMonitor::cancel(const char* reason) const {
+    //XFS::Logger() << "BrokerMonitor::cancel - reason: " << reason;
+    SetEvent(hCancel);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+HANDLE BrokerMonitor::open(const std::string& address) {
+    // FILE_WRITE_ATTRIBUTES est nécessaire pour passer le canal en mode message.
+    HANDLE hPipe = CreateFileA(address.c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        return hPipe;
+    }
+    DWORD mode = PIPE_READMODE_MESSAGE;
+    SetNamedPipeHandleState(hPipe, &mode, NULL, NULL);
+    return hPipe;
+}
+void BrokerMonitor::close() {
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    if (readPending) {
+        DWORD read;
+        CancelIo(hPipe);
+        GetOverlappedResult(hPipe, &overlapped, &read, TRUE);
+        readPending = false;
+    }
+    CloseHandle(hPipe);
+    hPipe = INVALID_HANDLE_VALUE;
+}
+void BrokerMonitor::run() {
+    while (!stopRequested) {
+        DWORD timeout = manager.getTimeout();
+        if (hPipe == INVALID_HANDLE_VALUE) {
+            hPipe = open(address);
+            if (hPipe == INVALID_HANDLE_VALUE) {
+                if (WaitForSingleObject(hCancel, timeout < reconnectDelay ? timeout : reconnectDelay) == WAIT_TIMEOUT) {
+                    manager.processTimeouts(bc::steady_clock::now());
+                }
+                continue;
+            }
+            {XFS::Logger() << "BrokerMonitor: reconnected to broker " << address; }
+        }
+        Broker::Message msg;
+        switch (receive(msg, timeout)) {
+            case Received: {
+                bc::steady_clock::time_point receivedAt = bc::steady_clock::now();
+                dispatch(msg);
+                manager.metrics().record("dispatch_us", Metrics::Labels(), receivedAt);
+                break;
+            }
+            case Timeout: {
+                manager.processTimeouts(bc::steady_clock::now());
+                break;
+            }
+            case Cancelled: {
+                // Le délai d'attente sera recalculé.
+                break;
+            }
+            case Disconnected: {
+                {XFS::Logger() << "BrokerMonitor: connection to broker " << address << " lost (" << GetLastError() << ")"; }
+                close();
+                break;
+            }
+        }
+    }
+}
+BrokerMonitor::ReceiveResult BrokerMonitor::receive(Broker::Message& msg, DWORD timeout) {
+    if (!readPending) {
+        // Si la lecture se termine immédiatement, l'événement est tout de même signalé.
+        if (!ReadFile(hPipe, &incoming, sizeof(incoming), NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING) {
+            return Disconnected;
+        }
+        readPending = true;
+    }
+    HANDLE handles[2] = { overlapped.hEvent, hCancel };
+    switch (WaitForMultipleObjects(2, handles, FALSE, timeout)) {
+        case WAIT_OBJECT_0: break;
+        case WAIT_OBJECT_0 + 1: return Cancelled;
+        default: return Timeout;
+    }
+    readPending = false;
+    DWORD read = 0;
+    // Un message de taille inattendue (ERROR_MORE_DATA) signifie un courtier d'une autre version.
+    if (!GetOverlappedResult(hPipe, &overlapped, &read, FALSE) || read != sizeof(incoming)) {
+        return Disconnected;
+    }
+    msg = incoming;
+    return Received;
+}
+void BrokerMonitor::dispatch(const Broker::Message& msg) {
+    Tracer::Span span("provider", "BrokerMonitor::dispatch");
+    SCARD_READERSTATE state;
+    ZeroMemory(&state, sizeof(state));
+    switch (msg.kind) {
+        case Broker::Hello: {
+            if (msg.eventState != Broker::protocolVersion) {
+                {XFS::Logger() << "BrokerMonitor: unexpected broker protocol version " << msg.eventState; }
+            }
+            break;
+        }
+        case Broker::ReaderState: {
+            state.szReader = msg.reader;
+            state.pvUserData = (void*)manager.readerNames().intern(msg.reader);
+            // Le gestionnaire calcule lui-même l'état précédent du lecteur.
+            state.dwEventState = msg.eventState | SCARD_STATE_CHANGED;
+            state.cbAtr = msg.cbAtr < sizeof(state.rgbAtr) ? msg.cbAtr : sizeof(state.rgbAtr);
+            std::memcpy(state.rgbAtr, msg.atr, state.cbAtr);
+            manager.notifyChanges(state, false);
+            break;
+        }
+        case Broker::ReadersChanged: {
+            state.szReader = "\\\\?PnP?\\Notification";
+            state.dwEventState = SCARD_STATE_CHANGED;
+            manager.notifyChanges(state, true);
+            break;
+        }
+        default: {
+            {XFS::Logger() << "BrokerMonitor: unknown message " << msg.kind; }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef PCSC_CENXFS_BRIDGE_BrokerMonitor_H
+#define PCSC_CENXFS_BRIDGE_BrokerMonitor_H
+
+#pragma once
+
+#include "ReaderMonitor.h"
+
+#include "Broker/Protocol.h"
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <windows.h>
+
+class Manager;
+/** Surveillance des lecteurs déléguée au courtier PC/SC de l'hôte (`Broker/`). Au lieu d'interroger
+    PC/SC lui-même, le thread reçoit les changements des lecteurs diffusés par le courtier et les
+    transmet au gestionnaire, exactement comme `ReaderChangesMonitor`. Les échanges avec les cartes
+    restent faits par le processus.
+@par
+    Si le courtier s'arrête, le thread essaie de s'y reconnecter chaque seconde, et reçoit de nouveau
+    l'état de tous les lecteurs. Les timeouts des tâches continuent d'être traités pendant ce temps.
+*/
+class BrokerMonitor : public ReaderMonitor {
+    enum ReceiveResult { Received, Timeout, Cancelled, Disconnected };
+private:
+    Manager& manager;
+    /// Nom du canal nommé du courtier.
+    const std::string address;
+    /// Canal connecté au courtier, `INVALID_HANDLE_VALUE` pendant la reconnexion.
+    HANDLE hPipe;
+    /// Événement signalé par `cancel` pour interrompre l'attente.
+    HANDLE hCancel;
+    /// Lecture asynchrone du canal en cours. Elle survit aux interruptions par `cancel`.
+    OVERLAPPED overlapped;
+    /// Tampon de la lecture en cours.
+    Broker::Message incoming;
+    bool readPending;
+    /// Flag positionné lors de la destruction, pour arrêter `waitChangesThread`.
+    bool stopRequested;
+    /// Thread recevant les changements du courtier.
+    boost::shared_ptr<boost::thread> waitChangesThread;
+public:
+    /** Se connecte au courtier et démarre la réception des changements.
+    @param address
+        Nom du canal nommé du courtier, `Broker::defaultAddress()` si vide.
+    @return
+        Moniteur créé, ou `NULL` si le courtier ne répond pas : le gestionnaire surveille alors
+        les lecteurs lui-même.
+    */
+    static BrokerMonitor* connect(Manager& manager, const std::string& address);
+    /// Demande l'arrêt du thread, attend sa fin et ferme la connexion au courtier.
+    virtual ~BrokerMonitor();
+
+    virtual void cancel(const char* reason) const;
+private:
+    BrokerMonitor(Manager& manager, const std::string& address, HANDLE hPipe);
+    /// Ouvre le canal du courtier, `INVALID_HANDLE_VALUE` s'il n'est pas disponible.
+    static HANDLE open(const std::string& address);
+    /// Abandonne la lecture en cours et ferme le canal.
+    void close();
+    /// Boucle du thread de réception.
+    void run();
+    /// Attend le prochain message du courtier au plus `timeout` ms, ou l'appel de `cancel`.
+    ReceiveResult receive(Broker::Message& msg, DWORD timeout);
+    /// Transmet le message reçu au gestionnaire.
+    void dispatch(const Broker::Message& msg);
+};
+
+#endif // PCSC_CENXFS_BRIDGE_BrokerMonitor_H
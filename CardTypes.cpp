@@ -0,0 +1,199 @@
+#include "CardTypes.h"
+
+#include "XFS/Logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+const char* const CardTypes::unknown = "unknown";
+
+/// Nombre maximal d'états de l'automate, au-delà duquel la base est refusée.
+static const std::size_t stateLimit = 65536;
+
+namespace {
+    /// Nœud de l'arbre des motifs, avant la compilation.
+    struct Node {
+        /// Nœud suivant pour chaque demi-octet, puis pour le joker `.`, `-1` s'il n'existe pas.
+        boost::int32_t next[17];
+        /// Indice du premier motif qui se termine dans ce nœud, `-1` s'il n'y en a pas.
+        boost::int32_t pattern;
+
+        Node() : pattern(-1) {
+            std::fill(next, next + 17, -1);
+        }
+    };
+    typedef std::vector<boost::int32_t> NodeSet;
+
+    int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        // Joker
+        if (c == '.') return 16;
+        return -1;
+    }
+    /// Lit un motif : suite d'octets en hexadécimal séparés par des espaces. Retourne `false` si la ligne est mal formée.
+    bool parsePattern(const std::string& line, std::vector<int>& nibbles) {
+        std::size_t i = 0;
+        while (i < line.size()) {
+            if (line[i] == ' ') {
+                ++i;
+                continue;
+            }
+            if (i + 1 >= line.size()) {
+                return false;
+            }
+            const int hi = hexDigit(line[i]);
+            const int lo = hexDigit(line[i + 1]);
+            if (hi < 0 || lo < 0 || (i + 2 < line.size() && line[i + 2] != ' ')) {
+                return false;
+            }
+            nibbles.push_back(hi);
+            nibbles.push_back(lo);
+            i += 2;
+        }
+        return !nibbles.empty();
+    }
+    /// Lit le nom du type au début de la ligne de description.
+    std::string parseName(const std::string& line) {
+        std::size_t i = line.find_first_not_of(" \t");
+        std::size_t begin = i;
+        for (; i < line.size(); ++i) {
+            const char c = line[i];
+            if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '-')) {
+                break;
+            }
+        }
+        if (begin == std::string::npos || (i < line.size() && line[i] != ' ' && line[i] != '\t')) {
+            return std::string();
+        }
+        return line.substr(begin, i - begin);
+    }
+} // namespace
+
+CardTypes::Ptr CardTypes::load(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        {XFS::Logger() << "CardTypes: cannot read " << path; }
+        return Ptr();
+    }
+    boost::shared_ptr<CardTypes> result(new CardTypes());
+    std::vector<Node> nodes(1);
+    // Type de chaque motif, indice dans mNames.
+    std::vector<boost::int32_t> patternTypes;
+    // Motifs lus qui attendent leur type.
+    std::size_t pending = 0;
+    std::string line;
+    for (std::size_t lineNo = 1; std::getline(file, line); ++lineNo) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line[0] == '\t') {
+            // Lignes de description après la première.
+            if (pending == 0) {
+                continue;
+            }
+            const std::string name = parseName(line);
+            if (name.empty()) {
+                {XFS::Logger() << "CardTypes: " << path << ':' << lineNo << ": invalid card type name"; }
+                return Ptr();
+            }
+            std::vector<std::string>::iterator it = std::find(result->mNames.begin(), result->mNames.end(), name);
+            const boost::int32_t type = (boost::int32_t)(it - result->mNames.begin());
+            if (it == result->mNames.end()) {
+                result->mNames.push_back(name);
+            }
+            patternTypes.resize(patternTypes.size() + pending, type);
+            pending = 0;
+            continue;
+        }
+        std::vector<int> nibbles;
+        if (!parsePattern(line, nibbles)) {
+            {XFS::Logger() << "CardTypes: " << path << ':' << lineNo << ": invalid ATR pattern"; }
+            return Ptr();
+        }
+        boost::int32_t n = 0;
+        for (std::size_t i = 0; i < nibbles.size(); ++i) {
+            if (nodes[n].next[nibbles[i]] < 0) {
+                nodes[n].next[nibbles[i]] = (boost::int32_t)nodes.size();
+                nodes.push_back(Node());
+            }
+            n = nodes[n].next[nibbles[i]];
+        }
+        // Le premier motif l'emporte sur les doublons.
+        if (nodes[n].pattern < 0) {
+            nodes[n].pattern = (boost::int32_t)(patternTypes.size() + pending);
+        }
+        ++pending;
+    }
+    if (pending != 0) {
+        {XFS::Logger() << "CardTypes: " << path << ": ATR patterns without card type at end of file"; }
+        return Ptr();
+    }
+
+    // Construction des sous-ensembles : chaque état de l'automate est l'ensemble des nœuds
+    // de l'arbre atteints par le même préfixe d'ATR.
+    std::map<NodeSet, boost::int32_t> ids;
+    std::vector<NodeSet> states(1, NodeSet(1, 0));
+    ids[states[0]] = 0;
+    for (std::size_t s = 0; s < states.size(); ++s) {
+        if (states.size() > stateLimit) {
+            {XFS::Logger() << "CardTypes: " << path << ": too many automaton states, simplify the patterns"; }
+            return Ptr();
+        }
+        boost::int32_t first = -1;
+        for (NodeSet::const_iterator it = states[s].begin(); it != states[s].end(); ++it) {
+            const boost::int32_t p = nodes[*it].pattern;
+            if (p >= 0 && (first < 0 || p < first)) {
+                first = p;
+            }
+        }
+        result->mAccept.push_back(first < 0 ? -1 : patternTypes[first]);
+
+        for (int nibble = 0; nibble < 16; ++nibble) {
+            NodeSet next;
+            for (NodeSet::const_iterator it = states[s].begin(); it != states[s].end(); ++it) {
+                if (nodes[*it].next[nibble] >= 0) {
+                    next.push_back(nodes[*it].next[nibble]);
+                }
+                if (nodes[*it].next[16] >= 0) {
+                    next.push_back(nodes[*it].next[16]);
+                }
+            }
+            boost::int32_t id = -1;
+            if (!next.empty()) {
+                std::sort(next.begin(), next.end());
+                next.erase(std::unique(next.begin(), next.end()), next.end());
+                std::map<NodeSet, boost::int32_t>::const_iterator found = ids.find(next);
+                if (found != ids.end()) {
+                    id = found->second;
+                } else {
+                    id = (boost::int32_t)states.size();
+                    ids[next] = id;
+                    states.push_back(next);
+                }
+            }
+            result->mTable.push_back(id);
+        }
+    }
+    {XFS::Logger() << "CardTypes: " << path << ": " << patternTypes.size() << " patterns, "
+                   << result->mNames.size() << " card types, " << result->mAccept.size() << " states"; }
+    return result;
+}
+const char* CardTypes::classify(const BYTE* atr, DWORD size) const {
+    boost::int32_t state = 0;
+    for (DWORD i = 0; i < size && state >= 0; ++i) {
+        state = mTable[state * 16 + (atr[i] >> 4)];
+        if (state >= 0) {
+            state = mTable[state * 16 + (atr[i] & 0x0F)];
+        }
+    }
+    if (state < 0 || mAccept[state] < 0) {
+        return unknown;
+    }
+    return mNames[mAccept[state]].c_str();
+}
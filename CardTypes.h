@@ -0,0 +1,65 @@
+#ifndef PCSC_CENXFS_BRIDGE_CardTypes_H
+#define PCSC_CENXFS_BRIDGE_CardTypes_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+// Pour BYTE et DWORD
+#include <windef.h>
+
+/** Base de motifs d'ATR, qui classe les cartes par type (par exemple `emv`, `eid`, `sam`) dès leur
+    insertion. Le fichier reprend le format de `smartcard_list.txt` de pcsc-tools :
+@code
+    # commentaire
+    3B 8F 80 01 80 4F 0C A0 00 00 03 06 .. .. .. .. .. .. ..
+    3B 6. 00 00 80 31 C0 ..
+    	emv   description libre
+@endcode
+    Chaque motif donne les octets de l'ATR en hexadécimal, un `.` remplaçant un chiffre quelconque ;
+    l'ATR doit avoir exactement la longueur du motif. La première ligne commençant par une tabulation
+    qui suit un ou plusieurs motifs donne leur type (lettres, chiffres, `_` et `-`), le reste de
+    la ligne et les lignes de description suivantes sont ignorés. Si plusieurs motifs correspondent,
+    le premier du fichier l'emporte.
+@par
+    Au chargement, les motifs sont compilés en un automate déterministe sur les demi-octets de l'ATR :
+    la classification suit une transition par demi-octet, sans retour arrière, quel que soit
+    le nombre de motifs.
+*/
+class CardTypes : private boost::noncopyable {
+public:
+    typedef boost::shared_ptr<const CardTypes> Ptr;
+    /// Type des cartes dont l'ATR ne correspond à aucun motif.
+    static const char* const unknown;
+private:
+    /// Noms des types, dans l'ordre de leur première apparition dans le fichier.
+    std::vector<std::string> mNames;
+    /// Transitions de l'automate : état suivant pour chaque état et demi-octet, `-1` sans correspondance.
+    std::vector<boost::int32_t> mTable;
+    /// Type (indice dans `mNames`) reconnu dans chaque état, `-1` si aucun motif ne s'y termine.
+    std::vector<boost::int32_t> mAccept;
+public:
+    /** Charge et compile la base spécifiée.
+    @return
+        `NULL` si le fichier ne peut être lu ou est mal formé ; l'erreur est écrite dans la trace.
+    */
+    static Ptr load(const std::string& path);
+
+    /** Type de la carte d'ATR spécifié, `unknown` si aucun motif ne correspond. La chaîne retournée
+        est valable tant que la base l'est.
+    */
+    const char* classify(const BYTE* atr, DWORD size) const;
+    /// Noms des types connus.
+    inline const std::vector<std::string>& names() const { return mNames; }
+    /// Nombre d'états de l'automate.
+    inline std::size_t stateCount() const { return mAccept.size(); }
+private:
+    CardTypes() {}
+};
+
+#endif // PCSC_CENXFS_BRIDGE_CardTypes_H
@@ -0,0 +1,23 @@
+#include "ConfigSource.h"
+
+#include "FileConfig.h"
+#include "RegistryConfig.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::getenv
+#include <cstdlib>
+
+const char* const ConfigSource::fileVariable = "PCSC_CENXFS_BRIDGE_CONFIG";
+
+ConfigSource::Ptr ConfigSource::open() {
+    const char* path = std::getenv(fileVariable);
+    if (path != NULL && *path != '\0') {
+        {XFS::Logger() << "ConfigSource::open: using configuration file " << path; }
+        return Ptr(new FileConfig(path));
+    }
+    return Ptr(new RegistryConfig());
+}
+std::string ConfigSource::provider(const char* serviceName) const {
+    return value(std::string("LOGICAL_SERVICES\\") + serviceName, "provider");
+}
@@ -0,0 +1,61 @@
+#ifndef PCSC_CENXFS_BRIDGE_ConfigSource_H
+#define PCSC_CENXFS_BRIDGE_ConfigSource_H
+
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+// Pour DWORD
+#include <windef.h>
+
+/** Source de la configuration des fournisseurs de services. Les clés sont désignées par leur chemin
+    relatif à la racine de la configuration XFS, les composants séparés par `\`, par exemple
+    `SERVICE_PROVIDERS\<fournisseur>\Workarounds`.
+@par
+    Deux sources existent : le registre, lu à travers l'API de configuration XFS (`WFM*Key`), et un
+    fichier INI de même structure, qui permet de faire tourner le pont sans registre XFS. Le fichier
+    est utilisé si la variable d'environnement `PCSC_CENXFS_BRIDGE_CONFIG` contient son chemin.
+*/
+class ConfigSource : private boost::noncopyable {
+public:
+    typedef boost::shared_ptr<ConfigSource> Ptr;
+    /// Nom de la variable d'environnement contenant le chemin du fichier de configuration.
+    static const char* const fileVariable;
+public:
+    virtual ~ConfigSource() {}
+
+    /// Crée la source indiquée par l'environnement : le fichier de configuration, sinon le registre.
+    static Ptr open();
+
+    /** Obtient la valeur de la clé spécifiée.
+    @param key
+        Chemin de la clé.
+    @param name
+        Nom de la valeur dans la clé. `NULL` désigne la valeur par défaut de la clé.
+    @return
+        Chaîne contenant la valeur. Si la valeur n'existe pas, retourne une chaîne vide.
+    */
+    virtual std::string value(const std::string& key, const char* name) const = 0;
+    /// Obtient la valeur numérique de la clé spécifiée, `0` si la valeur n'existe pas.
+    virtual DWORD dwValue(const std::string& key, const char* name) const = 0;
+
+    /// Relit la source, si elle conserve une copie de la configuration.
+    virtual void reload() = 0;
+    /** Attend une modification de la configuration pendant au plus le temps spécifié. La première
+        attente commence la surveillance. Appelée uniquement par le thread de surveillance.
+    @param timeout
+        Délai d'attente en millisecondes.
+    @return
+        `true` si la configuration a été modifiée, `false` à l'expiration du délai ou si
+        la surveillance n'est pas possible.
+    */
+    virtual bool waitChange(DWORD timeout) = 0;
+public:
+    /// Nom du fournisseur configuré pour le service logique spécifié.
+    std::string provider(const char* serviceName) const;
+};
+
+#endif // PCSC_CENXFS_BRIDGE_ConfigSource_H
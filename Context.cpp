@@ -2,16 +2,25 @@
 
 #include "PCSC/Status.h"
 
+#include "Utils/Probes.h"
+
 #include "XFS/Logger.h"
 
 namespace PCSC {
     Context::Context() {
         // Crée un contexte.
-        Status st = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &hContext);
+        Status st = PCSC_PROBED_CALL("SCardEstablishContext", NULL, SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &hContext));
         XFS::Logger() << "SCardEstablishContext: " << st;
     }
     Context::~Context() {
-        Status st = SCardReleaseContext(hContext);
+        Status st = PCSC_PROBED_CALL("SCardReleaseContext", NULL, SCardReleaseContext(hContext));
+        XFS::Logger() << "SCardReleaseContext: " << st;
+    }
+    Status Context::reestablish() {
+        Status st = PCSC_PROBED_CALL("SCardReleaseContext", NULL, SCardReleaseContext(hContext));
         XFS::Logger() << "SCardReleaseContext: " << st;
+        st = PCSC_PROBED_CALL("SCardEstablishContext", NULL, SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &hContext));
+        XFS::Logger() << "SCardEstablishContext: " << st;
+        return st;
     }
 }
\ No newline at end of file
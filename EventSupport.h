@@ -3,13 +3,17 @@
 
 #pragma once
 
-#include "XFS/Result.h"
+#include "XFS/ResultTemplate.h"
 
 #include <cassert>
 #include <set>
 #include <vector>
 // Pour std::pair
 #include <utility>
+
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+
 // Pour HWND et DWORD
 #include <windef.h>
 
@@ -54,10 +58,9 @@ public:
         mask &= ~event;
         return mask == 0;
     }
-    void notify(DWORD event, XFS::Result result) const {
-        if (mask & event) {
-            result.send(hWnd, event);
-        }
+    /// @return `true` si l'abonné souhaite recevoir les événements de la classe spécifiée.
+    inline bool accepts(DWORD event) const {
+        return (mask & event) != 0;
     }
 };
 class EventNotifier {
@@ -65,9 +68,13 @@ class EventNotifier {
     typedef std::pair<SubscriberList::iterator, bool> InsertResult;
 private:
     SubscriberList subscribers;
+    /// Les abonnements sont modifiés par les threads des applications XFS, alors que les événements
+    /// sont générés par le thread de surveillance des lecteurs.
+    mutable boost::mutex subscribersMutex;
 public:
     void add(HWND hWnd, DWORD event) {
         assert(hWnd != NULL && "Attempt to subscribe NULL window to events");
+        boost::lock_guard<boost::mutex> lock(subscribersMutex);
         InsertResult r = subscribers.insert(EventSubscriber(hWnd, event));
         // Si l'élément spécifié existait déjà dans la carte, il ne sera pas remplacé,
         // et nous n'en avons pas besoin. Au lieu de cela, nous devons mettre à jour l'élément existant.
@@ -77,6 +84,7 @@ public:
         }
     }
     void remove(HWND hWnd, DWORD event) {
+        boost::lock_guard<boost::mutex> lock(subscribersMutex);
         // NULL signifie que la désinscription se fait pour toutes les fenêtres
         if (hWnd == NULL) {
             std::vector<HWND> forRemove;
@@ -106,18 +114,47 @@ public:
     }
     /// Supprime tous les abonnés aux événements.
     void clear() {
+        boost::lock_guard<boost::mutex> lock(subscribersMutex);
         subscribers.clear();
     }
     /** Notifie tous les abonnés de l'événement spécifié.
-    @param resultGenerator Fonction qui doit retourner un résultat de type XFS::Result.
-           Cette fonction est appelée pour chaque abonné à l'événement.
+    @param resultBuilder Fonction qui doit retourner un modèle de résultat de type XFS::ResultTemplate.
+           Cette fonction est appelée une seule fois, et seulement si au moins un abonné s'intéresse
+           à l'événement ; chaque abonné reçoit ensuite sa propre copie du modèle.
+    */
+    template<class F>
+    void notify(DWORD event, F resultBuilder) const {
+        std::vector<HWND> targets;
+        {
+            boost::lock_guard<boost::mutex> lock(subscribersMutex);
+            for (SubscriberList::const_iterator it = subscribers.begin(); it != subscribers.end(); ++it) {
+                if (it->accepts(event)) {
+                    targets.push_back(it->hWnd);
+                }
+            }
+        }
+        if (targets.empty()) {
+            return;
+        }
+        const XFS::ResultTemplate payload = resultBuilder();
+        for (std::vector<HWND>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+            payload.clone().send(*it, event);
+        }
+    }
+    /** Notifie de l'événement spécifié le seul abonné `hWnd`, s'il s'y intéresse.
+        Utilisé pour mettre un nouvel abonné au courant de l'état actuel.
     */
     template<class F>
-    void notify(DWORD event, F resultGenerator) const {
-        SubscriberList::const_iterator end = subscribers.end();
-        for (SubscriberList::const_iterator it = subscribers.begin(); it != subscribers.end(); ++it) {
-            it->notify(event, resultGenerator());
+    void notify(HWND hWnd, DWORD event, F resultBuilder) const {
+        {
+            boost::lock_guard<boost::mutex> lock(subscribersMutex);
+            // Le deuxième paramètre du constructeur n'est pas important.
+            SubscriberList::const_iterator it = subscribers.find(EventSubscriber(hWnd, 0));
+            if (it == subscribers.end() || !it->accepts(event)) {
+                return;
+            }
         }
+        resultBuilder().clone().send(hWnd, event);
     }
 };
 
@@ -0,0 +1,176 @@
+#include "FileConfig.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::tolower
+#include <cctype>
+// Pour std::strtoul
+#include <cstdlib>
+#include <fstream>
+
+#include <boost/thread/lock_guard.hpp>
+
+#ifdef _WIN32
+// Pour FindFirstChangeNotification et WaitForSingleObject
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#endif
+
+/// Retire les espaces au début et à la fin de la chaîne.
+static std::string trim(const std::string& str) {
+    const char* spaces = " \t\r\n";
+    std::string::size_type begin = str.find_first_not_of(spaces);
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    return str.substr(begin, str.find_last_not_of(spaces) - begin + 1);
+}
+/// Retire les guillemets entourant la valeur, comme dans les fichiers `.reg`.
+static std::string unquote(const std::string& str) {
+    if (str.size() >= 2 && str[0] == '"' && str[str.size() - 1] == '"') {
+        return str.substr(1, str.size() - 2);
+    }
+    return str;
+}
+static std::string lower(std::string str) {
+    for (std::string::iterator it = str.begin(); it != str.end(); ++it) {
+        *it = (char)std::tolower((unsigned char)*it);
+    }
+    return str;
+}
+/// Construit la clé de la table des valeurs.
+static std::string makeKey(const std::string& key, const char* name) {
+    return lower(key + '\\' + (name != NULL ? name : "@"));
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+FileConfig::FileConfig(const std::string& path)
+    : path(path)
+#ifdef _WIN32
+    , hWatch(INVALID_HANDLE_VALUE)
+#else
+    , watchFd(-1)
+#endif
+{
+    values = parse();
+}
+FileConfig::~FileConfig() {
+#ifdef _WIN32
+    if (hWatch != INVALID_HANDLE_VALUE) {
+        FindCloseChangeNotification(hWatch);
+    }
+#else
+    if (watchFd >= 0) {
+        close(watchFd);
+    }
+#endif
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+std::string FileConfig::value(const std::string& key, const char* name) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    ValueMap::const_iterator it = values.find(makeKey(key, name));
+    return it != values.end() ? it->second : std::string();
+}
+DWORD FileConfig::dwValue(const std::string& key, const char* name) const {
+    std::string v = value(key, name);
+    // Notation des fichiers .reg : dword:0000000a
+    if (v.compare(0, 6, "dword:") == 0) {
+        return (DWORD)std::strtoul(v.c_str() + 6, NULL, 16);
+    }
+    // Décimal, ou hexadécimal avec le préfixe 0x.
+    return (DWORD)std::strtoul(v.c_str(), NULL, 0);
+}
+void FileConfig::reload() {
+    ValueMap fresh = parse();
+    boost::lock_guard<boost::mutex> lock(mutex);
+    values.swap(fresh);
+}
+FileConfig::ValueMap FileConfig::parse() const {
+    ValueMap result;
+    std::ifstream file(path.c_str());
+    if (!file) {
+        {XFS::Logger() << "FileConfig: cannot open " << path; }
+        return result;
+    }
+    std::string section;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == ';' || line[0] == '#') {
+            continue;
+        }
+        if (line[0] == '[' && line[line.size() - 1] == ']') {
+            section = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+        std::string::size_type eq = line.find('=');
+        if (eq == std::string::npos) {
+            {XFS::Logger() << "FileConfig: ignored line in " << path << ": " << line; }
+            continue;
+        }
+        std::string name = unquote(trim(line.substr(0, eq)));
+        result[makeKey(section, name.c_str())] = unquote(trim(line.substr(eq + 1)));
+    }
+    {XFS::Logger() << "FileConfig: " << result.size() << " values read from " << path; }
+    return result;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#ifdef _WIN32
+bool FileConfig::waitChange(DWORD timeout) {
+    if (hWatch == INVALID_HANDLE_VALUE) {
+        // Seuls les répertoires peuvent être surveillés : toute écriture dans le répertoire du fichier
+        // provoque une relecture, ce qui est sans conséquence.
+        std::string::size_type slash = path.find_last_of("\\/");
+        std::string dir = slash != std::string::npos ? path.substr(0, slash + 1) : ".";
+        hWatch = FindFirstChangeNotification(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    }
+    if (hWatch == INVALID_HANDLE_VALUE) {
+        Sleep(timeout);
+        return false;
+    }
+    if (WaitForSingleObject(hWatch, timeout) != WAIT_OBJECT_0) {
+        return false;
+    }
+    FindNextChangeNotification(hWatch);
+    return true;
+}
+#else
+bool FileConfig::waitChange(DWORD timeout) {
+    if (watchFd < 0) {
+        watchFd = inotify_init();
+        // Les éditeurs remplacent souvent le fichier au lieu de le réécrire : la surveillance
+        // suit donc aussi le déplacement et la suppression du fichier.
+        if (watchFd >= 0 && inotify_add_watch(watchFd, path.c_str(), IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+            close(watchFd);
+            watchFd = -1;
+        }
+    }
+    if (watchFd < 0) {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(timeout));
+        return false;
+    }
+    pollfd p = { watchFd, POLLIN, 0 };
+    if (poll(&p, 1, (int)timeout) <= 0) {
+        return false;
+    }
+    char buffer[4096];
+    ssize_t len = read(watchFd, buffer, sizeof(buffer));
+    bool replaced = false;
+    for (ssize_t i = 0; i < len; ) {
+        const inotify_event* e = reinterpret_cast<const inotify_event*>(buffer + i);
+        replaced = replaced || (e->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) != 0;
+        i += sizeof(inotify_event) + e->len;
+    }
+    // Le fichier a été remplacé : la surveillance sera reprise sur le nouveau fichier.
+    if (replaced) {
+        close(watchFd);
+        watchFd = -1;
+    }
+    return true;
+}
+#endif
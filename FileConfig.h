@@ -0,0 +1,54 @@
+#ifndef PCSC_CENXFS_BRIDGE_FileConfig_H
+#define PCSC_CENXFS_BRIDGE_FileConfig_H
+
+#pragma once
+
+#include "ConfigSource.h"
+
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+/** Configuration lue dans un fichier INI, qui reprend la structure du registre (voir `reg/provider.ini`) :
+@code
+[SERVICE_PROVIDERS\PC/SC-TO-CEN/XFS-BRIDGE\Workarounds\Track2]
+@=4761739001010010=10121010101010
+Report=dword:00000001
+@endcode
+    Chaque section est le chemin d'une clé relatif à la racine XFS, `@` désigne la valeur par défaut de
+    la clé. Les valeurs numériques s'écrivent comme dans un fichier `.reg` (`dword:` suivi de chiffres
+    hexadécimaux) ou en notation C (décimale, ou hexadécimale avec `0x`). Les lignes commençant par
+    `;` ou `#` sont des commentaires. Les noms de clés et de valeurs ne sont pas sensibles à la casse.
+@par
+    Le fichier est analysé une seule fois, puis à chaque `reload`, en une table plate de valeurs.
+*/
+class FileConfig : public ConfigSource {
+    /// Valeurs indexées par `<clé>\<nom>`, en minuscules.
+    typedef std::map<std::string, std::string> ValueMap;
+private:
+    /// Chemin du fichier.
+    const std::string path;
+    /// Protège `values`, remplacée lors de `reload` pendant que d'autres threads lisent.
+    mutable boost::mutex mutex;
+    ValueMap values;
+    /// Descripteur de la surveillance du fichier, ouvert lors de la première attente.
+#ifdef _WIN32
+    HANDLE hWatch;
+#else
+    int watchFd;
+#endif
+public:
+    explicit FileConfig(const std::string& path);
+    virtual ~FileConfig();
+
+    virtual std::string value(const std::string& key, const char* name) const;
+    virtual DWORD dwValue(const std::string& key, const char* name) const;
+    virtual void reload();
+    virtual bool waitChange(DWORD timeout);
+private:
+    /// Analyse le fichier et retourne la table de ses valeurs.
+    ValueMap parse() const;
+};
+
+#endif // PCSC_CENXFS_BRIDGE_FileConfig_H
@@ -0,0 +1,158 @@
+#include "FlightRecorder.h"
+
+#include "Tracer.h"
+#include "XFS/Logger.h"
+
+#include <algorithm>
+// Pour std::getenv
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include <boost/thread/lock_guard.hpp>
+
+// Pour GetCurrentThreadId, GetCurrentProcessId et GetLocalTime
+#include <windows.h>
+
+/// Intervalle minimal entre deux vidages automatiques, en nanosecondes.
+static const boost::int64_t failureDumpInterval = 10LL * 1000 * 1000 * 1000;
+
+FlightRecorder::FlightRecorder(const ReaderNames& names) : names(names), next(0), lastDump(0) {
+    const char* path = std::getenv("PCSC_CENXFS_BRIDGE_RECORDER");
+    if (path != NULL && *path != '\0') {
+        dumpPath = path;
+    }
+}
+void FlightRecorder::record(Kind kind, const char* name, ReaderId reader, HSERVICE hService, REQUESTID ReqID,
+                            LONG status, DWORD a, DWORD b) {
+    const boost::uint32_t n = next.fetch_add(1, boost::memory_order_relaxed);
+    Record& r = records[n % capacity];
+    // L'emplacement est marqué comme en cours d'écriture avant d'être modifié.
+    r.seq.store(0, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    r.entry.kind = kind;
+    r.entry.thread = GetCurrentThreadId();
+    r.entry.time = Tracer::now();
+    r.entry.name = name;
+    r.entry.reader = reader;
+    r.entry.hService = hService;
+    r.entry.reqId = ReqID;
+    r.entry.status = status;
+    r.entry.a = a;
+    r.entry.b = b;
+    r.seq.store(n + 1, boost::memory_order_release);
+}
+void FlightRecorder::apdu(ReaderId reader, HSERVICE hService, const BYTE* command, DWORD size) {
+    DWORD header = 0;
+    for (DWORD i = 0; i < 4; ++i) {
+        header = (header << 8) | (i < size ? command[i] : 0);
+    }
+    record(Apdu, NULL, reader, hService, 0, 0, header, size);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void FlightRecorder::failure(const char* reason) {
+    const boost::int64_t t = Tracer::now();
+    boost::int64_t last = lastDump.load(boost::memory_order_relaxed);
+    if (last != 0 && t - last < failureDumpInterval) {
+        return;
+    }
+    // Un seul des threads qui échouent en même temps vide l'enregistreur.
+    if (!lastDump.compare_exchange_strong(last, t, boost::memory_order_relaxed)) {
+        return;
+    }
+    dump(reason);
+}
+std::string FlightRecorder::dump(const char* reason) {
+    std::string result = text();
+    {XFS::Logger() << "FlightRecorder: " << reason << ", last events:\n" << result; }
+    if (!dumpPath.empty()) {
+        boost::lock_guard<boost::mutex> lock(fileMutex);
+        std::ofstream file(dumpPath.c_str(), std::ios::out | std::ios::app);
+        if (!file) {
+            {XFS::Logger() << "FlightRecorder: cannot write " << dumpPath; }
+        } else {
+            SYSTEMTIME st;
+            GetLocalTime(&st);
+            file << "=== " << st.wYear << '-' << std::setfill('0') << std::setw(2) << st.wMonth << '-' << std::setw(2) << st.wDay
+                 << ' ' << std::setw(2) << st.wHour << ':' << std::setw(2) << st.wMinute << ':' << std::setw(2) << st.wSecond
+                 << std::setfill(' ') << " pid=" << GetCurrentProcessId() << ": " << reason << '\n' << result;
+        }
+    }
+    return result;
+}
+/// Ordonne les enregistrements par numéro.
+template<class Pair>
+struct BySeq {
+    bool operator()(const Pair& a, const Pair& b) const {
+        return a.first < b.first;
+    }
+};
+std::string FlightRecorder::text() const {
+    typedef std::pair<boost::uint32_t, Entry> Pair;
+    std::vector<Pair> entries;
+    entries.reserve(capacity);
+    for (std::size_t i = 0; i < capacity; ++i) {
+        const Record& r = records[i];
+        const boost::uint32_t seq = r.seq.load(boost::memory_order_acquire);
+        if (seq == 0) {
+            continue;
+        }
+        Entry e = r.entry;
+        // L'enregistrement n'est gardé que s'il n'a pas été réécrit pendant la copie.
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (r.seq.load(boost::memory_order_relaxed) != seq) {
+            continue;
+        }
+        entries.push_back(std::make_pair(seq, e));
+    }
+    std::sort(entries.begin(), entries.end(), BySeq<Pair>());
+
+    const boost::int64_t t = Tracer::now();
+    std::ostringstream os;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        const Entry& e = entries[i].second;
+        // Moment relatif au vidage, en millisecondes.
+        const boost::int64_t us = (t - e.time) / 1000;
+        os << '-' << us / 1000 << '.' << std::setfill('0') << std::setw(3) << us % 1000 << std::setfill(' ')
+           << " ms tid=" << e.thread << ' ';
+        switch (e.kind) {
+            case SpiEntry: {
+                os << e.name << "(hService=" << e.hService << ", ReqID=" << e.reqId << ')';
+                break;
+            }
+            case SpiReturn: {
+                os << e.name << "(hService=" << e.hService << ", ReqID=" << e.reqId << ") = " << e.status;
+                break;
+            }
+            case PcscCall: {
+                os << e.name << "(reader='" << names.name(e.reader) << "', hService=" << e.hService << ") = 0x"
+                   << std::hex << std::setfill('0') << std::setw(8) << (DWORD)e.status;
+                if (e.a != 0) {
+                    os << ", SW=" << std::setw(4) << e.a;
+                }
+                os << std::dec << std::setfill(' ');
+                break;
+            }
+            case Apdu: {
+                os << "APDU(reader='" << names.name(e.reader) << "', hService=" << e.hService << "): "
+                   << std::hex << std::setfill('0')
+                   << std::setw(2) << (e.a >> 24) << ' ' << std::setw(2) << ((e.a >> 16) & 0xFF) << ' '
+                   << std::setw(2) << ((e.a >> 8) & 0xFF) << ' ' << std::setw(2) << (e.a & 0xFF)
+                   << std::dec << std::setfill(' ') << ", " << e.b << " bytes";
+                break;
+            }
+            case StateChange: {
+                os << "reader '" << names.name(e.reader) << "': state 0x" << std::hex << e.a << " -> 0x" << e.b << std::dec;
+                break;
+            }
+            case TaskTimeout: {
+                os << "task timeout (hService=" << e.hService << ", ReqID=" << e.reqId << ')';
+                break;
+            }
+        }
+        os << '\n';
+    }
+    return os.str();
+}
@@ -0,0 +1,123 @@
+#ifndef PCSC_CENXFS_BRIDGE_FlightRecorder_H
+#define PCSC_CENXFS_BRIDGE_FlightRecorder_H
+
+#pragma once
+
+#include "ReaderNames.h"
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+// PC/CS API
+#include <winscard.h>
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- pour HSERVICE et REQUESTID
+#include <XFSIDC.h>
+
+/** Enregistreur de vol : garde en permanence, à faible coût, les derniers événements du fournisseur
+    (appels SPI, appels PC/SC et leur résultat, en-têtes des APDU, changements d'état des lecteurs),
+    pour disposer de ce qui a précédé une panne sans laisser la trace complète activée.
+@par
+    Les enregistrements sont écrits sans verrou dans un tampon circulaire de taille fixe : chaque
+    écrivain réserve un emplacement par incrément atomique, et le numéro de séquence de l'emplacement
+    permet à la lecture d'écarter les enregistrements en cours d'écriture.
+@par
+    Le contenu est écrit dans la trace XFS, et ajouté au fichier désigné par la variable d'environnement
+    `PCSC_CENXFS_BRIDGE_RECORDER` si elle est définie :
+    - automatiquement, en cas d'échec de `SCardConnect` ou `SCardTransmit` et à l'expiration d'une tâche,
+      au plus une fois toutes les 10 secondes ;
+    - à la demande, par la commande `WFS_CMD_IDC_PCSC_DUMP_RECORDER` (voir `XFS/Vendor.h`).
+*/
+class FlightRecorder : private boost::noncopyable {
+public:
+    enum {
+        /// Nombre d'enregistrements gardés.
+        capacity = 1024
+    };
+    enum Kind {
+        SpiEntry,
+        SpiReturn,
+        PcscCall,
+        Apdu,
+        StateChange,
+        TaskTimeout
+    };
+private:
+    struct Entry {
+        Kind kind;
+        DWORD thread;
+        /// Nanosecondes de `steady_clock`.
+        boost::int64_t time;
+        /// Nom de la fonction, chaîne littérale. Peut être `NULL`.
+        const char* name;
+        ReaderId reader;
+        HSERVICE hService;
+        REQUESTID reqId;
+        LONG status;
+        /// Données propres au type d'enregistrement.
+        DWORD a;
+        DWORD b;
+    };
+    struct Record {
+        /// Numéro de l'enregistrement plus un, 0 pendant son écriture.
+        boost::atomic<boost::uint32_t> seq;
+        Entry entry;
+
+        Record() : seq(0) {}
+    };
+private:
+    /// Pour afficher les noms des lecteurs.
+    const ReaderNames& names;
+    Record records[capacity];
+    /// Numéro du prochain enregistrement.
+    boost::atomic<boost::uint32_t> next;
+    /// Moment du dernier vidage automatique, en nanosecondes de `steady_clock`, 0 s'il n'y en a pas eu.
+    boost::atomic<boost::int64_t> lastDump;
+    /// Fichier auquel les vidages sont ajoutés, vide s'il n'est pas demandé.
+    std::string dumpPath;
+    /// Sérialise les écritures dans le fichier.
+    boost::mutex fileMutex;
+public:
+    explicit FlightRecorder(const ReaderNames& names);
+
+    inline void spiEntry(const char* name, HSERVICE hService, REQUESTID ReqID) {
+        record(SpiEntry, name, ReaderNames::none, hService, ReqID, 0);
+    }
+    inline void spiReturn(const char* name, HSERVICE hService, REQUESTID ReqID, HRESULT hResult) {
+        record(SpiReturn, name, ReaderNames::none, hService, ReqID, hResult);
+    }
+    /** Enregistre le résultat d'un appel PC/SC.
+    @param sw
+        Mot d'état de la réponse de la carte (SW1 SW2) pour `SCardTransmit`, sinon 0.
+    */
+    inline void pcsc(const char* name, ReaderId reader, HSERVICE hService, LONG status, DWORD sw = 0) {
+        record(PcscCall, name, reader, hService, 0, status, sw);
+    }
+    /// Enregistre l'en-tête (CLA INS P1 P2) et la longueur de la commande envoyée à la carte.
+    void apdu(ReaderId reader, HSERVICE hService, const BYTE* command, DWORD size);
+    inline void stateChange(ReaderId reader, DWORD from, DWORD to) {
+        record(StateChange, NULL, reader, 0, 0, 0, from, to);
+    }
+    inline void taskTimeout(HSERVICE hService, REQUESTID ReqID) {
+        record(TaskTimeout, NULL, ReaderNames::none, hService, ReqID, 0);
+    }
+
+    /** Signale un échec : vide l'enregistreur, sauf s'il a déjà été vidé automatiquement
+        il y a moins de 10 secondes.
+    @param reason
+        Cause du vidage, écrite en tête.
+    */
+    void failure(const char* reason);
+    /// Vide l'enregistreur sans condition et retourne le texte écrit.
+    std::string dump(const char* reason);
+    /// Texte des enregistrements gardés, du plus ancien au plus récent, un par ligne.
+    std::string text() const;
+private:
+    void record(Kind kind, const char* name, ReaderId reader, HSERVICE hService, REQUESTID ReqID,
+                LONG status, DWORD a = 0, DWORD b = 0);
+};
+
+#endif // PCSC_CENXFS_BRIDGE_FlightRecorder_H
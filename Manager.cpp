@@ -1,44 +1,245 @@
 #include "Manager.h"
 
+#include "BrokerMonitor.h"
+#include "Reader.h"
+#include "ReaderChangesMonitor.h"
 #include "Service.h"
-#include "Settings.h"
+
+#include "Utils/Probes.h"
 
 #include "XFS/Logger.h"
 
-Manager::Manager() : readerChangesMonitor(*this) {
+#include <cassert>
+// Pour std::getenv
+#include <cstdlib>
+// Pour std::strcmp
+#include <cstring>
+
+#include <boost/thread/lock_guard.hpp>
+
+// Pour GetComputerNameEx
+#include <winbase.h>
+
+/// Obtient le nom NetBIOS de l'ordinateur.
+static std::string getWorkstationName() {
+    DWORD len = 0;
+    // D'abord la taille du tampon (y compris le 0 final), puis le nom lui-même.
+    GetComputerNameEx(ComputerNameNetBIOS, NULL, &len);
+    std::vector<CHAR> name(len + 1);
+    if (!GetComputerNameEx(ComputerNameNetBIOS, &name[0], &len)) {
+        return std::string();
+    }
+    return std::string(&name[0], len);
+}
+Manager::Manager() : metricsRegistry(names), flightRecorder(names), workstation(getWorkstationName()) {
     //XFS::Logger() << "Manager::Manager - Manager instance created";
+    const char* broker = std::getenv("PCSC_CENXFS_BRIDGE_BROKER");
+    if (broker != NULL && *broker != '\0') {
+        readerChangesMonitor.reset(BrokerMonitor::connect(*this, std::strcmp(broker, "default") == 0 ? std::string() : broker));
+    }
+    if (!readerChangesMonitor) {
+        readerChangesMonitor.reset(new ReaderChangesMonitor(*this));
+    }
+    callWatchdog.start(*this);
+}
+Manager::~Manager() {
+    callWatchdog.stop();
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Service& Manager::create(HSERVICE hService, const Settings& settings) {
+void Manager::create(HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel) {
     //XFS::Logger() << "Manager::create - Creating new service for hService=" << hService;
-    Service& result = services.create(*this, hService, settings);
-    //XFS::Logger() << "Manager::create - Service created successfully";
-    
-    // Interrompt l'attente du thread sur SCardGetStatusChange, car il est nécessaire de livrer
-    // au nouveau service des informations sur tous les lecteurs actuellement existants.
-    //XFS::Logger() << "Manager::create - Cancelling reader changes monitor to update new service";
-    readerChangesMonitor.cancel("Manager::create");
-    //XFS::Logger() << "Manager::create - Reader changes monitor cancelled";
+    {
+        boost::lock_guard<boost::mutex> lock(stateMutex);
+        services.create(*this, hService, serviceName, settings, traceLevel);
+        //XFS::Logger() << "Manager::create - Service created successfully";
+
+        // Livre au nouveau service le dernier état connu de tous les lecteurs. Comme la distribution
+        // des changements se fait sous le même verrou, le service ne peut manquer aucun changement.
+        // `seed` ne fait que mémoriser l'état, sans appel PC/SC.
+        ServiceRef service(*this, hService);
+        for (ReaderStatusMap::const_iterator it = lastStates.begin(); it != lastStates.end(); ++it) {
+            SCARD_READERSTATE state = it->second.state;
+            state.szReader = it->second.name.c_str();
+            state.dwCurrentState = SCARD_STATE_UNAWARE;
+            service->seed(state, it->first);
+        }
+    }
+    // La connexion avec la carte déjà présente est ouverte hors du verrou : SCardConnect ne doit
+    // bloquer ni le thread de surveillance, ni l'ouverture des autres services.
+    ServiceRef service(*this, hService);
+    if (service.isValid()) {
+        service->seeded();
+    }
+}
+bool Manager::remove(HSERVICE hService) {
+    // Les tâches ne gardent que le handle du service : une tâche terminée pendant sa fermeture
+    // ne le retrouve plus par `ServiceRef` et est annulée.
+    ServiceRef service(*this, hService);
+    if (!service.isValid()) {
+        return false;
+    }
+    services.remove(hService);
+    // Le service est retiré avant l'annulation des tâches : une tâche ajoutée entre-temps
+    // par un autre thread est soit annulée ici, soit par `addTask`.
+    if (tasks.cancelTasks(hService)) {
+        readerChangesMonitor->cancel("Manager::remove");
+    }
+    return true;
+}
+bool Manager::addSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
+    boost::lock_guard<boost::mutex> lock(stateMutex);
+    ServiceRef service(*this, hService);
+    if (!service.isValid()) {
+        return false;
+    }
+    service->add(hWndReg, dwEventClass);
+    service->replay(hWndReg);
+    return true;
+}
+bool Manager::removeSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
+    ServiceRef service(*this, hService);
+    if (!service.isValid()) {
+        return false;
+    }
+    service->remove(hWndReg, dwEventClass);
+    return true;
+}
+void Manager::rebind(Service& service, ReaderId reader) {
+    services.rebind(service, reader);
+    // Après le retrait de la carte, la lecture en attente doit voir l'insertion dans le nouveau lecteur lié.
+    tasks.rebind(service.handle(), reader);
+}
+Reader& Manager::reader(ReaderId id) {
+    assert(id != ReaderNames::none && "Attempt to get reader without identifier");
+    boost::lock_guard<boost::mutex> lock(readersMutex);
+    boost::shared_ptr<Reader>& r = readers[id];
+    if (!r) {
+        r.reset(new Reader(*this, id, names.name(id)));
+    }
+    return *r;
+}
+void Manager::lingerStarted() {
+    readerChangesMonitor->cancel("Manager::lingerStarted");
+}
+std::vector<Reader*> Manager::readerList() const {
+    std::vector<Reader*> result;
+    boost::lock_guard<boost::mutex> lock(readersMutex);
+    result.reserve(readers.size());
+    for (ReaderMap::const_iterator it = readers.begin(); it != readers.end(); ++it) {
+        result.push_back(it->second.get());
+    }
     return result;
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+DWORD Manager::getTimeout() const {
+    DWORD timeout = tasks.getTimeout();
+    bc::steady_clock::time_point now = bc::steady_clock::now();
+    const std::vector<Reader*> list = readerList();
+    for (std::vector<Reader*>::const_iterator it = list.begin(); it != list.end(); ++it) {
+        DWORD linger = (*it)->lingerTimeout(now);
+        if (linger < timeout) {
+            timeout = linger;
+        }
+    }
+    return timeout;
+}
+void Manager::processTimeouts(bc::steady_clock::time_point now) {
+    tasks.processTimeouts(now);
+    const std::vector<Reader*> list = readerList();
+    for (std::vector<Reader*>::const_iterator it = list.begin(); it != list.end(); ++it) {
+        (*it)->expire(now);
+    }
+}
 void Manager::notifyChanges(const SCARD_READERSTATE& state, bool deviceChange) {
     //XFS::Logger() << "Manager::notifyChanges - Notifying changes for reader [" << state.szReader << "], deviceChange=" << deviceChange;
-    // Notifie d'abord les auditeurs abonnés des changements, et seulement ensuite
-    // essaie de terminer les tâches.
-    services.notifyChanges(state, deviceChange);
-    //XFS::Logger() << "Manager::notifyChanges - Services notified";
-    tasks.notifyChanges(state, deviceChange);
+    ReaderId reader = (ReaderId)state.pvUserData;
+    PCSC_PROBE3(dispatch_entry, state.szReader, state.dwEventState, deviceChange);
+    SCARD_READERSTATE current = state;
+    {
+        boost::lock_guard<boost::mutex> lock(stateMutex);
+        if (!deviceChange && reader != ReaderNames::none) {
+            // Le changement est calculé par rapport au dernier état connu, et non à l'état fourni
+            // par le thread de surveillance : après chaque modification de la liste des lecteurs,
+            // celui-ci redécouvre tous les lecteurs depuis l'état inconnu.
+            ReaderStatus& last = lastStates[reader];
+            current.dwCurrentState = last.name.empty() ? SCARD_STATE_UNAWARE : last.state.dwEventState;
+            last.name = state.szReader;
+            last.state = state;
+            statusPublisher.update(reader, state);
+            flightRecorder.stateChange(reader, current.dwCurrentState, current.dwEventState);
+
+            DWORD added = (current.dwCurrentState ^ current.dwEventState) & current.dwEventState;
+            if (added & SCARD_STATE_PRESENT) {
+                metricsRegistry.add("inserts", Metrics::Labels(reader));
+            }
+            if ((added & SCARD_STATE_EMPTY) && (current.dwCurrentState & SCARD_STATE_PRESENT)) {
+                metricsRegistry.add("removals", Metrics::Labels(reader));
+            }
+        }
+        // Notifie d'abord les auditeurs abonnés des changements, et seulement ensuite
+        // essaie de terminer les tâches.
+        services.notifyChanges(current, reader, deviceChange);
+        //XFS::Logger() << "Manager::notifyChanges - Services notified";
+        // Le lecteur débranché n'est plus proposé aux nouveaux services. S'il revient, il est
+        // redécouvert depuis l'état inconnu.
+        if (!deviceChange && reader != ReaderNames::none
+         && (state.dwEventState & (SCARD_STATE_UNAVAILABLE | SCARD_STATE_UNKNOWN | SCARD_STATE_IGNORE))) {
+            lastStates.erase(reader);
+        }
+    }
+    // La carte a été retirée : la connexion gardée pour elle n'est plus utilisable.
+    // Le lecteur a été débranché : ses fonctions seront redemandées à l'appareil qui reviendra sous ce nom.
+    if (!deviceChange && reader != ReaderNames::none
+     && (state.dwEventState & (SCARD_STATE_EMPTY | SCARD_STATE_UNAVAILABLE | SCARD_STATE_UNKNOWN | SCARD_STATE_IGNORE))) {
+        Reader* r = NULL;
+        {
+            boost::lock_guard<boost::mutex> lock(readersMutex);
+            ReaderMap::const_iterator it = readers.find(reader);
+            if (it != readers.end()) {
+                r = it->second.get();
+            }
+        }
+        if (r != NULL) {
+            if (state.dwEventState & SCARD_STATE_EMPTY) {
+                r->drop();
+            } else {
+                r->unplugged();
+            }
+        }
+    }
+    tasks.notifyChanges(current, reader, deviceChange);
     //XFS::Logger() << "Manager::notifyChanges - Tasks notified";
+    PCSC_PROBE1(dispatch_return, state.szReader);
+}
+void Manager::slowCall(const Watchdog::Report& report) {
+    const std::string reader = names.name(report.reader);
+    {
+        XFS::Logger() << "Manager::slowCall: " << Watchdog::name(report.operation) << "(reader='" << reader
+                      << "', hService=" << report.hService << ") " << (report.completed ? "took " : "running for ")
+                      << report.elapsed << " ms, threshold " << report.threshold << " ms"
+                      << (report.cancelled ? ", cancelled" : "");
+    }
+    metricsRegistry.add(Watchdog::metric(report.operation), metricLabels(report.reader, report.hService));
+    services.slowCall(report, reader);
+}
+Metrics::Labels Manager::metricLabels(ReaderId reader, HSERVICE hService, LONG status) const {
+    ServiceRef service(*this, hService);
+    return Metrics::Labels(reader, service.isValid() ? service->serviceName() : NULL, status);
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void Manager::addTask(const Task::Ptr& task) {
     //XFS::Logger() << "Manager::addTask - Adding new task";
-    if (tasks.addTask(task)) {
+    bool first = tasks.addTask(task);
+    // Le service a pu être fermé par un autre thread pendant l'ajout, et ses tâches déjà annulées.
+    if (!ServiceRef(*this, task->serviceHandle()).isValid()) {
+        tasks.cancelTask(task->serviceHandle(), task->ReqID);
+        return;
+    }
+    if (first) {
         //XFS::Logger() << "Manager::addTask - Task added successfully, cancelling reader changes monitor";
         // Interrompt l'attente du thread sur SCardGetStatusChange, car il faut maintenant attendre
         // jusqu'à un nouveau délai d'attente. L'attente avec le nouveau délai démarrera automatiquement.
-        readerChangesMonitor.cancel("Manager::addTask");
+        readerChangesMonitor->cancel("Manager::addTask");
         //XFS::Logger() << "Manager::addTask - Reader changes monitor cancelled";
     } else {
         //XFS::Logger() << "Manager::addTask - Task not added (no timeout change)";
@@ -46,11 +247,18 @@ void Manager::addTask(const Task::Ptr& task) {
 }
 bool Manager::cancelTask(HSERVICE hService, REQUESTID ReqID) {
     //XFS::Logger() << "Manager::cancelTask - Cancelling task for hService=" << hService << ", ReqID=" << ReqID;
+    // ReqID nul : annulation de toutes les requêtes du service, réussie même s'il n'y en avait aucune.
+    if (ReqID == 0) {
+        if (tasks.cancelTasks(hService)) {
+            readerChangesMonitor->cancel("Manager::cancelTask");
+        }
+        return true;
+    }
     if (tasks.cancelTask(hService, ReqID)) {
         //XFS::Logger() << "Manager::cancelTask - Task cancelled successfully, cancelling reader changes monitor";
         // Interrompt l'attente du thread sur SCardGetStatusChange, car il faut maintenant attendre
         // jusqu'à un nouveau délai d'attente. L'attente avec le nouveau délai démarrera automatiquement.
-        readerChangesMonitor.cancel("Manager::cancelTask");
+        readerChangesMonitor->cancel("Manager::cancelTask");
         //XFS::Logger() << "Manager::cancelTask - Reader changes monitor cancelled";
         return true;
     }
@@ -3,18 +3,30 @@
 
 #pragma once
 
-#include "ReaderChangesMonitor.h"
+#include "FlightRecorder.h"
+#include "Metrics.h"
+#include "ReaderMonitor.h"
+#include "ReaderNames.h"
 #include "ServiceContainer.h"
+#include "SettingsCache.h"
+#include "StatusPublisher.h"
 #include "Task.h"
+#include "Watchdog.h"
+#include "Worker.h"
 
-#include "PCSC/Context.h"
 #include "PCSC/Status.h"
 
 #include "XFS/Result.h"
 
+#include <map>
+#include <string>
 #include <vector>
 
 #include <boost/chrono/chrono.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 // PC/CS API
 #include <winscard.h>
@@ -24,48 +36,144 @@
 // Liaison avec la bibliothèque d'implémentation de la norme PC/SC dans Windows
 #pragma comment(lib, "winscard.lib")
 
+class Reader;
 class Service;
-class Settings;
-/** Classe qui, dans son constructeur, initialise le sous-système PC/SC, et dans son destructeur, le ferme.
+/** Classe qui, dans son constructeur, démarre la surveillance des lecteurs, et dans son destructeur, l'arrête.
     Il est nécessaire de créer exactement une instance de cette classe lors du chargement de la DLL et de la détruire
     lors du déchargement. La manière la plus simple de le faire est de déclarer une variable globale de cette classe.
+@par
+    Le gestionnaire n'a pas de contexte PC/SC : chaque lecteur et le thread de surveillance ont le leur
+    (voir `PCSC::Context`).
 */
-class Manager : public PCSC::Context {
+class Manager : private boost::noncopyable {
+    /// Dernier état connu d'un lecteur.
+    struct ReaderStatus {
+        /// Nom du lecteur. `state.szReader` pointe sur le tampon du thread de surveillance
+        /// et ne doit pas être utilisé.
+        std::string name;
+        /// Dernier état signalé par PC/SC pour ce lecteur.
+        SCARD_READERSTATE state;
+    };
+    typedef std::map<ReaderId, ReaderStatus> ReaderStatusMap;
+    typedef std::map<ReaderId, boost::shared_ptr<Reader> > ReaderMap;
 private:
     // L'ordre des champs est important, car les objets
     // déclarés ci-dessous seront détruits en premier. Il est nécessaire en premier lieu
     // de terminer le thread d'interrogation des changements, puis d'envoyer des notifications
     // d'annulation de toutes les tâches et enfin de supprimer tous les services.
 
+    /// Table des noms des lecteurs connus. Utilisée par tous les objets suivants, elle est donc détruite en dernier.
+    ReaderNames names;
+    /// Métriques du fournisseur, alimentées par tous les objets suivants.
+    Metrics metricsRegistry;
+    /// Enregistreur des derniers événements, alimenté par tous les objets suivants.
+    FlightRecorder flightRecorder;
+    /// Paramètres des fournisseurs, partagés par les services qui les utilisent.
+    SettingsCache settingsCache;
+    /// Tableau d'état des lecteurs en mémoire partagée. Les lecteurs y publient leurs compteurs,
+    /// il doit donc être détruit après eux.
+    StatusPublisher statusPublisher;
+    /// Surveillance de la durée des appels PC/SC des lecteurs, il doit donc être détruit après eux.
+    /// Son thread est arrêté par le destructeur du gestionnaire, avant la destruction des services.
+    Watchdog callWatchdog;
+    /// Nom NetBIOS de la station de travail, transmis dans les événements système. Ne change pas
+    /// pendant la vie du processus, il est donc obtenu une seule fois au chargement.
+    std::string workstation;
+    /// Lecteurs avec lesquels les services ont travaillé. Les services s'y attachent, ils doivent
+    /// donc être détruits avant eux. Un lecteur, une fois créé, n'est jamais supprimé : les services
+    /// peuvent garder un pointeur sur lui sans verrou.
+    ReaderMap readers;
+    /// Protège `readers`.
+    mutable boost::mutex readersMutex;
     /// Liste des services ouverts pour l'interaction avec le système XFS.
     ServiceContainer services;
     /// Conteneur gérant les tâches asynchrones pour obtenir des données de la carte.
     TaskContainer tasks;
+    /// Dernier état connu de chaque lecteur. Permet de mettre immédiatement au courant
+    /// les nouveaux services et les nouveaux abonnés, sans interrompre la surveillance.
+    ReaderStatusMap lastStates;
+    /// Protège `lastStates` et sérialise la distribution des changements aux services avec la mise
+    /// au courant des nouveaux services et abonnés : aucun changement ne peut être perdu ou reçu deux fois.
+    boost::mutex stateMutex;
+    /// Thread des lectures de la puce demandées par les tâches terminées. Il utilise les services
+    /// et les lecteurs, et reçoit ses travaux du thread de surveillance : il est donc arrêté après
+    /// celui-ci et avant la destruction des tâches et des services.
+    Worker cardWorker;
     /// Objet pour surveiller l'état des lecteurs et envoyer des notifications
     /// lors du changement d'état. Lors de la destruction, il met fin à l'attente des changements.
-    ReaderChangesMonitor readerChangesMonitor;
+    boost::scoped_ptr<ReaderMonitor> readerChangesMonitor;
 public:
-    /// Ouvre une connexion au gestionnaire du sous-système PC/SC.
+    /** Démarre la surveillance des lecteurs.
+        Si la variable d'environnement `PCSC_CENXFS_BRIDGE_BROKER` est définie, les changements des
+        lecteurs sont reçus du courtier PC/SC de l'hôte (voir `BrokerMonitor`) : sa valeur est le nom
+        du canal du courtier, ou `default`. Si le courtier ne répond pas, ou si la variable n'est pas
+        définie, le processus surveille les lecteurs lui-même.
+    */
     Manager();
+    /// Arrête la surveillance des appels PC/SC, qui signale les appels lents aux services.
+    ~Manager();
 public:// Gestion des services
-    /** Vérifie que le handle de service spécifié est un handle de carte valide. */
-    inline bool isValid(HSERVICE hService) const { return services.isValid(hService); }
+    /// Accès à un service enregistré, voir `ServiceContainer::Ref`.
+    class ServiceRef : public ServiceContainer::Ref {
+    public:
+        inline ServiceRef(const Manager& manager, HSERVICE hService)
+            : ServiceContainer::Ref(manager.services, hService) {}
+    };
     /** @return true si aucun service n'est enregistré dans le gestionnaire. */
     inline bool isEmpty() const { return services.isEmpty(); }
 
-    Service& create(HSERVICE hService, const Settings& settings);
-    inline Service& get(HSERVICE hService) { return services.get(hService); }
-    inline void remove(HSERVICE hService) { services.remove(hService); }
+    /** Crée le service et lui transmet immédiatement, dans le thread appelant, le dernier état connu
+        de tous les lecteurs.
+    @param serviceName
+        Nom du service logique, passé à `WFPOpen`.
+    @param settings
+        Paramètres du service, voir `settingsFor`.
+    @param traceLevel
+        Niveau de trace demandé par l'application à l'ouverture du service.
+    */
+    void create(HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel);
+    /// @copydoc SettingsCache::get
+    inline SettingsCache::SlotPtr settingsFor(const char* serviceName) { return settingsCache.get(serviceName); }
+    /** Annule toutes les tâches du service, puis le supprime.
+    @return `false` si le `hService` spécifié n'est pas enregistré, sinon `true`.
+    */
+    bool remove(HSERVICE hService);
+    /** Lie le service au lecteur spécifié et rattache ses tâches en attente à ce lecteur.
+    @param service
+        Service dont la liaison change.
+    @param reader
+        Lecteur auquel le service est maintenant lié, ou `ReaderNames::none`.
+    */
+    void rebind(Service& service, ReaderId reader);
+    /** Lecteur avec l'identifiant spécifié, créé à la première demande. Le lecteur vit jusqu'à
+        la destruction du gestionnaire.
+    */
+    Reader& reader(ReaderId id);
+    /// Table d'internement des noms de lecteurs.
+    inline ReaderNames& readerNames() { return names; }
+    /// Nom de la station de travail sur laquelle le fournisseur est exécuté.
+    inline const std::string& workstationName() const { return workstation; }
+    /// Tableau d'état des lecteurs publié pour les outils de supervision.
+    inline StatusPublisher& status() { return statusPublisher; }
+    /// Registre des métriques du fournisseur.
+    inline Metrics& metrics() { return metricsRegistry; }
+    /** Étiquettes des métriques d'un appel fait pour le service spécifié : le service est désigné
+        par son nom logique, sans étiquette s'il est déjà fermé.
+    */
+    Metrics::Labels metricLabels(ReaderId reader, HSERVICE hService, LONG status = 0) const;
+    /// Enregistreur de vol du fournisseur.
+    inline FlightRecorder& recorder() { return flightRecorder; }
+    /// Surveillance de la durée des appels PC/SC.
+    inline Watchdog& watchdog() { return callWatchdog; }
+    /// Thread des échanges avec la puce qui ne doivent pas bloquer le thread de surveillance.
+    inline Worker& worker() { return cardWorker; }
 public:// Abonnement aux événements et génération d'événements
-    /** Ajoute la fenêtre spécifiée aux abonnés aux événements spécifiés par le service spécifié.
+    /** Ajoute la fenêtre spécifiée aux abonnés aux événements spécifiés par le service spécifié,
+        puis la met au courant de l'état actuel du service (voir `Service::replay`).
     @return `false` si le `hService` spécifié n'est pas enregistré dans l'objet, sinon `true`.
     */
-    inline bool addSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
-        return services.addSubscriber(hService, hWndReg, dwEventClass);
-    }
-    inline bool removeSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
-        return services.removeSubscriber(hService, hWndReg, dwEventClass);
-    }
+    bool addSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass);
+    bool removeSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass);
 public:// Gestion des tâches
     void addTask(const Task::Ptr& task);
     /** Annule la tâche avec le numéro de suivi spécifié, retourne `true` si une tâche avec ce
@@ -74,19 +182,45 @@ public:// Gestion des tâches
         XFS service pour lequel la tâche est annulée.
     @param ReqID
         Identifiant unique de la tâche pour annuler. Il n'y a pas deux tâches avec un
-        et le même identifiant dans la liste pour un même `hService`.
+        et le même identifiant dans la liste pour un même `hService`. `0` annule toutes
+        les tâches du service.
 
     @return
-        `true` si une tâche avec ce numéro existait dans la liste, sinon `false`.
+        `true` si une tâche avec ce numéro existait dans la liste ou si `ReqID` est nul, sinon `false`.
     */
     bool cancelTask(HSERVICE hService, REQUESTID ReqID);
-private:// Fonctions pour utiliser ReaderChangesMonitor
+private:// Fonctions pour utiliser Reader
+    friend class Reader;
+    /** Appelé par le lecteur qui garde une connexion en attente : le thread de surveillance doit
+        recalculer son délai d'attente pour fermer la connexion à temps.
+    */
+    void lingerStarted();
+    /** Copie la liste des lecteurs sous `readersMutex`. Les lecteurs n'étant jamais supprimés, le thread
+        de surveillance les appelle ensuite sans garder ce verrou.
+    */
+    std::vector<Reader*> readerList() const;
+private:// Fonctions pour utiliser Watchdog
+    friend class Watchdog;
+    /** Compte l'appel lent dans les métriques et le signale aux services liés à son lecteur.
+        Appelé par le thread de surveillance des appels, hors de l'appel lui-même.
+    */
+    void slowCall(const Watchdog::Report& report);
+private:// Fonctions pour utiliser ReaderChangesMonitor et BrokerMonitor
     friend class ReaderChangesMonitor;
-    /// @copydoc TaskContainer::getTimeout
-    inline DWORD getTimeout() const { return tasks.getTimeout(); }
-    /// @copydoc TaskContainer::processTimeouts
-    inline void processTimeouts(boost::chrono::steady_clock::time_point now) { tasks.processTimeouts(now); }
-    /// @copydoc TaskContainer::notifyChanges
+    friend class BrokerMonitor;
+    /** Calcule le délai d'attente des changements jusqu'au prochain timeout d'une tâche
+        ou à l'expiration d'une connexion en attente.
+    */
+    DWORD getTimeout() const;
+    /// Termine les tâches dont le timeout est atteint et ferme les connexions en attente expirées.
+    void processTimeouts(boost::chrono::steady_clock::time_point now);
+    /** Notifie les services puis les tâches des changements du lecteur.
+    @param state
+        État du lecteur modifié. Le champ `pvUserData` contient l'identifiant du lecteur,
+        attribué par le thread de surveillance.
+    @param deviceChange
+        Si `true`, alors le changement concerne le nombre de lecteurs.
+    */
     void notifyChanges(const SCARD_READERSTATE& state, bool deviceChange);
 };
 
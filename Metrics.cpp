@@ -0,0 +1,247 @@
+#include "Metrics.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::strcmp
+#include <cstring>
+// Pour std::getenv
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/thread/lock_guard.hpp>
+
+// Pour GetCurrentThreadId
+#include <windows.h>
+
+/// Période d'écriture des métriques dans le fichier, en secondes.
+static const int dumpPeriod = 10;
+
+Histogram::Histogram() : mCount(0), mSum(0), mMax(0) {
+    std::memset(buckets, 0, sizeof(buckets));
+}
+std::size_t Histogram::index(boost::uint64_t value) {
+    if (value < subBuckets) {
+        return (std::size_t)value;
+    }
+    // Position du bit de poids fort, au moins 4 puisque value >= 16.
+    unsigned msb = 4;
+    while (msb < 63 && (value >> (msb + 1)) != 0) {
+        ++msb;
+    }
+    if (msb > 31) {
+        return bucketCount - 1;
+    }
+    // Les 4 bits qui suivent le bit de poids fort choisissent l'intervalle dans la puissance de deux.
+    return subBuckets + (msb - 4) * subBuckets + (std::size_t)((value >> (msb - 4)) & (subBuckets - 1));
+}
+boost::uint64_t Histogram::lowerBound(std::size_t i) {
+    if (i < subBuckets) {
+        return i;
+    }
+    std::size_t msb = (i - subBuckets) / subBuckets + 4;
+    return (boost::uint64_t)(subBuckets + (i - subBuckets) % subBuckets) << (msb - 4);
+}
+void Histogram::record(boost::uint64_t value) {
+    ++buckets[index(value)];
+    ++mCount;
+    mSum += value;
+    if (value > mMax) {
+        mMax = value;
+    }
+}
+void Histogram::merge(const Histogram& other) {
+    for (std::size_t i = 0; i < bucketCount; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    mCount += other.mCount;
+    mSum += other.mSum;
+    if (other.mMax > mMax) {
+        mMax = other.mMax;
+    }
+}
+boost::uint64_t Histogram::percentile(double p) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    boost::uint64_t rank = (boost::uint64_t)(p * mCount + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    boost::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            boost::uint64_t upper = i + 1 < bucketCount ? lowerBound(i + 1) - 1 : mMax;
+            return upper < mMax ? upper : mMax;
+        }
+    }
+    return mMax;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool Metrics::Labels::operator<(const Labels& other) const {
+    if (reader != other.reader) return reader < other.reader;
+    if (service != other.service) {
+        if (service == NULL || other.service == NULL) return service == NULL;
+        int cmp = std::strcmp(service, other.service);
+        if (cmp != 0) return cmp < 0;
+    }
+    return status < other.status;
+}
+bool Metrics::Key::operator<(const Key& other) const {
+    int cmp = std::strcmp(name, other.name);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    return labels < other.labels;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Metrics::Metrics(const ReaderNames& names) : names(names) {
+    const char* path = std::getenv("PCSC_CENXFS_BRIDGE_METRICS");
+    if (path != NULL && *path != '\0') {
+        dumpPath = path;
+        dumpThread.reset(new boost::thread(&Metrics::run, this));
+    }
+}
+Metrics::~Metrics() {
+    if (dumpThread) {
+        dumpThread->interrupt();
+        dumpThread->join();
+        dump();
+    }
+}
+Metrics::Shard& Metrics::shard() {
+    return shards[GetCurrentThreadId() % shardCount];
+}
+const char* Metrics::intern(const std::string& name) {
+    boost::lock_guard<boost::mutex> lock(internMutex);
+    return interned.insert(name).first->c_str();
+}
+void Metrics::add(const char* name, const Labels& labels, boost::uint64_t delta) {
+    Shard& s = shard();
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    s.counters[Key(name, labels)] += delta;
+}
+void Metrics::record(const char* name, const Labels& labels, boost::chrono::steady_clock::duration elapsed) {
+    boost::uint64_t us = (boost::uint64_t)boost::chrono::duration_cast<boost::chrono::microseconds>(elapsed).count();
+    Shard& s = shard();
+    boost::lock_guard<boost::mutex> lock(s.mutex);
+    s.histograms[Key(name, labels)].record(us);
+}
+void Metrics::aggregate(CounterMap& counters, HistogramMap& histograms) const {
+    for (std::size_t i = 0; i < shardCount; ++i) {
+        boost::lock_guard<boost::mutex> lock(shards[i].mutex);
+        for (CounterMap::const_iterator it = shards[i].counters.begin(); it != shards[i].counters.end(); ++it) {
+            counters[it->first] += it->second;
+        }
+        for (HistogramMap::const_iterator it = shards[i].histograms.begin(); it != shards[i].histograms.end(); ++it) {
+            histograms[it->first].merge(it->second);
+        }
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/// Écrit la chaîne entre guillemets, avec les échappements JSON.
+static void quote(std::ostream& os, const std::string& str) {
+    os << '"';
+    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+        unsigned char c = (unsigned char)*it;
+        if (c == '"' || c == '\\') {
+            os << '\\' << *it;
+        } else if (c < 0x20) {
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (unsigned)c << std::dec;
+        } else {
+            os << *it;
+        }
+    }
+    os << '"';
+}
+/// Écrit les étiquettes présentes, séparées par `sep`, les noms entre `q`.
+static void labels(std::ostream& os, const Metrics::Labels& l, const ReaderNames& names, const char* sep, bool json) {
+    const char* q = json ? "\"" : "";
+    const char* eq = json ? ":" : "=";
+    if (l.reader != ReaderNames::none) {
+        os << sep << q << "reader" << q << eq;
+        quote(os, names.name(l.reader));
+    }
+    if (l.service != NULL) {
+        os << sep << q << "service" << q << eq;
+        quote(os, l.service);
+    }
+    if (l.status != 0) {
+        os << sep << q << "status" << q << eq << "\"0x" << std::hex << std::setw(8) << std::setfill('0') << (DWORD)l.status << std::dec << '"';
+    }
+}
+std::string Metrics::json() const {
+    CounterMap counters;
+    HistogramMap histograms;
+    aggregate(counters, histograms);
+
+    std::ostringstream os;
+    os << "{\"counters\":[";
+    for (CounterMap::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+        os << (it == counters.begin() ? "" : ",") << "{\"name\":\"" << it->first.name << '"';
+        labels(os, it->first.labels, names, ",", true);
+        os << ",\"value\":" << it->second << '}';
+    }
+    os << "],\"histograms\":[";
+    for (HistogramMap::const_iterator it = histograms.begin(); it != histograms.end(); ++it) {
+        const Histogram& h = it->second;
+        os << (it == histograms.begin() ? "" : ",") << "{\"name\":\"" << it->first.name << '"';
+        labels(os, it->first.labels, names, ",", true);
+        os << ",\"count\":" << h.count()
+           << ",\"mean\":" << (h.count() != 0 ? h.sum() / h.count() : 0)
+           << ",\"p50\":" << h.percentile(0.50)
+           << ",\"p90\":" << h.percentile(0.90)
+           << ",\"p99\":" << h.percentile(0.99)
+           << ",\"max\":" << h.maximum() << '}';
+    }
+    os << "]}";
+    return os.str();
+}
+std::string Metrics::text() const {
+    CounterMap counters;
+    HistogramMap histograms;
+    aggregate(counters, histograms);
+
+    std::ostringstream os;
+    for (CounterMap::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+        os << it->first.name << '{';
+        std::ostringstream l;
+        labels(l, it->first.labels, names, ",", false);
+        os << l.str().substr(l.str().empty() ? 0 : 1) << "} " << it->second << '\n';
+    }
+    for (HistogramMap::const_iterator it = histograms.begin(); it != histograms.end(); ++it) {
+        const Histogram& h = it->second;
+        os << it->first.name << '{';
+        std::ostringstream l;
+        labels(l, it->first.labels, names, ",", false);
+        os << l.str().substr(l.str().empty() ? 0 : 1) << "}"
+           << " count=" << h.count()
+           << " mean=" << (h.count() != 0 ? h.sum() / h.count() : 0)
+           << " p50=" << h.percentile(0.50)
+           << " p90=" << h.percentile(0.90)
+           << " p99=" << h.percentile(0.99)
+           << " max=" << h.maximum() << '\n';
+    }
+    return os.str();
+}
+void Metrics::dump() const {
+    const bool asJson = dumpPath.size() >= 5 && dumpPath.compare(dumpPath.size() - 5, 5, ".json") == 0;
+    std::ofstream file(dumpPath.c_str(), std::ios::out | std::ios::trunc);
+    if (!file) {
+        {XFS::Logger() << "Metrics: cannot write " << dumpPath; }
+        return;
+    }
+    file << (asJson ? json() : text());
+}
+void Metrics::run() const {
+    try {
+        for (;;) {
+            boost::this_thread::sleep_for(boost::chrono::seconds(dumpPeriod));
+            dump();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Arrêt demandé par le destructeur.
+    }
+}
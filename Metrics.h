@@ -0,0 +1,149 @@
+#ifndef PCSC_CENXFS_BRIDGE_Metrics_H
+#define PCSC_CENXFS_BRIDGE_Metrics_H
+
+#pragma once
+
+#include "ReaderNames.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Pour LONG et DWORD
+#include <windef.h>
+
+/** Histogramme à précision relative constante (à la manière de HdrHistogram) : les valeurs sont
+    rangées dans des intervalles dont la largeur croît avec la valeur, 16 intervalles par puissance
+    de deux, soit une erreur relative inférieure à 6,25 %. Les valeurs au-delà de 2^32 sont comptées
+    dans le dernier intervalle.
+*/
+class Histogram {
+public:
+    enum {
+        /// Nombre d'intervalles par puissance de deux.
+        subBuckets = 16,
+        bucketCount = subBuckets + 28 * subBuckets
+    };
+private:
+    boost::uint32_t buckets[bucketCount];
+    boost::uint64_t mCount;
+    boost::uint64_t mSum;
+    boost::uint64_t mMax;
+public:
+    Histogram();
+    void record(boost::uint64_t value);
+    void merge(const Histogram& other);
+
+    inline boost::uint64_t count() const { return mCount; }
+    inline boost::uint64_t sum() const { return mSum; }
+    inline boost::uint64_t maximum() const { return mMax; }
+    /** Valeur en dessous de laquelle se trouve la fraction `p` des valeurs enregistrées, arrondie
+        à la borne supérieure de son intervalle.
+    */
+    boost::uint64_t percentile(double p) const;
+private:
+    static std::size_t index(boost::uint64_t value);
+    /// Plus petite valeur rangée dans l'intervalle `i`.
+    static boost::uint64_t lowerBound(std::size_t i);
+};
+
+/** Registre des métriques du fournisseur : compteurs et histogrammes de durées, toujours actifs.
+@par
+    Chaque série est identifiée par son nom et ses étiquettes : lecteur, service logique et code d'erreur
+    PC/SC, chacune pouvant être absente. Les séries ne sont jamais supprimées : une étiquette ne prend donc
+    que des valeurs en nombre borné. Le service est ainsi désigné par son nom logique (`WFPOpen`), et non
+    par son handle, nouveau à chaque ouverture.
+@par
+    Les enregistrements sont répartis entre 16 fragments selon l'identifiant du thread appelant, chacun
+    protégé par son propre verrou : les threads se gênent rarement entre eux. Il n'y a pas d'agrégation
+    périodique : `json` et `text` additionnent tous les fragments à chaque appel.
+@par
+    Si la variable d'environnement `PCSC_CENXFS_BRIDGE_METRICS` contient un chemin de fichier, les
+    métriques y sont écrites toutes les 10 secondes et au déchargement de la bibliothèque, en JSON si
+    le nom se termine par `.json`, en texte sinon. Elles sont aussi disponibles par `WFPGetInfo` avec
+    la catégorie `WFS_INF_IDC_PCSC_METRICS` (voir `XFS/Vendor.h`).
+*/
+class Metrics : private boost::noncopyable {
+public:
+    /// Étiquettes d'une série. Les valeurs nulles signifient « sans étiquette ».
+    struct Labels {
+        ReaderId reader;
+        /// Nom du service logique, interné (voir `intern`). Comparé par son contenu.
+        const char* service;
+        LONG status;
+
+        explicit Labels(ReaderId reader = ReaderNames::none, const char* service = NULL, LONG status = 0)
+            : reader(reader), service(service), status(status) {}
+        bool operator<(const Labels& other) const;
+    };
+private:
+    struct Key {
+        /// Nom de la série. Chaîne littérale, comparée par son contenu.
+        const char* name;
+        Labels labels;
+
+        Key(const char* name, const Labels& labels) : name(name), labels(labels) {}
+        bool operator<(const Key& other) const;
+    };
+    typedef std::map<Key, boost::uint64_t> CounterMap;
+    typedef std::map<Key, Histogram> HistogramMap;
+    struct Shard {
+        boost::mutex mutex;
+        CounterMap counters;
+        HistogramMap histograms;
+    };
+    enum { shardCount = 16 };
+private:
+    /// Pour afficher les noms des lecteurs.
+    const ReaderNames& names;
+    /// Modifiables pendant l'agrégation, qui prend leurs verrous.
+    mutable Shard shards[shardCount];
+    /// Fichier où les métriques sont écrites périodiquement, vide si l'écriture n'est pas demandée.
+    std::string dumpPath;
+    boost::shared_ptr<boost::thread> dumpThread;
+    /// Protège `interned`.
+    boost::mutex internMutex;
+    /// Noms de séries construits à l'exécution, gardés jusqu'à la destruction du registre.
+    std::set<std::string> interned;
+public:
+    explicit Metrics(const ReaderNames& names);
+    /// Arrête l'écriture périodique et écrit une dernière fois les métriques.
+    ~Metrics();
+
+    /** Retourne une copie du nom spécifié, valable aussi longtemps que le registre, pour les noms de
+        séries construits à l'exécution et les noms des services. `add` et `record` ne gardent que
+        les pointeurs sur les noms.
+    */
+    const char* intern(const std::string& name);
+    /// Ajoute `delta` au compteur.
+    void add(const char* name, const Labels& labels, boost::uint64_t delta = 1);
+    /// Enregistre une durée, en microsecondes, dans l'histogramme.
+    void record(const char* name, const Labels& labels, boost::chrono::steady_clock::duration elapsed);
+    /// Enregistre la durée écoulée depuis `since`.
+    inline void record(const char* name, const Labels& labels, boost::chrono::steady_clock::time_point since) {
+        record(name, labels, boost::chrono::steady_clock::now() - since);
+    }
+
+    /// Agrège toutes les séries et les retourne au format JSON.
+    std::string json() const;
+    /// Agrège toutes les séries et les retourne au format texte, une série par ligne.
+    std::string text() const;
+private:
+    /// Fragment utilisé par le thread appelant.
+    Shard& shard();
+    /// Additionne les séries de tous les fragments.
+    void aggregate(CounterMap& counters, HistogramMap& histograms) const;
+    /// Écrit les métriques dans `dumpPath`.
+    void dump() const;
+    /// Boucle du thread d'écriture périodique.
+    void run() const;
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Metrics_H
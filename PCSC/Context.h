@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "PCSC/Status.h"
+
 #include <boost/noncopyable.hpp>
 
 // PC/SC API
@@ -12,7 +14,10 @@ namespace PCSC {
     /** Un contexte représente une connexion au sous-système PC/SC. Il est isolé dans une classe distincte
         principalement pour s'assurer que son destructeur ferme le contexte PC/SC au tout dernier moment,
         lorsque tous les autres objets dépendant du contexte auront déjà été détruits.
-        Ainsi, il est destiné à être hérité par la classe manager.
+    @par
+        PC/SC sérialise les appels faits sur un même contexte, et `SCardCancel` interrompt tous les
+        appels bloquants du contexte. Chaque lecteur (`Reader`) et le thread de surveillance des
+        lecteurs (`ReaderChangesMonitor`) ont donc leur propre contexte.
     */
     class Context : private boost::noncopyable {
         /// Le contexte du sous-système PC/SC.
@@ -22,6 +27,16 @@ namespace PCSC {
         Context();
         /// Ferme la connexion au sous-système PC/SC.
         ~Context();
+        /** Ferme le contexte et en ouvre un nouveau. Nécessaire après un redémarrage du service PC/SC
+            (sous Windows, il s'arrête avec le retrait du dernier lecteur), qui invalide tous les contextes.
+        */
+        Status reestablish();
+        /// `true` si l'erreur signifie que le contexte n'est plus utilisable et doit être rétabli.
+        static inline bool isLost(Status st) {
+            return st.value() == SCARD_E_NO_SERVICE
+                || st.value() == SCARD_E_SERVICE_STOPPED
+                || st.value() == SCARD_E_INVALID_HANDLE;
+        }
     public:// Accès aux internes
         inline SCARDCONTEXT context() const { return hContext; }
     };
@@ -8,69 +8,118 @@
 #include "PCSC/ReaderState.h"
 
 #include "XFS/Logger.h"
-// Для XFS::Str
-#include "XFS/Memory.h"
-#include "XFS/Result.h"
+#include "XFS/ResultTemplate.h"
+#include "XFS/Vendor.h"
+
+#include <string>
 
 // PC/CS API -- для SCARD_READERSTATE
 #include <winscard.h>
-// Для GetComputerNameEx
-#include <winbase.h>
 
 namespace PCSC {
     /// Базовый класс для всех событий, генерируемых подсистемой PC/SC и транслируемых в XFS.
+    /// Каждое событие строит шаблон результата один раз, после чего каждый заинтересованный
+    /// слушатель получает его копию (см. `EventNotifier::notify`).
     class Event {
     protected:
         const Service& mService;
     protected:
         Event(const Service& service) : mService(service) {}
 
-        inline XFS::Result success() const {
+        inline XFS::ResultTemplate success() const {
             // Поля ReqID и hResult не нужны для сервисных событий
-            return XFS::Result(0, mService.handle(), WFS_SUCCESS);
+            return XFS::ResultTemplate(0, mService.handle(), WFS_SUCCESS);
         }
     };
 
-    /// Функтор, создающий результат уведомления о вставке карты каждому заинтересованному слушателю.
+    /// Функтор, создающий шаблон уведомления о вставке карты.
     class CardInserted : public Event {
     public:
         CardInserted(const Service& service) : Event(service) {}
-        XFS::Result operator()() const {
+        XFS::ResultTemplate operator()() const {
             XFS::Logger() << "Create CardInserted event";
-            return success().cardInserted();
+            XFS::ResultTemplate result = success();
+            result.event(WFS_EXEE_IDC_MEDIAINSERTED);
+            return result;
         }
     };
-    /// Функтор, создающий результат уведомления о удалении карты каждому заинтересованному слушателю.
+    /// Функтор, создающий шаблон уведомления о удалении карты.
     class CardRemoved : public Event {
     public:
         CardRemoved(const Service& service) : Event(service) {}
-        XFS::Result operator()() const {
+        XFS::ResultTemplate operator()() const {
             XFS::Logger() << "Create CardRemoved event";
-            return success().cardRemoved();
+            XFS::ResultTemplate result = success();
+            result.event(WFS_SRVE_IDC_MEDIAREMOVED);
+            return result;
+        }
+    };
+    /// Функтор, создающий шаблон уведомления о карте, обнаруженной при сбросе устройства
+    /// (WFS_CMD_IDC_RESET). Карта остается в позиции чтения.
+    class CardDetected : public Event {
+    public:
+        CardDetected(const Service& service) : Event(service) {}
+        XFS::ResultTemplate operator()() const {
+            XFS::Logger() << "Create CardDetected event";
+            XFS::ResultTemplate result = success();
+            result.event(WFS_SRVE_IDC_MEDIADETECTED);
+            const WORD position = WFS_IDC_CARDREADPOSITION;
+            return result.attach(result.append(position));
         }
     };
-    /// Функтор, создающий результат уведомления о появлении нового устройства каждому заинтересованному слушателю.
+    /// Функтор, создающий шаблон уведомления о появлении нового устройства.
     class DeviceDetected : public Event {
-        /// Состояние вновь подключившигося устройства.
-        /// TODO: Сделать копию объекта? Вдруг считыватель исчезнет прежде, чем успеем послать сообщение?
+        /// Имя рабочей станции, определенное при загрузке библиотеки.
+        const std::string& workstation;
+        /// Состояние вновь подключившигося устройства. Используется только при построении шаблона,
+        /// после чего все данные уже скопированы.
         const SCARD_READERSTATE& state;
     public:
-        DeviceDetected(const Service& service, const SCARD_READERSTATE& state) : Event(service), state(state) {}
-        XFS::Result operator()() const {
+        DeviceDetected(const Service& service, const std::string& workstation, const SCARD_READERSTATE& state)
+            : Event(service), workstation(workstation), state(state) {}
+        XFS::ResultTemplate operator()() const {
             XFS::Logger() << "Create DeviceDetected event";
-            //TODO: Возможно, необходимо выделять память через WFSAllocateMore
-            WFSDEVSTATUS* status = XFS::alloc<WFSDEVSTATUS>();
-            // Имя физичеcкого устройства, чье состояние изменилось
-            status->lpszPhysicalName = (LPSTR)XFS::Str(state.szReader).begin();
+            XFS::ResultTemplate result = success();
+            result.event(WFS_SYSE_DEVICE_STATUS);
 
-            DWORD len = 0;
-            // Сначала получаем размер буфера (включает размер для завершающего 0)
-            GetComputerNameEx(ComputerNameNetBIOS, NULL, &len);
+            WFSDEVSTATUS status = WFSDEVSTATUS();
+            status.dwState = PCSC::ReaderState(state.dwEventState).translate();
+            const std::size_t pStatus = result.append(status);
+            // Имя физичеcкого устройства, чье состояние изменилось
+            const std::size_t pName = result.append(state.szReader);
             // Рабочая станция, на которой запущен сервис.
-            status->lpszWorkstationName = XFS::allocArr<CHAR>(len);
-            GetComputerNameEx(ComputerNameNetBIOS, status->lpszWorkstationName, &len);
-            status->dwState = PCSC::ReaderState(state.dwEventState).translate();
-            return success().attach(status);
+            const std::size_t pWorkstation = result.append(workstation.c_str());
+
+            result.link(pStatus + offsetof(WFSDEVSTATUS, lpszPhysicalName), pName);
+            result.link(pStatus + offsetof(WFSDEVSTATUS, lpszWorkstationName), pWorkstation);
+            return result.attach(pStatus);
+        }
+    };
+    /// Функтор, создающий шаблон уведомления о медленном вызове PC/SC (см. `Watchdog`).
+    class SlowCall : public Event {
+        /// Имя считывателя, на котором выполнялся вызов.
+        const std::string& reader;
+        const Watchdog::Report& report;
+    public:
+        SlowCall(const Service& service, const std::string& reader, const Watchdog::Report& report)
+            : Event(service), reader(reader), report(report) {}
+        XFS::ResultTemplate operator()() const {
+            XFS::Logger() << "Create SlowCall event";
+            XFS::ResultTemplate result = success();
+            result.event(WFS_USRE_IDC_PCSC_SLOW_CALL);
+
+            WFSIDCPCSCSLOWCALL call = WFSIDCPCSCSLOWCALL();
+            call.ulThreshold = report.threshold;
+            call.ulElapsed = report.elapsed;
+            call.bCompleted = report.completed;
+            call.bCancelled = report.cancelled;
+            const std::size_t pCall = result.append(call);
+            const std::size_t pName = result.append(reader.c_str());
+            const std::size_t pOperation = result.append(Watchdog::name(report.operation));
+
+            result.link(pCall + offsetof(WFSIDCPCSCSLOWCALL, lpszPhysicalName), pName);
+            result.link(pCall + offsetof(WFSIDCPCSCSLOWCALL, lpszOperation), pOperation);
+            return result.attach(pCall);
         }
     };
 } // namespace PCSC
@@ -1,6 +1,8 @@
 #include "Manager.h"
 #include "Service.h"
 #include "Settings.h"
+#include "Tlv.h"
+#include "Tracer.h"
 
 #include "PCSC/Status.h"
 
@@ -8,6 +10,8 @@
 #include "XFS/Logger.h"  // Pour le logging
 #include "XFS/XFSManager.h"
 
+#include "Utils/Probes.h"
+
 // Pour strncpy.
 #include <cstring>
 // Pour std::size_t.
@@ -39,12 +43,37 @@ void safecopy(char (&dst)[N1], const char (&src)[N2]) {
     std::strncpy(dst, src, N1 < N2 ? N1 : N2);
 }
 
+/** Traceur d'intervalles. Construit avant le gestionnaire et détruit après lui (ordre de définition
+    dans une même unité de traduction), pour tracer aussi le travail fait à la construction et à la destruction.
+*/
+Tracer tracer;
 /** Lors du chargement de la DLL, les constructeurs de tous les objets globaux seront appelés et une
     connexion au sous-système PC/SC sera établie. Lors du déchargement de la DLL, les destructeurs des
     objets globaux seront appelés et la connexion se fermera automatiquement.
 */
 Manager pcsc;
 
+/** Appel d'une fonction SPI : intervalle du traceur, points `wfp_entry`/`wfp_return` et enregistreur de vol. */
+class SpiCall {
+    const char* mName;
+    HSERVICE mService;
+    REQUESTID mReqId;
+    Tracer::Span mSpan;
+public:
+    SpiCall(const char* name, HSERVICE hService, REQUESTID ReqID = 0)
+        : mName(name), mService(hService), mReqId(ReqID), mSpan("spi", name, hService, ReqID)
+    {
+        PCSC_PROBE3(wfp_entry, mName, mService, mReqId);
+        pcsc.recorder().spiEntry(mName, mService, mReqId);
+    }
+    /// Déclenche `wfp_return` et retourne le résultat de la fonction.
+    inline HRESULT leave(HRESULT hResult) const {
+        PCSC_PROBE4(wfp_return, mName, mService, mReqId, hResult);
+        pcsc.recorder().spiReturn(mName, mService, mReqId, hResult);
+        return hResult;
+    }
+};
+
 extern "C" {
 
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved) {
@@ -99,11 +128,12 @@ HRESULT SPI_API WFPOpen(HSERVICE hService, LPSTR lpszLogicalName,
                         DWORD dwSPIVersionsRequired, LPWFSVERSION lpSPIVersion, 
                         DWORD dwSrvcVersionsRequired, LPWFSVERSION lpSrvcVersion
 ) {
+    SpiCall call("WFPOpen", hService, ReqID);
     XFS::Logger() << "WFPOpen called with logical name: " << lpszLogicalName << ", timeout: " << dwTimeOut;
     
     if (!XFS::XFSManager::getInstance().isInitialized()) {
         XFS::Logger() << "WFPOpen failed: XFS Manager not initialized";
-        return WFS_ERR_NOT_STARTED;
+        return call.leave(WFS_ERR_NOT_STARTED);
     }
     
     // Retourne les versions supportées.
@@ -128,11 +158,12 @@ HRESULT SPI_API WFPOpen(HSERVICE hService, LPSTR lpszLogicalName,
         safecopy(lpSrvcVersion->szDescription, DLL_VERSION);
     }
 
-    pcsc.create(hService, Settings(lpszLogicalName, dwTraceLevel));
+    // Les paramètres ne sont lus dans le registre qu'à la première ouverture du service logique.
+    pcsc.create(hService, lpszLogicalName, pcsc.settingsFor(lpszLogicalName), dwTraceLevel);
     XFS::Result(ReqID, hService, WFS_SUCCESS).send(hWnd, WFS_OPEN_COMPLETE);
     
     XFS::Logger() << "WFPOpen completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 /** Termine une session (série de requêtes vers un service, initiée par l'appel à la fonction SPI WFPOpen)
     entre le gestionnaire XFS et le fournisseur de services spécifié.
@@ -146,18 +177,18 @@ HRESULT SPI_API WFPOpen(HSERVICE hService, LPSTR lpszLogicalName,
 @param ReqId Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPClose(HSERVICE hService, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPClose", hService, ReqID);
     XFS::Logger() << "WFPClose called for service: " << hService;
     
-    if (!pcsc.isValid(hService)) {
+    if (!pcsc.remove(hService)) {
         XFS::Logger() << "WFPClose failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
     
-    pcsc.remove(hService);
     XFS::Result(ReqID, hService, WFS_SUCCESS).send(hWnd, WFS_CLOSE_COMPLETE);
     
     XFS::Logger() << "WFPClose completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 /** Abonne la fenêtre spécifiée aux événements des classes spécifiées par le fournisseur de services spécifié.
@@ -172,16 +203,17 @@ HRESULT SPI_API WFPClose(HSERVICE hService, HWND hWnd, REQUESTID ReqID) {
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPRegister(HSERVICE hService,  DWORD dwEventClass, HWND hWndReg, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPRegister", hService, ReqID);
     XFS::Logger() << "WFPRegister called for service: " << hService << ", event class: 0x" << std::hex << dwEventClass << std::dec;
     
     if (!pcsc.addSubscriber(hService, hWndReg, dwEventClass)) {
         XFS::Logger() << "WFPRegister failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
     
     XFS::Result(ReqID, hService, WFS_SUCCESS).send(hWnd, WFS_REGISTER_COMPLETE);
     XFS::Logger() << "WFPRegister completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 /** Interrompt la surveillance des classes de messages spécifiées par le fournisseur de services spécifié pour les fenêtres spécifiées.
 
@@ -196,17 +228,18 @@ HRESULT SPI_API WFPRegister(HSERVICE hService,  DWORD dwEventClass, HWND hWndReg
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPDeregister(HSERVICE hService, DWORD dwEventClass, HWND hWndReg, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPDeregister", hService, ReqID);
     XFS::Logger() << "WFPDeregister called for service: " << hService << ", event class: 0x" << std::hex << dwEventClass << std::dec;
 
     // Se désabonne des événements. Si personne n'a été supprimé, personne n'était enregistré.
     if (!pcsc.removeSubscriber(hService, hWndReg, dwEventClass)) {
         XFS::Logger() << "WFPDeregister failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
     // La suppression de l'abonné est toujours réussie.
     XFS::Result(ReqID, hService, WFS_SUCCESS).send(hWnd, WFS_DEREGISTER_COMPLETE);
     XFS::Logger() << "WFPDeregister completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 /** Obtient un accès exclusif au périphérique.
@@ -220,18 +253,21 @@ HRESULT SPI_API WFPDeregister(HSERVICE hService, DWORD dwEventClass, HWND hWndRe
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPLock(HSERVICE hService, DWORD dwTimeOut, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPLock", hService, ReqID);
     XFS::Logger() << "WFPLock called for service: " << hService << ", timeout: " << dwTimeOut;
     
-    if (!pcsc.isValid(hService)) {
+    // Le service ne peut pas être détruit par un WFPClose concurrent tant que `service` existe.
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPLock failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
 
-    PCSC::Status st = pcsc.get(hService).lock();
+    PCSC::Status st = service->lock();
     XFS::Result(ReqID, hService, st).send(hWnd, WFS_LOCK_COMPLETE);
     
     XFS::Logger() << "WFPLock completed with status: " << st;
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 /**
 @message WFS_UNLOCK_COMPLETE
@@ -241,18 +277,20 @@ HRESULT SPI_API WFPLock(HSERVICE hService, DWORD dwTimeOut, HWND hWnd, REQUESTID
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPUnlock(HSERVICE hService, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPUnlock", hService, ReqID);
     XFS::Logger() << "WFPUnlock called for service: " << hService;
 
-    if (!pcsc.isValid(hService)) {
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPUnlock failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
 
-    PCSC::Status st = pcsc.get(hService).unlock();
+    PCSC::Status st = service->unlock();
     XFS::Result(ReqID, hService, st).send(hWnd, WFS_UNLOCK_COMPLETE);
     XFS::Logger() << "WFPUnlock completed with status: " << st;
 
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -268,17 +306,19 @@ HRESULT SPI_API WFPUnlock(HSERVICE hService, HWND hWnd, REQUESTID ReqID) {
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPGetInfo(HSERVICE hService, DWORD dwCategory, LPVOID lpQueryDetails, DWORD dwTimeOut, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPGetInfo", hService, ReqID);
     XFS::Logger() << "WFPGetInfo called for service: " << hService << ", category: 0x" << std::hex << dwCategory << std::dec << ", timeout: " << dwTimeOut;
 
-    if (!pcsc.isValid(hService)) {
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPGetInfo failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
     // Pour IDC, seules ces constantes peuvent être demandées (WFS_INF_IDC_*)
     switch (dwCategory) {
         case WFS_INF_IDC_STATUS: {      // Pas de paramètres supplémentaires
             XFS::Logger() << "WFPGetInfo: STATUS category";
-            std::pair<WFSIDCSTATUS*, PCSC::Status> status = pcsc.get(hService).getStatus();
+            std::pair<WFSIDCSTATUS*, PCSC::Status> status = service->getStatus();
             // Obtention d'informations sur le lecteur est toujours réussie.
             XFS::Result(ReqID, hService, WFS_SUCCESS).attach(status.first).send(hWnd, WFS_GETINFO_COMPLETE);
             XFS::Logger() << "WFPGetInfo: STATUS completed";
@@ -286,21 +326,60 @@ HRESULT SPI_API WFPGetInfo(HSERVICE hService, DWORD dwCategory, LPVOID lpQueryDe
         }
         case WFS_INF_IDC_CAPABILITIES: {// Pas de paramètres supplémentaires
             XFS::Logger() << "WFPGetInfo: CAPABILITIES category";
-            std::pair<WFSIDCCAPS*, PCSC::Status> caps = pcsc.get(hService).getCaps();
+            std::pair<WFSIDCCAPS*, PCSC::Status> caps = service->getCaps();
             XFS::Result(ReqID, hService, caps.second).attach(caps.first).send(hWnd, WFS_GETINFO_COMPLETE);
             XFS::Logger() << "WFPGetInfo: CAPABILITIES completed with status: " << caps.second;
             break;
         }
-        case WFS_INF_IDC_FORM_LIST:
+        case WFS_INF_IDC_PCSC_METRICS: {// Pas de paramètres supplémentaires
+            XFS::Logger() << "WFPGetInfo: PCSC_METRICS category";
+            std::string json = pcsc.metrics().json();
+            LPSTR text = XFS::allocArr<char>(json.size() + 1);
+            std::memcpy(text, json.c_str(), json.size() + 1);
+            XFS::Result(ReqID, hService, WFS_SUCCESS).metrics(text).send(hWnd, WFS_GETINFO_COMPLETE);
+            break;
+        }
+        case WFS_INF_IDC_PCSC_CHIP_TAGS: {
+            XFS::Logger() << "WFPGetInfo: PCSC_CHIP_TAGS category";
+            if (lpQueryDetails == NULL) {
+                XFS::Logger() << "WFPGetInfo: PCSC_CHIP_TAGS failed - NULL query details";
+                return call.leave(WFS_ERR_INVALID_POINTER);
+            }
+            std::vector<DWORD> tags;
+            if (!Tlv::parseTags((const char*)lpQueryDetails, tags)) {
+                XFS::Logger() << "WFPGetInfo: PCSC_CHIP_TAGS failed - invalid tag list: " << (const char*)lpQueryDetails;
+                return call.leave(WFS_ERR_INVALID_DATA);
+            }
+            std::pair<LPSTR, PCSC::Status> fields = service->getChipTags(tags);
+            XFS::Result(ReqID, hService, fields.second).chipTags(fields.first).send(hWnd, WFS_GETINFO_COMPLETE);
+            XFS::Logger() << "WFPGetInfo: PCSC_CHIP_TAGS completed with status: " << fields.second;
+            break;
+        }
+        case WFS_INF_IDC_PCSC_FEATURES: {// Pas de paramètres supplémentaires
+            XFS::Logger() << "WFPGetInfo: PCSC_FEATURES category";
+            std::pair<LPSTR, PCSC::Status> features = service->getFeatures();
+            XFS::Result(ReqID, hService, features.second).features(features.first).send(hWnd, WFS_GETINFO_COMPLETE);
+            XFS::Logger() << "WFPGetInfo: PCSC_FEATURES completed with status: " << features.second;
+            break;
+        }
+        case WFS_INF_IDC_FORM_LIST: {// Pas de paramètres supplémentaires
+            // La forme détermine où les données se trouvent sur les pistes. Comme nous ne lisons pas
+            // les pistes, seule la forme propre au fournisseur, pour les données de la puce, est connue.
+            XFS::Logger() << "WFPGetInfo: FORM_LIST category";
+            static const char names[] = WFS_IDC_PCSC_FORM_TLV "\0";
+            LPSTR text = XFS::allocArr<char>(sizeof(names));
+            std::memcpy(text, names, sizeof(names));
+            XFS::Result(ReqID, hService, WFS_SUCCESS).formList(text).send(hWnd, WFS_GETINFO_COMPLETE);
+            break;
+        }
         case WFS_INF_IDC_QUERY_FORM: {
-            // Les formes ne sont pas supportées. La forme détermine où les données se trouvent sur les pistes.
-            // Comme nous ne lisons ni n'écrivons pas les pistes, les formes ne sont pas supportées.
-            XFS::Logger() << "WFPGetInfo: FORM_LIST or QUERY_FORM category (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            // La description de la forme (WFSIDCFORM) ne porte que sur les pistes.
+            XFS::Logger() << "WFPGetInfo: QUERY_FORM category (unsupported)";
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         default:
             XFS::Logger() << "WFPGetInfo failed: Invalid category 0x" << std::hex << dwCategory << std::dec;
-            return WFS_ERR_INVALID_CATEGORY;
+            return call.leave(WFS_ERR_INVALID_CATEGORY);
     }
     // Codes de fin possibles pour une requête asynchrone (d'autres peuvent également être retournés)
     // WFS_ERR_CANCELED        La requête a été annulée par WFSCancelAsyncRequest.
@@ -323,7 +402,7 @@ HRESULT SPI_API WFPGetInfo(HSERVICE hService, DWORD dwCategory, LPVOID lpQueryDe
     // WFS_ERR_UNSUPP_CATEGORY    Le dwCategory émis, bien que valide pour cette classe de service, n'est pas supporté par ce fournisseur de services.
 
     XFS::Logger() << "WFPGetInfo completed";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 /** Envoie une commande pour exécuter le lecteur de carte.
 
@@ -344,11 +423,13 @@ HRESULT SPI_API WFPGetInfo(HSERVICE hService, DWORD dwCategory, LPVOID lpQueryDe
 @param ReqID Identifiant de la requête qui doit être passé à la fenêtre `hWnd` à la fin de l'opération.
 */
 HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData, DWORD dwTimeOut, HWND hWnd, REQUESTID ReqID) {
+    SpiCall call("WFPExecute", hService, ReqID);
     XFS::Logger() << "WFPExecute called for service: " << hService << ", command: 0x" << std::hex << dwCommand << std::dec << ", timeout: " << dwTimeOut;
     
-    if (!pcsc.isValid(hService)) {
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPExecute failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
 
     switch (dwCommand) {
@@ -358,17 +439,17 @@ HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData,
             XFS::Logger() << "WFPExecute: READ_TRACK command";
             if (lpCmdData == NULL) {
                 XFS::Logger() << "WFPExecute: READ_TRACK failed - NULL command data";
-                return WFS_ERR_INVALID_POINTER;
+                return call.leave(WFS_ERR_INVALID_POINTER);
             }
             LPSTR formName = (LPSTR)lpCmdData;
             XFS::Logger() << "WFPExecute: READ_TRACK form name: " << formName << " (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // Identique à la lecture des pistes.
         case WFS_CMD_IDC_WRITE_TRACK: {
             XFS::Logger() << "WFPExecute: WRITE_TRACK command (unsupported)";
             //WFSIDCWRITETRACK* input = (WFSIDCWRITETRACK*)lpCmdData;
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // La commande demande au lecteur de retourner la carte. Comme notre lecteur ne peut rien faire
         // avec la carte, nous ne la supportons pas.
@@ -378,30 +459,30 @@ HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData,
             // n'est pas supportée, et tombe en erreur fatale si nous lui disons qu'il demande quelque chose d'impossible,
             // bien que, selon la spécification, nous devons lui dire que cette fonctionnalité n'est pas supportée
             // par le code de réponse WFS_ERR_UNSUPP_COMMAND et nous avons le droit de ne pas la supporter.
-            if (pcsc.get(hService).settings().workarounds.canEject) {
+            if (service->settings()->workarounds.canEject) {
                 XFS::Result(ReqID, hService, WFS_SUCCESS).eject().send(hWnd, WFS_EXECUTE_COMPLETE);
                 XFS::Logger() << "WFPExecute: EJECT_CARD completed (with workaround)";
-                return WFS_SUCCESS;
+                return call.leave(WFS_SUCCESS);
             }
             XFS::Logger() << "WFPExecute: EJECT_CARD command (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // La commande capture la carte lue par le lecteur. Identique à la commande précédente.
         case WFS_CMD_IDC_RETAIN_CARD: {// Pas de paramètres d'entrée.
             XFS::Logger() << "WFPExecute: RETAIN_CARD command (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // La commande réinitialise le compteur de cartes capturées. Comme nous ne les capturons pas, nous ne les supportons pas.
         case WFS_CMD_IDC_RESET_COUNT: {// Pas de paramètres d'entrée.
             XFS::Logger() << "WFPExecute: RESET_COUNT command (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // Définit la clé DES nécessaire pour le fonctionnement du module CIM86. Nous ne la supportons pas,
         // car nous n'avons pas de tel module.
         case WFS_CMD_IDC_SETKEY: {
             XFS::Logger() << "WFPExecute: SETKEY command (unsupported)";
             //WFSIDCSETKEY* = (WFSIDCSETKEY*)lpCmdData;
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // Connecte le chip, le réinitialise et lit ATR (Answer To Reset).
         // Cette commande peut également être utilisée pour un "reset froid" du chip.
@@ -411,18 +492,20 @@ HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData,
             XFS::Logger() << "WFPExecute: READ_RAW_DATA command";
             if (lpCmdData == NULL) {
                 XFS::Logger() << "WFPExecute: READ_RAW_DATA failed - NULL command data";
-                return WFS_ERR_INVALID_POINTER;
+                return call.leave(WFS_ERR_INVALID_POINTER);
             }
             // Masque binaire avec les données qui doivent être lues.
             XFS::ReadFlags readData = *((WORD*)lpCmdData);
             XFS::Logger() << "WFPExecute: READ_RAW_DATA flags: " << readData.value();
-            if (readData.value() & WFS_IDC_CHIP) {
-                pcsc.get(hService).asyncRead(dwTimeOut, hWnd, ReqID, readData);
+            // Le type de la carte n'est pas encore connu : il suffit qu'un profil lise la piste 2 dans la puce.
+            const bool track2FromChip = (readData.value() & WFS_IDC_TRACK2) && service->settings()->track2FromChip();
+            if ((readData.value() & (WFS_IDC_CHIP | WFS_IDC_PCSC_UID | WFS_IDC_PCSC_ATS)) || track2FromChip) {
+                service->asyncRead(dwTimeOut, hWnd, ReqID, readData);
                 XFS::Logger() << "WFPExecute: READ_RAW_DATA async read started";
-                return WFS_SUCCESS;
+                return call.leave(WFS_SUCCESS);
             }
             XFS::Logger() << "WFPExecute: READ_RAW_DATA command (unsupported flags)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // Attend le temps spécifié jusqu'à ce qu'une carte soit insérée, puis écrit les données sur la piste spécifiée.
         // Nous ne la supportons pas, car nous ne savons pas écrire des pistes.
@@ -430,58 +513,139 @@ HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData,
             XFS::Logger() << "WFPExecute: WRITE_RAW_DATA command (unsupported)";
             //NULL-terminated array
             //WFSIDCCARDDATA** data = (WFSIDCCARDDATA**)lpCmdData;
-            return WFS_ERR_UNSUPP_COMMAND;
+            return call.leave(WFS_ERR_UNSUPP_COMMAND);
         }
         // Envoie des données au chip et reçoit la réponse de celui-ci. Les données sont transparentes pour le fournisseur.
         case WFS_CMD_IDC_CHIP_IO: {
             XFS::Logger() << "WFPExecute: CHIP_IO command";
             if (lpCmdData == NULL) {
                 XFS::Logger() << "WFPExecute: CHIP_IO failed - NULL command data";
-                return WFS_ERR_INVALID_POINTER;
+                return call.leave(WFS_ERR_INVALID_POINTER);
             }
             const WFSIDCCHIPIO* data = (const WFSIDCCHIPIO*)lpCmdData;
-            std::pair<WFSIDCCHIPIO*, PCSC::Status> result = pcsc.get(hService).transmit(data);
+            std::pair<WFSIDCCHIPIO*, PCSC::Status> result = service->transmit(data);
             XFS::Logger() << "WFPExecute: CHIP_IO completed with status: " << result.second;
             XFS::Result(ReqID, hService, result.second).attach(result.first).send(hWnd, WFS_EXECUTE_COMPLETE);
-            return WFS_SUCCESS;
+            return call.leave(WFS_SUCCESS);
         }
-        // Déconnecte le chip.
+        // Réinitialise l'appareil et la puce de la carte présente.
         case WFS_CMD_IDC_RESET: {
             XFS::Logger() << "WFPExecute: RESET command";
-            // Masque binaire. NULL signifie que le fournisseur décide ce que faire.
+            // Action sur la carte présente. NULL signifie que le fournisseur décide ce que faire.
             WORD wResetIn = lpCmdData ? *((WORD*)lpCmdData) : WFS_IDC_NOACTION;
             XFS::Logger() << "WFPExecute: RESET flags: " << wResetIn;
-            //TODO: Implémenter la commande WFS_CMD_IDC_RESET
-            XFS::Logger() << "WFPExecute: RESET command (unsupported)";
-            return WFS_ERR_UNSUPP_COMMAND;
+            switch (wResetIn) {
+                case WFS_IDC_NOACTION: break;
+                // Comme pour EJECT_CARD, l'utilisateur retire la carte lui-même.
+                case WFS_IDC_EJECT: {
+                    if (service->settings()->workarounds.canEject) {
+                        break;
+                    }
+                    XFS::Logger() << "WFPExecute: RESET command (eject unsupported)";
+                    return call.leave(WFS_ERR_UNSUPP_DATA);
+                }
+                // Les lecteurs PC/SC n'ont pas de bac de capture.
+                case WFS_IDC_RETAIN: {
+                    XFS::Logger() << "WFPExecute: RESET command (retain unsupported)";
+                    return call.leave(WFS_ERR_UNSUPP_DATA);
+                }
+                default: {
+                    XFS::Logger() << "WFPExecute: RESET failed - invalid action";
+                    return call.leave(WFS_ERR_INVALID_DATA);
+                }
+            }
+            PCSC::Status st = service->resetDevice();
+            XFS::Logger() << "WFPExecute: RESET completed with status: " << st;
+            XFS::Result(ReqID, hService, st).reset().send(hWnd, WFS_EXECUTE_COMPLETE);
+            return call.leave(WFS_SUCCESS);
         }
         case WFS_CMD_IDC_CHIP_POWER: {
             XFS::Logger() << "WFPExecute: CHIP_POWER command";
             if (lpCmdData == NULL) {
                 XFS::Logger() << "WFPExecute: CHIP_POWER failed - NULL command data";
-                return WFS_ERR_INVALID_POINTER;
+                return call.leave(WFS_ERR_INVALID_POINTER);
             }
             WORD wChipPower = *((WORD*)lpCmdData);
             XFS::Logger() << "WFPExecute: CHIP_POWER state: " << wChipPower;
-            std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> result = pcsc.get(hService).reset(wChipPower);
+            std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> result = service->reset(wChipPower);
             XFS::Logger() << "WFPExecute: CHIP_POWER completed with status: " << result.second;
             XFS::Result(ReqID, hService, result.second).attach(result.first).send(hWnd, WFS_EXECUTE_COMPLETE);
-            return WFS_SUCCESS;
+            return call.leave(WFS_SUCCESS);
         }
         // Analyse le résultat, précédemment retourné par la commande WFS_CMD_IDC_READ_RAW_DATA. Comme nous ne la supportons pas, nous ne la supportons pas.
         case WFS_CMD_IDC_PARSE_DATA: {
-            XFS::Logger() << "WFPExecute: PARSE_DATA command (unsupported)";
-            // WFSIDCPARSEDATA* parseData = (WFSIDCPARSEDATA*)lpCmdData;
-            return WFS_ERR_UNSUPP_COMMAND;
+            XFS::Logger() << "WFPExecute: PARSE_DATA command";
+            const WFSIDCPARSEDATA* parseData = (const WFSIDCPARSEDATA*)lpCmdData;
+            if (parseData == NULL || parseData->lpstrFormName == NULL || parseData->lppCardData == NULL) {
+                XFS::Logger() << "WFPExecute: PARSE_DATA failed - NULL command data";
+                return call.leave(WFS_ERR_INVALID_POINTER);
+            }
+            if (std::strcmp(parseData->lpstrFormName, WFS_IDC_PCSC_FORM_TLV) != 0) {
+                XFS::Logger() << "WFPExecute: PARSE_DATA failed - unknown form: " << parseData->lpstrFormName;
+                return call.leave(WFS_ERR_IDC_FORMNOTFOUND);
+            }
+            const WFSIDCCARDDATA* chip = NULL;
+            for (WFSIDCCARDDATA** it = parseData->lppCardData; *it != NULL; ++it) {
+                if ((*it)->wDataSource == WFS_IDC_CHIP && (*it)->wStatus == WFS_IDC_DATAOK) {
+                    chip = *it;
+                    break;
+                }
+            }
+            if (chip == NULL || chip->lpbData == NULL) {
+                XFS::Logger() << "WFPExecute: PARSE_DATA failed - no chip data";
+                return call.leave(WFS_ERR_IDC_INVALIDDATA);
+            }
+            // Les éléments sont lus directement dans le tampon de l'application.
+            ULONG size = chip->ulDataLength;
+            if (size >= 2 && !Tlv::valid(chip->lpbData, size)) {
+                // Réponse de WFS_CMD_IDC_CHIP_IO, terminée par SW1 SW2.
+                size -= 2;
+            }
+            std::string fields;
+            if (!Tlv::appendFields(fields, chip->lpbData, size)) {
+                XFS::Logger() << "WFPExecute: PARSE_DATA failed - malformed BER-TLV data";
+                return call.leave(WFS_ERR_IDC_INVALIDDATA);
+            }
+            fields += '\0';
+            LPSTR text = XFS::allocArr<char>(fields.size());
+            std::memcpy(text, fields.data(), fields.size());
+            XFS::Logger() << "WFPExecute: PARSE_DATA completed";
+            XFS::Result(ReqID, hService, WFS_SUCCESS).parsed(text).send(hWnd, WFS_EXECUTE_COMPLETE);
+            return call.leave(WFS_SUCCESS);
+        }
+        // Transmet un code de contrôle au lecteur (PC/SC partie 10), par exemple la saisie sécurisée du code PIN.
+        case WFS_CMD_IDC_PCSC_CONTROL: {
+            XFS::Logger() << "WFPExecute: PCSC_CONTROL command";
+            if (!service->settings()->control) {
+                XFS::Logger() << "WFPExecute: PCSC_CONTROL command (disabled)";
+                return call.leave(WFS_ERR_UNSUPP_COMMAND);
+            }
+            const WFSIDCPCSCCONTROL* data = (const WFSIDCPCSCCONTROL*)lpCmdData;
+            if (data == NULL || (data->ulInDataLength != 0 && data->lpbInData == NULL)) {
+                XFS::Logger() << "WFPExecute: PCSC_CONTROL failed - NULL command data";
+                return call.leave(WFS_ERR_INVALID_POINTER);
+            }
+            std::pair<WFSIDCPCSCCONTROLOUT*, PCSC::Status> result = service->control(data);
+            XFS::Logger() << "WFPExecute: PCSC_CONTROL completed with status: " << result.second;
+            XFS::Result(ReqID, hService, result.second).attach(result.first).send(hWnd, WFS_EXECUTE_COMPLETE);
+            return call.leave(WFS_SUCCESS);
+        }
+        case WFS_CMD_IDC_PCSC_DUMP_RECORDER: {// Pas de paramètres d'entrée.
+            XFS::Logger() << "WFPExecute: PCSC_DUMP_RECORDER command";
+            std::string dump = pcsc.recorder().dump("WFS_CMD_IDC_PCSC_DUMP_RECORDER");
+            LPSTR text = XFS::allocArr<char>(dump.size() + 1);
+            std::memcpy(text, dump.c_str(), dump.size() + 1);
+            XFS::Result(ReqID, hService, WFS_SUCCESS).recorderDump(text).send(hWnd, WFS_EXECUTE_COMPLETE);
+            return call.leave(WFS_SUCCESS);
         }
         default: {
             XFS::Logger() << "WFPExecute failed: Invalid command 0x" << std::hex << dwCommand << std::dec;
-            return WFS_ERR_INVALID_COMMAND;
+            return call.leave(WFS_ERR_INVALID_COMMAND);
         }
     }// switch (dwCommand)
     
     XFS::Logger() << "WFPExecute completed";
-    return WFS_ERR_INTERNAL_ERROR;
+    return call.leave(WFS_ERR_INTERNAL_ERROR);
 }
 /** Annule une requête asynchrone spécifiée (ou toutes pour un service spécifié) avant qu'elle ne se termine.
     Toutes les requêtes qui n'ont pas pu être exécutées à ce moment seront terminées avec le code `WFS_ERR_CANCELED`.
@@ -492,29 +656,33 @@ HRESULT SPI_API WFPExecute(HSERVICE hService, DWORD dwCommand, LPVOID lpCmdData,
        pour le service spécifié `hService`.
 */
 HRESULT SPI_API WFPCancelAsyncRequest(HSERVICE hService, REQUESTID ReqID) {
+    SpiCall call("WFPCancelAsyncRequest", hService, ReqID);
     XFS::Logger() << "WFPCancelAsyncRequest called for service: " << hService << ", request: " << ReqID;
     
-    if (!pcsc.isValid(hService)) {
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPCancelAsyncRequest failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
     
     if (!pcsc.cancelTask(hService, ReqID)) {
         XFS::Logger() << "WFPCancelAsyncRequest failed: Invalid request ID";
-        return WFS_ERR_INVALID_REQ_ID;
+        return call.leave(WFS_ERR_INVALID_REQ_ID);
     }
     
     XFS::Logger() << "WFPCancelAsyncRequest completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 HRESULT SPI_API WFPSetTraceLevel(HSERVICE hService, DWORD dwTraceLevel) {
+    SpiCall call("WFPSetTraceLevel", hService);
     XFS::Logger() << "WFPSetTraceLevel called for service: " << hService << ", trace level: " << dwTraceLevel;
 
-    if (!pcsc.isValid(hService)) {
+    Manager::ServiceRef service(pcsc, hService);
+    if (!service.isValid()) {
         XFS::Logger() << "WFPSetTraceLevel failed: Invalid service handle";
-        return WFS_ERR_INVALID_HSERVICE;
+        return call.leave(WFS_ERR_INVALID_HSERVICE);
     }
-    pcsc.get(hService).setTraceLevel(dwTraceLevel);
+    service->setTraceLevel(dwTraceLevel);
     // Codes de fin possibles pour la fonction :
     // WFS_ERR_CONNECTION_LOST    The connection to the service is lost.
     // WFS_ERR_INTERNAL_ERROR     An internal inconsistency or other unexpected error occurred in the XFS subsystem.
@@ -523,10 +691,11 @@ HRESULT SPI_API WFPSetTraceLevel(HSERVICE hService, DWORD dwTraceLevel) {
     // WFS_ERR_NOT_STARTED        The application has not previously performed a successful WFSStartUp.
     // WFS_ERR_OP_IN_PROGRESS     A blocking operation is in progress on the thread; only WFSCancelBlockingCall and WFSIsBlocking are permitted at this time.
     XFS::Logger() << "WFPSetTraceLevel completed successfully";
-    return WFS_SUCCESS;
+    return call.leave(WFS_SUCCESS);
 }
 /** Appelé par XFS pour déterminer si DLL peut être déchargée avec ce fournisseur de services directement maintenant. */
 HRESULT SPI_API WFPUnloadService() {
+    SpiCall call("WFPUnloadService", 0);
     XFS::Logger() << "WFPUnloadService called";
 
     // Codes de fin possibles pour la fonction :
@@ -537,6 +706,6 @@ HRESULT SPI_API WFPUnloadService() {
 
     bool empty = pcsc.isEmpty();
     XFS::Logger() << "WFPUnloadService completed, can unload: " << empty;
-    return empty ? WFS_SUCCESS : WFS_ERR_NOT_OK_TO_UNLOAD;
+    return call.leave(empty ? WFS_SUCCESS : WFS_ERR_NOT_OK_TO_UNLOAD);
 }
 } // extern "C"
\ No newline at end of file
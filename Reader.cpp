@@ -0,0 +1,856 @@
+#include "Reader.h"
+
+#include "Manager.h"
+#include "Tlv.h"
+#include "Tracer.h"
+
+#include "Utils/Probes.h"
+
+#include "XFS/Logger.h"
+#include "XFS/Memory.h"
+
+#include <cassert>
+// Pour std::memcpy
+#include <cstring>
+#include <sstream>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/locks.hpp>
+
+/// Nombre maximal de réponses de la puce gardées, assez pour une transaction EMV complète. Au-delà,
+/// les plus anciennes sont oubliées : les étiquettes demandées viennent des dernières commandes.
+static const std::size_t responseLimit = 32;
+/// Délai en millisecondes avant de réessayer de fermer une connexion en attente occupée par un appel PC/SC.
+static const unsigned busyRetry = 50;
+
+#ifndef CM_IOCTL_GET_FEATURE_REQUEST
+/// Liste des fonctions du lecteur (PC/SC partie 10, 2.2), comme dans `reader.h` de pcsc-lite.
+#define CM_IOCTL_GET_FEATURE_REQUEST SCARD_CTL_CODE(3400)
+#endif
+/// Les fonctions 2048 à 4095 de `SCARD_CTL_CODE` sont réservées aux fabricants : commandes d'échappement
+/// des pilotes, dont `SCARD_CTL_CODE(3500)` du pilote CCID de Windows, qu'il n'annonce pas toujours par
+/// `FEATURE_CCID_ESC_COMMAND`.
+static inline bool isVendorCode(DWORD controlCode) {
+    return controlCode >= SCARD_CTL_CODE(2048) && controlCode <= SCARD_CTL_CODE(4095);
+}
+
+Reader::Reader(Manager& pcsc, ReaderId id, const std::string& name)
+    : pcsc(pcsc)
+    , mId(id)
+    , mName(name)
+    , hCard(0)
+    , mActiveProtocol(0)
+    , mRefs(0)
+    , mOwner(0)
+    , mDepth(0)
+    , mExclusive(false)
+    , mReaderAttrsRead(false)
+    , mPower(PowerOff)
+    , mUnshared(false)
+    , mChipUsed(false)
+    , mFeaturesRead(false)
+{}
+Reader::~Reader() {
+    // Tous les services sont détruits avant les lecteurs et se sont donc détachés.
+    assert(mRefs == 0 && "Reader destroyed while services are attached");
+    // Il ne peut rester qu'une connexion en attente.
+    if (hCard != 0) {
+        disconnect();
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+PCSC::Status Reader::attach(HSERVICE hService, bool exclusive, const Settings::Watchdog& limits, const std::vector<BYTE>& atr) {
+    Tracer::Span span("pcsc", "Reader::attach", hService);
+    boost::lock_guard<boost::mutex> io(ioMutex);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mLimits = limits;
+    }
+
+    if (exclusive && mOwner != 0 && mOwner != hService) {
+        {XFS::Logger() << "Reader '" << mName << "': service " << hService << " needs exclusive access, but card is locked by service " << mOwner; }
+        return SCARD_E_SHARING_VIOLATION;
+    }
+    if (isParked()) {
+        if (canAdopt(atr)) {
+            {XFS::Logger() << "Reader '" << mName << "': service " << hService << " adopts lingering connection hCard=" << hCard; }
+        } else {
+            disconnect();
+        }
+    }
+    if (hCard == 0) {
+        assert(mRefs == 0 && "Internal error: services attached to disconnected reader");
+        boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+        PCSC::Status st = connect(hService, exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED);
+        pcsc.metrics().record("connect_us", Metrics::Labels(mId), start);
+        pcsc.recorder().pcsc("SCardConnect", mId, hService, st.value());
+        pcsc.metrics().add(st ? "connects" : "errors", pcsc.metricLabels(mId, hService, st ? 0 : st.value()));
+        pcsc.status().count(mId, mName.c_str(), st ? StatusPublisher::Connects : StatusPublisher::Errors);
+        if (!st) {
+            return st;
+        }
+        readAtr();
+        readAttributes();
+        boost::lock_guard<boost::mutex> lock(mutex);
+        // Le gestionnaire de ressources met la carte sous tension à son insertion.
+        mPower = PowerCold;
+        mPoweredAt = boost::chrono::steady_clock::now();
+        mChipUsed = false;
+        mResponses.clear();
+    }
+    if (exclusive && mOwner != hService) {
+        // Les autres processus sont écartés par le mode de connexion et non par une transaction :
+        // Windows termine les transactions restées inactives environ 5 secondes.
+        PCSC::Status st = mExclusive ? PCSC::Status(SCARD_S_SUCCESS) : share(hService, SCARD_SHARE_EXCLUSIVE);
+        if (!st) {
+            // Ne laisse pas de connexion ouverte sans service attaché.
+            if (mRefs == 0) {
+                disconnect();
+            }
+            return st;
+        }
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mOwner = hService;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (exclusive) {
+        ++mDepth;
+    }
+    ++mRefs;
+    return SCARD_S_SUCCESS;
+}
+PCSC::Status Reader::detach(HSERVICE hService, DWORD linger) {
+    Tracer::Span span("pcsc", "Reader::detach", hService);
+    {
+        boost::lock_guard<boost::mutex> io(ioMutex);
+        assert(mRefs > 0 && "Attempt detach from reader without attached services");
+
+        if (mOwner == hService) {
+            // La fermeture de la connexion libère d'elle-même la carte.
+            releaseTransaction(mRefs == 1 && linger == 0);
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--mRefs != 0) {
+            return SCARD_S_SUCCESS;
+        }
+        if (linger == 0) {
+            lock.unlock();
+            return disconnect();
+        }
+        // La connexion reste ouverte : un service ouvert peu après sur la même carte la reprendra.
+        mParkedUntil = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(linger);
+        {XFS::Logger() << "Reader '" << mName << "': connection hCard=" << hCard << " lingers for " << linger << " ms"; }
+    }
+    // Le thread de surveillance doit recalculer son délai d'attente pour fermer la connexion à temps.
+    pcsc.lingerStarted();
+    return SCARD_S_SUCCESS;
+}
+bool Reader::isConnected() const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return hCard != 0;
+}
+DWORD Reader::lingerTimeout(boost::chrono::steady_clock::time_point now) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!isParked()) {
+        return INFINITE;
+    }
+    if (mParkedUntil <= now) {
+        return 0;
+    }
+    return (DWORD)boost::chrono::duration_cast<boost::chrono::milliseconds>(mParkedUntil - now).count();
+}
+void Reader::expire(boost::chrono::steady_clock::time_point now) {
+    // Le thread de surveillance n'attend jamais la fin d'un appel PC/SC sur la connexion.
+    boost::unique_lock<boost::mutex> io(ioMutex, boost::try_to_lock);
+    if (!io.owns_lock()) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (isParked() && mParkedUntil <= now) {
+            mParkedUntil = now + boost::chrono::milliseconds(busyRetry);
+        }
+        return;
+    }
+    if (isParked() && mParkedUntil <= now) {
+        {XFS::Logger() << "Reader '" << mName << "': lingering connection expired"; }
+        disconnect();
+    }
+}
+void Reader::drop() {
+    boost::unique_lock<boost::mutex> io(ioMutex, boost::try_to_lock);
+    if (!io.owns_lock()) {
+        // La connexion est occupée : `expire` la fermera dès que l'appel en cours sera terminé.
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (isParked()) {
+            mParkedUntil = boost::chrono::steady_clock::now();
+        }
+        return;
+    }
+    if (isParked()) {
+        {XFS::Logger() << "Reader '" << mName << "': lingering connection dropped"; }
+        disconnect();
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+PCSC::Status Reader::beginTransaction(HSERVICE hService) {
+    Tracer::Span span("pcsc", "Reader::beginTransaction", hService);
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    if (mOwner == hService) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        ++mDepth;
+        return SCARD_S_SUCCESS;
+    }
+    if (mOwner != 0) {
+        return SCARD_E_SHARING_VIOLATION;
+    }
+    PCSC::Status st = PCSC_PROBED_CALL("SCardBeginTransaction", mName.c_str(), SCardBeginTransaction(hCard));
+    {XFS::Logger() << "SCardBeginTransaction(hCard=" << hCard << ") = " << st; }
+    pcsc.recorder().pcsc("SCardBeginTransaction", mId, hService, st.value());
+    if (st) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mOwner = hService;
+        mDepth = 1;
+    }
+    return st;
+}
+PCSC::Status Reader::endTransaction(HSERVICE hService) {
+    Tracer::Span span("pcsc", "Reader::endTransaction", hService);
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    if (mOwner != hService) {
+        return SCARD_E_NOT_TRANSACTED;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (--mDepth != 0) {
+            return SCARD_S_SUCCESS;
+        }
+    }
+    releaseTransaction(false);
+    return SCARD_S_SUCCESS;
+}
+void Reader::releaseTransaction(bool closing) {
+    if (mExclusive) {
+        // Les autres processus retrouvent l'accès à la carte quand la connexion repasse en mode partagé.
+        if (!closing) {
+            share(mOwner, SCARD_SHARE_SHARED);
+        }
+    } else {
+        // Termine la transaction, ne fait rien avec la carte.
+        PCSC::Status st = PCSC_PROBED_CALL("SCardEndTransaction", mName.c_str(), SCardEndTransaction(hCard, SCARD_LEAVE_CARD));
+        {XFS::Logger() << "SCardEndTransaction(hCard=" << hCard << ", SCARD_LEAVE_CARD) = " << st; }
+        pcsc.recorder().pcsc("SCardEndTransaction", mId, mOwner, st.value());
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    mOwner = 0;
+    mDepth = 0;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+PCSC::Status Reader::status(PCSC::MediaStatus& state, PCSC::ProtocolTypes& protocol) const {
+    Tracer::Span span("pcsc", "Reader::status");
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    DWORD nameLen = 0;
+    DWORD atrLen = 0;
+    Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Status, mId, 0, mLimits.status, cancelContext());
+    PCSC::Status st = PCSC_PROBED_CALL("SCardStatus", mName.c_str(), SCardStatus(hCard,
+        // Le nom n'est pas demandé, mais sa longueur doit l'être, NULL n'est pas admis.
+        NULL, &nameLen,
+        // Petit raccourci admissible, nos enveloppes sont transparentes.
+        (DWORD*)&state, (DWORD*)&protocol,
+        // L'ATR n'est pas demandé, mais sa longueur doit l'être, NULL n'est pas admis.
+        NULL, &atrLen
+    ));
+    {XFS::Logger() << "SCardStatus(hCard=" << hCard << ", ..., state=&" << state << ", dwActiveProtocol=&" << protocol << ", ...) = " << st; }
+    return st;
+}
+PCSC::Status Reader::getAttrib(DWORD attr, BYTE* buffer, DWORD* len) const {
+    Tracer::Span span("pcsc", "Reader::getAttrib");
+    boost::lock_guard<boost::mutex> io(ioMutex);
+    return PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, attr, buffer, len));
+}
+PCSC::Status Reader::transmit(HSERVICE hService, const SCARD_IO_REQUEST* ioRq,
+                              const BYTE* input, DWORD inputSize,
+                              BYTE* output, DWORD* outputSize) const {
+    Tracer::Span span("pcsc", "Reader::transmit", hService);
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    PCSC::Status st = checkAccess(hService);
+    if (!st) {
+        *outputSize = 0;
+        return st;
+    }
+    pcsc.recorder().apdu(mId, hService, input, inputSize);
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    // Les commandes de classe FF sont traitées par le lecteur lui-même (PC/SC partie 3) et ne touchent pas la puce.
+    const bool toChip = inputSize == 0 || input[0] != 0xFF;
+    if (toChip) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mChipUsed = true;
+    }
+    {
+        Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Transmit, mId, hService, mLimits.transmit, cancelContext());
+        st = PCSC_PROBED_CALL("SCardTransmit", mName.c_str(), SCardTransmit(hCard, ioRq, input, inputSize, NULL, output, outputSize));
+    }
+    pcsc.metrics().record("transmit_us", Metrics::Labels(mId), start);
+    {XFS::Logger() << "SCardTransmit(hCard=" << hCard << ", ...) = " << st; }
+    // Mot d'état de la carte : les deux derniers octets de la réponse.
+    const DWORD sw = st && *outputSize >= 2 ? (output[*outputSize - 2] << 8) | output[*outputSize - 1] : 0;
+    pcsc.recorder().pcsc("SCardTransmit", mId, hService, st.value(), sw);
+    pcsc.metrics().add(st ? "transmits" : "errors", pcsc.metricLabels(mId, hService, st ? 0 : st.value()));
+    pcsc.status().count(mId, mName.c_str(), st ? StatusPublisher::Transmits : StatusPublisher::Errors);
+    // Seules les réponses BER-TLV de la puce sont gardées, pour WFS_INF_IDC_PCSC_CHIP_TAGS.
+    if (sw == 0x9000 && *outputSize > 2 && toChip && Tlv::valid(output, *outputSize - 2)) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (mResponses.size() >= responseLimit) {
+            mResponses.erase(mResponses.begin());
+        }
+        mResponses.push_back(std::vector<BYTE>(output, output + *outputSize - 2));
+    }
+    return st;
+}
+PCSC::Status Reader::reconnect(HSERVICE hService, DWORD initialization) {
+    Tracer::Span span("pcsc", "Reader::reconnect", hService);
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    PCSC::Status st = checkAccess(hService);
+    if (!st) {
+        return st;
+    }
+    const ChipPower requested = initialization == SCARD_UNPOWER_CARD ? PowerCold
+                              : initialization == SCARD_RESET_CARD   ? PowerWarm
+                              : PowerOff;
+    // canAdopt vérifie par SCardStatus que la carte n'a pas été retirée ou réinitialisée par un autre processus.
+    // `mChipUsed` ne voit que les commandes de ce processus : sans accès exclusif, un autre a pu utiliser la puce.
+    if (requested != PowerOff && requested == mPower && mUnshared && !mChipUsed && canAdopt(mAtr)) {
+        namespace bc = boost::chrono;
+        bc::milliseconds since = bc::duration_cast<bc::milliseconds>(bc::steady_clock::now() - mPoweredAt);
+        {XFS::Logger() << "Reader '" << mName << "': chip already " << (requested == PowerCold ? "cold" : "warm") << " reset " << since.count() << " ms ago and unused, reset skipped"; }
+        pcsc.metrics().add("resets_skipped", pcsc.metricLabels(mId, hService));
+        return SCARD_S_SUCCESS;
+    }
+    DWORD protocol = mActiveProtocol.value();
+    {
+        Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Reconnect, mId, hService, mLimits.reconnect, cancelContext());
+        st = PCSC_PROBED_CALL("SCardReconnect", mName.c_str(), SCardReconnect(hCard,
+            // La réinitialisation garde le mode de partage de la connexion.
+            mExclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
+            // Le protocole actif actuel doit être parmi ceux demandés, sinon
+            // la fonction retournera une erreur.
+            protocol | SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+            initialization,
+            &protocol
+        ));
+    }
+    {XFS::Logger() << "SCardReconnect(hCard=" << hCard << ", ..., dwActiveProtocol=&" << PCSC::ProtocolTypes(protocol) << ") = " << st; }
+    pcsc.recorder().pcsc("SCardReconnect", mId, hService, st.value());
+    pcsc.metrics().add(st ? "resets" : "errors", pcsc.metricLabels(mId, hService, st ? 0 : st.value()));
+    readAtr();
+    readAttributes();
+    boost::lock_guard<boost::mutex> lock(mutex);
+    mActiveProtocol = protocol;
+    mPower = requested;
+    mPoweredAt = boost::chrono::steady_clock::now();
+    // Après un échec, l'état de la puce est inconnu : la prochaine réinitialisation ne doit pas être omise.
+    mChipUsed = !st;
+    mUnshared = mExclusive;
+    mResponses.clear();
+    return st;
+}
+PCSC::ProtocolTypes Reader::protocol() const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return mActiveProtocol;
+}
+Reader::ChipPower Reader::power() const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return mPower;
+}
+std::string Reader::chipFields(const std::vector<DWORD>& tags) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::string result;
+    for (std::vector<DWORD>::const_iterator tag = tags.begin(); tag != tags.end(); ++tag) {
+        for (std::size_t i = mResponses.size(); i > 0; --i) {
+            const std::vector<BYTE>& r = mResponses[i - 1];
+            Tlv::Element e;
+            if (Tlv::find(&r[0], (DWORD)r.size(), *tag, e)) {
+                Tlv::appendField(result, e);
+                break;
+            }
+        }
+    }
+    return result;
+}
+bool Reader::chipTag(DWORD tag, std::vector<BYTE>& value) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (std::size_t i = mResponses.size(); i > 0; --i) {
+        const std::vector<BYTE>& r = mResponses[i - 1];
+        Tlv::Element e;
+        if (Tlv::find(&r[0], (DWORD)r.size(), tag, e)) {
+            value.assign(e.value, e.value + e.length);
+            return true;
+        }
+    }
+    return false;
+}
+std::string Reader::track2() const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return mTrack2;
+}
+void Reader::track2(const std::string& value) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    mTrack2 = value;
+}
+std::vector<BYTE> Reader::atr() const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return mAtr;
+}
+LPSTR Reader::extra(const std::string& more) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (mExtra.empty() && more.empty()) {
+        return NULL;
+    }
+    // mExtra se termine par le zéro de fin de liste, qui doit suivre les paires ajoutées.
+    const std::size_t size = mExtra.empty() ? 0 : mExtra.size() - 1;
+    //TODO: Il pourrait être nécessaire d'allouer de la mémoire via WFSAllocateMore
+    LPSTR result = XFS::allocArr<char>(size + more.size() + 1);
+    std::memcpy(result, mExtra.data(), size);
+    std::memcpy(result + size, more.data(), more.size());
+    result[size + more.size()] = '\0';
+    return result;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/// Nom de la fonction d'étiquette spécifiée (PC/SC partie 10, 2.3), `NULL` si elle est inconnue.
+static const char* featureName(BYTE tag) {
+    static const char* names[] = {
+        "FEATURE_VERIFY_PIN_START",
+        "FEATURE_VERIFY_PIN_FINISH",
+        "FEATURE_MODIFY_PIN_START",
+        "FEATURE_MODIFY_PIN_FINISH",
+        "FEATURE_GET_KEY_PRESSED",
+        "FEATURE_VERIFY_PIN_DIRECT",
+        "FEATURE_MODIFY_PIN_DIRECT",
+        "FEATURE_MCT_READER_DIRECT",
+        "FEATURE_MCT_UNIVERSAL",
+        "FEATURE_IFD_PIN_PROPERTIES",
+        "FEATURE_ABORT",
+        "FEATURE_SET_SPE_MESSAGE",
+        "FEATURE_VERIFY_PIN_DIRECT_APP_ID",
+        "FEATURE_MODIFY_PIN_DIRECT_APP_ID",
+        "FEATURE_WRITE_DISPLAY",
+        "FEATURE_GET_KEY",
+        "FEATURE_IFD_DISPLAY_PROPERTIES",
+        "FEATURE_GET_TLV_PROPERTIES",
+        "FEATURE_CCID_ESC_COMMAND",
+        "FEATURE_EXECUTE_PACE",
+    };
+    return tag >= 1 && tag <= sizeof(names) / sizeof(names[0]) ? names[tag - 1] : NULL;
+}
+/** `true` si l'échec de la demande des fonctions peut disparaître de lui-même (carte retirée, lecteur
+    occupé, service PC/SC redémarré) : le résultat n'est alors pas gardé.
+*/
+static bool isTransient(PCSC::Status st) {
+    switch (st.value()) {
+        case SCARD_E_TIMEOUT:
+        case SCARD_E_SHARING_VIOLATION:
+        case SCARD_E_NO_SMARTCARD:
+        case SCARD_E_READER_UNAVAILABLE:
+        case SCARD_W_REMOVED_CARD:
+        case SCARD_W_RESET_CARD:
+            return true;
+    }
+    return PCSC::Context::isLost(st);
+}
+PCSC::Status Reader::featureFields(std::string& out) {
+    Tracer::Span span("pcsc", "Reader::featureFields");
+    bool cached;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        cached = mFeaturesRead;
+    }
+    PCSC::Status st = SCARD_S_SUCCESS;
+    if (!cached) {
+        boost::lock_guard<boost::mutex> io(ioMutex);
+        st = readFeatures();
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!st && !mFeaturesRead) {
+        return st;
+    }
+    static const char digits[] = "0123456789ABCDEF";
+    for (std::vector<Feature>::const_iterator it = mFeatures.begin(); it != mFeatures.end(); ++it) {
+        const char* name = featureName(it->tag);
+        if (name != NULL) {
+            out += name;
+        } else {
+            out += "FEATURE_";
+            out += digits[it->tag >> 4];
+            out += digits[it->tag & 0x0F];
+        }
+        out += '=';
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            out += digits[(it->controlCode >> shift) & 0x0F];
+        }
+        out += '\0';
+    }
+    // Un lecteur sans fonctions n'est pas une erreur : la liste est simplement vide.
+    return SCARD_S_SUCCESS;
+}
+PCSC::Status Reader::control(HSERVICE hService, DWORD controlCode,
+                             const BYTE* input, DWORD inputSize,
+                             BYTE* output, DWORD* outputSize) {
+    Tracer::Span span("pcsc", "Reader::control", hService);
+    // Seul le verrou des appels PC/SC est gardé pendant la saisie du code PIN, l'état du lecteur reste accessible.
+    boost::lock_guard<boost::mutex> io(ioMutex);
+
+    PCSC::Status st = checkAccess(hService);
+    if (!st) {
+        *outputSize = 0;
+        return st;
+    }
+    readFeatures();
+    bool known = isVendorCode(controlCode);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        for (std::vector<Feature>::const_iterator it = mFeatures.begin(); !known && it != mFeatures.end(); ++it) {
+            if (it->controlCode == controlCode) {
+                known = true;
+                break;
+            }
+        }
+        // La vérification du code PIN et les commandes d'échappement peuvent toucher la puce.
+        if (known) {
+            mChipUsed = true;
+        }
+    }
+    if (!known) {
+        {XFS::Logger() << "Reader '" << mName << "': control code 0x" << std::hex << controlCode << std::dec << " is neither announced by the reader nor a vendor code"; }
+        *outputSize = 0;
+        return SCARD_E_UNSUPPORTED_FEATURE;
+    }
+    const DWORD capacity = *outputSize;
+    st = PCSC_PROBED_CALL("SCardControl", mName.c_str(), SCardControl(hCard, controlCode, input, inputSize, output, capacity, outputSize));
+    {XFS::Logger() << "SCardControl(hCard=" << hCard << ", dwControlCode=0x" << std::hex << controlCode << std::dec << ", ...) = " << st; }
+    pcsc.recorder().pcsc("SCardControl", mId, hService, st.value());
+    pcsc.metrics().add(st ? "controls" : "errors", pcsc.metricLabels(mId, hService, st ? 0 : st.value()));
+    if (!st) {
+        *outputSize = 0;
+    }
+    return st;
+}
+void Reader::unplugged() {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (mFeaturesRead || mReaderAttrsRead) {
+        {XFS::Logger() << "Reader '" << mName << "': unplugged, features and attributes will be read again"; }
+    }
+    mFeaturesRead = false;
+    mFeatures.clear();
+    // Les attributs du lecteur débranché ne doivent pas être recopiés dans `mExtra` à la fermeture
+    // de la connexion, ni rendus à l'appareil qui reviendra sous ce nom.
+    mReaderAttrsRead = false;
+    mReaderAttrs.clear();
+    mCardAttrs.clear();
+    mExtra.clear();
+}
+PCSC::Status Reader::readFeatures() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (mFeaturesRead) {
+            return SCARD_S_SUCCESS;
+        }
+    }
+    SCARDHANDLE handle = hCard;
+    PCSC::Status st = SCARD_S_SUCCESS;
+    if (handle == 0) {
+        // Sans carte, le lecteur est joint en mode direct, sans mise sous tension ni choix de protocole.
+        DWORD protocol = 0;
+        st = PCSC_PROBED_CALL("SCardConnect", mName.c_str(), SCardConnect(mContext.context(), mName.c_str(), SCARD_SHARE_DIRECT, 0, &handle, &protocol));
+        {XFS::Logger() << "SCardConnect(hContext=" << mContext.context() << ", szReader=" << mName << ", SCARD_SHARE_DIRECT, ..., hCard=&" << handle << ") = " << st; }
+        if (!st) {
+            return st;
+        }
+    }
+    // Suite de triplets étiquette (1 octet), longueur (toujours 4), code de contrôle en gros-boutiste.
+    BYTE buffer[256];
+    DWORD len = 0;
+    st = PCSC_PROBED_CALL("SCardControl", mName.c_str(), SCardControl(handle, CM_IOCTL_GET_FEATURE_REQUEST, NULL, 0, buffer, sizeof(buffer), &len));
+    {XFS::Logger() << "SCardControl(hCard=" << handle << ", CM_IOCTL_GET_FEATURE_REQUEST, ..., size=&" << len << ") = " << st; }
+    pcsc.recorder().pcsc("SCardControl", mId, 0, st.value());
+    if (handle != hCard) {
+        PCSC::Status dst = PCSC_PROBED_CALL("SCardDisconnect", mName.c_str(), SCardDisconnect(handle, SCARD_LEAVE_CARD));
+        {XFS::Logger() << "SCardDisconnect(hCard=" << handle << ", SCARD_LEAVE_CARD) = " << dst; }
+    }
+    std::vector<Feature> features;
+    for (DWORD i = 0; st && i + 6 <= len && buffer[i + 1] == 4; i += 6) {
+        Feature f;
+        f.tag = buffer[i];
+        f.controlCode = (DWORD)buffer[i + 2] << 24 | (DWORD)buffer[i + 3] << 16 | (DWORD)buffer[i + 4] << 8 | buffer[i + 5];
+        features.push_back(f);
+    }
+    // Un pilote qui ne connaît pas la requête la refusera toujours : le refus est gardé comme une liste vide.
+    const bool cached = st || !isTransient(st);
+    {XFS::Logger() << "Reader '" << mName << "': " << features.size() << " features" << (cached ? ", cached" : ""); }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    mFeatures.swap(features);
+    mFeaturesRead = cached;
+    return st;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+PCSC::Status Reader::checkAccess(HSERVICE hService) const {
+    if (hCard == 0) {
+        return SCARD_E_NO_SMARTCARD;
+    }
+    if (mOwner != 0 && mOwner != hService) {
+        return SCARD_E_SHARING_VIOLATION;
+    }
+    return SCARD_S_SUCCESS;
+}
+bool Reader::canAdopt(const std::vector<BYTE>& atr) const {
+    Tracer::Span span("pcsc", "SCardStatus");
+    DWORD nameLen = 0;
+    DWORD state = 0;
+    DWORD protocol = 0;
+    BYTE current[MAX_ATR_SIZE];
+    DWORD atrLen = sizeof(current);
+    // Une carte retirée ou réinitialisée par un autre processus rend le handle invalide,
+    // SCardStatus retourne alors SCARD_W_REMOVED_CARD ou SCARD_W_RESET_CARD.
+    Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Status, mId, 0, mLimits.status, cancelContext());
+    PCSC::Status st = PCSC_PROBED_CALL("SCardStatus", mName.c_str(), SCardStatus(hCard, NULL, &nameLen, &state, &protocol, current, &atrLen));
+    {XFS::Logger() << "SCardStatus(hCard=" << hCard << ", ..., atr=&[" << atrLen << " bytes]) = " << st; }
+    if (!st) {
+        return false;
+    }
+    return std::vector<BYTE>(current, current + atrLen) == mAtr && mAtr == atr;
+}
+PCSC::Status Reader::connect(HSERVICE hService, DWORD share) {
+    Tracer::Span span("pcsc", "SCardConnect");
+    PCSC::Status st = SCARD_S_SUCCESS;
+    SCARDHANDLE handle = 0;
+    DWORD protocol = 0;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        {
+            // Le contexte interrompu par la surveillance doit rester valide pendant l'appel, pas au-delà.
+            Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Connect, mId, hService, mLimits.connect, cancelContext());
+            st = PCSC_PROBED_CALL("SCardConnect", mName.c_str(), SCardConnect(mContext.context(), mName.c_str(),
+                share,
+                // Nous n'avons pas de protocole préféré, nous travaillons avec ce qui est donné
+                SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                // Obtient le handle de la carte et le protocole choisi.
+                &handle, &protocol
+            ));
+        }
+        {
+            XFS::Logger()
+                << "SCardConnect(hContext=" << mContext.context()
+                << ", szReader=" << mName << ", ..., hCard=&" << handle
+                << ", dwActiveProtocol=&" << PCSC::ProtocolTypes(protocol) << ") = " << st;
+        }
+        if (!PCSC::Context::isLost(st) || attempt > 0) {
+            break;
+        }
+        mContext.reestablish();
+    }
+    if (st) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        hCard = handle;
+        mActiveProtocol = protocol;
+        mExclusive = share == SCARD_SHARE_EXCLUSIVE;
+        mUnshared = mExclusive;
+    }
+    return st;
+}
+PCSC::Status Reader::share(HSERVICE hService, DWORD mode) {
+    Tracer::Span span("pcsc", "SCardReconnect", hService);
+    DWORD protocol = mActiveProtocol.value();
+    PCSC::Status st = SCARD_S_SUCCESS;
+    {
+        Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Reconnect, mId, hService, mLimits.reconnect, cancelContext());
+        // Seul le mode de partage change, la carte n'est pas réinitialisée.
+        st = PCSC_PROBED_CALL("SCardReconnect", mName.c_str(), SCardReconnect(hCard, mode,
+            protocol | SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+            SCARD_LEAVE_CARD,
+            &protocol
+        ));
+    }
+    {
+        XFS::Logger()
+            << "SCardReconnect(hCard=" << hCard << ", "
+            << (mode == SCARD_SHARE_EXCLUSIVE ? "SCARD_SHARE_EXCLUSIVE" : "SCARD_SHARE_SHARED")
+            << ", ..., SCARD_LEAVE_CARD, dwActiveProtocol=&" << PCSC::ProtocolTypes(protocol) << ") = " << st;
+    }
+    pcsc.recorder().pcsc("SCardReconnect", mId, hService, st.value());
+    if (st) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        mActiveProtocol = protocol;
+        mExclusive = mode == SCARD_SHARE_EXCLUSIVE;
+        // Passer en mode exclusif ne dit rien de ce que les autres processus ont fait de la puce avant.
+        mUnshared = mUnshared && mExclusive;
+    }
+    return st;
+}
+PCSC::Status Reader::disconnect() {
+    Tracer::Span span("pcsc", "SCardDisconnect");
+    // Lors de la fermeture de la connexion, on ne fait rien avec la carte, on la laisse dans le lecteur.
+    PCSC::Status st = PCSC_PROBED_CALL("SCardDisconnect", mName.c_str(), SCardDisconnect(hCard, SCARD_LEAVE_CARD));
+    {XFS::Logger() << "SCardDisconnect(hCard=" << hCard << ", SCARD_LEAVE_CARD) = " << st; }
+    pcsc.recorder().pcsc("SCardDisconnect", mId, 0, st.value());
+    boost::lock_guard<boost::mutex> lock(mutex);
+    hCard = 0;
+    mOwner = 0;
+    mDepth = 0;
+    mExclusive = false;
+    mUnshared = false;
+    mPower = PowerOff;
+    mResponses.clear();
+    mTrack2.clear();
+    mAtr.clear();
+    // Les attributs du lecteur restent valables, ceux de la carte non.
+    mCardAttrs.clear();
+    mExtra = mReaderAttrs.empty() ? std::string() : mReaderAttrs + '\0';
+    return st;
+}
+void Reader::readAtr() {
+    Tracer::Span span("pcsc", "Reader::readAtr");
+    // Obtient l'ATR (Answer To Reset). D'abord la longueur, puis les données elles-mêmes.
+    DWORD len = 0;
+    PCSC::Status st = PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, SCARD_ATTR_ATR_STRING, NULL, &len));
+    {XFS::Logger() << "SCardGetAttrib(hCard=" << hCard << ", SCARD_ATTR_ATR_STRING, ..., size=&" << len << ") = " << st; }
+    std::vector<BYTE> atr(len);
+    if (len != 0) {
+        st = PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, SCARD_ATTR_ATR_STRING, &atr[0], &len));
+        {XFS::Logger() << "SCardGetAttrib(hCard=" << hCard << ", SCARD_ATTR_ATR_STRING, ..., size=&" << len << ") = " << st; }
+        atr.resize(st ? len : 0);
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    mAtr.swap(atr);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/** Retourne la position des caractères historiques dans l'ATR (ISO/IEC 7816-3, 8.2) et leur nombre
+    dans `count`. Retourne `atr.size()` si l'ATR est tronqué.
+*/
+static std::size_t historicalBytes(const std::vector<BYTE>& atr, std::size_t& count) {
+    count = 0;
+    if (atr.size() < 2) {
+        return atr.size();
+    }
+    // T0 : indicateur des caractères d'interface qui suivent et nombre de caractères historiques.
+    count = atr[1] & 0x0F;
+    std::size_t i = 1;
+    BYTE y = atr[1] & 0xF0;
+    while (y != 0) {
+        // TAi, TBi et TCi sont présents selon les bits 5 à 7, TDi selon le bit 8 ; TDi indique la suite.
+        std::size_t present = ((y >> 4) & 1) + ((y >> 5) & 1) + ((y >> 6) & 1);
+        if (y & 0x80) {
+            i += present + 1;
+            if (i >= atr.size()) {
+                return atr.size();
+            }
+            y = atr[i] & 0xF0;
+        } else {
+            i += present;
+            y = 0;
+        }
+    }
+    return i + 1 + count <= atr.size() ? i + 1 : atr.size();
+}
+static void appendHex(std::string& out, const char* key, const BYTE* data, std::size_t size) {
+    static const char digits[] = "0123456789ABCDEF";
+    out += key;
+    out += '=';
+    for (std::size_t i = 0; i < size; ++i) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0x0F];
+    }
+    out += '\0';
+}
+void Reader::appendString(std::string& out, const char* key, DWORD attr) const {
+    char buffer[256];
+    DWORD len = sizeof(buffer);
+    PCSC::Status st = PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, attr, (BYTE*)buffer, &len));
+    if (!st || len == 0) {
+        return;
+    }
+    out += key;
+    out += '=';
+    for (DWORD i = 0; i < len && buffer[i] != '\0'; ++i) {
+        // Les zéros et les caractères de contrôle sépareraient les paires ou les rendraient illisibles.
+        out += (unsigned char)buffer[i] < 0x20 ? '?' : buffer[i];
+    }
+    out += '\0';
+}
+bool Reader::appendNumber(std::string& out, const char* key, DWORD attr, DWORD& value) const {
+    BYTE buffer[sizeof(DWORD)] = {0};
+    DWORD len = sizeof(buffer);
+    PCSC::Status st = PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, attr, buffer, &len));
+    if (!st || len == 0 || len > sizeof(buffer)) {
+        return false;
+    }
+    // Certains pilotes retournent moins de 4 octets, toujours en little-endian.
+    value = 0;
+    for (DWORD i = len; i > 0; --i) {
+        value = (value << 8) | buffer[i - 1];
+    }
+    std::ostringstream os;
+    os << key << '=' << value;
+    out += os.str();
+    out += '\0';
+    return true;
+}
+void Reader::readAttributes() {
+    Tracer::Span span("pcsc", "Reader::readAttributes");
+    bool readerAttrsRead;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        readerAttrsRead = mReaderAttrsRead;
+    }
+    std::string readerAttrs;
+    if (!readerAttrsRead) {
+        appendString(readerAttrs, "VendorName", SCARD_ATTR_VENDOR_NAME);
+        appendString(readerAttrs, "VendorIfdType", SCARD_ATTR_VENDOR_IFD_TYPE);
+        appendString(readerAttrs, "VendorIfdSerialNo", SCARD_ATTR_VENDOR_IFD_SERIAL_NO);
+        BYTE version[sizeof(DWORD)] = {0};
+        DWORD len = sizeof(version);
+        if (PCSC::Status(PCSC_PROBED_CALL("SCardGetAttrib", mName.c_str(), SCardGetAttrib(hCard, SCARD_ATTR_VENDOR_IFD_VERSION, version, &len))) && len == sizeof(version)) {
+            // 0xMMmmbbbb : version majeure, mineure et numéro de build.
+            std::ostringstream os;
+            os << "VendorIfdVersion=" << (unsigned)version[3] << '.' << (unsigned)version[2] << '.' << (version[1] << 8 | version[0]);
+            readerAttrs += os.str();
+            readerAttrs += '\0';
+        }
+    }
+    std::string cardAttrs;
+    DWORD clk = 0, f = 0, d = 0, value = 0;
+    bool hasClk = appendNumber(cardAttrs, "CurrentClk", SCARD_ATTR_CURRENT_CLK, clk);
+    bool hasF = appendNumber(cardAttrs, "CurrentF", SCARD_ATTR_CURRENT_F, f);
+    bool hasD = appendNumber(cardAttrs, "CurrentD", SCARD_ATTR_CURRENT_D, d);
+    if (hasClk && hasF && hasD && f != 0) {
+        // CLK est en kHz, un bit dure F/D cycles d'horloge (ISO/IEC 7816-3, 7.1).
+        std::ostringstream os;
+        os << "CurrentBaud=" << (boost::uint64_t)clk * 1000 * d / f;
+        cardAttrs += os.str();
+        cardAttrs += '\0';
+    }
+    appendNumber(cardAttrs, "CurrentN", SCARD_ATTR_CURRENT_N, value);
+    appendNumber(cardAttrs, "CurrentW", SCARD_ATTR_CURRENT_W, value);
+    appendNumber(cardAttrs, "CurrentIFSC", SCARD_ATTR_CURRENT_IFSC, value);
+    appendNumber(cardAttrs, "CurrentIFSD", SCARD_ATTR_CURRENT_IFSD, value);
+    appendNumber(cardAttrs, "CurrentBWT", SCARD_ATTR_CURRENT_BWT, value);
+    appendNumber(cardAttrs, "CurrentCWT", SCARD_ATTR_CURRENT_CWT, value);
+    if (!mAtr.empty()) {
+        appendHex(cardAttrs, "ATR", &mAtr[0], mAtr.size());
+        std::size_t count;
+        std::size_t pos = historicalBytes(mAtr, count);
+        if (pos < mAtr.size() && count != 0) {
+            appendHex(cardAttrs, "HistoricalBytes", &mAtr[pos], count);
+        }
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!readerAttrsRead) {
+        mReaderAttrs.swap(readerAttrs);
+        mReaderAttrsRead = true;
+    }
+    mCardAttrs.swap(cardAttrs);
+    mExtra = mReaderAttrs + mCardAttrs;
+    if (!mExtra.empty()) {
+        mExtra += '\0';
+    }
+}
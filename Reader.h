@@ -0,0 +1,307 @@
+#ifndef PCSC_CENXFS_BRIDGE_Reader_H
+#define PCSC_CENXFS_BRIDGE_Reader_H
+
+#pragma once
+
+#include "ReaderNames.h"
+#include "Settings.h"
+
+#include "PCSC/Context.h"
+#include "PCSC/MediaStatus.h"
+#include "PCSC/ProtocolTypes.h"
+#include "PCSC/Status.h"
+
+// Pour std::size_t
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+// PC/CS API
+#include <winscard.h>
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- pour HSERVICE
+#include <XFSIDC.h>
+
+class Manager;
+/** Lecteur PC/SC et connexion à la carte qui s'y trouve, partagée par tous les services XFS
+    qui travaillent avec ce lecteur.
+@par
+    Le premier service qui s'attache au lecteur ouvre la connexion à la carte, le dernier qui s'en
+    détache la ferme. Entre les deux, l'ATR et le protocole actif sont connus sans interroger PC/SC.
+@par
+    Le service avec le paramètre `exclusive` ouvre la connexion en mode exclusif (`SCARD_SHARE_EXCLUSIVE`),
+    ou y fait passer la connexion existante, jusqu'à son détachement : les autres processus sont écartés
+    par PC/SC lui-même, sans transaction que Windows terminerait après quelques secondes d'inactivité.
+    `WFPLock` sur une connexion partagée est obtenu par une transaction PC/SC. Dans les deux cas,
+    à l'intérieur du processus, le lecteur se souvient du service propriétaire et refuse aux autres
+    l'accès à la carte avec `SCARD_E_SHARING_VIOLATION`.
+@par
+    Tous les appels PC/SC sur la connexion sont sérialisés par `ioMutex`. L'état du lecteur est protégé
+    par `mutex`, qui n'est jamais gardé pendant un appel PC/SC : le thread de surveillance, qui calcule
+    les délais des connexions en attente et les ferme, n'attend pas la fin d'un échange. Chaque lecteur
+    a son propre contexte PC/SC : les échanges avec des cartes de lecteurs différents se font en
+    parallèle, et l'interruption de l'attente du thread de surveillance ne les touche pas.
+@par
+    Le dernier service qui se détache peut demander de garder la connexion ouverte pendant un certain
+    temps (paramètre `linger` du service). La connexion est alors « en attente » : un service qui
+    s'attache pendant ce temps et voit la même carte la reprend sans reconnexion ni réinitialisation
+    de la carte. La connexion en attente est fermée à l'expiration du délai (`expire`) ou au retrait
+    de la carte (`drop`).
+*/
+class Reader : private boost::noncopyable {
+public:
+    /// État d'alimentation de la puce, tel qu'il résulte de la dernière action du fournisseur.
+    enum ChipPower {
+        /// Pas de connexion, ou la dernière action n'a pas réinitialisé la puce.
+        PowerOff,
+        /// Mise sous tension (connexion) ou réinitialisation à froid.
+        PowerCold,
+        /// Réinitialisation à chaud.
+        PowerWarm
+    };
+    /// Fonction du lecteur (PC/SC partie 10, par exemple la saisie sécurisée du code PIN) et code de contrôle qui la pilote.
+    struct Feature {
+        /// Étiquette de la fonction, par exemple `0x06` pour `FEATURE_VERIFY_PIN_DIRECT`.
+        BYTE tag;
+        /// Code de contrôle à passer à `SCardControl`.
+        DWORD controlCode;
+    };
+private:
+    Manager& pcsc;
+    /// Identifiant du lecteur.
+    const ReaderId mId;
+    /// Nom PC/SC du lecteur.
+    const std::string mName;
+    /// Contexte PC/SC propre au lecteur. Déclaré avant la connexion, il est fermé après elle.
+    PCSC::Context mContext;
+    /// Sérialise les appels PC/SC sur `hCard`. Toujours pris avant `mutex`. Le thread de surveillance
+    /// ne fait que l'essayer (`expire`, `drop`).
+    mutable boost::mutex ioMutex;
+    /** Protège tous les champs suivants, pour de courtes durées seulement. L'état de la connexion est
+        modifié sous les deux verrous et peut donc être lu sous l'un ou l'autre ; `mTrack2`, les
+        attributs et les fonctions du lecteur, modifiés aussi par le thread de surveillance, ne se lisent
+        que sous `mutex`.
+    */
+    mutable boost::mutex mutex;
+    /// Handle de la carte, 0 si aucun service n'est attaché.
+    SCARDHANDLE hCard;
+    /// Protocole utilisé par la carte.
+    PCSC::ProtocolTypes mActiveProtocol;
+    /// ATR de la carte, lu à la connexion et après chaque réinitialisation.
+    std::vector<BYTE> mAtr;
+    /// Nombre de services attachés.
+    std::size_t mRefs;
+    /// Service propriétaire de la transaction en cours, 0 s'il n'y a pas de transaction.
+    HSERVICE mOwner;
+    /// Nombre d'acquisitions de la transaction par son propriétaire.
+    std::size_t mDepth;
+    /// `true` si la connexion est en mode exclusif (`SCARD_SHARE_EXCLUSIVE`). Le propriétaire n'a alors
+    /// pas de transaction PC/SC, l'accès exclusif est rendu en repassant en mode partagé.
+    bool mExclusive;
+    /// Moment de fermeture de la connexion en attente. N'a de sens que si `hCard != 0` et `mRefs == 0`.
+    boost::chrono::steady_clock::time_point mParkedUntil;
+    /// `true` si les attributs du lecteur lui-même (fabricant, modèle...) ont déjà été lus.
+    bool mReaderAttrsRead;
+    /// Paires `clé=valeur` des attributs du lecteur, chacune terminée par zéro. Lues une seule fois,
+    /// oubliées quand le lecteur est débranché (voir `unplugged`).
+    std::string mReaderAttrs;
+    /// Paires `clé=valeur` des attributs de la session avec la carte (paramètres de communication, ATR),
+    /// relues à chaque connexion et réinitialisation.
+    std::string mCardAttrs;
+    /// Contenu préformaté de `lpszExtra` : `mReaderAttrs`, `mCardAttrs` et le zéro final.
+    std::string mExtra;
+    /// Seuils de durée des appels PC/SC, ceux du dernier service attaché (voir `Watchdog`).
+    Settings::Watchdog mLimits;
+    /// État d'alimentation de la puce.
+    ChipPower mPower;
+    /// Moment de la dernière mise sous tension ou réinitialisation de la puce.
+    boost::chrono::steady_clock::time_point mPoweredAt;
+    /// `true` si la connexion est restée en mode exclusif depuis la dernière mise sous tension ou réinitialisation
+    /// de la puce par ce lecteur : aucun autre processus n'a pu lui envoyer de commande.
+    bool mUnshared;
+    /// `true` si une commande a été envoyée à la puce depuis sa dernière mise sous tension ou réinitialisation.
+    /// Modifié par `transmit`, sous les deux verrous.
+    mutable bool mChipUsed;
+    /** Réponses BER-TLV de la puce (sans SW1 SW2) depuis sa dernière mise sous tension ou réinitialisation,
+        dans l'ordre de réception, les 32 dernières. Modifié par `transmit`, sous les deux verrous.
+    */
+    mutable std::vector<std::vector<BYTE> > mResponses;
+    /// Piste 2 lue dans la puce (voir `Service::readChipTrack2`), vide si elle n'a pas encore été lue.
+    /// Gardée jusqu'à la déconnexion de la carte, les réinitialisations ne la changent pas.
+    std::string mTrack2;
+    /// `true` si les fonctions du lecteur ont été demandées par `CM_IOCTL_GET_FEATURE_REQUEST`, avec succès
+    /// ou refus définitif du pilote. Remis à `false` seulement quand le lecteur est débranché.
+    bool mFeaturesRead;
+    /// Fonctions annoncées par le lecteur, dans l'ordre de sa réponse.
+    std::vector<Feature> mFeatures;
+public:
+    Reader(Manager& pcsc, ReaderId id, const std::string& name);
+    ~Reader();
+public:
+    inline ReaderId id() const { return mId; }
+    inline const std::string& name() const { return mName; }
+public:// Gestion de la connexion
+    /** Attache le service au lecteur, en ouvrant la connexion à la carte si nécessaire.
+    @param hService
+        Service qui s'attache.
+    @param exclusive
+        Si `true`, le service devient de plus propriétaire de la carte jusqu'à son détachement et la
+        connexion passe en mode exclusif. La connexion en attente, toujours partagée, est reprise.
+        Le mode exclusif est refusé par PC/SC si un autre processus utilise la carte.
+    @param limits
+        Seuils de durée des appels PC/SC du service. Remplacent ceux du service attaché précédemment.
+    @param atr
+        ATR de la carte vue par le service. La connexion en attente n'est reprise que si la carte
+        a toujours le même ATR et n'a pas été retirée ou réinitialisée entre-temps.
+    @return
+        Résultat de l'ouverture de la connexion ou de l'acquisition de la transaction. En cas d'échec
+        le service n'est pas attaché.
+    */
+    PCSC::Status attach(HSERVICE hService, bool exclusive, const Settings::Watchdog& limits, const std::vector<BYTE>& atr);
+    /** Détache le service du lecteur. Libère la transaction dont il était propriétaire et
+        ferme la connexion, s'il était le dernier service attaché.
+    @param linger
+        Durée en millisecondes pendant laquelle la connexion est gardée en attente au lieu d'être
+        fermée, si le service était le dernier attaché. `0` ferme la connexion immédiatement.
+    */
+    PCSC::Status detach(HSERVICE hService, DWORD linger);
+    /// @return `true` si la connexion à la carte est ouverte.
+    bool isConnected() const;
+    /** Calcule le temps restant jusqu'à la fermeture de la connexion en attente.
+    @return Temps en millisecondes, `INFINITE` s'il n'y a pas de connexion en attente.
+    */
+    DWORD lingerTimeout(boost::chrono::steady_clock::time_point now) const;
+    /** Ferme la connexion en attente, si son délai est écoulé au moment `now`. Si un appel PC/SC est en
+        cours sur la connexion, n'attend pas sa fin et repousse légèrement le délai.
+    */
+    void expire(boost::chrono::steady_clock::time_point now);
+    /// Ferme la connexion en attente, par exemple au retrait de la carte. Si la connexion est occupée,
+    /// avance son délai pour que `expire` la ferme dès que possible.
+    void drop();
+public:// Transactions
+    /** Acquiert la transaction sur la carte pour le service spécifié. Le propriétaire peut
+        l'acquérir plusieurs fois, elle sera libérée après autant d'appels à `endTransaction`.
+    */
+    PCSC::Status beginTransaction(HSERVICE hService);
+    PCSC::Status endTransaction(HSERVICE hService);
+public:// Accès à la carte
+    /// Obtient l'état de la carte et le protocole actif.
+    PCSC::Status status(PCSC::MediaStatus& state, PCSC::ProtocolTypes& protocol) const;
+    /// Lit l'attribut spécifié du lecteur ou de la carte, voir `SCardGetAttrib`.
+    PCSC::Status getAttrib(DWORD attr, BYTE* buffer, DWORD* len) const;
+    /** Transmet une commande à la carte au nom du service spécifié.
+    @return `SCARD_E_SHARING_VIOLATION`, si la transaction appartient à un autre service.
+    */
+    PCSC::Status transmit(HSERVICE hService, const SCARD_IO_REQUEST* ioRq,
+                          const BYTE* input, DWORD inputSize,
+                          BYTE* output, DWORD* outputSize) const;
+    /** Réinitialise la carte au nom du service spécifié et relit son ATR.
+    @par
+        La réinitialisation est omise, et l'ATR connu est gardé, si la puce est déjà dans l'état demandé
+        (`PowerCold` pour `SCARD_UNPOWER_CARD`, `PowerWarm` pour `SCARD_RESET_CARD`), que la connexion est
+        restée exclusive depuis (les commandes des autres processus ne sont pas visibles), qu'aucune commande
+        ne lui a été envoyée et que PC/SC confirme que la carte n'a pas été réinitialisée entre-temps.
+        C'est le cas de la réinitialisation à froid demandée par les noyaux EMV juste après l'insertion.
+    @param initialization
+        Action sur la carte, `SCARD_LEAVE_CARD`, `SCARD_RESET_CARD` ou `SCARD_UNPOWER_CARD`.
+    */
+    PCSC::Status reconnect(HSERVICE hService, DWORD initialization);
+    /// Protocole actif de la carte.
+    PCSC::ProtocolTypes protocol() const;
+    /// État d'alimentation de la puce.
+    ChipPower power() const;
+    /// ATR de la carte, vide si la connexion n'est pas ouverte.
+    std::vector<BYTE> atr() const;
+    /** Éléments d'étiquettes spécifiées, cherchés dans les réponses de la puce gardées depuis sa dernière
+        réinitialisation, de la plus récente à la plus ancienne, au format de `Tlv::appendField`.
+        Les étiquettes introuvables sont omises.
+    */
+    std::string chipFields(const std::vector<DWORD>& tags) const;
+    /** Valeur de l'étiquette spécifiée dans les réponses de la puce gardées, voir `chipFields`.
+    @return `false` si l'étiquette est introuvable.
+    */
+    bool chipTag(DWORD tag, std::vector<BYTE>& value) const;
+    /// Piste 2 lue dans la puce pendant la connexion actuelle, vide si elle n'a pas encore été lue.
+    std::string track2() const;
+    void track2(const std::string& value);
+    /** Attributs connus du lecteur et de la carte, au format de `lpszExtra` : paires `clé=valeur`
+        terminées chacune par zéro, la liste se termine par un zéro supplémentaire. Les attributs
+        sont lus à la connexion, cette fonction ne fait que copier le tampon préformaté.
+    @param more
+        Paires propres au service, au même format mais sans le zéro final, ajoutées après les attributs.
+    @return
+        Chaîne allouée par le gestionnaire XFS, `NULL` si aucun attribut n'est encore connu.
+    */
+    LPSTR extra(const std::string& more = std::string()) const;
+public:// Fonctions du lecteur (PC/SC partie 10)
+    /** Fonctions annoncées par le lecteur, au format de `lpszExtra` sans le zéro final : paires
+        `nom=code` (code de contrôle en hexadécimal), par exemple `FEATURE_VERIFY_PIN_DIRECT=42330006`.
+    @par
+        Le lecteur n'est interrogé qu'une fois (voir `readFeatures`), les appels suivants lisent le cache.
+    */
+    PCSC::Status featureFields(std::string& out);
+    /** Envoie au lecteur, au nom du service spécifié, un code de contrôle par `SCardControl`. Seuls les
+        codes des fonctions annoncées par le lecteur et les codes des fabricants (fonctions 2048 à 4095
+        de `SCARD_CTL_CODE`, commandes d'échappement) sont transmis. L'appel n'est pas surveillé par
+        `Watchdog` : la saisie du code PIN attend le porteur de la carte. Pendant ce temps seul `ioMutex`
+        est gardé, le thread de surveillance et les lectures de l'état du lecteur ne sont pas bloqués.
+    @return
+        `SCARD_E_UNSUPPORTED_FEATURE`, si le lecteur n'annonce aucune fonction avec ce code et que ce
+        n'est pas un code de fabricant ;
+        `SCARD_E_SHARING_VIOLATION`, si la transaction appartient à un autre service.
+    */
+    PCSC::Status control(HSERVICE hService, DWORD controlCode,
+                         const BYTE* input, DWORD inputSize,
+                         BYTE* output, DWORD* outputSize);
+    /// Oublie les fonctions et les attributs du lecteur débranché : un autre appareil peut revenir sous le même nom.
+    void unplugged();
+private:
+    /** Ouvre la connexion à la carte. Si le service PC/SC a été redémarré, rétablit le contexte
+        et réessaie une fois. Appelé sous `ioMutex`.
+    @param share
+        Mode de partage, `SCARD_SHARE_SHARED` ou `SCARD_SHARE_EXCLUSIVE`.
+    */
+    PCSC::Status connect(HSERVICE hService, DWORD share);
+    /** Change le mode de partage de la connexion ouverte par `SCardReconnect`, sans réinitialiser
+        la carte. Appelé sous `ioMutex`.
+    */
+    PCSC::Status share(HSERVICE hService, DWORD mode);
+    /// Contexte que la surveillance des appels doit interrompre, 0 si l'interruption n'est pas demandée.
+    inline SCARDCONTEXT cancelContext() const { return mLimits.cancel ? mContext.context() : 0; }
+    /// Vérifie que le service peut accéder à la carte. Appelé sous `ioMutex`.
+    PCSC::Status checkAccess(HSERVICE hService) const;
+    /// Relit l'ATR de la carte. Appelé sous `ioMutex`.
+    void readAtr();
+    /** Relit les attributs de la session avec la carte et, à la première connexion, ceux du lecteur,
+        puis reconstruit `mExtra`. Appelé sous `ioMutex`, après `readAtr`.
+    */
+    void readAttributes();
+    /// Ajoute à `out` la paire `key=valeur` de l'attribut textuel, s'il est fourni par le lecteur.
+    void appendString(std::string& out, const char* key, DWORD attr) const;
+    /** Ajoute à `out` la paire `key=valeur` de l'attribut numérique, s'il est fourni par le lecteur.
+    @return `true` si l'attribut a été lu, sa valeur est alors dans `value`.
+    */
+    bool appendNumber(std::string& out, const char* key, DWORD attr, DWORD& value) const;
+    /** Libère la transaction PC/SC ou fait repasser la connexion exclusive en mode partagé. Appelé sous `ioMutex`.
+    @param closing
+        `true` si la connexion va être fermée : le mode exclusif n'a alors pas besoin d'être quitté.
+    */
+    void releaseTransaction(bool closing);
+    /** Demande les fonctions du lecteur par `CM_IOCTL_GET_FEATURE_REQUEST`, une seule fois. Sans connexion
+        à une carte, le lecteur est joint en mode direct le temps de la requête. Appelé sous `ioMutex`.
+    */
+    PCSC::Status readFeatures();
+    /// @return `true` si aucun service n'est attaché mais que la connexion est ouverte. Appelé sous l'un des verrous.
+    inline bool isParked() const { return mRefs == 0 && hCard != 0; }
+    /** Vérifie que la connexion en attente peut être reprise : la carte n'a été ni retirée
+        ni réinitialisée et son ATR est celui attendu. Appelé sous `ioMutex`.
+    */
+    bool canAdopt(const std::vector<BYTE>& atr) const;
+    /// Ferme la connexion sans toucher à la carte. Appelé sous `ioMutex`.
+    PCSC::Status disconnect();
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Reader_H
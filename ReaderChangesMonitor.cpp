@@ -1,10 +1,13 @@
 #include "ReaderChangesMonitor.h"
 
 #include "Manager.h"
+#include "Tracer.h"
 
 #include "PCSC/ReaderState.h"
 #include "PCSC/Status.h"
 
+#include "Utils/Probes.h"
+
 #include "XFS/Logger.h"
 
 ReaderChangesMonitor::ReaderChangesMonitor(Manager& manager)
@@ -60,15 +63,19 @@ std::vector<const char*> getReaderNames(const std::vector<char>& readerNames) {
 DWORD ReaderChangesMonitor::getReadersAndWaitChanges(DWORD readersState) {
     //XFS::Logger() << "ReaderChangesMonitor::getReadersAndWaitChanges - Getting readers list";
     DWORD readersCount = 0;
-    // Détermine les lecteurs disponibles : d'abord la quantité, puis les lecteurs eux-mêmes.
-    PCSC::Status st = SCardListReaders(manager.context(), NULL, NULL, &readersCount);
-    //XFS::Logger() << "ReaderChangesMonitor::getReadersAndWaitChanges - SCardListReaders[count] result: " << st;
+    std::vector<char> readerNames;
+    {
+        Tracer::Span span("pcsc", "SCardListReaders");
+        // Détermine les lecteurs disponibles : d'abord la quantité, puis les lecteurs eux-mêmes.
+        PCSC::Status st = PCSC_PROBED_CALL("SCardListReaders", NULL, SCardListReaders(context.context(), NULL, NULL, &readersCount));
+        //XFS::Logger() << "ReaderChangesMonitor::getReadersAndWaitChanges - SCardListReaders[count] result: " << st;
 
-    // Obtient les noms des lecteurs disponibles.
-    std::vector<char> readerNames(readersCount);
-    if (readersCount != 0) {
-        st = SCardListReaders(manager.context(), NULL, &readerNames[0], &readersCount);
-        //XFS::Logger() << "ReaderChangesMonitor::getReadersAndWaitChanges - SCardListReaders[data] result: " << st;
+        // Obtient les noms des lecteurs disponibles.
+        readerNames.resize(readersCount);
+        if (readersCount != 0) {
+            st = PCSC_PROBED_CALL("SCardListReaders", NULL, SCardListReaders(context.context(), NULL, &readerNames[0], &readersCount));
+            //XFS::Logger() << "ReaderChangesMonitor::getReadersAndWaitChanges - SCardListReaders[data] result: " << st;
+        }
     }
 
     std::vector<const char*> names = getReaderNames(readerNames);
@@ -82,9 +89,12 @@ DWORD ReaderChangesMonitor::getReadersAndWaitChanges(DWORD readersState) {
     readers[0].szReader = "\\\\?PnP?\\Notification";
     readers[0].dwCurrentState = readersState;
 
-    // Remplit les structures pour attendre les événements des lecteurs trouvés.
+    // Remplit les structures pour attendre les événements des lecteurs trouvés. Les noms sont
+    // internés une seule fois par liste de lecteurs, l'identifiant obtenu voyage ensuite avec
+    // chaque événement dans pvUserData.
     for (std::size_t i = 0; i < names.size(); ++i) {
         readers[1 + i].szReader = names[i];
+        readers[1 + i].pvUserData = (void*)manager.readerNames().intern(names[i]);
     }
 
     // Attend les événements des lecteurs.
@@ -99,14 +109,32 @@ DWORD ReaderChangesMonitor::getReadersAndWaitChanges(DWORD readersState) {
 }
 bool ReaderChangesMonitor::waitChanges(std::vector<SCARD_READERSTATE>& readers) {
     //XFS::Logger() << "ReaderChangesMonitor::waitChanges - Waiting for reader changes";
-    PCSC::Status st = SCardGetStatusChange(manager.context(), manager.getTimeout(), &readers[0], (DWORD)readers.size());
+    const DWORD timeout = manager.getTimeout();
+    PCSC::Status st = SCARD_S_SUCCESS;
+    {
+        // L'attente apparaît dans la trace : la fin de l'intervalle est le réveil du thread.
+        Tracer::Span span("pcsc", "SCardGetStatusChange");
+        st = PCSC_PROBED_CALL("SCardGetStatusChange", NULL, SCardGetStatusChange(context.context(), timeout, &readers[0], (DWORD)readers.size()));
+    }
     //XFS::Logger() << "ReaderChangesMonitor::waitChanges - SCardGetStatusChange result: " << st;
 
+    if (PCSC::Context::isLost(st)) {
+        // Le service PC/SC a été redémarré : la liste des lecteurs est relue avec un nouveau contexte.
+        // S'il ne répond toujours pas, la prochaine tentative est différée pour ne pas boucler.
+        if (!context.reestablish()) {
+            boost::this_thread::sleep_for(boost::chrono::seconds(1));
+        }
+        return true;
+    }
     if (st.value() == SCARD_E_TIMEOUT) {
         //XFS::Logger() << "ReaderChangesMonitor::waitChanges - Processing timeouts";
         manager.processTimeouts(bc::steady_clock::now());
     }
 
+    // Délai entre le réveil du thread et la fin de la distribution des changements.
+    bc::steady_clock::time_point wokenAt = bc::steady_clock::now();
+    Tracer::Span span("provider", "ReaderChangesMonitor::dispatch");
+    bool dispatched = false;
     bool readersChanged = false;
     bool first = true;
     for (std::vector<SCARD_READERSTATE>::iterator it = readers.begin(); it != readers.end(); ++it) {
@@ -123,15 +151,20 @@ bool ReaderChangesMonitor::waitChanges(std::vector<SCARD_READERSTATE>& readers)
             }
             //XFS::Logger() << "ReaderChangesMonitor::waitChanges - Notifying changes for reader [" << it->szReader << "]";
             manager.notifyChanges(*it, first);
+            dispatched = true;
         }
         it->dwCurrentState = it->dwEventState;
         first = false;
     }
+    if (dispatched) {
+        manager.metrics().record("dispatch_us", Metrics::Labels(), wokenAt);
+    }
     //XFS::Logger() << "ReaderChangesMonitor::waitChanges - Changes processed, readersChanged=" << readersChanged;
     return readersChanged;
 }
 void ReaderChangesMonitor::cancel(const char* reason) const {
     //XFS::Logger() << "ReaderChangesMonitor::cancel - Cancelling wait operation, reason: " << reason;
-    PCSC::Status st = SCardCancel(manager.context());
+    Tracer::Span span("pcsc", "SCardCancel");
+    PCSC::Status st = PCSC_PROBED_CALL("SCardCancel", NULL, SCardCancel(context.context()));
     //XFS::Logger() << "ReaderChangesMonitor::cancel - SCardCancel result: " << st;
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include "ReaderMonitor.h"
+
+#include "PCSC/Context.h"
+
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
@@ -12,11 +16,14 @@
 #include <winscard.h>
 
 class Manager;
-class ReaderChangesMonitor {
+class ReaderChangesMonitor : public ReaderMonitor {
     /// Объект для общения с подсистемой PC/SC и для получения величины таймаута
     /// ожидания изменений в считывателях, для возможности корреткно обрабатывать
     /// таймауты задач на чтение карточки.
     Manager& manager;
+    /// Собственный контекст PC/SC потока ожидания. `SCardCancel` на нем прерывает только
+    /// ожидание изменений и не затрагивает обмен с карточками, идущий в других потоках.
+    PCSC::Context context;
     /// Поток для выполнения ожидания изменений.
     boost::shared_ptr<boost::thread> waitChangesThread;
     /// Флаг, выставляемый основным потоком, когда возникнет необходимость остановить
@@ -31,16 +38,16 @@ public:
     */
     ReaderChangesMonitor(Manager& manager);
     /// Запрашивает останов потока отслеживания изменений и ждет его завершения.
-    ~ReaderChangesMonitor();
+    virtual ~ReaderChangesMonitor();
 
     /** Прерывает ожидание изменений.
 
     @param reason
-        Причина, по которой было прервано ожидание. Это может быть отмена задачи,
-        добавление новой задачи (нужно пересчитать таймаут) или сервиса (ему нужно
-        доставить сообщения о статусе считывателей).
+        Причина, по которой было прервано ожидание. Это может быть отмена задачи
+        или добавление новой задачи (нужно пересчитать таймаут). Новые сервисы
+        получают состояние считывателей от менеджера и ожидание не прерывают.
     */
-    void cancel(const char* reason) const;
+    virtual void cancel(const char* reason) const;
 private:// Опрос изменений
     /** Функция для запуска в другом потоке для ожидания изменений в считывателях.
         Блокирует выполнение потока, пока не будет обнаружено изменение. Данная функция
@@ -0,0 +1,23 @@
+#ifndef PCSC_CENXFS_BRIDGE_ReaderMonitor_H
+#define PCSC_CENXFS_BRIDGE_ReaderMonitor_H
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+/** Thread de surveillance des lecteurs du gestionnaire. Il transmet les changements des lecteurs
+    au gestionnaire et termine les tâches à leur timeout. La surveillance est faite par le processus
+    lui-même (`ReaderChangesMonitor`) ou par le courtier PC/SC de l'hôte (`BrokerMonitor`).
+*/
+class ReaderMonitor : private boost::noncopyable {
+public:
+    /// Le destructeur des classes dérivées arrête le thread et attend sa fin.
+    virtual ~ReaderMonitor() {}
+    /** Interrompt l'attente des changements, pour qu'elle reprenne avec un nouveau délai.
+    @param reason
+        Raison de l'interruption, pour la trace.
+    */
+    virtual void cancel(const char* reason) const = 0;
+};
+
+#endif // PCSC_CENXFS_BRIDGE_ReaderMonitor_H
@@ -0,0 +1,36 @@
+#include "ReaderNames.h"
+
+#include <cassert>
+
+#include <boost/thread/lock_guard.hpp>
+
+ReaderNames::ReaderNames() : names(1) {}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ReaderId ReaderNames::intern(const char* name) {
+    if (name == NULL || *name == '\0') {
+        return none;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    // L'insertion ne réussit que si le nom est nouveau, et dans ce cas il reçoit l'identifiant suivant.
+    std::pair<IdMap::iterator, bool> r = ids.insert(std::make_pair(std::string(name), names.size()));
+    if (r.second) {
+        names.push_back(r.first->first);
+    }
+    return r.first->second;
+}
+ReaderId ReaderNames::find(const char* name) const {
+    if (name == NULL || *name == '\0') {
+        return none;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    IdMap::const_iterator it = ids.find(name);
+    return it != ids.end() ? it->second : none;
+}
+std::string ReaderNames::name(ReaderId id) const {
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    assert(id < names.size() && "Unknown reader identifier");
+    return names[id];
+}
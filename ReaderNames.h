@@ -0,0 +1,56 @@
+#ifndef PCSC_CENXFS_BRIDGE_ReaderNames_H
+#define PCSC_CENXFS_BRIDGE_ReaderNames_H
+
+#pragma once
+
+// Pour std::size_t
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+/// Identifiant compact d'un lecteur. Les identifiants sont attribués à partir de 1,
+/// la valeur `ReaderNames::none` signifie "aucun lecteur".
+typedef std::size_t ReaderId;
+
+/** Table d'internement des noms de lecteurs PC/SC. Chaque nom reçoit un petit identifiant entier
+    lors de sa première apparition, ce qui permet de comparer les lecteurs et d'indexer les services
+    et les tâches sans comparer de chaînes. Les identifiants ne sont jamais libérés : le nombre de
+    lecteurs différents vus par un processus est très faible.
+@par
+    La table est utilisée à la fois par le thread de surveillance des lecteurs et par les threads
+    appelant les fonctions SPI, elle est donc protégée par un mutex.
+*/
+class ReaderNames {
+    typedef std::map<std::string, ReaderId> IdMap;
+public:
+    /// Identifiant signifiant l'absence de lecteur (service non lié à un lecteur).
+    static const ReaderId none = 0;
+private:
+    /// Correspondance nom -> identifiant.
+    IdMap ids;
+    /// Correspondance identifiant -> nom. L'élément d'indice 0 correspond à `none`.
+    std::vector<std::string> names;
+    mutable boost::mutex mutex;
+public:
+    ReaderNames();
+public:
+    /** Retourne l'identifiant du lecteur portant le nom spécifié, en l'attribuant si
+        le nom est rencontré pour la première fois.
+    @param name
+        Nom du lecteur. Un nom vide ou `NULL` retourne `none`.
+    */
+    ReaderId intern(const char* name);
+    /// @copydoc intern(const char*)
+    inline ReaderId intern(const std::string& name) { return intern(name.c_str()); }
+    /** Retourne l'identifiant du lecteur portant le nom spécifié, sans l'attribuer.
+    @return `none` si ce nom n'a jamais été interné.
+    */
+    ReaderId find(const char* name) const;
+    /// Retourne le nom du lecteur correspondant à l'identifiant, ou une chaîne vide pour `none`.
+    std::string name(ReaderId id) const;
+};
+
+#endif // PCSC_CENXFS_BRIDGE_ReaderNames_H
@@ -0,0 +1,196 @@
+#include "RegistryConfig.h"
+
+#include "XFS/Logger.h"
+
+#include <string>
+#include <vector>
+// Pour CreateEvent, WaitForSingleObject et GetTickCount
+#include <windows.h>
+// Pour RegNotifyChangeKeyValue
+#include <winreg.h>
+// API XFS pour les fonctions d'accès au registre.
+#include <xfsconf.h>
+
+#pragma comment(lib, "advapi32.lib")
+
+/// Classe pour fermer automatiquement les clés de registre ouvertes lorsqu'elles ne sont plus nécessaires.
+class RegKey {
+    HKEY hKey;
+public:
+    inline RegKey(HKEY root, const char* name) {
+        HRESULT r = WFMOpenKey(root, (LPSTR)name, &hKey);
+
+        XFS::Logger() << "RegKey::RegKey(root=" << root << ", name=" << name << ", hKey=&" << hKey << ") = "  << r;
+    }
+    inline ~RegKey() {
+        HRESULT r = WFMCloseKey(hKey);
+
+        XFS::Logger() << "WFMCloseKey(hKey=" << hKey << ") = " << r;
+    }
+
+    inline RegKey child(const char* name) const {
+        return RegKey(hKey, name);
+    }
+    /** Obtient la valeur de la clé de registre avec le nom spécifié.
+    @param name
+        Nom de la valeur dans la clé de registre à obtenir. La valeur par défaut (`NULL`)
+        signifie que la valeur par défaut de la clé doit être obtenue.
+
+    @return
+        Chaîne contenant la valeur de la clé. Si la valeur n'existe pas, retourne une chaîne vide.
+    */
+    inline std::string value(const char* name = NULL) const {
+        // Détermine la taille de la valeur de la clé.
+        DWORD dwSize = 0;
+        HRESULT r = WFMQueryValue(hKey, (LPSTR)name, NULL, &dwSize);
+
+        {XFS::Logger() << "RegKey::value[size](name=" << name << ", size=&" << dwSize << ") = " << r;}
+        // Utilise un vecteur car il garantit la continuité de la mémoire pour les données,
+        // ce qui n'est pas le cas avec string.
+        // dwSize contient la longueur de la chaîne sans le NULL final, mais il est écrit dans la valeur de sortie.
+        std::vector<char> value(dwSize+1);
+        if (dwSize > 0) {
+            dwSize = value.capacity();
+            r = WFMQueryValue(hKey, (LPSTR)name, &value[0], &dwSize);
+            {XFS::Logger() << "RegKey::value[value](name=" << name << ", value=&" << &value[0] << ", size=&" << dwSize << ") = " << r;}
+        }
+        std::string result = std::string(value.begin(), value.end()-1);
+
+        XFS::Logger() << "RegKey::value(name=" << name << ") = " << result;
+        return result;
+    }
+    inline DWORD dwValue(const char* name) const {
+        // Détermine la taille de la valeur de la clé.
+        DWORD result = 0;
+        DWORD dwSize = sizeof(DWORD);
+        HRESULT r = WFMQueryValue(hKey, (LPSTR)name, (LPSTR)&result, &dwSize);
+
+        XFS::Logger() << "RegKey::value(name=" << name << ") = " << result;
+        return result;
+    }
+    /// Fonction de débogage pour afficher dans la trace toutes les clés enfants.
+    void keys() const {
+        {XFS::Logger() << "keys";}
+        std::vector<char> keyName(256);
+        for (DWORD i = 0; ; ++i) {
+            DWORD size = keyName.capacity();
+            HRESULT r = WFMEnumKey(hKey, i, &keyName[0], &size, NULL);
+            if (r == WFS_ERR_CFG_NO_MORE_ITEMS) {
+                break;
+            }
+            keyName[size] = '\0';
+
+            XFS::Logger() << &keyName[0];
+        }
+    }
+    /// Fonction de débogage pour afficher dans la trace toutes les valeurs enfants de la clé.
+    /// Une valeur de clé est une paire (nom=valeur).
+    void values() const {
+        {XFS::Logger() << "values";}
+        // Malheureusement, il est impossible de connaître les longueurs spécifiques à l'avance.
+        std::vector<char> name(256);
+        std::vector<char> value(256);
+        for (DWORD i = 0; ; ++i) {
+            DWORD szName = name.capacity();
+            DWORD szValue = value.capacity();
+            HRESULT r = WFMEnumValue(hKey, i, &name[0], &szName, &value[0], &szValue);
+            if (r == WFS_ERR_CFG_NO_MORE_ITEMS) {
+                break;
+            }
+            name[szName] = '\0';
+            value[szValue] = '\0';
+
+            XFS::Logger()
+                << i << ": " << '('<<szName<<','<<szValue<<')' << std::string(name.begin(), name.begin()+szName) << "="
+                << std::string(value.begin(), value.begin()+szValue);
+        }
+    }
+};
+
+/// Délais minimal et maximal entre deux tentatives d'ouvrir la clé surveillée, en ms.
+static const DWORD minRetryDelay = 1000;
+static const DWORD maxRetryDelay = 60000;
+
+RegistryConfig::RegistryConfig()
+    : hWatched(NULL)
+    , hChanged(CreateEvent(NULL, FALSE, FALSE, NULL))
+    , retryDelay(0)
+    , failedAt(0)
+{}
+RegistryConfig::~RegistryConfig() {
+    if (hWatched != NULL) {
+        RegCloseKey(hWatched);
+    }
+    CloseHandle(hChanged);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+std::string RegistryConfig::value(const std::string& key, const char* name) const {
+    // Chez Kalignite, le fournisseur n'apparaît pas sous cette racine s'il est dans
+    // HKEY_LOCAL_MACHINE\SOFTWARE\XFS\SERVICE_PROVIDERS\
+    // HKEY root = WFS_CFG_HKEY_XFS_ROOT;
+    HKEY root = WFS_CFG_USER_DEFAULT_XFS_ROOT;// HKEY_USERS\.DEFAULT\XFS
+    return RegKey(root, key.c_str()).value(name);
+}
+DWORD RegistryConfig::dwValue(const std::string& key, const char* name) const {
+    HKEY root = WFS_CFG_USER_DEFAULT_XFS_ROOT;// HKEY_USERS\.DEFAULT\XFS
+    return RegKey(root, key.c_str()).dwValue(name);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+bool RegistryConfig::waitChange(DWORD timeout) {
+    if (hWatched == NULL && !watch()) {
+        // Sans surveillance, les paramètres restent ceux lus à l'ouverture des services.
+        Sleep(timeout);
+        return false;
+    }
+    if (WaitForSingleObject(hChanged, timeout) != WAIT_OBJECT_0) {
+        return false;
+    }
+    // La notification est réarmée avant la relecture, pour ne perdre aucune modification faite pendant celle-ci.
+    if (!arm()) {
+        unwatch();
+    }
+    return true;
+}
+bool RegistryConfig::watch() {
+    if (retryDelay != 0 && GetTickCount() - failedAt < retryDelay) {
+        return false;
+    }
+    // La branche lue à travers WFS_CFG_USER_DEFAULT_XFS_ROOT.
+    LONG r = RegOpenKeyEx(HKEY_USERS, ".DEFAULT\\XFS", 0, KEY_NOTIFY, &hWatched);
+    if (r != ERROR_SUCCESS) {
+        // Seul le premier échec est tracé, les suivants ne font qu'espacer les tentatives.
+        if (retryDelay == 0) {
+            XFS::Logger() << "RegistryConfig: RegOpenKeyEx(HKEY_USERS\\.DEFAULT\\XFS) = " << r << ", retrying with backoff";
+        }
+        hWatched = NULL;
+        unwatch();
+        return false;
+    }
+    if (!arm()) {
+        unwatch();
+        return false;
+    }
+    if (retryDelay != 0) {
+        XFS::Logger() << "RegistryConfig: watching HKEY_USERS\\.DEFAULT\\XFS again";
+    }
+    retryDelay = 0;
+    return true;
+}
+void RegistryConfig::unwatch() {
+    if (hWatched != NULL) {
+        RegCloseKey(hWatched);
+        hWatched = NULL;
+    }
+    failedAt = GetTickCount();
+    retryDelay = retryDelay == 0 ? minRetryDelay : (retryDelay >= maxRetryDelay / 2 ? maxRetryDelay : 2 * retryDelay);
+}
+bool RegistryConfig::arm() {
+    LONG r = RegNotifyChangeKeyValue(hWatched, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, hChanged, TRUE);
+    if (r != ERROR_SUCCESS) {
+        if (retryDelay == 0) {
+            XFS::Logger() << "RegistryConfig: RegNotifyChangeKeyValue = " << r << ", retrying with backoff";
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef PCSC_CENXFS_BRIDGE_RegistryConfig_H
+#define PCSC_CENXFS_BRIDGE_RegistryConfig_H
+
+#pragma once
+
+#include "ConfigSource.h"
+
+// Pour HANDLE et HKEY
+#include <windef.h>
+
+/** Configuration lue dans le registre à travers l'API de configuration XFS, sous la racine
+    `WFS_CFG_USER_DEFAULT_XFS_ROOT` (`HKEY_USERS\.DEFAULT\XFS`). Les valeurs ne sont pas conservées :
+    chaque lecture interroge le registre.
+*/
+class RegistryConfig : public ConfigSource {
+    /// Clé surveillée, ouverte lors de la première attente de modification.
+    HKEY hWatched;
+    /// Événement signalé par le registre lors d'une modification de la branche surveillée.
+    HANDLE hChanged;
+    /// Délai avant la prochaine tentative d'ouvrir la clé surveillée, en ms, doublé à chaque échec.
+    /// `0` tant qu'aucune tentative n'a échoué.
+    DWORD retryDelay;
+    /// Moment (`GetTickCount`) de la dernière tentative échouée.
+    DWORD failedAt;
+public:
+    RegistryConfig();
+    virtual ~RegistryConfig();
+
+    virtual std::string value(const std::string& key, const char* name) const;
+    virtual DWORD dwValue(const std::string& key, const char* name) const;
+    virtual void reload() {}
+    virtual bool waitChange(DWORD timeout);
+private:
+    /// Arme la notification de modification du registre, qui ne se déclenche qu'une fois.
+    bool arm();
+    /// Ouvre la clé surveillée et arme la notification, au plus une fois par `retryDelay` après un échec.
+    bool watch();
+    /// Ferme la clé surveillée après un échec et espace la tentative suivante.
+    void unwatch();
+};
+
+#endif // PCSC_CENXFS_BRIDGE_RegistryConfig_H
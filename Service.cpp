@@ -1,6 +1,9 @@
 #include "Service.h"
 
 #include "Manager.h"
+#include "Reader.h"
+#include "Tlv.h"
+#include "Tracer.h"
 
 #include "PCSC/Events.h"
 #include "PCSC/MediaStatus.h"
@@ -16,7 +19,10 @@
 #include <sstream>
 #include <string>
 // Для работы с текущим временем, для получения времени дедлайна.
+#include <boost/bind/bind.hpp>
 #include <boost/chrono/chrono.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/lock_guard.hpp>
 
 class Hex {
     const char* mBegin;
@@ -40,109 +46,214 @@ class CardReadTask : public Task {
 public:
     CardReadTask(bc::steady_clock::time_point deadline, Service& service,
                 HWND hWnd, REQUESTID ReqID, XFS::ReadFlags flags
-    ) : Task(deadline, service, hWnd, ReqID), mFlags(flags) {
+    ) : Task(deadline, service.manager(), service.handle(), service.bindedReaderId(), hWnd, ReqID), mFlags(flags) {
         XFS::Logger() << "Service " << service.handle() << ": Listen reader(s), read flags: " << flags;
     }
-    virtual bool match(const SCARD_READERSTATE& state, bool deviceChange) const {
-        // Если изменения нас не интересуют, выходим.
-        if (!mService.match(state, deviceChange)) {
+    virtual bool match(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange) const {
+        // Если сервис уже закрыт или изменения нас не интересуют, выходим.
+        Manager::ServiceRef service(manager, hService);
+        if (!service.isValid() || !service->match(reader, deviceChange)) {
             return false;
         }
         DWORD added = (state.dwCurrentState ^ state.dwEventState) & state.dwEventState;
-        // Если в указанном бите есть изменения и он был установлен, генерируем событие вставки карты.
-        if (added & SCARD_STATE_PRESENT) {
-            {XFS::Logger() << "Service " << mService.handle() << ": Card inserted to reader '" << state.szReader << "', read flags: " << mFlags; }
+        // Если в указанном бите есть изменения и он был установлен, задача выполнена.
+        return (added & SCARD_STATE_PRESENT) != 0;
+    }
+    virtual void complete(const SCARD_READERSTATE& state) const {
+        Tracer::Span span("provider", "CardReadTask::complete", serviceHandle(), ReqID);
+        // Задача завершается вне блокировки контейнера задач, и сервис может быть закрыт в этот момент:
+        // ссылка не дает его удалить, а если он уже закрыт, задача отменяется, как и остальные его задачи.
+        Manager::ServiceRef service(manager, hService);
+        if (!service.isValid()) {
+            {XFS::Logger() << "Service " << hService << ": Closed before card read"; }
+            cancel();
+            return;
+        }
+        {XFS::Logger() << "Service " << hService << ": Card inserted to reader '" << state.szReader << "', read flags: " << mFlags; }
+        // Сервисы уведомляются раньше задач, поэтому момент вставки карточки уже известен.
+        bc::steady_clock::time_point seenAt = service->cardSeenAt();
+        // Буфер состояния принадлежит потоку мониторинга, ATR копируется.
+        const std::vector<BYTE> atr(state.rgbAtr, state.rgbAtr + state.cbAtr);
 
-            WFSIDCCARDDATA** result = mService.wrap(translate(state), mFlags);
-            // Уведомляем поставщика задачи, что она выполнена.
-            XFS::Result(ReqID, serviceHandle(), WFS_SUCCESS).attach(result).send(hWnd, WFS_EXECUTE_COMPLETE);
-            // Задача обработана, можно удалять из списка.
-            return true;
+        // Чтение UID, ATS и track2 из чипа требует соединения с карточкой, которое при ленивой политике
+        // еще не открыто, и обмена с ней, который может длиться секундами. Поэтому оно выполняется
+        // в отдельном потоке, чтобы не задерживать уведомления об остальных считывателях.
+        if ((mFlags.value() & (WFS_IDC_PCSC_UID | WFS_IDC_PCSC_ATS))
+         || ((mFlags.value() & WFS_IDC_TRACK2) && service->workarounds().track2.fromChip)) {
+            manager.worker().post(boost::bind(&CardReadTask::readCard, boost::ref(manager), serviceHandle(), hWnd, ReqID, mFlags, atr, seenAt));
+            return;
         }
-        return false;
+        finish(*service, NULL, hWnd, ReqID, mFlags, atr, seenAt);
     }
 private:
-    WFSIDCCARDDATA* translate(const SCARD_READERSTATE& state) const {
+    /// Соединяется с карточкой и завершает задачу, вызывается в потоке `Manager::worker`.
+    static void readCard(Manager& manager, HSERVICE hService, HWND hWnd, REQUESTID ReqID,
+                        XFS::ReadFlags flags, const std::vector<BYTE>& atr, bc::steady_clock::time_point seenAt
+    ) {
+        Tracer::Span span("provider", "CardReadTask::readCard", hService, ReqID);
+        Manager::ServiceRef service(manager, hService);
+        if (!service.isValid()) {
+            // Сервис закрыт, пока задача ждала своей очереди: как и остальные его задачи, она отменяется.
+            {XFS::Logger() << "Service " << hService << ": Closed before card read"; }
+            XFS::Result(ReqID, hService, WFS_ERR_CANCELED).attach((WFSIDCCARDDATA**)0).send(hWnd, WFS_EXECUTE_COMPLETE);
+            return;
+        }
+        Reader* reader = NULL;
+        service->connect(reader);
+        finish(*service, reader, hWnd, ReqID, flags, atr, seenAt);
+    }
+    static void finish(Service& service, Reader* reader, HWND hWnd, REQUESTID ReqID,
+                        XFS::ReadFlags flags, const std::vector<BYTE>& atr, bc::steady_clock::time_point seenAt
+    ) {
+        WFSIDCCARDDATA** result = service.wrap(reader, flags.value() & WFS_IDC_CHIP ? translate(service, atr) : NULL, flags);
+        // Уведомляем поставщика задачи, что она выполнена.
+        XFS::Result(ReqID, service.handle(), WFS_SUCCESS).attach(result).send(hWnd, WFS_EXECUTE_COMPLETE);
+        service.manager().metrics().record("insert_to_complete_us", Metrics::Labels(service.bindedReaderId(), service.serviceName()), seenAt);
+    }
+    static WFSIDCCARDDATA* translate(const Service& service, const std::vector<BYTE>& atr) {
         //TODO: Возможно, необходимо выделять память через WFSAllocateMore
         WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
         // data->lpbData содержит ATR (Answer To Reset), прочитанный с чипа
         data->wDataSource = WFS_IDC_CHIP;
         data->wStatus = WFS_IDC_DATAOK;
-        data->ulDataLength = state.cbAtr;
-        data->lpbData = XFS::allocArr<BYTE>(state.cbAtr);
-        std::memcpy(data->lpbData, state.rgbAtr, state.cbAtr);
-        {XFS::Logger() << "Service " << mService.handle() << ": ATR=" << Hex(data->lpbData, data->ulDataLength);}
+        data->ulDataLength = (ULONG)atr.size();
+        data->lpbData = XFS::allocArr<BYTE>(atr.size());
+        if (!atr.empty()) {
+            std::memcpy(data->lpbData, &atr[0], atr.size());
+        }
+        {XFS::Logger() << "Service " << service.handle() << ": ATR=" << Hex(data->lpbData, data->ulDataLength);}
         return data;
     }
 };
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Service::Service(Manager& pcsc, HSERVICE hService, const Settings& settings)
+Service::Service(Manager& pcsc, HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel)
     : pcsc(pcsc)
     , hService(hService)
-    , hCard(0)
-    , mActiveProtocol(0)
-    , mBindedReaderName(settings.readerName)
+    , mServiceName(pcsc.metrics().intern(serviceName))
+    , mReader(NULL)
+    // Привязка из настроек фиксируется при открытии сервиса, изменение ReaderName
+    // действует на вновь открываемые сервисы.
+    , mBindedReader(pcsc.readerNames().intern(settings->get()->readerName))
+    , mSettingsReader(mBindedReader.load())
     , mSettings(settings)
-    , mInited(false)
+    , mTraceLevel(traceLevel)
+    , mCardPresent(false)
 {
 }
 Service::~Service() {
-    if (hCard != 0) {
-        close();
+    // Сервис к этому моменту уже исключен из реестра, поэтому только закрываем
+    // соединение, не трогая привязку. Обычно оно уже закрыто в ServiceContainer::remove,
+    // и здесь закрывается только при выгрузке библиотеки, поэтому без удержания.
+    if (mReader != NULL) {
+        disconnect(0);
     }
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-PCSC::Status Service::open(const char* readerName) {
-    assert(hCard == 0 && "Must open only one card at one service");
-    PCSC::Status st = SCardConnect(pcsc.context(), readerName,
-        mSettings.exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
-        // У нас нет предпочитаемого протокола, работаем с тем, что дают
-        SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
-        // Получаем хендл карты и выбранный протокол.
-        &hCard, (DWORD*)&mActiveProtocol
-    );
-    {
-        XFS::Logger()
-            << "SCardConnect(hContext=" << pcsc.context()
-            << ", szReader=" << readerName << ", ..., hCard=&" << hCard
-            << ", dwActiveProtocol=&" << mActiveProtocol << ") = " << st;
+PCSC::Status Service::connect() {
+    Reader* reader;
+    return connect(reader);
+}
+PCSC::Status Service::connect(Reader*& reader) {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    PCSC::Status st = connectLocked();
+    // Указатель остается действительным и после отключения сервиса: считыватели живут столько же, сколько менеджер.
+    reader = mReader;
+    return st;
+}
+PCSC::Status Service::connectLocked() {
+    Tracer::Span span("provider", "Service::connect", hService);
+    if (mReader != NULL) {
+        return SCARD_S_SUCCESS;
+    }
+    if (!mCardPresent) {
+        return SCARD_E_NO_SMARTCARD;
     }
+    // Соединение с карточкой принадлежит считывателю и открывается только первым сервисом,
+    // либо подхватывается у недавно закрытого сервиса, если карточка та же.
+    Reader& r = pcsc.reader(mBindedReader.load());
+    SettingsCache::Snapshot settings = this->settings();
+    PCSC::Status st = r.attach(hService, settings->exclusive, settings->watchdog, mCardAtr);
+    {XFS::Logger() << "Service " << handle() << " attach to reader '" << r.name() << "' = " << st; }
     if (st) {
-        // Если открытие совершилось корректно, то запоминаем имя текущего считывателя.
-        mBindedReaderName = readerName;
-        XFS::Logger() << "Service " << handle() << " binded to reader '" << mBindedReaderName << "'";
+        mReader = &r;
+        namespace bc = boost::chrono;
+        bc::milliseconds ready = bc::duration_cast<bc::milliseconds>(bc::steady_clock::now() - mCardSeenAt);
+        {XFS::Logger() << "Service " << handle() << ": card ready in " << ready.count() << " ms (connect policy: " << connectPolicyName(settings->connectPolicy) << ')'; }
+        pcsc.metrics().record("card_ready_us", Metrics::Labels(mBindedReader.load(), mServiceName), mCardSeenAt);
+    } else {
+        // Сохраняем то, что предшествовало ошибке, пока оно не вытеснено из буфера.
+        pcsc.recorder().failure("SCardConnect failed");
     }
     return st;
 }
+bc::steady_clock::time_point Service::cardSeenAt() const {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    return mCardSeenAt;
+}
+std::string Service::cardType() const {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    return mCardType;
+}
+/// Пара "CardType=тип\0" для lpszExtra, пустая строка, если тип карточки неизвестен.
+static std::string cardTypeExtra(const std::string& cardType) {
+    return cardType.empty() ? std::string() : "CardType=" + cardType + '\0';
+}
 PCSC::Status Service::close() {
-    assert(hCard != 0 && "Attempt disconnect from non-connected card");
-    // При закрытии соединения ничего не делаем с карточкой, оставляем ее в считывателе.
-    PCSC::Status st = SCardDisconnect(hCard, SCARD_LEAVE_CARD);
-    {XFS::Logger() << "SCardDisconnect(hCard=" << hCard << ", SCARD_LEAVE_CARD) = " << st; }
-    hCard = 0;
+    mCardPresent = false;
+    mCardAtr.clear();
+    mCardType.clear();
+    PCSC::Status st = SCARD_S_SUCCESS;
+    if (mReader != NULL) {
+        // Карточка извлечена, держать соединение с ней незачем.
+        st = disconnect(0);
+    }
     // Сбрасываем привязку на привязку из настроек. Таким образом, если в настойках
     // не указано конкретного считывателя, то прявязка будет пустая и сервис привяжется
     // к первому считывателю, в котором он обнаружит карточку. Если же конкретный считыватель
     // будет указан, то сервис будет игнорировать все события, кроме как от этого считывателя.
-    mBindedReaderName = mSettings.readerName;
+    bind(mSettingsReader);
     return st;
 }
+void Service::release() {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    if (mReader != NULL) {
+        disconnect(settings()->linger);
+    }
+}
+PCSC::Status Service::disconnect(DWORD linger) {
+    assert(mReader != NULL && "Attempt disconnect from non-connected card");
+    // Соединение закрывается, только если это был последний сервис, работающий с карточкой.
+    PCSC::Status st = mReader->detach(hService, linger);
+    mReader = NULL;
+    return st;
+}
+void Service::bind(ReaderId reader) {
+    // Индекс менеджера должен знать, о каких считывателях уведомлять данный сервис,
+    // поэтому привязка меняется им самим под его блокировкой.
+    pcsc.rebind(*this, reader);
+}
 
 PCSC::Status Service::lock() {
-    PCSC::Status st = SCardBeginTransaction(hCard);
-    {XFS::Logger() << "SCardBeginTransaction(hCard=" << hCard << ") = " << st; }
-
-    return st;
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (!st) {
+        return st;
+    }
+    return reader->beginTransaction(hService);
 }
 PCSC::Status Service::unlock() {
-    // Заканчиваем транзакцию, ничего не делаем с картой.
-    PCSC::Status st = SCardEndTransaction(hCard, SCARD_LEAVE_CARD);
-    {XFS::Logger() << "SCardEndTransaction(hCard=" << hCard << ", SCARD_LEAVE_CARD) = " << st; }
-
-    return st;
+    Reader* reader;
+    {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        reader = mReader;
+    }
+    if (reader == NULL) {
+        return SCARD_E_NO_SMARTCARD;
+    }
+    return reader->endTransaction(hService);
 }
-bool Service::match(const SCARD_READERSTATE& state, bool deviceChange) {
+bool Service::match(ReaderId reader, bool deviceChange) const {
     // Изменения в количестве считывателей нас не интересуют.
     if (deviceChange) {
         return false;
@@ -152,72 +263,142 @@ bool Service::match(const SCARD_READERSTATE& state, bool deviceChange) {
     // так и тот считыватель, в который первым была вставлена карточка. Поэтому,
     // если в данный момент мы уже работаем с какой-то карточкой, то игнорируем все
     // уведомления от остальных считывателей.
-    if (!mBindedReaderName.empty() && mBindedReaderName != state.szReader) {
+    const ReaderId binded = mBindedReader.load();
+    if (binded != ReaderNames::none && binded != reader) {
         return false;
     }
     return true;
 }
 
-void Service::notify(const SCARD_READERSTATE& state, bool deviceChange) {
+void Service::notify(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange) {
+    update(state, reader, deviceChange, false);
+}
+void Service::seed(const SCARD_READERSTATE& state, ReaderId reader) {
+    update(state, reader, false, true);
+}
+void Service::slowCall(const Watchdog::Report& report, const std::string& readerName) const {
+    EventNotifier::notify(WFS_USER_EVENT, PCSC::SlowCall(*this, readerName, report));
+}
+void Service::update(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange, bool atOpen) {
     // Если изменения нас не интересуют, выходим.
-    if (!match(state, deviceChange)) {
+    if (!match(reader, deviceChange)) {
         return;
     }
+    // Менеджер вычисляет изменения относительно последнего известного ему состояния считывателя.
+    // Новый сервис получает все известные состояния с предыдущим состоянием SCARD_STATE_UNAWARE,
+    // поэтому для него они выглядят как изменения.
     DWORD added = (state.dwCurrentState ^ state.dwEventState) & state.dwEventState;
-    // В том случае, если сервис только что был добавлен, то реально изменений в
-    // считывателях, скорее всего, не будет. Однако нам требуется как-то узнать текущее
-    // состояние считывателей и разослать заинтересованным уведомления, поэтому на первый
-    // раз мы исследуем новое состояние, а не изменения.
-    //
-    // Хотя стоит заметить, что с уведомлением подписчиков будут гонки. Прерывание ожидания
-    // изменений, которое приводи к вызову этой функции, выполняется в момент добавления
-    // сервиса, когда вызывающая сторона еще не могла зарегистрировать в нем каких-либо
-    // слушателей. Тем не менее, из-за многопоточной природы она может успеть это сделать,
-    // до того, как проснется поток ожидания изменений и сможет рапортовать о них через эту
-    // функцию.
-    DWORD forCheck = mInited ? added : state.dwEventState;
-    mInited = true;
     {XFS::Logger() << "Service::notify: reader=" << state.szReader << ", state=" << PCSC::ReaderState(state.dwEventState) << ", added=" << PCSC::ReaderState(added); }
-    /*if (forCheck & SCARD_STATE_) {
-        EventNotifier::notify(WFS_SYSTEM_EVENT, PCSC::DeviceDetected(*this, state));
+    /*if (added & SCARD_STATE_) {
+        EventNotifier::notify(WFS_SYSTEM_EVENT, PCSC::DeviceDetected(*this, pcsc.workstationName(), state));
     }*/
-    if (forCheck & SCARD_STATE_EMPTY) {
+    if (added & SCARD_STATE_EMPTY) {
         EventNotifier::notify(WFS_SERVICE_EVENT, PCSC::CardRemoved(*this));
-        if (hCard != 0) {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        if (mCardPresent) {
             close();
         }
     }
-    if (forCheck & SCARD_STATE_PRESENT) {
-        open(state.szReader);
+    if (added & SCARD_STATE_PRESENT) {
+        cardInserted(state, reader, atOpen);
         EventNotifier::notify(WFS_EXECUTE_EVENT, PCSC::CardInserted(*this));
     }
 }
+void Service::cardInserted(const SCARD_READERSTATE& state, ReaderId reader, bool atOpen) {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    mCardPresent = true;
+    mCardAtr.assign(state.rgbAtr, state.rgbAtr + state.cbAtr);
+    mCardSeenAt = boost::chrono::steady_clock::now();
+    SettingsCache::Snapshot settings = this->settings();
+    // Классификация по ATR -- проход по автомату, без обращений к карточке.
+    mCardType = settings->classify(mCardAtr);
+    if (!mCardType.empty()) {
+        {XFS::Logger() << "Service " << handle() << ": card type '" << mCardType << "'"; }
+        pcsc.metrics().add(pcsc.metrics().intern("cards_" + mCardType), Metrics::Labels(reader, mServiceName));
+    }
+    // Запоминаем текущий считыватель: пока карточка не извлечена, события от остальных
+    // считывателей игнорируются.
+    bind(reader);
+    XFS::Logger() << "Service " << handle() << " binded to reader '" << state.szReader << "'";
+
+    // При открытии сервиса соединение откроет seeded(), вне блокировки менеджера.
+    if (atOpen) {
+        return;
+    }
+    switch (settings->connectPolicy) {
+        // SCardConnect не должен удерживать блокировку рассылки изменений менеджера. Задачи чтения чипа
+        // ставятся в ту же очередь позже и получают уже открытое соединение.
+        case Settings::ConnectEager: {
+            pcsc.worker().post(boost::bind(&Service::connectInserted, boost::ref(pcsc), hService));
+            break;
+        }
+        // Карточка, вставленная после открытия сервиса, подключается первой командой.
+        case Settings::ConnectSpeculative: {
+            break;
+        }
+        // Соединение откроет первая команда, которой нужен чип.
+        case Settings::ConnectLazy: {
+            break;
+        }
+    }
+}
+void Service::connectInserted(Manager& manager, HSERVICE hService) {
+    Manager::ServiceRef service(manager, hService);
+    if (!service.isValid()) {
+        return;
+    }
+    boost::lock_guard<boost::mutex> lock(service->mCardMutex);
+    // Карточка могла быть извлечена, пока задание ждало своей очереди.
+    service->connectLocked();
+}
+void Service::seeded() {
+    boost::lock_guard<boost::mutex> lock(mCardMutex);
+    // Карточка уже была в считывателе при открытии сервиса -- скорее всего, приложение
+    // открыло сервис, чтобы с ней работать. Она могла быть извлечена после seed().
+    if (mCardPresent && settings()->connectPolicy != Settings::ConnectLazy) {
+        connectLocked();
+    }
+}
+void Service::replay(HWND hWnd) const {
+    bool present;
+    {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        present = mCardPresent;
+    }
+    if (present) {
+        EventNotifier::notify(hWnd, WFS_EXECUTE_EVENT, PCSC::CardInserted(*this));
+    }
+}
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 std::pair<WFSIDCSTATUS*, PCSC::Status> Service::getStatus() {
+    Tracer::Span span("provider", "Service::getStatus", hService);
     // Состояние считывателя.
     PCSC::MediaStatus state;
-    DWORD nameLen = 0;
-    DWORD atrLen = 0;
+    PCSC::ProtocolTypes protocol;
     // Если карточки не будет в считывателе, то вернется ошибка и в ответ мы дадим WFS_IDC_MEDIANOTPRESENT
     PCSC::Status st = SCARD_S_SUCCESS;
-    if (hCard != 0) {
-        st = SCardStatus(hCard,
-            // Имя получать не будем, тем не менее длину получить требуется, NULL недопустим.
-            NULL, &nameLen,
-            // Небольшой хак допустим, у нас прозрачная обертка, ничего лишнего.
-            (DWORD*)&state, (DWORD*)&mActiveProtocol,
-            // ATR получать не будем, тем не менее длину получить требуется, NULL недопустим.
-            NULL, &atrLen
-        );
-        {XFS::Logger() << "SCardStatus(hCard=" << hCard << ", ..., state=&" << state << ", dwActiveProtocol=&" << mActiveProtocol << ", ...) = " << st; }
-    }
-    bool hasCard = hCard != 0 && st;
+    bool present;
+    Reader* reader;
+    ReaderId binded;
+    std::string more;
+    {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        present = mCardPresent;
+        reader = mReader;
+        binded = mBindedReader.load();
+        more = cardTypeExtra(mCardType);
+    }
+    if (reader != NULL) {
+        st = reader->status(state, protocol);
+    }
+    bool hasCard = reader != NULL && st;
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     WFSIDCSTATUS* lpStatus = XFS::alloc<WFSIDCSTATUS>();
     // Набор флагов, определяющих состояние устройства. Наше устройство всегда на связи,
     // т.к. в противном случае при открытии сессии с PC/SC драйвером будет ошибка.
     lpStatus->fwDevice = WFS_IDC_DEVONLINE;
-    lpStatus->fwMedia = hasCard ? state.translateMedia() : WFS_IDC_MEDIANOTPRESENT;
+    // Карточка может быть в считывателе и без соединения с ней (отложенное соединение).
+    lpStatus->fwMedia = hasCard ? state.translateMedia() : (present ? WFS_IDC_MEDIAPRESENT : WFS_IDC_MEDIANOTPRESENT);
     // У считывателей нет корзины для захваченных карт.
     lpStatus->fwRetainBin = WFS_IDC_RETAINNOTSUPP;
     // Модуль безопасноси отсутствует
@@ -226,11 +407,18 @@ std::pair<WFSIDCSTATUS*, PCSC::Status> Service::getStatus() {
     // то данный параметр не имеет смысла.
     //TODO Хотя, может быть, можно будет его отслеживать как количество вытащенных карт.
     lpStatus->usCards = 0;
-    lpStatus->fwChipPower = hasCard ? state.translateChipPower() : WFS_IDC_CHIPNOCARD;
-    //TODO: Добавить lpszExtra со всеми параметрами, полученными от PC/SC.
+    lpStatus->fwChipPower = hasCard ? state.translateChipPower() : (present ? WFS_IDC_CHIPUNKNOWN : WFS_IDC_CHIPNOCARD);
+    // Атрибуты считывателя известны и без соединения, если с ним уже соединялись.
+    if (reader != NULL) {
+        lpStatus->lpszExtra = reader->extra(more);
+    } else
+    if (binded != ReaderNames::none) {
+        lpStatus->lpszExtra = pcsc.reader(binded).extra(more);
+    }
     return std::make_pair(lpStatus, st);
 }
 std::pair<WFSIDCCAPS*, PCSC::Status> Service::getCaps() const {
+    Tracer::Span span("provider", "Service::getCaps", hService);
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     WFSIDCCAPS* lpCaps = XFS::alloc<WFSIDCCAPS>();
 
@@ -238,11 +426,18 @@ std::pair<WFSIDCCAPS*, PCSC::Status> Service::getCaps() const {
     PCSC::ProtocolTypes types;
     DWORD len = sizeof(DWORD);
     PCSC::Status st = SCARD_S_SUCCESS;
-    if (hCard != 0) {
-        st = SCardGetAttrib(hCard, SCARD_ATTR_PROTOCOL_TYPES, (BYTE*)&types, &len);
-        {XFS::Logger() << "SCardGetAttrib(hCard=" << hCard << ", attr=SCARD_ATTR_PROTOCOL_TYPES, types=&" << types << "...) = " << st; }
+    Reader* reader;
+    std::string more;
+    {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        reader = mReader;
+        more = cardTypeExtra(mCardType);
     }
-    bool hasCard = hCard != 0 && st;
+    if (reader != NULL) {
+        st = reader->getAttrib(SCARD_ATTR_PROTOCOL_TYPES, (BYTE*)&types, &len);
+        {XFS::Logger() << "SCardGetAttrib(reader=" << reader->name() << ", attr=SCARD_ATTR_PROTOCOL_TYPES, types=&" << types << "...) = " << st; }
+    }
+    bool hasCard = reader != NULL && st;
     // Устройство является считывателем карт.
     lpCaps->wClass = WFS_SERVICE_CLASS_IDC;
     // Карта вставляется рукой и может быть вытащена в любой момент.
@@ -252,7 +447,9 @@ std::pair<WFSIDCCAPS*, PCSC::Status> Service::getCaps() const {
     // Какие треки могут быть прочитаны -- никакие, только чип.
     // Так как Kalignite не желает работать, если считыватель не умеет читать хоть какой-то
     // трек, то сообщаем, что умеем читать самый востребованный, чтобы удовлетворить Kaliginte.
-    lpCaps->fwReadTracks = mSettings.workarounds.track2.report ? WFS_IDC_TRACK2 : WFS_IDC_NOTSUPP;
+    SettingsCache::Snapshot settings = this->settings();
+    const bool track2 = settings->workarounds.track2.report || settings->track2FromChip();
+    lpCaps->fwReadTracks = track2 ? WFS_IDC_TRACK2 : WFS_IDC_NOTSUPP;
     // Какие треки могут быть записаны -- никакие, только чип.
     lpCaps->fwWriteTracks = WFS_IDC_NOTSUPP;
     // Виды поддерживаемых устройством протоколов -- все возможные.
@@ -276,47 +473,86 @@ std::pair<WFSIDCCAPS*, PCSC::Status> Service::getCaps() const {
     // Возможности считывателя по управлению питанием чипа.
     //TODO: Получить реальные возможности считывателя. Пока предполагаем, что все возможности есть.
     lpCaps->fwChipPower = WFS_IDC_CHIPPOWERCOLD | WFS_IDC_CHIPPOWERWARM | WFS_IDC_CHIPPOWEROFF;
-    //TODO: Добавить lpszExtra со всеми параметрами, полученными от PC/SC.
+    // Атрибуты считывателя и текущие параметры связи с карточкой, прочитанные при соединении.
+    if (reader != NULL) {
+        lpCaps->lpszExtra = reader->extra(more);
+    }
     return std::make_pair(lpCaps, st);
 }
+std::pair<LPSTR, PCSC::Status> Service::getChipTags(const std::vector<DWORD>& tags) {
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (!st) {
+        return std::make_pair((LPSTR)NULL, st);
+    }
+    // Пары "тег=значение\0", список завершается дополнительным нулем.
+    std::string fields = reader->chipFields(tags);
+    fields += '\0';
+    //TODO: Возможно, необходимо выделять память через WFSAllocateMore
+    LPSTR result = XFS::allocArr<char>(fields.size());
+    std::memcpy(result, fields.data(), fields.size());
+    return std::make_pair(result, st);
+}
+std::pair<LPSTR, PCSC::Status> Service::getFeatures() {
+    Reader* reader;
+    ReaderId binded;
+    {
+        boost::lock_guard<boost::mutex> lock(mCardMutex);
+        reader = mReader;
+        binded = mBindedReader.load();
+    }
+    if (reader == NULL && binded != ReaderNames::none) {
+        // Функции считывателя известны и без карточки, через прямое подключение.
+        reader = &pcsc.reader(binded);
+    }
+    if (reader == NULL) {
+        return std::make_pair((LPSTR)NULL, PCSC::Status(SCARD_E_NO_SMARTCARD));
+    }
+    std::string fields;
+    PCSC::Status st = reader->featureFields(fields);
+    if (!st) {
+        return std::make_pair((LPSTR)NULL, st);
+    }
+    fields += '\0';
+    //TODO: Возможно, необходимо выделять память через WFSAllocateMore
+    LPSTR result = XFS::allocArr<char>(fields.size());
+    std::memcpy(result, fields.data(), fields.size());
+    return std::make_pair(result, st);
+}
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void Service::asyncRead(DWORD dwTimeOut, HWND hWnd, REQUESTID ReqID, XFS::ReadFlags forRead) {
     // В считывателе нет карты, начинаем ожидание, пока вставят. В противном случае
-    // информацию можно послать сразу.
-    if (hCard == 0) {
+    // информацию можно послать сразу, открыв соединение, если оно еще не открыто.
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (st.value() == SCARD_E_NO_SMARTCARD) {
         namespace bc = boost::chrono;
         bc::steady_clock::time_point now = bc::steady_clock::now();
         pcsc.addTask(Task::Ptr(new CardReadTask(now + bc::milliseconds(dwTimeOut), *this, hWnd, ReqID, forRead)));
+    } else
+    if (!st) {
+        XFS::Result(ReqID, handle(), st).attach((WFSIDCCARDDATA**)NULL).send(hWnd, WFS_EXECUTE_COMPLETE);
     } else {
-        WFSIDCCARDDATA** result = wrap(readChip(), forRead);
+        WFSIDCCARDDATA** result = wrap(reader, forRead.value() & WFS_IDC_CHIP ? readChip(*reader) : NULL, forRead);
         // Уведомляем поставщика задачи, что она выполнена.
         XFS::Result(ReqID, handle(), WFS_SUCCESS).attach(result).send(hWnd, WFS_EXECUTE_COMPLETE);
     }
 }
-std::pair<DWORD, BYTE*> Service::readATR() const {
-    assert(hCard != 0 && "Service::readATR: Attempt read ATR when card not in the reader");
-
-    {XFS::Logger() << "Read ATR (hCard=" << hCard << ')'; }
-    
-    std::pair<DWORD, BYTE*> result;
-
-    // Получаем ATR (Answer To Reset). Сначала длину, потом сами данные.
-    PCSC::Status st = SCardGetAttrib(hCard, SCARD_ATTR_ATR_STRING, NULL, &result.first);
-    {XFS::Logger() << "SCardGetAttrib(hCard=" << hCard << ", SCARD_ATTR_ATR_STRING, ..., size=&" << result.first << ") = " << st; }
+std::pair<DWORD, BYTE*> Service::readATR(const Reader& reader) const {
+    // ATR (Answer To Reset) уже прочитан считывателем при соединении с карточкой.
+    std::vector<BYTE> atr = reader.atr();
+    std::pair<DWORD, BYTE*> result((DWORD)atr.size(), NULL);
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     result.second = XFS::allocArr<BYTE>(result.first);
-    st = SCardGetAttrib(hCard, SCARD_ATTR_ATR_STRING, result.second, &result.first);
-    {
-        XFS::Logger l;
-        l << "SCardGetAttrib(hCard=" << hCard << ", SCARD_ATTR_ATR_STRING, atr=&["
-          << Hex(result.second, result.first) << "], size=&" << result.first << ") = " << st;
+    if (!atr.empty()) {
+        std::memcpy(result.second, &atr[0], atr.size());
     }
+    {XFS::Logger() << "Read ATR (reader=" << reader.name() << "): atr=[" << Hex(result.second, result.first) << ']'; }
     return result;
 }
-WFSIDCCARDDATA* Service::readChip() const {
-    assert(hCard != 0 && "Service::readChip: Attempt read ATR when card not in the reader");
-
-    {XFS::Logger() << "Read chip (hCard=" << hCard << ')'; }
+WFSIDCCARDDATA* Service::readChip(const Reader& reader) const {
+    Tracer::Span span("provider", "Service::readChip", hService);
+    {XFS::Logger() << "Read chip (reader=" << reader.name() << ')'; }
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
     // data->lpbData содержит ATR (Answer To Reset), прочитанный с чипа
@@ -325,17 +561,16 @@ WFSIDCCARDDATA* Service::readChip() const {
     // который вернула SCardGetAttrib.
     data->wStatus = WFS_IDC_DATAOK;
 
-    std::pair<DWORD, BYTE*> atr = readATR();
+    std::pair<DWORD, BYTE*> atr = readATR(reader);
     data->ulDataLength = atr.first;
     data->lpbData = atr.second;
     return data;
 }
-WFSIDCCARDDATA* Service::readTrack2() const {
-    assert(hCard != 0 && "Attempt read TRACK2 when card not in the reader");
-    assert(mSettings.workarounds.track2.report == true && "Attempt read TRACK2 when setting Workarounds.Track2.Report is false");
+WFSIDCCARDDATA* Service::readTrack2(const Settings& settings) const {
+    assert(settings.workarounds.track2.report == true && "Attempt read TRACK2 when setting Workarounds.Track2.Report is false");
 
-    {XFS::Logger() << "Read track2 (hCard=" << hCard << ')'; }
-    std::size_t size = mSettings.workarounds.track2.value.size();
+    {XFS::Logger() << "Read track2 (service=" << hService << ')'; }
+    std::size_t size = settings.workarounds.track2.value.size();
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
     data->wDataSource  = WFS_IDC_TRACK2;
@@ -343,17 +578,278 @@ WFSIDCCARDDATA* Service::readTrack2() const {
     if (size != 0) {
         data->ulDataLength = size;
         data->lpbData      = XFS::allocArr<BYTE>(size);
-        std::memcpy(data->lpbData, mSettings.workarounds.track2.value.c_str(), size);
+        std::memcpy(data->lpbData, settings.workarounds.track2.value.c_str(), size);
+    }
+    return data;
+}
+/// Ищет тег в ответе карточки, который может быть пустым.
+static bool findTag(const std::vector<BYTE>& data, DWORD tag, Tlv::Element& e) {
+    return !data.empty() && Tlv::find(&data[0], (DWORD)data.size(), tag, e);
+}
+/// SELECT по имени (AID или имя каталога), с Le=00.
+static std::vector<BYTE> selectCommand(const BYTE* name, std::size_t size) {
+    const BYTE header[] = {0x00, 0xA4, 0x04, 0x00, (BYTE)size};
+    std::vector<BYTE> command(header, header + sizeof(header));
+    command.insert(command.end(), name, name + size);
+    command.push_back(0x00);
+    return command;
+}
+static std::vector<BYTE> readRecordCommand(BYTE sfi, BYTE record) {
+    const BYTE command[] = {0x00, 0xB2, record, (BYTE)((sfi << 3) | 0x04), 0x00};
+    return std::vector<BYTE>(command, command + sizeof(command));
+}
+WORD Service::exchange(Reader& reader, std::vector<BYTE> command, std::vector<BYTE>& response) const {
+    response.clear();
+    const DWORD protocol = reader.protocol().value();
+    // Le есть у команд case 2 (только заголовок и Le) и case 4 (Lc, данные и Le).
+    bool hasLe = command.size() == 5 || (command.size() > 5 && command.size() == 5u + command[4] + 1);
+    // В T=0 команда case 4 передается без Le, ответ забирается через GET RESPONSE (ISO 7816-3, 12.2).
+    if (protocol == SCARD_PROTOCOL_T0 && hasLe && command.size() > 5) {
+        command.pop_back();
+        hasLe = false;
+    }
+    SCARD_IO_REQUEST ioRq = {protocol, sizeof(SCARD_IO_REQUEST)};
+    // 2 байта на код ответа, остальное -- на сам ответ чипа.
+    BYTE buffer[256 + 2];
+    // Ограничивает число повторов, чтобы неисправная карточка не зациклила чтение.
+    for (int i = 0; i < 8; ++i) {
+        DWORD len = sizeof(buffer);
+        PCSC::Status st = reader.transmit(hService, &ioRq, &command[0], (DWORD)command.size(), buffer, &len);
+        {XFS::Logger() << "Chip track2: command=[" << Hex(&command[0], (ULONG)command.size()) << "]: " << st << ", response=[" << Hex(buffer, st ? len : 0) << ']'; }
+        if (!st || len < 2) {
+            return 0;
+        }
+        const BYTE sw1 = buffer[len - 2];
+        const BYTE sw2 = buffer[len - 1];
+        response.insert(response.end(), buffer, buffer + len - 2);
+        if (sw1 == 0x61) {
+            // Есть еще sw2 байт ответа.
+            const BYTE getResponse[] = {0x00, 0xC0, 0x00, 0x00, sw2};
+            command.assign(getResponse, getResponse + sizeof(getResponse));
+            hasLe = true;
+            continue;
+        }
+        if (sw1 == 0x6C && command.size() >= 4) {
+            // Неверный Le, карточка сообщает правильный. Если Le был убран, последний байт -- это данные.
+            if (hasLe) {
+                command.back() = sw2;
+            } else {
+                command.push_back(sw2);
+                hasLe = true;
+            }
+            continue;
+        }
+        return (WORD)((sw1 << 8) | sw2);
+    }
+    return 0;
+}
+bool Service::findChipTrack2(Reader& reader, bool gpo, std::vector<BYTE>& value) const {
+    // Приложение могло уже прочитать тег 57 через CHIP_IO.
+    if (reader.chipTag(0x57, value)) {
+        {XFS::Logger() << "Chip track2: found in cached chip responses"; }
+        return true;
+    }
+    std::vector<BYTE> response;
+    Tlv::Element e;
+    // Сначала PPSE бесконтактных карточек, затем PSE контактных.
+    static const char* const directories[] = {"2PAY.SYS.DDF01", "1PAY.SYS.DDF01"};
+    std::vector<BYTE> aid;
+    for (std::size_t i = 0; i < 2 && aid.empty(); ++i) {
+        const BYTE* name = (const BYTE*)directories[i];
+        if (exchange(reader, selectCommand(name, std::strlen(directories[i])), response) != 0x9000) {
+            continue;
+        }
+        if (findTag(response, 0x4F, e)) {
+            aid.assign(e.value, e.value + e.length);
+            break;
+        }
+        // FCI каталога PSE содержит только SFI его файла (тег 88), приложения перечислены в записях.
+        if (!findTag(response, 0x88, e) || e.length != 1) {
+            continue;
+        }
+        const BYTE sfi = e.value[0];
+        for (BYTE record = 1; record <= 16 && aid.empty(); ++record) {
+            if (exchange(reader, readRecordCommand(sfi, record), response) != 0x9000) {
+                break;
+            }
+            if (findTag(response, 0x4F, e)) {
+                aid.assign(e.value, e.value + e.length);
+            }
+        }
+    }
+    if (aid.empty()) {
+        {XFS::Logger() << "Chip track2: no application found"; }
+        return false;
+    }
+    if (exchange(reader, selectCommand(&aid[0], aid.size()), response) != 0x9000) {
+        return false;
+    }
+    // Тег 57 редко, но бывает прямо в FCI приложения.
+    if (findTag(response, 0x57, e)) {
+        value.assign(e.value, e.value + e.length);
+        return true;
+    }
+    const std::vector<BYTE> fci = response;
+    // Большинство карточек разрешает READ RECORD до GET PROCESSING OPTIONS, а тег 57 обычно
+    // лежит в первых записях первых SFI. Карточки, требующие GPO, отвечают 6985 и перебор прекращается.
+    bool denied = false;
+    for (BYTE sfi = 1; sfi <= 3 && !denied; ++sfi) {
+        for (BYTE record = 1; record <= 4; ++record) {
+            const WORD sw = exchange(reader, readRecordCommand(sfi, record), response);
+            if (sw != 0x9000) {
+                denied = sw == 0x6985;
+                break;
+            }
+            if (findTag(response, 0x57, e)) {
+                value.assign(e.value, e.value + e.length);
+                return true;
+            }
+        }
+    }
+    // GPO начинает транзакцию EMV и увеличивает счетчик транзакций карточки, поэтому только по настройке.
+    if (!gpo) {
+        {XFS::Logger() << "Chip track2: tag 57 not found without GET PROCESSING OPTIONS"; }
+        return false;
+    }
+    // Данные PDOL заполняются нулями: терминальные данные для чтения записей не нужны.
+    DWORD pdolLength = 0;
+    if (findTag(fci, 0x9F38, e) && !Tlv::dolLength(e.value, e.length, pdolLength)) {
+        return false;
+    }
+    if (pdolLength > 0x7F) {
+        return false;
+    }
+    const BYTE gpoHeader[] = {0x80, 0xA8, 0x00, 0x00, (BYTE)(pdolLength + 2), 0x83, (BYTE)pdolLength};
+    std::vector<BYTE> gpoCommand(gpoHeader, gpoHeader + sizeof(gpoHeader));
+    gpoCommand.resize(gpoCommand.size() + pdolLength + 1, 0x00);
+    if (exchange(reader, gpoCommand, response) != 0x9000) {
+        return false;
+    }
+    // Бесконтактные карточки часто возвращают тег 57 сразу в ответе на GPO.
+    if (findTag(response, 0x57, e)) {
+        value.assign(e.value, e.value + e.length);
+        return true;
+    }
+    // Формат 2 (шаблон 77) содержит AFL в теге 94, формат 1 (тег 80) -- AIP из 2 байт и затем AFL.
+    std::vector<BYTE> afl;
+    if (findTag(response, 0x94, e)) {
+        afl.assign(e.value, e.value + e.length);
+    } else
+    if (findTag(response, 0x80, e) && e.length >= 2) {
+        afl.assign(e.value + 2, e.value + e.length);
+    }
+    // Каждая запись AFL: SFI в старших 5 битах, первая и последняя запись, число записей для ODA.
+    for (std::size_t i = 0; i + 4 <= afl.size(); i += 4) {
+        const BYTE sfi = afl[i] >> 3;
+        for (unsigned int record = afl[i + 1]; record != 0 && record <= afl[i + 2]; ++record) {
+            if (exchange(reader, readRecordCommand(sfi, (BYTE)record), response) != 0x9000) {
+                continue;
+            }
+            if (findTag(response, 0x57, e)) {
+                value.assign(e.value, e.value + e.length);
+                return true;
+            }
+        }
+    }
+    {XFS::Logger() << "Chip track2: tag 57 not found"; }
+    return false;
+}
+WFSIDCCARDDATA* Service::readChipTrack2(Reader* reader, bool gpo) const {
+    Tracer::Span span("provider", "Service::readChipTrack2", hService);
+    //TODO: Возможно, необходимо выделять память через WFSAllocateMore
+    WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
+    data->wDataSource = WFS_IDC_TRACK2;
+    data->wStatus = WFS_IDC_DATAMISSING;
+    if (reader == NULL) {
+        return data;
+    }
+    std::string track2 = reader->track2();
+    if (track2.empty()) {
+        std::vector<BYTE> value;
+        if (!findChipTrack2(*reader, gpo, value) || value.empty()) {
+            return data;
+        }
+        // Тег 57 в BCD: PAN, разделитель D, срок действия, сервисный код, дискреционные данные,
+        // дополнение F до целого байта. В дорожке 2 разделителем служит '='.
+        for (std::size_t i = 0; i < 2 * value.size(); ++i) {
+            const BYTE nibble = (i % 2 == 0 ? value[i / 2] >> 4 : value[i / 2]) & 0x0F;
+            if (nibble <= 9) {
+                track2 += (char)('0' + nibble);
+            } else
+            if (nibble == 0x0D) {
+                track2 += '=';
+            } else
+            if (nibble == 0x0F && i == 2 * value.size() - 1) {
+                break;
+            } else {
+                {XFS::Logger() << "Chip track2: invalid tag 57 value"; }
+                data->wStatus = WFS_IDC_DATAINVALID;
+                return data;
+            }
+        }
+        reader->track2(track2);
+    }
+    data->wStatus = WFS_IDC_DATAOK;
+    data->ulDataLength = track2.size();
+    data->lpbData = XFS::allocArr<BYTE>(track2.size());
+    std::memcpy(data->lpbData, track2.data(), track2.size());
+    return data;
+}
+WFSIDCCARDDATA* Service::readGetData(Reader* reader, WORD source) const {
+    Tracer::Span span("provider", "Service::readGetData", hService);
+    //TODO: Возможно, необходимо выделять память через WFSAllocateMore
+    WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
+    data->wDataSource = source;
+    data->wStatus = WFS_IDC_DATAMISSING;
+    if (reader == NULL) {
+        return data;
+    }
+    // GET DATA из PC/SC 2.01, часть 3: P1=00 -- UID, P1=01 -- исторические байты ATS (ATQB для типа B).
+    // Le=00 -- вернуть данные полностью.
+    const BYTE command[] = {0xFF, 0xCA, (BYTE)(source == WFS_IDC_PCSC_UID ? 0x00 : 0x01), 0x00, 0x00};
+    // 2 байта на код ответа, остальное -- на сами данные.
+    BYTE response[256 + 2];
+    DWORD len = sizeof(response);
+    SCARD_IO_REQUEST ioRq = {reader->protocol().value(), sizeof(SCARD_IO_REQUEST)};
+    PCSC::Status st = reader->transmit(hService, &ioRq, command, sizeof(command), response, &len);
+    {XFS::Logger() << "GET DATA (reader=" << reader->name() << ", P1=" << (int)command[2] << "): " << st << ", response=[" << Hex(response, st ? len : 0) << ']'; }
+    if (!st || len < 2) {
+        return data;
+    }
+    const WORD sw = (response[len - 2] << 8) | response[len - 1];
+    switch (sw) {
+        // 6282 -- данных меньше, чем запрошено в Le, но они верны.
+        case 0x9000:
+        case 0x6282: {
+            data->wStatus = WFS_IDC_DATAOK;
+            data->ulDataLength = len - 2;
+            data->lpbData = XFS::allocArr<BYTE>(len - 2);
+            std::memcpy(data->lpbData, response, len - 2);
+            break;
+        }
+        // Функция не поддерживается: контактная карточка или считыватель без части 3.
+        case 0x6A81: {
+            data->wStatus = WFS_IDC_DATASRCNOTSUPP;
+            break;
+        }
+        default: {
+            data->wStatus = WFS_IDC_DATAINVALID;
+            break;
+        }
     }
     return data;
 }
 
-WFSIDCCARDDATA** Service::wrap(WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead) const {
-    assert((forRead.value() & WFS_IDC_CHIP) && "Service::wrap: Chip data not requested");
+WFSIDCCARDDATA** Service::wrap(Reader* reader, WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead) const {
+    Tracer::Span span("provider", "Service::wrap", hService);
+    assert(((forRead.value() & WFS_IDC_CHIP) != 0) == (iccData != NULL) && "Service::wrap: Chip data mismatch");
     // Данный вызов вернет заполненный нулями массив под два указателя на WFSIDCCARDDATA.
     // В поледнем элементе NULL -- признак конца массива.
     //TODO: Возможно, необходимо выделять память через WFSAllocateMore
     WFSIDCCARDDATA** result = XFS::allocArr<WFSIDCCARDDATA*>(forRead.size() + 1);
+    SettingsCache::Snapshot settings = this->settings();
+    // Профиль типа карточки может включить чтение track2 из чипа.
+    const Settings::Workarounds workarounds = settings->workaroundsFor(cardType());
 
     std::size_t j = 0;
     for (std::size_t i = 0; i < XFS::ReadFlags::count; ++i) {
@@ -363,11 +859,17 @@ WFSIDCCARDDATA** Service::wrap(WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead)
             if (flag == WFS_IDC_CHIP) {
                 result[j] = iccData;
             } else
+            if (flag == WFS_IDC_TRACK2 && workarounds.track2.fromChip) {
+                result[j] = readChipTrack2(reader, workarounds.track2.fromChipGpo);
+            } else
             // Kalignite требует, чтобы track2 мог читаться устройством, иначе он падает.
             // Поэтому, если такая информация запрошена и у нас в настройках сказано ее отдать,
             // то эмулируем ее наличие.
-            if (flag == WFS_IDC_TRACK2 && mSettings.workarounds.track2.report) {
-                result[j] = readTrack2();
+            if (flag == WFS_IDC_TRACK2 && settings->workarounds.track2.report) {
+                result[j] = readTrack2(*settings);
+            } else
+            if ((flag == WFS_IDC_PCSC_UID || flag == WFS_IDC_PCSC_ATS) && settings->contactless) {
+                result[j] = readGetData(reader, (WORD)flag);
             } else {
                 //TODO: Возможно, необходимо выделять память через WFSAllocateMore
                 WFSIDCCARDDATA* data = XFS::alloc<WFSIDCCARDDATA>();
@@ -380,13 +882,18 @@ WFSIDCCARDDATA** Service::wrap(WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead)
     }
     return result;
 }
-std::pair<WFSIDCCHIPIO*, PCSC::Status> Service::transmit(const WFSIDCCHIPIO* input) const {
+std::pair<WFSIDCCHIPIO*, PCSC::Status> Service::transmit(const WFSIDCCHIPIO* input) {
     assert(input != NULL && "Service::transmit: No input from XFS subsystem");
-    assert(hCard != 0 && "Service::transmit: No card in reader");
+
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (!st) {
+        return std::make_pair((WFSIDCCHIPIO*)NULL, st);
+    }
 
     {
         XFS::Logger l;
-        l << "Service::transmit(input): dwActiveProtocol=" << mActiveProtocol
+        l << "Service::transmit(input): dwActiveProtocol=" << reader->protocol()
              << ", protocol=" << input->wChipProtocol
              << ", len=" << input->ulChipDataLength
              << ", data=[" << Hex(input->lpbChipData, input->ulChipDataLength)
@@ -397,7 +904,7 @@ std::pair<WFSIDCCHIPIO*, PCSC::Status> Service::transmit(const WFSIDCCHIPIO* inp
     result->wChipProtocol = input->wChipProtocol;
 
     std::size_t inputSize = input->ulChipDataLength;
-    if (mSettings.workarounds.correctChipIO && input->wChipProtocol == WFS_IDC_CHIPT0) {
+    if (workarounds().correctChipIO && input->wChipProtocol == WFS_IDC_CHIPT0) {
         // Команду получения результата Kalignite передает правильно, без ненужного довеска.
         // Эта комана состоит всего из 4 байт, т.е. даже не содержит поля со своей длиной.
         // Так как он в принципе формирует данную команду, непонятно, зачем же он для других
@@ -414,11 +921,13 @@ std::pair<WFSIDCCHIPIO*, PCSC::Status> Service::transmit(const WFSIDCCHIPIO* inp
     result->lpbChipData = XFS::allocArr<BYTE>(result->ulChipDataLength);
     //TODO: Убедится в выравнивании! Необходимо выравнивание на двойное слово!
     SCARD_IO_REQUEST ioRq = {input->wChipProtocol, sizeof(SCARD_IO_REQUEST)};
-    PCSC::Status st = SCardTransmit(hCard,
+    st = reader->transmit(hService,
         &ioRq, input->lpbChipData, inputSize,
-        NULL, result->lpbChipData, &result->ulChipDataLength
+        result->lpbChipData, &result->ulChipDataLength
     );
-    {XFS::Logger() << "SCardTransmit(hCard=" << hCard << ", ...) = " << st; }
+    if (!st) {
+        pcsc.recorder().failure("SCardTransmit failed");
+    }
     {
         XFS::Logger l;
         l << "Service::transmit(result): len=" << result->ulChipDataLength
@@ -428,21 +937,67 @@ std::pair<WFSIDCCHIPIO*, PCSC::Status> Service::transmit(const WFSIDCCHIPIO* inp
 
     return std::make_pair(result, st);
 }
-std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> Service::reset(XFS::ResetAction action) const {
-    assert(hCard != 0 && "Service::reset: No card in the reader");
+std::pair<WFSIDCPCSCCONTROLOUT*, PCSC::Status> Service::control(const WFSIDCPCSCCONTROL* input) {
+    assert(input != NULL && "Service::control: No input from XFS subsystem");
 
-    PCSC::Status st = SCardReconnect(
-        hCard,
-        mSettings.exclusive ? SCARD_SHARE_EXCLUSIVE : SCARD_SHARE_SHARED,
-        // Текущий активный протокол должен быть в числе запрошенных, иначе
-        // функция вернет ошибку.
-        mActiveProtocol.value() | SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
-        action.translate(),
-        (DWORD*)&mActiveProtocol
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (!st) {
+        return std::make_pair((WFSIDCPCSCCONTROLOUT*)NULL, st);
+    }
+    {
+        XFS::Logger l;
+        l << "Service::control(input): dwControlCode=0x" << std::hex << input->dwControlCode << std::dec
+          << ", len=" << input->ulInDataLength
+          << ", data=[" << Hex(input->lpbInData, input->ulInDataLength)
+          << ']';
+    }
+    //TODO: Возможно, необходимо выделять память через WFSAllocateMore
+    WFSIDCPCSCCONTROLOUT* result = XFS::alloc<WFSIDCPCSCCONTROLOUT>();
+    // Ответы CCID (PC_to_RDR_Escape, проверка PIN) укладываются в короткое сообщение CCID.
+    result->ulOutDataLength = 1024;
+    result->lpbOutData = XFS::allocArr<BYTE>(result->ulOutDataLength);
+    DWORD outSize = result->ulOutDataLength;
+    st = reader->control(hService, input->dwControlCode,
+        input->lpbInData, input->ulInDataLength,
+        result->lpbOutData, &outSize
     );
-    {XFS::Logger() << "SCardReconnect(hCard=" << hCard << ", ..., dwActiveProtocol=&" << mActiveProtocol << ") = " << st; }
+    result->ulOutDataLength = outSize;
+    if (!st) {
+        pcsc.recorder().failure("SCardControl failed");
+    }
+    {
+        XFS::Logger l;
+        l << "Service::control(result): len=" << result->ulOutDataLength
+          << ", data=[" << Hex(result->lpbOutData, result->ulOutDataLength)
+          << ']';
+    }
+    return std::make_pair(result, st);
+}
+PCSC::Status Service::resetDevice() {
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (st.value() == SCARD_E_NO_SMARTCARD) {
+        return SCARD_S_SUCCESS;
+    }
+    if (!st) {
+        return st;
+    }
+    st = reader->reconnect(hService, SCARD_UNPOWER_CARD);
+    if (st) {
+        EventNotifier::notify(WFS_SERVICE_EVENT, PCSC::CardDetected(*this));
+    }
+    return st;
+}
+std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> Service::reset(XFS::ResetAction action) {
+    Reader* reader;
+    PCSC::Status st = connect(reader);
+    if (!st) {
+        return std::make_pair((WFSIDCCHIPPOWEROUT*)NULL, st);
+    }
+    st = reader->reconnect(hService, action.translate());
 
-    std::pair<DWORD, BYTE*> atr = readATR();
+    std::pair<DWORD, BYTE*> atr = readATR(*reader);
     WFSIDCCHIPPOWEROUT* result = XFS::alloc<WFSIDCCHIPPOWEROUT>();
     result->ulChipDataLength = atr.first;
     result->lpbChipData = atr.second;
@@ -7,17 +7,26 @@
 #include <xfsapi.h>
 
 #include "EventSupport.h"
+#include "ReaderNames.h"
 #include "Settings.h"
+#include "SettingsCache.h"
+#include "Watchdog.h"
 
 #include "PCSC/ProtocolTypes.h"
 #include "PCSC/Status.h"
 
 #include "XFS/ReadFlags.h"
 #include "XFS/ResetAction.h"
+#include "XFS/Vendor.h"
 
 #include <string>
 // Pour std::pair
 #include <utility>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/mutex.hpp>
 // CEN/XFS API -- Doit être en haut, car si placé ici,
 // des erreurs de compilation étranges commencent à apparaître depuis winnt.h au moins dans MSVC 2005.
 //#include <xfsapi.h>
@@ -25,54 +34,126 @@
 #include <winscard.h>
 
 class Manager;
+class Reader;
 class Service : public EventNotifier {
     Manager& pcsc;
     /// Handle du service XFS que cet objet représente
     HSERVICE hService;
-    /// Handle de la carte avec laquelle l'opération sera effectuée.
-    SCARDHANDLE hCard;
-    /// Protocole utilisé par la carte.
-    PCSC::ProtocolTypes mActiveProtocol;
-    /// Nom du lecteur dont les notifications sont traitées par ce fournisseur de services.
+    /// Nom du service logique, interné par le registre des métriques, dont il est l'étiquette `service`.
+    const char* mServiceName;
+    /// Lecteur auquel le service est attaché pour travailler avec la carte qui s'y trouve,
+    /// `NULL` si le service ne travaille avec aucune carte. La connexion à la carte appartient
+    /// au lecteur et est partagée avec les autres services attachés.
+    Reader* mReader;
+    /// Lecteur dont les notifications sont traitées par ce fournisseur de services.
     /// Peut être explicitement spécifié dans les paramètres, ou rempli au moment de la détection
     /// de la carte dans n'importe quel lecteur disponible. Dans ce dernier cas, tant que
     /// la carte n'est pas retirée, tous les événements des autres lecteurs seront ignorés.
-    std::string mBindedReaderName;
-    /// Paramètres de ce service.
-    Settings mSettings;
-    /// Drapeau indiquant qu'après la création du service, il a déjà pris connaissance de l'état actuel
-    /// des lecteurs. Lors de la création du service, ce drapeau est mis à `false`,
-    /// et lors de la première notification des lecteurs, il est mis à `true`.
-    bool mInited;
+    /// `ReaderNames::none` si le service n'est lié à aucun lecteur. Modifié par `ServiceContainer::rebind`
+    /// sous son verrou, lu sans verrou par le thread de surveillance et les tâches.
+    boost::atomic<ReaderId> mBindedReader;
+    /// Lecteur spécifié dans les paramètres, auquel le service revient à la fermeture de la carte.
+    ReaderId mSettingsReader;
+    /// Paramètres de ce service, relus à chaud lors des modifications du registre.
+    SettingsCache::SlotPtr mSettings;
+    /// Niveau de trace du service, fixé par l'application (`WFPOpen`, `WFPSetTraceLevel`)
+    /// indépendamment des paramètres du registre.
+    DWORD mTraceLevel;
+    /// Protège `mReader` et l'état de la carte : la connexion peut être ouverte aussi bien
+    /// par le thread de surveillance des lecteurs que par une commande de l'application.
+    mutable boost::mutex mCardMutex;
+    /// `true` si une carte est présente dans le lecteur lié, que la connexion soit ouverte ou non.
+    bool mCardPresent;
+    /// ATR de la carte présente, tel que signalé par le lecteur.
+    std::vector<BYTE> mCardAtr;
+    /// Type de la carte présente selon la base des motifs d'ATR (voir `Settings::cardTypes`),
+    /// vide si la base n'est pas configurée ou s'il n'y a pas de carte.
+    std::string mCardType;
+    /// Moment où le service a appris la présence de la carte. Sert à mesurer le temps
+    /// jusqu'à l'ouverture de la connexion, selon la politique de connexion.
+    boost::chrono::steady_clock::time_point mCardSeenAt;
     // Cette classe créera des objets de cette classe en appelant le constructeur.
     friend class ServiceContainer;
 private:
     /** Ouvre la carte spécifiée pour l'opération.
     @param pcsc Gestionnaire de ressources du sous-système PC/SC.
     @param hService Handle attribué au service par le gestionnaire XFS.
+    @param serviceName Nom du service logique, passé à `WFPOpen`.
     @param settings Paramètres du service XFS.
+    @param traceLevel Niveau de trace demandé par l'application.
     */
-    Service(Manager& pcsc, HSERVICE hService, const Settings& settings);
+    Service(Manager& pcsc, HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel);
 public:
     ~Service();
 
-    PCSC::Status open(const char* readerName);
-    PCSC::Status close();
+    /** Ouvre la connexion avec la carte présente dans le lecteur lié, si elle n'est pas encore ouverte.
+        Avec la politique `Settings::ConnectLazy`, c'est la première commande qui a besoin de la puce
+        qui ouvre la connexion.
+    @return
+        `SCARD_E_NO_SMARTCARD` s'il n'y a pas de carte dans le lecteur lié.
+    */
+    PCSC::Status connect();
+    /** Comme `connect`, et retourne le lecteur attaché, `NULL` si la connexion n'est pas ouverte. Une commande
+        doit utiliser ce pointeur jusqu'à sa fin, et non `mReader` : le thread de surveillance peut détacher
+        le service entre-temps (carte retirée). Le lecteur lui-même vit aussi longtemps que le gestionnaire,
+        ses appels échouent alors simplement avec une erreur PC/SC.
+    */
+    PCSC::Status connect(Reader*& reader);
 
     PCSC::Status lock();
     PCSC::Status unlock();
 
-    inline void setTraceLevel(DWORD level) { mSettings.traceLevel = level; }
+    inline void setTraceLevel(DWORD level) { mTraceLevel = level; }
+    inline DWORD traceLevel() const { return mTraceLevel; }
     /** Cette méthode est appelée lors de tout changement de lecteur et lors du changement du nombre de lecteurs.
+        Un nouveau service la reçoit aussi pour chaque lecteur connu, avec l'état précédent `SCARD_STATE_UNAWARE`.
     @param state
-        Informations sur l'état actuel du lecteur modifié.
+        Informations sur l'état actuel du lecteur modifié. Le changement est donné par
+        la différence entre `dwCurrentState` et `dwEventState`.
+    @param reader
+        Identifiant du lecteur modifié.
+    */
+    void notify(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange);
+    /** Met le nouveau service au courant du dernier état connu du lecteur, à l'ouverture du service.
+        Équivalent à `notify`, sauf que la connexion avec une carte déjà présente n'est pas ouverte :
+        appelé sous le verrou de distribution des changements, voir `seeded`.
+    */
+    void seed(const SCARD_READERSTATE& state, ReaderId reader);
+    /** Termine la mise au courant du nouveau service, hors du verrou de distribution des changements :
+        avec les politiques `Settings::ConnectEager` et `Settings::ConnectSpeculative`, ouvre la connexion
+        avec la carte déjà présente. `seed` n'ouvre jamais de connexion.
     */
-    void notify(const SCARD_READERSTATE& state, bool deviceChange);
+    void seeded();
+    /** Envoie aux abonnés l'événement `WFS_USRE_IDC_PCSC_SLOW_CALL` : un appel PC/SC sur le lecteur
+        du service a dépassé son seuil.
+    @param readerName
+        Nom PC/SC du lecteur de l'appel.
+    */
+    void slowCall(const Watchdog::Report& report, const std::string& readerName) const;
     /** Vérifie que le service attend des messages de ce lecteur. */
-    bool match(const SCARD_READERSTATE& state, bool deviceChange);
+    bool match(ReaderId reader, bool deviceChange) const;
+    /** Met le nouvel abonné au courant de l'état actuel : si le service travaille avec une carte,
+        lui envoie l'événement d'insertion de carte.
+    @param hWnd
+        Fenêtre qui vient de s'abonner aux événements du service.
+    */
+    void replay(HWND hWnd) const;
 public:// Fonctions appelées dans WFPGetInfo
     std::pair<WFSIDCSTATUS*, PCSC::Status> getStatus();
     std::pair<WFSIDCCAPS*, PCSC::Status> getCaps() const;
+    /** Éléments BER-TLV d'étiquettes spécifiées des réponses de la puce (voir `Reader::chipFields`).
+    @return
+        Une paire contenant la liste `étiquette=valeur` à transmettre à l'application, terminée
+        par un double zéro, et le statut d'exécution de la commande.
+    */
+    std::pair<LPSTR, PCSC::Status> getChipTags(const std::vector<DWORD>& tags);
+    /** Fonctions du lecteur de la carte présente ou, sans carte, du lecteur spécifié dans les paramètres
+        (voir `Reader::featureFields`).
+    @return
+        Une paire contenant la liste `nom=code` à transmettre à l'application, terminée par un double zéro,
+        et le statut d'exécution de la commande : `SCARD_E_NO_SMARTCARD` si le service ne connaît aucun lecteur.
+    */
+    std::pair<LPSTR, PCSC::Status> getFeatures();
 public:// Fonctions appelées dans WFPExecute
     /** Démarre l'opération d'attente de l'insertion d'une carte dans le lecteur. Dès que la carte
         est insérée dans le lecteur, un message `WFS_EXEE_IDC_MEDIAINSERTED` est généré,
@@ -93,15 +174,47 @@ public:// Fonctions appelées dans WFPExecute
         Numéro de suivi pour suivre la requête, passé dans le message
         `WFS_EXECUTE_COMPLETE`.
     @param forRead
-        Liste des données à lire. Seul `WFS_IDC_CHIP` est réellement lu,
-        pour tous les autres types, un indicateur que la valeur n'a pas pu être lue est retourné.
+        Liste des données à lire. Seuls `WFS_IDC_CHIP`, `WFS_IDC_TRACK2` si le paramètre
+        `Settings::Workarounds::Track2::fromChip` est activé et, si le paramètre `Settings::contactless`
+        est activé, `WFS_IDC_PCSC_UID` et `WFS_IDC_PCSC_ATS` sont réellement lus ; pour tous les autres
+        types, un indicateur que la valeur n'a pas pu être lue est retourné.
     */
     void asyncRead(DWORD dwTimeOut, HWND hWnd, REQUESTID ReqID, XFS::ReadFlags forRead);
 
-    std::pair<DWORD, BYTE*> readATR() const;
-    WFSIDCCARDDATA* readChip() const;
-    WFSIDCCARDDATA* readTrack2() const;
-    WFSIDCCARDDATA** wrap(WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead) const;
+    std::pair<DWORD, BYTE*> readATR(const Reader& reader) const;
+    WFSIDCCARDDATA* readChip(const Reader& reader) const;
+    /// Retourne la piste 2 émulée, voir `Settings::Workarounds::Track2`.
+    WFSIDCCARDDATA* readTrack2(const Settings& settings) const;
+    /** Retourne la piste 2 de la carte présente, lue dans la puce (étiquette EMV `57`) une seule fois
+        par connexion, voir `Settings::Workarounds::Track2::fromChip`.
+    @param gpo
+        Voir `Settings::Workarounds::Track2::fromChipGpo`.
+    */
+    WFSIDCCARDDATA* readChipTrack2(Reader* reader, bool gpo) const;
+    /** Obtient la valeur de l'étiquette `57` : dans les réponses de la puce déjà reçues, sinon par
+        la sélection de la première application du répertoire PPSE ou PSE, dans son FCI ou ses
+        premiers enregistrements. Si `gpo` est `true`, continue par GET PROCESSING OPTIONS et la lecture
+        des enregistrements désignés par l'AFL.
+    @return `false` si l'étiquette n'a pas été trouvée.
+    */
+    bool findChipTrack2(Reader& reader, bool gpo, std::vector<BYTE>& value) const;
+    /** Envoie une commande à la puce et retourne sa réponse complète, sans SW1 SW2 : les réponses `61xx`
+        sont complétées par GET RESPONSE et les commandes refusées par `6Cxx` sont répétées avec le bon Le.
+    @return SW1 SW2 de la dernière réponse, `0` en cas d'échec de la transmission.
+    */
+    WORD exchange(Reader& reader, std::vector<BYTE> command, std::vector<BYTE>& response) const;
+    /** Lit l'UID (`WFS_IDC_PCSC_UID`) ou les octets historiques de l'ATS (`WFS_IDC_PCSC_ATS`) de la carte
+        sans contact par la pseudo-commande GET DATA de PC/SC partie 3.
+    */
+    WFSIDCCARDDATA* readGetData(Reader* reader, WORD source) const;
+    /** Construit le résultat de `WFS_CMD_IDC_READ_RAW_DATA`.
+    @param reader
+        Lecteur attaché (voir `connect`), `NULL` si la connexion n'est pas ouverte : les données lues
+        dans la carte sont alors signalées manquantes.
+    @param iccData
+        Données de la puce, `NULL` si `WFS_IDC_CHIP` n'est pas demandé.
+    */
+    WFSIDCCARDDATA** wrap(Reader* reader, WFSIDCCARDDATA* iccData, XFS::ReadFlags forRead) const;
 
     /** Effectue la transmission de données du paramètre d'entrée vers la puce et reçoit une réponse de celle-ci.
 
@@ -112,13 +225,64 @@ public:// Fonctions appelées dans WFPExecute
         Une paire contenant le tampon à transmettre à l'application (elle gère la libération de la mémoire)
         et le statut d'exécution de la commande.
     */
-    std::pair<WFSIDCCHIPIO*, PCSC::Status> transmit(const WFSIDCCHIPIO* input) const;
+    std::pair<WFSIDCCHIPIO*, PCSC::Status> transmit(const WFSIDCCHIPIO* input);
     /// Effectue la réinitialisation de la puce.
-    std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> reset(XFS::ResetAction action) const;
+    std::pair<WFSIDCCHIPPOWEROUT*, PCSC::Status> reset(XFS::ResetAction action);
+    /** Envoie un code de contrôle au lecteur de la carte présente (voir `Reader::control`).
+    @return
+        Une paire contenant la réponse du lecteur à transmettre à l'application et le statut d'exécution de la commande.
+    */
+    std::pair<WFSIDCPCSCCONTROLOUT*, PCSC::Status> control(const WFSIDCPCSCCONTROL* input);
+    /** Réinitialise l'appareil (WFS_CMD_IDC_RESET) : la carte présente est réinitialisée à froid, ce qui
+        est omis si elle vient d'être mise sous tension et n'a pas servi (voir `Reader::reconnect`), puis
+        l'événement WFS_SRVE_IDC_MEDIADETECTED est envoyé. Sans carte, la commande réussit sans effet.
+    */
+    PCSC::Status resetDevice();
 public:// Fonctions de service
     inline HSERVICE handle() const { return hService; }
-    inline const Settings& settings() const { return mSettings; }
-    inline const std::string& bindedReader() const { return mBindedReaderName; }
+    /// Nom du service logique, étiquette `service` de ses métriques.
+    inline const char* serviceName() const { return mServiceName; }
+    /// Gestionnaire auquel appartient le service.
+    inline Manager& manager() const { return pcsc; }
+    /** Paramètres actuels du service. Une commande doit obtenir l'instantané une seule fois
+        et l'utiliser jusqu'à sa fin, pour ne pas mélanger les anciennes et les nouvelles valeurs.
+    */
+    inline SettingsCache::Snapshot settings() const { return mSettings->get(); }
+    inline ReaderId bindedReaderId() const { return mBindedReader.load(); }
+    /// Moment où la carte actuelle a été détectée dans le lecteur.
+    boost::chrono::steady_clock::time_point cardSeenAt() const;
+    /// Type de la carte actuelle, voir `Settings::cardTypes`.
+    std::string cardType() const;
+    /// Contournements en vigueur pour la carte actuelle, voir `Settings::workaroundsFor`.
+    inline Settings::Workarounds workarounds() const { return settings()->workaroundsFor(cardType()); }
+private:
+    /// Traite le changement d'état du lecteur, voir `notify` et `seed`.
+    void update(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange, bool atOpen);
+    /** Mémorise la carte détectée, lie le service à son lecteur et, selon la politique de connexion,
+        ouvre la connexion avec elle.
+    @param atOpen
+        `true` si la carte était déjà présente à l'ouverture du service.
+    */
+    void cardInserted(const SCARD_READERSTATE& state, ReaderId reader, bool atOpen);
+    /// Voir `connect`. Appelé sous `mCardMutex`.
+    PCSC::Status connectLocked();
+    /** Ouvre la connexion avec la carte insérée, selon la politique `Settings::ConnectEager`. Appelé dans
+        le thread `Manager::worker` : `cardInserted` est appelé sous le verrou de distribution des
+        changements, que SCardConnect ne doit pas bloquer.
+    */
+    static void connectInserted(Manager& manager, HSERVICE hService);
+    /// Oublie la carte retirée, ferme la connexion et rétablit la liaison des paramètres. Appelé sous `mCardMutex`.
+    PCSC::Status close();
+    /// Libère la connexion à la fermeture du service, en la laissant en attente selon le paramètre `linger`.
+    void release();
+    /** Détache le service du lecteur sans toucher à la liaison au lecteur.
+    @param linger
+        Durée en millisecondes pendant laquelle la connexion est gardée pour un service suivant,
+        voir `Reader::detach`.
+    */
+    PCSC::Status disconnect(DWORD linger);
+    /// Lie le service au lecteur spécifié et met à jour l'index des lecteurs du gestionnaire.
+    void bind(ReaderId reader);
 };
 
 #endif // PCSC_CENXFS_BRIDGE_Service_H
\ No newline at end of file
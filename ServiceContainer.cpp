@@ -5,61 +5,131 @@
 
 #include "XFS/Logger.h"
 
+#include <algorithm>
 #include <cassert>
 
+#include <boost/thread/lock_guard.hpp>
+
+Service* ServiceContainer::Snapshot::find(HSERVICE hService) const {
+    ServiceMap::const_iterator it = services.find(hService);
+    if (it == services.end()) {
+        return NULL;
+    }
+    assert(it->second != NULL && "Internal error: no service data for valid service handle");
+    return it->second;
+}
+ServiceContainer::ServiceList& ServiceContainer::Snapshot::listFor(ReaderId reader) {
+    return reader == ReaderNames::none ? unbound : bound[reader];
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ServiceContainer::Ref::Ref(const ServiceContainer& container, HSERVICE hService)
+    : guard(container.epochs), service(container.current.load()->find(hService)) {}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ServiceContainer::ServiceContainer() : current(new Snapshot()) {}
 ServiceContainer::~ServiceContainer() {
-    for (ServiceMap::const_iterator it = services.begin(); it != services.end(); ++it) {
+    // Plus aucune fonction SPI ni le thread de surveillance ne peuvent lire le registre.
+    const Snapshot* last = current.exchange(NULL);
+    for (ServiceMap::const_iterator it = last->services.begin(); it != last->services.end(); ++it) {
         assert(it->second != NULL && "Internal error: no service data while cleanup");
         delete it->second;
     }
-    services.clear();
+    delete last;
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Service& ServiceContainer::create(Manager& manager, HSERVICE hService, const Settings& settings) {
-    assert(!isValid(hService) && "Try to create already registered service");
-    Service* service = new Service(manager, hService, settings);
-    services.insert(std::make_pair(hService, service));
-    return *service;
-}
-Service& ServiceContainer::get(HSERVICE hService) {
-    assert(isValid(hService) && "Try to get not registered service");
-    Service* service = services.find(hService)->second;
-    assert(service != NULL && "Internal error: no service data for valid service handle while get service");
-    return *service;
+bool ServiceContainer::isEmpty() const {
+    EpochDomain::Guard guard(epochs);
+    return current.load()->services.empty();
 }
-void ServiceContainer::remove(HSERVICE hService) {
-    assert(isValid(hService) && "Try to remove not registered service");
-    ServiceMap::iterator it = services.find(hService);
+void ServiceContainer::create(Manager& manager, HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel) {
+    // Le constructeur n'accède pas au registre, il peut donc être appelé hors du verrou.
+    Service* service = new Service(manager, hService, serviceName, settings, traceLevel);
 
-    assert(it->second != NULL && "Internal error: no service data for valid service handle while remove service");
-    // Закрытие PC/SC соединения происходит в деструкторе Service.
-    delete it->second;
-    services.erase(it);
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    Snapshot* next = new Snapshot(*current.load());
+    bool inserted = next->services.insert(std::make_pair(hService, service)).second;
+    assert(inserted && "Try to create already registered service");
+    next->listFor(service->bindedReaderId()).push_back(service);
+    publish(next);
 }
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-bool ServiceContainer::addSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
-    ServiceMap::iterator it = services.find(hService);
-    if (it == services.end()) {
-        return false;
+bool ServiceContainer::remove(HSERVICE hService) {
+    Service* service;
+    {
+        boost::lock_guard<boost::mutex> lock(writeMutex);
+        const Snapshot* prev = current.load();
+        service = prev->find(hService);
+        if (service == NULL) {
+            return false;
+        }
+        Snapshot* next = new Snapshot(*prev);
+        next->services.erase(hService);
+        ServiceList& list = next->listFor(service->bindedReaderId());
+        list.erase(std::remove(list.begin(), list.end(), service), list.end());
+        publish(next);
     }
-    assert(it->second != NULL && "Internal error: no service data for valid service handle while add subscribe");
-    it->second->add(hWndReg, dwEventClass);
+    // La connexion PC/SC est libérée immédiatement, et non lors de la destruction différée de l'objet.
+    // Elle peut être gardée par le lecteur pour le prochain service ouvert sur la même carte.
+    // Hors du verrou : le service prend son propre verrou, sous lequel il peut modifier sa liaison.
+    service->release();
+
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    epochs.retire(service);
     return true;
 }
-bool ServiceContainer::removeSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass) {
-    ServiceMap::iterator it = services.find(hService);
-    if (it == services.end()) {
-        return false;
+void ServiceContainer::rebind(Service& service, ReaderId reader) {
+    boost::lock_guard<boost::mutex> lock(writeMutex);
+    // La liaison est modifiée sous le verrou, pour que `remove` trouve toujours le service
+    // dans la liste correspondant à sa liaison.
+    const ReaderId from = service.mBindedReader.exchange(reader);
+    if (from == reader) {
+        return;
     }
-    assert(it->second != NULL && "Internal error: no service data for valid service handle while remove subscribe");
-    it->second->remove(hWndReg, dwEventClass);
-    return true;
+    const Snapshot* prev = current.load();
+    // Le service a pu être supprimé du registre pendant qu'un autre thread l'utilisait encore.
+    if (prev->find(service.handle()) != &service) {
+        return;
+    }
+    Snapshot* next = new Snapshot(*prev);
+    ServiceList& old = next->listFor(from);
+    old.erase(std::remove(old.begin(), old.end(), &service), old.end());
+    next->listFor(reader).push_back(&service);
+    publish(next);
+}
+void ServiceContainer::publish(Snapshot* next) {
+    const Snapshot* prev = current.exchange(next);
+    epochs.retire(prev);
+    epochs.reclaim();
 }
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void ServiceContainer::notifyChanges(const SCARD_READERSTATE& state, bool deviceChange) {
+void ServiceContainer::notifyChanges(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange) {
     {XFS::Logger() << "ServiceContainer::notifyChanges";}
-    for (ServiceMap::const_iterator it = services.begin(); it != services.end(); ++it) {
-        assert(it->second != NULL && "Internal error: no service data while do notification");
-        it->second->notify(state, deviceChange);
+    // Les services ne s'intéressent pas aux changements du nombre de lecteurs.
+    if (deviceChange) {
+        return;
+    }
+    EpochDomain::Guard guard(epochs);
+    // La notification peut lier ou délier le service à un lecteur, ce qui publie un nouvel instantané.
+    // Celui-ci reste intact et vivant jusqu'à la fin de la section de lecture.
+    const Snapshot* snapshot = current.load();
+    for (ServiceList::const_iterator it = snapshot->unbound.begin(); it != snapshot->unbound.end(); ++it) {
+        (*it)->notify(state, reader, deviceChange);
     }
-}
\ No newline at end of file
+    if (reader != ReaderNames::none) {
+        ReaderMap::const_iterator list = snapshot->bound.find(reader);
+        if (list != snapshot->bound.end()) {
+            for (ServiceList::const_iterator it = list->second.begin(); it != list->second.end(); ++it) {
+                (*it)->notify(state, reader, deviceChange);
+            }
+        }
+    }
+}
+void ServiceContainer::slowCall(const Watchdog::Report& report, const std::string& readerName) const {
+    EpochDomain::Guard guard(epochs);
+    const Snapshot* snapshot = current.load();
+    ReaderMap::const_iterator list = snapshot->bound.find(report.reader);
+    if (list == snapshot->bound.end()) {
+        return;
+    }
+    for (ServiceList::const_iterator it = list->second.begin(); it != list->second.end(); ++it) {
+        (*it)->slowCall(report, readerName);
+    }
+}
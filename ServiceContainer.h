@@ -3,7 +3,19 @@
 
 #pragma once
 
+#include "ReaderNames.h"
+#include "SettingsCache.h"
+#include "Watchdog.h"
+
+#include "Utils/Epoch.h"
+
 #include <map>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 
 // PC/CS API -- pour SCARD_READERSTATE
 #include <winscard.h>
@@ -12,35 +24,94 @@
 
 class Manager;
 class Service;
-class Settings;
-class ServiceContainer {
+/** Registre des services XFS ouverts. Les fonctions SPI de plusieurs applications et le thread de
+    surveillance des lecteurs le consultent en permanence, alors qu'il n'est modifié qu'à l'ouverture,
+    à la fermeture d'un service et lors d'un changement de lecteur lié.
+@par
+    Le contenu du registre est donc un instantané immuable, publié par un pointeur atomique. La lecture
+    se fait sans verrou dans une section de lecture (`Ref` ou `notifyChanges`). Les modifications sont
+    sérialisées par un mutex : elles copient l'instantané, modifient la copie et la publient. L'ancien
+    instantané, ainsi que les services supprimés, sont détruits par `EpochDomain` lorsqu'aucune section
+    de lecture ne peut plus les voir.
+*/
+class ServiceContainer : private boost::noncopyable {
     /// Type pour mapper les services XFS aux cartes PC/SC.
     typedef std::map<HSERVICE, Service*> ServiceMap;
+    /// Liste de services intéressés par les événements d'un même lecteur.
+    typedef std::vector<Service*> ServiceList;
+    /// Type pour mapper les lecteurs aux services qui leur sont liés.
+    typedef std::map<ReaderId, ServiceList> ReaderMap;
+    /// État du registre à un instant donné. N'est jamais modifié après sa publication.
+    struct Snapshot {
+        /// Liste des cartes ouvertes pour l'interaction avec le système XFS.
+        ServiceMap services;
+        /// Index des services liés à un lecteur, par identifiant de lecteur. Permet de ne notifier
+        /// que les services intéressés par le lecteur modifié.
+        ReaderMap bound;
+        /// Services qui ne sont liés à aucun lecteur et qui sont donc intéressés par tous les lecteurs.
+        ServiceList unbound;
+
+        Service* find(HSERVICE hService) const;
+        ServiceList& listFor(ReaderId reader);
+    };
 private:
-    /// Liste des cartes ouvertes pour l'interaction avec le système XFS.
-    ServiceMap services;
+    /// Domaine de récupération des instantanés et des services supprimés. Déclaré en premier,
+    /// pour être détruit en dernier.
+    mutable EpochDomain epochs;
+    /// Instantané courant.
+    boost::atomic<const Snapshot*> current;
+    /// Sérialise les modifications du registre.
+    boost::mutex writeMutex;
 public:
+    /** Accès à un service enregistré. Tant que l'objet existe, le service ne sera pas détruit,
+        même s'il est fermé par un autre thread. Chaque fonction SPI ne recherche ainsi le service qu'une fois.
+    */
+    class Ref : private boost::noncopyable {
+        EpochDomain::Guard guard;
+        Service* service;
+    public:
+        Ref(const ServiceContainer& container, HSERVICE hService);
+        /// @return `true` si le service est enregistré.
+        inline bool isValid() const { return service != NULL; }
+        inline Service& operator*() const { return *service; }
+        inline Service* operator->() const { return service; }
+    };
+public:
+    ServiceContainer();
     ~ServiceContainer();
 public:
-    /** Vérifie que le handle de service spécifié est un handle de carte valide. */
-    inline bool isValid(HSERVICE hService) const {
-        return services.find(hService) != services.end();
-    }
     /** @return true si aucun service n'est enregistré dans le conteneur. */
-    inline bool isEmpty() const { return services.empty(); }
+    bool isEmpty() const;
 
-    Service& create(Manager& manager, HSERVICE hService, const Settings& settings);
-    Service& get(HSERVICE hService);
-    void remove(HSERVICE hService);
-public:// Abonnement aux événements et génération d'événements
-    /** Ajoute la fenêtre spécifiée aux abonnés aux événements spécifiés par le service spécifié.
+    void create(Manager& manager, HSERVICE hService, const char* serviceName, const SettingsCache::SlotPtr& settings, DWORD traceLevel);
+    /** Supprime le service du registre et ferme sa connexion PC/SC. L'objet lui-même sera détruit
+        lorsque plus aucun `Ref` ne le référencera.
     @return `false` si le `hService` spécifié n'est pas enregistré dans l'objet, sinon `true`.
     */
-    bool addSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass);
-    bool removeSubscriber(HSERVICE hService, HWND hWndReg, DWORD dwEventClass);
+    bool remove(HSERVICE hService);
+    /** Lie le service au lecteur spécifié et met à jour l'index des lecteurs.
+    @param service
+        Service dont la liaison change.
+    @param reader
+        Lecteur auquel le service est maintenant lié, ou `ReaderNames::none`.
+    */
+    void rebind(Service& service, ReaderId reader);
 public:
-    /// Notifie tous les services des changements survenus aux lecteurs.
-    void notifyChanges(const SCARD_READERSTATE& state, bool deviceChange);
+    /** Notifie les services intéressés des changements survenus au lecteur : ceux qui lui sont liés
+        et ceux qui ne sont liés à aucun lecteur.
+    @param state
+        État du lecteur modifié.
+    @param reader
+        Identifiant du lecteur modifié.
+    @param deviceChange
+        Si `true`, alors le changement concerne le nombre de lecteurs.
+    */
+    void notifyChanges(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange);
+    /// Signale l'appel PC/SC lent aux services liés à son lecteur, voir `Service::slowCall`.
+    void slowCall(const Watchdog::Report& report, const std::string& readerName) const;
+private:
+    /// Publie l'instantané modifié et confie l'ancien à la récupération. Appelé sous `writeMutex`.
+    void publish(Snapshot* next);
 };
 
-#endif // PCSC_CENXFS_BRIDGE_ServiceContainer_H
\ No newline at end of file
+#endif // PCSC_CENXFS_BRIDGE_ServiceContainer_H
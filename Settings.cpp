@@ -1,136 +1,115 @@
 #include "Settings.h"
 
+#include "ConfigSource.h"
+
 #include "XFS/Logger.h"
 
+#include <sstream>
 #include <string>
-#include <vector>
-// API XFS pour les fonctions d'accès au registre.
-#include <xfsconf.h>
-
-/// Classe pour fermer automatiquement les clés de registre ouvertes lorsqu'elles ne sont plus nécessaires.
-class RegKey {
-    HKEY hKey;
-public:
-    inline RegKey(HKEY root, const char* name) {
-        HRESULT r = WFMOpenKey(root, (LPSTR)name, &hKey);
 
-        XFS::Logger() << "RegKey::RegKey(root=" << root << ", name=" << name << ", hKey=&" << hKey << ") = "  << r;
+/// Convertit la valeur `ConnectPolicy` du registre. Une valeur absente ou inconnue donne `ConnectEager`.
+static Settings::ConnectPolicy parseConnectPolicy(const std::string& value) {
+    if (value == "lazy") {
+        return Settings::ConnectLazy;
     }
-    inline ~RegKey() {
-        HRESULT r = WFMCloseKey(hKey);
-
-        XFS::Logger() << "WFMCloseKey(hKey=" << hKey << ") = " << r;
+    if (value == "speculative") {
+        return Settings::ConnectSpeculative;
     }
-
-    inline RegKey child(const char* name) const {
-        return RegKey(hKey, name);
+    return Settings::ConnectEager;
+}
+const char* connectPolicyName(Settings::ConnectPolicy policy) {
+    switch (policy) {
+        case Settings::ConnectLazy:        return "lazy";
+        case Settings::ConnectSpeculative: return "speculative";
+        default:                           return "eager";
     }
-    /** Obtient la valeur de la clé de registre avec le nom spécifié.
-    @param name
-        Nom de la valeur dans la clé de registre à obtenir. La valeur par défaut (`NULL`)
-        signifie que la valeur par défaut de la clé doit être obtenue.
+}
 
-    @return
-        Chaîne contenant la valeur de la clé. Si la valeur n'existe pas, retourne une chaîne vide.
-    */
-    inline std::string value(const char* name = NULL) const {
-        // Détermine la taille de la valeur de la clé.
-        DWORD dwSize = 0;
-        HRESULT r = WFMQueryValue(hKey, (LPSTR)name, NULL, &dwSize);
+Settings::Settings(const ConfigSource& source, const std::string& providerName)
+    : providerName(providerName)
+    , traceLevel(0)
+    , exclusive(false)
+    , linger(0)
+    , connectPolicy(ConnectEager)
+    , contactless(false)
+    , control(false)
+{
+    reread(source);
+}
+void Settings::reread(const ConfigSource& source) {
+    const std::string pcscSettings = "SERVICE_PROVIDERS\\" + providerName;
+    readerName = source.value(pcscSettings, "ReaderName");
+    traceLevel = source.dwValue(pcscSettings, "TraceLevel");
+    exclusive  = source.dwValue(pcscSettings, "Exclusive") != 0;
+    linger     = source.dwValue(pcscSettings, "Linger");
+    connectPolicy = parseConnectPolicy(source.value(pcscSettings, "ConnectPolicy"));
+    contactless   = source.dwValue(pcscSettings, "Contactless") != 0;
+    control       = source.dwValue(pcscSettings, "Control") != 0;
+
+    // Seuils des appels PC/SC lents
+    const std::string watchdogSettings = pcscSettings + "\\Watchdog";
+    watchdog.connect   = source.dwValue(watchdogSettings, "Connect");
+    watchdog.transmit  = source.dwValue(watchdogSettings, "Transmit");
+    watchdog.reconnect = source.dwValue(watchdogSettings, "Reconnect");
+    watchdog.status    = source.dwValue(watchdogSettings, "Status");
+    watchdog.cancel    = source.dwValue(watchdogSettings, "Cancel") != 0;
 
-        {XFS::Logger() << "RegKey::value[size](name=" << name << ", size=&" << dwSize << ") = " << r;}
-        // Utilise un vecteur car il garantit la continuité de la mémoire pour les données,
-        // ce qui n'est pas le cas avec string.
-        // dwSize contient la longueur de la chaîne sans le NULL final, mais il est écrit dans la valeur de sortie.
-        std::vector<char> value(dwSize+1);
-        if (dwSize > 0) {
-            dwSize = value.capacity();
-            r = WFMQueryValue(hKey, (LPSTR)name, &value[0], &dwSize);
-            {XFS::Logger() << "RegKey::value[value](name=" << name << ", value=&" << &value[0] << ", size=&" << dwSize << ") = " << r;}
+    // Paramètres pour contourner divers problèmes
+    const std::string workaroundSettings = pcscSettings + "\\Workarounds";
+    workarounds.correctChipIO = source.dwValue(workaroundSettings, "CorrectChipIO") != 0;
+    workarounds.canEject = source.dwValue(workaroundSettings, "CanEject") != 0;
+
+    const std::string track2Settings = workaroundSettings + "\\Track2";
+    workarounds.track2.report = source.dwValue(track2Settings, "Report") != 0;
+    workarounds.track2.value = source.value(track2Settings, NULL);
+    workarounds.track2.fromChip = source.dwValue(track2Settings, "FromChip") != 0;
+    workarounds.track2.fromChipGpo = source.dwValue(track2Settings, "FromChipGpo") != 0;
+
+    // Types de cartes et leurs contournements
+    const std::string cardTypeSettings = pcscSettings + "\\CardTypes";
+    const std::string database = source.value(cardTypeSettings, "Database");
+    cardTypes = database.empty() ? CardTypes::Ptr() : CardTypes::load(database);
+    profiles.clear();
+    if (cardTypes) {
+        const std::vector<std::string>& names = cardTypes->names();
+        for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+            const std::string profileSettings = cardTypeSettings + '\\' + *it;
+            Profile p;
+            p.correctChipIO  = source.dwValue(profileSettings, "CorrectChipIO") != 0;
+            p.track2FromChip = source.dwValue(profileSettings, "Track2FromChip") != 0;
+            if (p.correctChipIO || p.track2FromChip) {
+                profiles[*it] = p;
+            }
         }
-        std::string result = std::string(value.begin(), value.end()-1);
-
-        XFS::Logger() << "RegKey::value(name=" << name << ") = " << result;
-        return result;
     }
-    inline DWORD dwValue(const char* name) const {
-        // Détermine la taille de la valeur de la clé.
-        DWORD result = 0;
-        DWORD dwSize = sizeof(DWORD);
-        HRESULT r = WFMQueryValue(hKey, (LPSTR)name, (LPSTR)&result, &dwSize);
 
-        XFS::Logger() << "RegKey::value(name=" << name << ") = " << result;
-        return result;
+    XFS::Logger() << "Settings::reread: Nouveaux paramètres lus : " << toJSONString();
+}
+std::string Settings::classify(const std::vector<BYTE>& atr) const {
+    if (!cardTypes) {
+        return std::string();
     }
-    /// Fonction de débogage pour afficher dans la trace toutes les clés enfants.
-    void keys() const {
-        {XFS::Logger() << "keys";}
-        std::vector<char> keyName(256);
-        for (DWORD i = 0; ; ++i) {
-            DWORD size = keyName.capacity();
-            HRESULT r = WFMEnumKey(hKey, i, &keyName[0], &size, NULL);
-            if (r == WFS_ERR_CFG_NO_MORE_ITEMS) {
-                break;
-            }
-            keyName[size] = '\0';
-
-            XFS::Logger() << &keyName[0];
-        }
+    return cardTypes->classify(atr.empty() ? NULL : &atr[0], (DWORD)atr.size());
+}
+Settings::Workarounds Settings::workaroundsFor(const std::string& cardType) const {
+    Workarounds result = workarounds;
+    ProfileMap::const_iterator it = profiles.find(cardType);
+    if (it != profiles.end()) {
+        result.correctChipIO = result.correctChipIO || it->second.correctChipIO;
+        result.track2.fromChip = result.track2.fromChip || it->second.track2FromChip;
     }
-    /// Fonction de débogage pour afficher dans la trace toutes les valeurs enfants de la clé.
-    /// Une valeur de clé est une paire (nom=valeur).
-    void values() const {
-        {XFS::Logger() << "values";}
-        // Malheureusement, il est impossible de connaître les longueurs spécifiques à l'avance.
-        std::vector<char> name(256);
-        std::vector<char> value(256);
-        for (DWORD i = 0; ; ++i) {
-            DWORD szName = name.capacity();
-            DWORD szValue = value.capacity();
-            HRESULT r = WFMEnumValue(hKey, i, &name[0], &szName, &value[0], &szValue);
-            if (r == WFS_ERR_CFG_NO_MORE_ITEMS) {
-                break;
-            }
-            name[szName] = '\0';
-            value[szValue] = '\0';
-
-            XFS::Logger()
-                << i << ": " << '('<<szName<<','<<szValue<<')' << std::string(name.begin(), name.begin()+szName) << "="
-                << std::string(value.begin(), value.begin()+szValue);
+    return result;
+}
+bool Settings::track2FromChip() const {
+    if (workarounds.track2.fromChip) {
+        return true;
+    }
+    for (ProfileMap::const_iterator it = profiles.begin(); it != profiles.end(); ++it) {
+        if (it->second.track2FromChip) {
+            return true;
         }
     }
-};
-
-Settings::Settings(const char* serviceName, int traceLevel)
-    : traceLevel(traceLevel)
-    , exclusive(false)
-{
-    // Chez Kalignite, le fournisseur n'apparaît pas sous cette racine s'il est dans
-    // HKEY_LOCAL_MACHINE\SOFTWARE\XFS\SERVICE_PROVIDERS\
-    // HKEY root = WFS_CFG_HKEY_XFS_ROOT;
-    HKEY root = WFS_CFG_USER_DEFAULT_XFS_ROOT;// HKEY_USERS\.DEFAULT\XFS
-    providerName = RegKey(root, "LOGICAL_SERVICES").child(serviceName).value("provider");
-
-    reread();
-}
-void Settings::reread() {
-    HKEY root = WFS_CFG_USER_DEFAULT_XFS_ROOT;// HKEY_USERS\.DEFAULT\XFS
-
-    RegKey pcscSettings = RegKey(root, "SERVICE_PROVIDERS").child(providerName.c_str());
-    readerName = pcscSettings.value("ReaderName");
-    traceLevel = pcscSettings.dwValue("TraceLevel");
-    exclusive  = pcscSettings.dwValue("Exclusive") != 0;
-
-    // Paramètres pour contourner divers problèmes
-    RegKey workaroundSettings = pcscSettings.child("Workarounds");
-    workarounds.correctChipIO = workaroundSettings.dwValue("CorrectChipIO") != 0;
-    workarounds.canEject = workaroundSettings.dwValue("CanEject") != 0;
-
-    RegKey track2Settings = workaroundSettings.child("Track2");
-    workarounds.track2.report = track2Settings.dwValue("Report") != 0;
-    workarounds.track2.value = track2Settings.value();
-
-    XFS::Logger() << "Settings::reread: Nouveaux paramètres lus : " << toJSONString();
+    return false;
 }
 std::string Settings::toJSONString() const {
     std::stringstream ss;
@@ -139,10 +118,26 @@ std::string Settings::toJSONString() const {
     ss << "\tReaderName: " << readerName << ",\n";
     ss << "\tTraceLevel: " << traceLevel << ",\n";
     ss << "\tExclusive: " << std::boolalpha << exclusive << ",\n";
+    ss << "\tLinger: " << linger << ",\n";
+    ss << "\tConnectPolicy: " << connectPolicyName(connectPolicy) << ",\n";
+    ss << "\tContactless: " << std::boolalpha << contactless << ",\n";
+    ss << "\tControl: " << std::boolalpha << control << ",\n";
+    ss << "\tWatchdog.Connect: " << watchdog.connect << ",\n";
+    ss << "\tWatchdog.Transmit: " << watchdog.transmit << ",\n";
+    ss << "\tWatchdog.Reconnect: " << watchdog.reconnect << ",\n";
+    ss << "\tWatchdog.Status: " << watchdog.status << ",\n";
+    ss << "\tWatchdog.Cancel: " << std::boolalpha << watchdog.cancel << ",\n";
     ss << "\tWorkarounds.CorrectChipIO: " << std::boolalpha << workarounds.correctChipIO << ",\n";
     ss << "\tWorkarounds.CanEject: " << std::boolalpha << workarounds.canEject << ",\n";
     ss << "\tWorkarounds.Track2.Report: " << std::boolalpha << workarounds.track2.report << ",\n";
     ss << "\tWorkarounds.Track2.Value: " << workarounds.track2.value << ",\n";
+    ss << "\tWorkarounds.Track2.FromChip: " << std::boolalpha << workarounds.track2.fromChip << ",\n";
+    ss << "\tWorkarounds.Track2.FromChipGpo: " << std::boolalpha << workarounds.track2.fromChipGpo << ",\n";
+    ss << "\tCardTypes: " << (cardTypes ? cardTypes->names().size() : 0) << ",\n";
+    for (ProfileMap::const_iterator it = profiles.begin(); it != profiles.end(); ++it) {
+        ss << "\tCardTypes." << it->first << ".CorrectChipIO: " << std::boolalpha << it->second.correctChipIO << ",\n";
+        ss << "\tCardTypes." << it->first << ".Track2FromChip: " << std::boolalpha << it->second.track2FromChip << ",\n";
+    }
     ss << '}';
     return ss.str();
 }
\ No newline at end of file
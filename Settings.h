@@ -3,8 +3,16 @@
 
 #pragma once
 
+#include "CardTypes.h"
+
+#include <map>
 #include <string>
+#include <vector>
+
+// Pour DWORD
+#include <windef.h>
 
+class ConfigSource;
 class Settings
 {
 public:
@@ -33,8 +41,26 @@ public:
                 se terminera avec le statut `WFS_IDC_DATAMISSING`.
             */
             std::string value;
+            /** Lire la piste 2 dans la puce : l'équivalent de la piste 2 (étiquette EMV `57`) est pris dans
+                les réponses de la puce déjà reçues, ou obtenu par les commandes SELECT et READ RECORD (voir
+                `fromChipGpo`), puis gardé jusqu'au retrait de la carte.
+            @par Effet
+                Si activé, lors de l'interrogation des capacités de l'appareil, il est indiqué que l'appareil peut lire
+                la deuxième piste, et sa lecture retourne les données de la carte présente au lieu de `value`.
+            @par Valeur par défaut
+                Par défaut, le paramètre est désactivé.
+            */
+            bool fromChip;
+            /** Si l'étiquette `57` n'est ni dans le FCI de l'application, ni dans ses premiers enregistrements,
+                envoyer GET PROCESSING OPTIONS avec un PDOL rempli de zéros et lire les enregistrements de l'AFL.
+                GET PROCESSING OPTIONS démarre une transaction EMV et incrémente le compteur de transactions
+                de l'application (ATC) : ne l'activer que si l'application ne lit pas la puce elle-même.
+            @par Valeur par défaut
+                Par défaut, le paramètre est désactivé.
+            */
+            bool fromChipGpo;
         public:
-            Track2() : report(false) {}
+            Track2() : report(false), fromChip(false), fromChipGpo(false) {}
         };
     public:
         /** Kalignite, pour une raison quelconque, lorsqu'il utilise le protocole de communication T0, envoie des commandes pour
@@ -67,6 +93,54 @@ public:
     public:
         Workarounds() : correctChipIO(false) {}
     };
+    /** Seuils de durée des appels PC/SC, en millisecondes, au-delà desquels l'appel est signalé comme lent
+        (voir `Watchdog`). Un seuil `0` désactive la surveillance de l'appel.
+    @par Valeur par défaut
+        Par défaut, tous les seuils sont à `0` et l'interruption est désactivée.
+    */
+    class Watchdog {
+    public:
+        /// Seuil de `SCardConnect`.
+        DWORD connect;
+        /// Seuil de `SCardTransmit`.
+        DWORD transmit;
+        /// Seuil de `SCardReconnect`.
+        DWORD reconnect;
+        /// Seuil de `SCardStatus`.
+        DWORD status;
+        /** Si `true`, un appel qui dépasse son seuil est interrompu par `SCardCancel` sur le contexte
+            du lecteur. PC/SC n'interrompt que les appels qui attendent, les autres se terminent normalement.
+        */
+        bool cancel;
+    public:
+        Watchdog() : connect(0), transmit(0), reconnect(0), status(0), cancel(false) {}
+    };
+    /** Contournements propres à un type de carte (voir `CardTypes`), lus dans la sous-section
+        `CardTypes\<type>`. Ils s'ajoutent à ceux de `workarounds` : un profil ne peut qu'activer
+        un contournement pour les cartes de son type.
+    */
+    class Profile {
+    public:
+        /// Voir `Workarounds::correctChipIO`.
+        bool correctChipIO;
+        /// Voir `Workarounds::Track2::fromChip`.
+        bool track2FromChip;
+    public:
+        Profile() : correctChipIO(false), track2FromChip(false) {}
+    };
+    typedef std::map<std::string, Profile> ProfileMap;
+    /// Moment où le service ouvre la connexion avec la carte détectée dans le lecteur.
+    enum ConnectPolicy {
+        /// Dès que la carte est détectée, y compris à l'ouverture du service si elle est déjà présente.
+        ConnectEager,
+        /// À la première commande qui a besoin de la puce (`WFS_CMD_IDC_READ_RAW_DATA`,
+        /// `WFS_CMD_IDC_CHIP_IO`, `WFS_CMD_IDC_CHIP_POWER`, `WFPLock`). Convient aux scénarios
+        /// qui ne lisent que la piste magnétique.
+        ConnectLazy,
+        /// À l'ouverture du service (`WFPOpen`), si le lecteur signale déjà une carte ; les cartes
+        /// insérées ensuite sont connectées comme avec `ConnectLazy`.
+        ConnectSpeculative
+    };
 public:// Paramètres non relus.
     /// Nom du fournisseur lui-même. Ne change pas après la création des paramètres.
     std::string providerName;
@@ -81,14 +155,61 @@ public:// Paramètres relus par la fonction reread()
         Par défaut, le mode exclusif n'est pas utilisé.
     */
     bool exclusive;
+    /** Durée en millisecondes pendant laquelle la connexion avec la carte est gardée ouverte après
+        la fermeture du service (`WFPClose`). Un service ouvert pendant ce temps sur le même lecteur,
+        qui y voit la même carte, reprend la connexion sans reconnexion ni réinitialisation de la carte.
+    @par Valeur par défaut
+        Par défaut, `0` : la connexion est fermée avec le service.
+    */
+    DWORD linger;
+    /** Moment de l'ouverture de la connexion avec la carte, voir `ConnectPolicy`. Lu depuis la valeur
+        `ConnectPolicy` du registre : `eager`, `lazy` ou `speculative`.
+    @par Valeur par défaut
+        Par défaut, `ConnectEager`.
+    */
+    ConnectPolicy connectPolicy;
+    /** Si `true`, les indicateurs `WFS_IDC_PCSC_UID` et `WFS_IDC_PCSC_ATS` de `WFS_CMD_IDC_READ_RAW_DATA`
+        (voir `XFS/Vendor.h`) sont lus sur la carte par la pseudo-commande GET DATA de PC/SC partie 3 :
+        un passage de carte sans contact est servi par une seule fin de commande, sans `WFS_CMD_IDC_CHIP_IO`.
+    @par Valeur par défaut
+        Par défaut, le paramètre est désactivé : ces indicateurs sont signalés comme non supportés.
+    */
+    bool contactless;
+    /** Si `true`, la commande `WFS_CMD_IDC_PCSC_CONTROL` (voir `XFS/Vendor.h`) transmet au lecteur les codes
+        de contrôle des fonctions qu'il annonce (saisie sécurisée du code PIN, affichage, échappement du fabricant).
+    @par Valeur par défaut
+        Par défaut, le paramètre est désactivé : la commande n'est pas supportée.
+    */
+    bool control;
+    /// Seuils de signalement des appels PC/SC lents.
+    Watchdog watchdog;
     /// Paramètres concernant le contournement des bugs d'implémentation du sous-système XFS dans Kalignite.
     Workarounds workarounds;
+    /** Base des motifs d'ATR, compilée à chaque lecture des paramètres depuis le fichier désigné par
+        la valeur `Database` de la sous-section `CardTypes`.
+    @par Valeur par défaut
+        Par défaut, `NULL` : les cartes ne sont pas classées.
+    */
+    CardTypes::Ptr cardTypes;
+    /// Contournements de chaque type de carte de `cardTypes` qui en a.
+    ProfileMap profiles;
 public:
-    Settings(const char* serviceName, int traceLevel);
+    /// Lit les paramètres du fournisseur de service spécifié dans la source de configuration.
+    Settings(const ConfigSource& source, const std::string& providerName);
 
     /// Relit tous les paramètres du fournisseur de service, sauf le nom du fournisseur de service.
-    void reread();
+    void reread(const ConfigSource& source);
     std::string toJSONString() const;
+
+    /// Type de la carte d'ATR spécifié, chaîne vide si la base des motifs n'est pas configurée.
+    std::string classify(const std::vector<BYTE>& atr) const;
+    /// Contournements en vigueur pour les cartes du type spécifié : ceux de `workarounds` et de son profil.
+    Workarounds workaroundsFor(const std::string& cardType) const;
+    /// `true` si la piste 2 est lue dans la puce, pour toutes les cartes ou pour un type de carte.
+    bool track2FromChip() const;
 };
 
+/// Nom de la politique de connexion, tel qu'il est écrit dans le registre.
+const char* connectPolicyName(Settings::ConnectPolicy policy);
+
 #endif // PCSC_CENXFS_BRIDGE_Settings_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "SettingsCache.h"
+
+#include "XFS/Logger.h"
+
+#include <boost/thread/lock_guard.hpp>
+
+/// Période de vérification de la demande d'arrêt du thread de surveillance, en millisecondes.
+static const DWORD watchPeriod = 250;
+/// Délai pendant lequel les modifications successives de la configuration sont regroupées en une seule relecture.
+static const DWORD reloadDelay = 200;
+
+SettingsCache::SettingsCache()
+    : source(ConfigSource::open())
+    , stopRequested(false)
+{
+    watchThread.reset(new boost::thread(&SettingsCache::run, this));
+}
+SettingsCache::~SettingsCache() {
+    stopRequested = true;
+    watchThread->join();
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+SettingsCache::SlotPtr SettingsCache::get(const char* serviceName) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    ProviderMap::iterator p = providers.find(serviceName);
+    if (p == providers.end()) {
+        p = providers.insert(std::make_pair(std::string(serviceName), source->provider(serviceName))).first;
+    }
+    SlotPtr& slot = slots[p->second];
+    if (!slot) {
+        slot.reset(new Slot(Snapshot(new Settings(*source, p->second))));
+    }
+    return slot;
+}
+void SettingsCache::reload() {
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    source->reload();
+    providers.clear();
+    for (SlotMap::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+        it->second->set(Snapshot(new Settings(*source, it->first)));
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void SettingsCache::run() {
+    while (!stopRequested) {
+        if (!source->waitChange(watchPeriod)) {
+            continue;
+        }
+        // Les outils d'édition écrivent les valeurs une par une : laisse passer la rafale.
+        while (!stopRequested && source->waitChange(reloadDelay)) {}
+        if (!stopRequested) {
+            {XFS::Logger() << "SettingsCache: configuration changed, reloading settings"; }
+            reload();
+        }
+    }
+}
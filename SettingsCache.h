@@ -0,0 +1,79 @@
+#ifndef PCSC_CENXFS_BRIDGE_SettingsCache_H
+#define PCSC_CENXFS_BRIDGE_SettingsCache_H
+
+#pragma once
+
+#include "ConfigSource.h"
+#include "Settings.h"
+
+#include <map>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Cache des paramètres des fournisseurs de services, partagé par tout le processus.
+@par
+    Les paramètres de chaque fournisseur ne sont lus dans la source de configuration (voir `ConfigSource`)
+    qu'une seule fois, à la première ouverture d'un service qui l'utilise. `WFPOpen` ne paie donc plus
+    les accès au registre.
+@par
+    Un thread surveille la source de configuration. À chaque modification, les paramètres de tous les
+    fournisseurs connus sont relus, et les nouvelles valeurs sont publiées sous forme d'instantanés
+    immuables, remplacés atomiquement : les services ouverts voient les nouvelles valeurs à leur
+    prochaine commande, sans verrou.
+*/
+class SettingsCache : private boost::noncopyable {
+public:
+    /// Instantané immuable des paramètres d'un fournisseur.
+    typedef boost::shared_ptr<const Settings> Snapshot;
+    /// Emplacement des paramètres d'un fournisseur, dont l'instantané est remplacé à chaque relecture.
+    class Slot : private boost::noncopyable {
+        Snapshot current;
+    public:
+        explicit Slot(const Snapshot& snapshot) : current(snapshot) {}
+        /// Instantané actuel. Peut être appelé depuis n'importe quel thread.
+        inline Snapshot get() const { return boost::atomic_load(&current); }
+        /// Publie un nouvel instantané.
+        inline void set(const Snapshot& snapshot) { boost::atomic_store(&current, snapshot); }
+    };
+    typedef boost::shared_ptr<Slot> SlotPtr;
+private:
+    typedef std::map<std::string, std::string> ProviderMap;
+    typedef std::map<std::string, SlotPtr> SlotMap;
+private:
+    /// Source de la configuration, choisie au chargement.
+    ConfigSource::Ptr source;
+    /// Protège `providers` et `slots`, et sérialise les lectures de la source.
+    boost::mutex mutex;
+    /// Nom du fournisseur configuré pour chaque service logique déjà ouvert.
+    ProviderMap providers;
+    /// Paramètres de chaque fournisseur déjà utilisé.
+    SlotMap slots;
+    /// Flag positionné lors de la destruction du cache, pour arrêter le thread de surveillance.
+    boost::atomic<bool> stopRequested;
+    /// Thread de surveillance des modifications de la configuration.
+    boost::shared_ptr<boost::thread> watchThread;
+public:
+    /// Ouvre la source de configuration et démarre sa surveillance.
+    SettingsCache();
+    /// Arrête la surveillance et attend la fin du thread.
+    ~SettingsCache();
+
+    /** Obtient les paramètres utilisés par le service logique spécifié. Lit la source de configuration
+        seulement lors du premier appel pour ce service et ce fournisseur.
+    */
+    SlotPtr get(const char* serviceName);
+    /** Relit les paramètres de tous les fournisseurs connus et publie les nouveaux instantanés.
+        La correspondance entre services logiques et fournisseurs sera relue à la prochaine ouverture.
+    */
+    void reload();
+private:
+    /// Boucle du thread de surveillance.
+    void run();
+};
+
+#endif // PCSC_CENXFS_BRIDGE_SettingsCache_H
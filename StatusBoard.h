@@ -0,0 +1,107 @@
+#ifndef PCSC_CENXFS_BRIDGE_StatusBoard_H
+#define PCSC_CENXFS_BRIDGE_StatusBoard_H
+
+#pragma once
+
+// Pour std::memcpy
+#include <cstring>
+
+#include <windows.h>
+
+/** Tableau d'état des lecteurs, publié en mémoire partagée par tous les processus qui chargent
+    le fournisseur de services (voir `StatusPublisher`). Les outils de supervision le lisent
+    directement, sans passer par le gestionnaire XFS ni par PC/SC :
+@code
+HANDLE h = OpenFileMappingA(FILE_MAP_READ, FALSE, "Global\\PCSC-CENXFS-Bridge-Status");
+// ou "Local\\..." si le processus n'a pas pu créer l'objet global
+const StatusBoard::Header* board = (const StatusBoard::Header*)MapViewOfFile(h, FILE_MAP_READ, 0, 0, 0);
+if (board->magic == StatusBoard::magic && board->version == StatusBoard::version) {
+    for (LONG i = 0; i < board->rowCount; ++i) {
+        StatusBoard::Row row;
+        if (StatusBoard::read(board->rows[i], row)) { ... }
+    }
+}
+@endcode
+@par
+    Ce fichier ne dépend que de `windows.h`, pour pouvoir être repris tel quel par les outils.
+    Toute modification de la disposition doit incrémenter `version`.
+*/
+namespace StatusBoard {
+    /// Signature 'PCSB' au début de la mémoire partagée.
+    static const DWORD magic = 0x42534350;
+    static const DWORD version = 1;
+    /// Nom de l'objet de mémoire partagée, précédé de `Global\` ou `Local\`.
+    static const char* const name = "PCSC-CENXFS-Bridge-Status";
+    /// Nombre maximal de lecteurs publiés.
+    static const LONG maxRows = 32;
+
+    /** État d'un lecteur, protégé par un verrou séquentiel (seqlock) : l'écrivain rend `seq` impair
+        avant la modification et pair après. Le lecteur copie la ligne et recommence si `seq` était
+        impair ou a changé pendant la copie (voir `read`).
+    @par
+        Les compteurs sont cumulés par tous les processus. Les compteurs d'insertions et de retraits
+        ne comptent que les changements réels de l'état publié : chaque processus voit le même
+        changement, seul le premier qui le publie le compte.
+    */
+    struct Row {
+        volatile LONG seq;
+        /// Nom PC/SC du lecteur, terminé par zéro. Ne change plus une fois la ligne attribuée.
+        CHAR name[128];
+        /// État du périphérique, constante `WFS_IDC_DEV*`.
+        WORD fwDevice;
+        /// État du support, constante `WFS_IDC_MEDIA*`.
+        WORD fwMedia;
+        /// Dernier état signalé par PC/SC (`SCARD_STATE_*`), sans le compteur d'événements.
+        DWORD pcscState;
+        DWORD cbAtr;
+        BYTE atr[36];
+        /// Moment du dernier changement d'état, en `FILETIME` UTC.
+        ULONGLONG lastEvent;
+        /// Nombre de changements d'état.
+        LONG events;
+        /// Nombre d'insertions de carte.
+        LONG insertions;
+        /// Nombre de retraits de carte.
+        LONG removals;
+        /// Nombre de connexions à la carte ouvertes (`SCardConnect`), tous processus confondus.
+        volatile LONG connects;
+        /// Nombre d'échanges APDU (`SCardTransmit`), tous processus confondus.
+        volatile LONG transmits;
+        /// Nombre d'échecs de connexion et d'échange.
+        volatile LONG errors;
+    };
+    struct Header {
+        /// Écrit en dernier par le processus qui crée la mémoire partagée.
+        volatile DWORD magic;
+        DWORD version;
+        DWORD rowSize;
+        /// Nombre de lignes attribuées. Les lignes ne sont jamais libérées.
+        volatile LONG rowCount;
+        /// Verrou d'attribution des lignes, pris par les écrivains seulement.
+        volatile LONG allocLock;
+        Row rows[maxRows];
+    };
+
+    /** Copie une ligne de façon cohérente.
+    @param attempts
+        Nombre de tentatives tant qu'une écriture est en cours.
+    @return `false` si la ligne était en cours de modification à chaque tentative.
+    */
+    inline bool read(const Row& row, Row& copy, unsigned attempts = 1000) {
+        for (unsigned i = 0; i < attempts; ++i) {
+            LONG before = row.seq;
+            MemoryBarrier();
+            if ((before & 1) == 0) {
+                std::memcpy(&copy, (const void*)&row, sizeof(copy));
+                MemoryBarrier();
+                if (row.seq == before) {
+                    return true;
+                }
+            }
+            YieldProcessor();
+        }
+        return false;
+    }
+} // namespace StatusBoard
+
+#endif // PCSC_CENXFS_BRIDGE_StatusBoard_H
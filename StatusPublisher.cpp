@@ -0,0 +1,198 @@
+#include "StatusPublisher.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::strncmp et std::strncpy
+#include <cstring>
+#include <string>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- constantes WFS_IDC_*
+#include <XFSIDC.h>
+
+/** Durée pendant laquelle le verrou peut rester pris par la même écriture avant d'être considéré comme
+    abandonné : un processus tué au milieu d'une écriture laisse le verrou pris, alors qu'une écriture ne
+    dure que quelques microsecondes, même quand l'ordonnanceur d'une machine chargée interrompt l'écrivain.
+*/
+static const boost::chrono::seconds abandonAfter(2);
+/// Nombre de tentatives actives, après lesquelles l'attente cède le processeur entre deux tentatives.
+static const unsigned maxSpins = 1000;
+
+/// Prend le verrou séquentiel : rend `seq` impair.
+static void lock(volatile LONG& seq) {
+    namespace bc = boost::chrono;
+    // Valeur impaire du verrou pris et moment où elle a été vue la première fois. Une autre valeur
+    // impaire signifie que le verrou a été libéré et repris entre-temps : l'écrivain est vivant.
+    LONG held = 0;
+    bc::steady_clock::time_point since;
+    for (unsigned i = 0; ; ++i) {
+        LONG s = seq;
+        if ((s & 1) == 0) {
+            if (InterlockedCompareExchange(&seq, s + 1, s) == s) {
+                return;
+            }
+        } else if (s != held) {
+            held = s;
+            since = bc::steady_clock::now();
+        } else if (bc::steady_clock::now() - since >= abandonAfter) {
+            // Reprend le verrou abandonné, `seq` reste impair.
+            if (InterlockedCompareExchange(&seq, s + 2, s) == s) {
+                {XFS::Logger() << "StatusPublisher: took over lock abandoned for " << abandonAfter.count() << " s"; }
+                return;
+            }
+        }
+        if (i < maxSpins) {
+            YieldProcessor();
+        } else {
+            Sleep(1);
+        }
+    }
+}
+/// Libère le verrou séquentiel : rend `seq` pair. L'opération atomique sert aussi de barrière.
+static void unlock(volatile LONG& seq) {
+    InterlockedIncrement(&seq);
+}
+static WORD translateDevice(DWORD state) {
+    if (state & (SCARD_STATE_UNAVAILABLE | SCARD_STATE_UNKNOWN | SCARD_STATE_IGNORE)) {
+        return WFS_IDC_DEVNODEVICE;
+    }
+    return WFS_IDC_DEVONLINE;
+}
+static WORD translateMedia(DWORD state) {
+    if (state & SCARD_STATE_PRESENT) {
+        return WFS_IDC_MEDIAPRESENT;
+    }
+    if (state & SCARD_STATE_EMPTY) {
+        return WFS_IDC_MEDIANOTPRESENT;
+    }
+    return WFS_IDC_MEDIAUNKNOWN;
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StatusPublisher::StatusPublisher() : hMapping(NULL), board(NULL) {
+    // L'objet global est visible des outils des autres sessions, mais sa création demande un privilège
+    // que les applications n'ont pas toujours.
+    const char* prefixes[] = { "Global\\", "Local\\" };
+    for (std::size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]) && hMapping == NULL; ++i) {
+        hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(StatusBoard::Header),
+            (std::string(prefixes[i]) + StatusBoard::name).c_str()
+        );
+    }
+    if (hMapping == NULL) {
+        {XFS::Logger() << "StatusPublisher: CreateFileMapping failed: " << GetLastError(); }
+        return;
+    }
+    const bool created = GetLastError() != ERROR_ALREADY_EXISTS;
+    StatusBoard::Header* header = (StatusBoard::Header*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatusBoard::Header));
+    if (header == NULL) {
+        // La mémoire partagée existante est plus petite : elle a été créée par une autre version.
+        {XFS::Logger() << "StatusPublisher: MapViewOfFile failed: " << GetLastError(); }
+        return;
+    }
+    if (created) {
+        // La mémoire est initialisée à zéro par le système.
+        header->version = StatusBoard::version;
+        header->rowSize = sizeof(StatusBoard::Row);
+        MemoryBarrier();
+        header->magic = StatusBoard::magic;
+    } else {
+        // Le processus qui l'a créée est peut-être encore en train de l'initialiser.
+        for (int i = 0; i < 100 && header->magic != StatusBoard::magic; ++i) {
+            Sleep(10);
+        }
+    }
+    if (header->magic != StatusBoard::magic || header->version != StatusBoard::version || header->rowSize != sizeof(StatusBoard::Row)) {
+        {XFS::Logger() << "StatusPublisher: incompatible status board, version " << header->version; }
+        UnmapViewOfFile(header);
+        return;
+    }
+    board = header;
+}
+StatusPublisher::~StatusPublisher() {
+    if (board != NULL) {
+        UnmapViewOfFile(board);
+    }
+    if (hMapping != NULL) {
+        CloseHandle(hMapping);
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void StatusPublisher::update(ReaderId reader, const SCARD_READERSTATE& state) {
+    StatusBoard::Row* r = row(reader, state.szReader);
+    if (r == NULL) {
+        return;
+    }
+    // Le mot de poids fort contient le compteur d'événements PC/SC, propre à chaque contexte.
+    const DWORD current = state.dwEventState & 0xFFFF & ~SCARD_STATE_CHANGED;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+
+    lock(r->seq);
+    // Tous les processus publient le même changement : seul le premier le compte.
+    if (r->pcscState != current) {
+        const bool wasPresent = (r->pcscState & SCARD_STATE_PRESENT) != 0;
+        const bool present = (current & SCARD_STATE_PRESENT) != 0;
+        ++r->events;
+        if (present && !wasPresent) {
+            ++r->insertions;
+        }
+        if (!present && wasPresent) {
+            ++r->removals;
+        }
+        r->pcscState = current;
+        r->fwDevice = translateDevice(current);
+        r->fwMedia = translateMedia(current);
+        r->cbAtr = present && state.cbAtr <= sizeof(r->atr) ? state.cbAtr : 0;
+        std::memcpy(r->atr, state.rgbAtr, r->cbAtr);
+        r->lastEvent = ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    }
+    unlock(r->seq);
+}
+void StatusPublisher::count(ReaderId reader, const char* name, Counter counter) {
+    StatusBoard::Row* r = row(reader, name);
+    if (r == NULL) {
+        return;
+    }
+    // Les compteurs ne font pas partie de l'état protégé par `seq` : chacun est incrémenté atomiquement.
+    switch (counter) {
+        case Connects:  InterlockedIncrement(&r->connects);  break;
+        case Transmits: InterlockedIncrement(&r->transmits); break;
+        case Errors:    InterlockedIncrement(&r->errors);    break;
+    }
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+StatusBoard::Row* StatusPublisher::row(ReaderId reader, const char* name) {
+    if (board == NULL || reader == ReaderNames::none) {
+        return NULL;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (reader >= rows.size()) {
+        rows.resize(reader + 1, NULL);
+    }
+    if (rows[reader] == NULL) {
+        rows[reader] = find(name);
+    }
+    return rows[reader];
+}
+StatusBoard::Row* StatusPublisher::find(const char* name) {
+    StatusBoard::Row* result = NULL;
+    lock(board->allocLock);
+    const LONG count = board->rowCount;
+    for (LONG i = 0; i < count && result == NULL; ++i) {
+        if (std::strncmp(board->rows[i].name, name, sizeof(board->rows[i].name) - 1) == 0) {
+            result = &board->rows[i];
+        }
+    }
+    if (result == NULL && count < StatusBoard::maxRows) {
+        result = &board->rows[count];
+        std::strncpy(result->name, name, sizeof(result->name) - 1);
+        // Le nom est écrit avant que la ligne ne devienne visible des lecteurs.
+        InterlockedIncrement(&board->rowCount);
+    }
+    unlock(board->allocLock);
+    if (result == NULL) {
+        {XFS::Logger() << "StatusPublisher: status board is full, reader '" << name << "' is not published"; }
+    }
+    return result;
+}
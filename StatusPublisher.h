@@ -0,0 +1,54 @@
+#ifndef PCSC_CENXFS_BRIDGE_StatusPublisher_H
+#define PCSC_CENXFS_BRIDGE_StatusPublisher_H
+
+#pragma once
+
+#include "ReaderNames.h"
+#include "StatusBoard.h"
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+// PC/CS API -- pour SCARD_READERSTATE
+#include <winscard.h>
+
+/** Publie l'état des lecteurs dans le tableau en mémoire partagée (voir `StatusBoard`).
+@par
+    Tous les processus qui chargent le fournisseur écrivent dans le même tableau : chaque ligne est
+    protégée par son verrou séquentiel, pris aussi entre écrivains. Si la mémoire partagée ne peut
+    pas être créée, ou a été créée par une version incompatible, rien n'est publié.
+*/
+class StatusPublisher : private boost::noncopyable {
+public:
+    /// Compteurs incrémentés par les lecteurs.
+    enum Counter { Connects, Transmits, Errors };
+private:
+    HANDLE hMapping;
+    /// Vue de la mémoire partagée, `NULL` si la publication est désactivée.
+    StatusBoard::Header* board;
+    /// Protège `rows`.
+    boost::mutex mutex;
+    /// Ligne de chaque lecteur déjà publié, indexée par son identifiant.
+    std::vector<StatusBoard::Row*> rows;
+public:
+    /// Ouvre ou crée la mémoire partagée.
+    StatusPublisher();
+    ~StatusPublisher();
+
+    /** Publie le nouvel état du lecteur.
+    @param reader
+        Identifiant du lecteur, `state.szReader` contient son nom.
+    */
+    void update(ReaderId reader, const SCARD_READERSTATE& state);
+    /// Incrémente le compteur du lecteur.
+    void count(ReaderId reader, const char* name, Counter counter);
+private:
+    /// Ligne du lecteur, attribuée à la première demande. `NULL` si le tableau est plein ou désactivé.
+    StatusBoard::Row* row(ReaderId reader, const char* name);
+    /// Cherche la ligne du lecteur dans le tableau, ou en attribue une nouvelle.
+    StatusBoard::Row* find(const char* name);
+};
+
+#endif // PCSC_CENXFS_BRIDGE_StatusPublisher_H
@@ -1,9 +1,12 @@
 #include "Task.h"
 
+#include "Manager.h"
 #include "Service.h"
 
 #include "XFS/Result.h"
 
+#include "Utils/Probes.h"
+
 #include <cassert>
 #include <sstream>
 
@@ -13,27 +16,35 @@ void Task::complete(HRESULT result) const {
     //XFS::Logger() << "Task::complete - Task completed successfully";
 }
 
-HSERVICE Task::serviceHandle() const {
-    return mService.handle();
-}
-
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 TaskContainer::~TaskContainer() {
     //XFS::Logger() << "TaskContainer::~TaskContainer - Destroying task container";
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
-    for (TaskList::iterator it = tasks.begin(); it != tasks.end(); ++it) {
+    TaskVector cancelled;
+    {
+        boost::lock_guard<boost::mutex> lock(tasksMutex);
+        cancelled.assign(tasks.begin(), tasks.end());
+        tasks.clear();
+    }
+    for (TaskVector::const_iterator it = cancelled.begin(); it != cancelled.end(); ++it) {
         (*it)->cancel();
     }
-    tasks.clear();
     //XFS::Logger() << "TaskContainer::~TaskContainer - All tasks cancelled and container cleared";
 }
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 bool TaskContainer::addTask(const Task::Ptr& task) {
     //XFS::Logger() << "TaskContainer::addTask - Adding new task";
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
-
+    boost::lock_guard<boost::mutex> lock(tasksMutex);
+
+    // La liaison du service a pu changer depuis la création de la tâche ; les changements
+    // suivants la mettront à jour par `rebind`. Si le service est déjà fermé, `Manager::addTask`
+    // annulera la tâche.
+    Manager::ServiceRef service(task->manager, task->hService);
+    if (service.isValid()) {
+        task->reader = service->bindedReaderId();
+    }
     std::pair<TaskList::iterator, bool> r = tasks.insert(task);
+    PCSC_PROBE2(task_add, task->serviceHandle(), task->ReqID);
     // Les éléments insérés doivent être uniques par ReqID.
     assert(r.second == true && "[TaskContainer::addTask] Ajout d'une tâche avec un <ServiceHandle, ReqID> existant");
     assert(!tasks.empty() &&  "[TaskContainer::addTask] L'insertion de la tâche n'a pas été effectuée");
@@ -49,28 +60,74 @@ bool TaskContainer::addTask(const Task::Ptr& task) {
 
 bool TaskContainer::cancelTask(HSERVICE hService, REQUESTID ReqID) {
     //XFS::Logger() << "TaskContainer::cancelTask - Cancelling task for hService=" << hService << ", ReqID=" << ReqID;
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
-
-    // Obtient le deuxième index -- par numéro de suivi
-    typedef TaskList::nth_index<1>::type Index1;
-
-    Index1& byID = tasks.get<1>();
-    Index1::iterator it = byID.find(boost::make_tuple(hService, ReqID));
-    if (it == byID.end()) {
-        //XFS::Logger() << "TaskContainer::cancelTask - Task not found";
-        return false;
+    Task::Ptr task;
+    {
+        boost::lock_guard<boost::mutex> lock(tasksMutex);
+
+        // Obtient le deuxième index -- par numéro de suivi
+        typedef TaskList::nth_index<1>::type Index1;
+
+        Index1& byID = tasks.get<1>();
+        Index1::iterator it = byID.find(boost::make_tuple(hService, ReqID));
+        if (it == byID.end()) {
+            //XFS::Logger() << "TaskContainer::cancelTask - Task not found";
+            return false;
+        }
+        task = *it;
+        byID.erase(it);
     }
+    PCSC_PROBE2(task_cancel, hService, ReqID);
     // Signale aux auditeurs enregistrés que la tâche est annulée.
-    (*it)->cancel();
-    byID.erase(it);
+    task->cancel();
     //XFS::Logger() << "TaskContainer::cancelTask - Task cancelled and removed successfully";
     return true;
 }
+bool TaskContainer::cancelTasks(HSERVICE hService) {
+    TaskVector cancelled;
+    {
+        boost::lock_guard<boost::mutex> lock(tasksMutex);
+
+        // Obtient le deuxième index -- par numéro de suivi. Toutes les tâches du service
+        // y sont contiguës, car le handle du service est le premier élément de la clé.
+        typedef TaskList::nth_index<1>::type Index1;
+
+        Index1& byID = tasks.get<1>();
+        std::pair<Index1::iterator, Index1::iterator> range = byID.equal_range(boost::make_tuple(hService));
+        cancelled.assign(range.first, range.second);
+        byID.erase(range.first, range.second);
+    }
+    for (TaskVector::const_iterator it = cancelled.begin(); it != cancelled.end(); ++it) {
+        PCSC_PROBE2(task_cancel, hService, (*it)->ReqID);
+        (*it)->cancel();
+    }
+    return !cancelled.empty();
+}
+/// Change le lecteur attendu par la tâche, pour `TaskContainer::rebind`.
+struct SetReader {
+    ReaderId reader;
+    explicit SetReader(ReaderId reader) : reader(reader) {}
+    void operator()(Task::Ptr& task) const { task->reader = reader; }
+};
+void TaskContainer::rebind(HSERVICE hService, ReaderId reader) {
+    boost::lock_guard<boost::mutex> lock(tasksMutex);
+
+    // Obtient le deuxième index -- par numéro de suivi. Sa clé ne change pas,
+    // le parcours reste donc valide pendant la modification de l'index par lecteur.
+    typedef TaskList::nth_index<1>::type Index1;
+
+    Index1& byID = tasks.get<1>();
+    std::pair<Index1::iterator, Index1::iterator> range = byID.equal_range(boost::make_tuple(hService));
+    for (Index1::iterator it = range.first; it != range.second; ++it) {
+        if ((*it)->reader != reader) {
+            byID.modify(it, SetReader(reader));
+        }
+    }
+}
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 DWORD TaskContainer::getTimeout() const {
     //XFS::Logger() << "TaskContainer::getTimeout - Calculating timeout";
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
+    boost::lock_guard<boost::mutex> lock(tasksMutex);
 
     // S'il y a des tâches, on attend jusqu'à leur timeout, sinon jusqu'à l'infini.
     if (!tasks.empty()) {
@@ -87,41 +144,69 @@ DWORD TaskContainer::getTimeout() const {
 
 void TaskContainer::processTimeouts(bc::steady_clock::time_point now) {
     //XFS::Logger() << "TaskContainer::processTimeouts - Processing timeouts at " << now;
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
+    TaskVector expired;
+    {
+        boost::lock_guard<boost::mutex> lock(tasksMutex);
 
-    // Obtient le premier index -- par temps de deadline
-    typedef TaskList::nth_index<0>::type Index0;
+        // Obtient le premier index -- par temps de deadline
+        typedef TaskList::nth_index<0>::type Index0;
 
-    Index0& byDeadline = tasks.get<0>();
-    Index0::iterator begin = byDeadline.begin();
-    Index0::iterator it = begin;
-    for (; it != byDeadline.end(); ++it) {
+        Index0& byDeadline = tasks.get<0>();
         // Extrait toutes les tâches dont le timeout est atteint. Comme toutes les tâches sont ordonnées par
         // temps de timeout (plus le timeout est proche, plus la tâche est proche du début de la file), alors la première
         // tâche dont le timeout n'est pas encore atteint interrompt la chaîne des timeouts.
-        if ((*it)->deadline > now) {
-            break;
+        Index0::iterator end = byDeadline.begin();
+        while (end != byDeadline.end() && (*end)->deadline <= now) {
+            ++end;
         }
-        // Signale aux auditeurs enregistrés que le timeout est survenu.
+        expired.assign(byDeadline.begin(), end);
+        // Supprime les tâches terminées par timeout.
+        byDeadline.erase(byDeadline.begin(), end);
+    }
+    // Signale aux auditeurs enregistrés que le timeout est survenu.
+    for (TaskVector::const_iterator it = expired.begin(); it != expired.end(); ++it) {
+        PCSC_PROBE2(task_timeout, (*it)->serviceHandle(), (*it)->ReqID);
+        (*it)->manager.recorder().taskTimeout((*it)->serviceHandle(), (*it)->ReqID);
         (*it)->timeout();
     }
-    // Supprime les tâches terminées par timeout.
-    byDeadline.erase(begin, it);
+    if (!expired.empty()) {
+        expired.front()->manager.recorder().failure("task timeout");
+    }
     //XFS::Logger() << "TaskContainer::processTimeouts - Timeouts processed";
 }
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-void TaskContainer::notifyChanges(const SCARD_READERSTATE& state, bool deviceChange) {
+void TaskContainer::notifyChanges(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange) {
     //XFS::Logger() << "TaskContainer::notifyChanges - Notifying tasks of reader changes, deviceChange=" << deviceChange;
-    boost::lock_guard<boost::recursive_mutex> lock(tasksMutex);
-    for (TaskList::iterator it = tasks.begin(); it != tasks.end();) {
+    TaskVector matched;
+    {
+        boost::lock_guard<boost::mutex> lock(tasksMutex);
+        // Tâches attendant précisément ce lecteur, puis celles attendant n'importe quel lecteur.
+        if (reader != ReaderNames::none) {
+            collectMatched(reader, state, reader, deviceChange, matched);
+        }
+        collectMatched(ReaderNames::none, state, reader, deviceChange, matched);
+    }
+    for (TaskVector::const_iterator it = matched.begin(); it != matched.end(); ++it) {
+        PCSC_PROBE2(task_complete, (*it)->serviceHandle(), (*it)->ReqID);
+        (*it)->complete(state);
+    }
+    //XFS::Logger() << "TaskContainer::notifyChanges - Changes notification completed";
+}
+void TaskContainer::collectMatched(ReaderId key, const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange, TaskVector& matched) {
+    // Obtient le troisième index -- par lecteur attendu
+    typedef TaskList::nth_index<2>::type Index2;
+
+    Index2& byReader = tasks.get<2>();
+    std::pair<Index2::iterator, Index2::iterator> range = byReader.equal_range(key);
+    for (Index2::iterator it = range.first; it != range.second;) {
         // Si la tâche attendait cet événement, alors on la supprime de la liste.
-        if ((*it)->match(state, deviceChange)) {
-            it = tasks.erase(it);
+        if ((*it)->match(state, reader, deviceChange)) {
+            matched.push_back(*it);
+            it = byReader.erase(it);
             //XFS::Logger() << "TaskContainer::notifyChanges - Task matched and removed";
             continue;
         }
         ++it;
     }
-    //XFS::Logger() << "TaskContainer::notifyChanges - Changes notification completed";
 }
\ No newline at end of file
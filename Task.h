@@ -3,10 +3,12 @@
 
 #pragma once
 
+#include "ReaderNames.h"
+
 #include <boost/chrono/chrono.hpp>
 
 #include <boost/shared_ptr.hpp>
-#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/lock_guard.hpp>
 
 // Conteneur pour stocker les tâches de lecture de carte.
@@ -17,6 +19,8 @@
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 
+#include <vector>
+
 // PC/CS API -- pour SCARD_READERSTATE
 #include <winscard.h>
 // Définitions pour les lecteurs de cartes (Identification card unit (IDC)) --
@@ -26,7 +30,7 @@
 namespace mi = boost::multi_index;
 namespace bc = boost::chrono;
 
-class Service;
+class Manager;
 
 /** Classe pour stocker les informations nécessaires à l'envoi des événements EXECUTE après
     leur occurrence à la fenêtre qui a été spécifiée comme destinataire lors de l'appel
@@ -36,8 +40,15 @@ class Task {
 public:
     /// Moment où le timeout de cette tâche expire.
     bc::steady_clock::time_point deadline;
-    /// Service qui a créé cette tâche.
-    Service& mService;
+    /// Gestionnaire auquel appartient le service qui a créé cette tâche.
+    Manager& manager;
+    /// Service qui a créé cette tâche. Le service peut être fermé pendant que la tâche est
+    /// terminée hors du verrou du conteneur : il est retrouvé par `Manager::ServiceRef`.
+    HSERVICE hService;
+    /// Lecteur dont les événements intéressent cette tâche, ou `ReaderNames::none`,
+    /// si la tâche s'intéresse à tous les lecteurs. Suit la liaison du service (voir
+    /// `TaskContainer::rebind`), n'est modifié que sous le verrou du conteneur de tâches.
+    ReaderId reader;
     /// Fenêtre qui recevra la notification de fin de tâche.
     HWND hWnd;
     /// Numéro de suivi de cette tâche qui sera fourni dans la notification à la fenêtre `hWnd`.
@@ -46,22 +57,25 @@ public:
 public:
     typedef boost::shared_ptr<Task> Ptr;
 public:
-    Task(bc::steady_clock::time_point deadline, Service& service, HWND hWnd, REQUESTID ReqID)
-        : deadline(deadline), mService(service), hWnd(hWnd), ReqID(ReqID) {}
+    Task(bc::steady_clock::time_point deadline, Manager& manager, HSERVICE hService, ReaderId reader, HWND hWnd, REQUESTID ReqID)
+        : deadline(deadline), manager(manager), hService(hService), reader(reader), hWnd(hWnd), ReqID(ReqID) {}
     inline bool operator<(const Task& other) const {
         return deadline < other.deadline;
     }
     inline bool operator==(const Task& other) const {
-        return &mService == &other.mService && ReqID == other.ReqID;
+        return hService == other.hService && ReqID == other.ReqID;
     }
 public:
     /** Vérifie si l'événement spécifié est celui attendu par cette tâche.
         Si la fonction retourne `true`, alors cette tâche sera considérée comme terminée
-        et sera exclue de la liste des tâches enregistrées. Si la tâche nécessite
-        d'effectuer des actions en cas de succès, cela doit être fait ici.
+        et sera exclue de la liste des tâches enregistrées, puis `complete(state)` sera
+        appelé. La fonction est appelée sous le verrou du conteneur de tâches : elle ne doit
+        ni allouer de mémoire XFS, ni envoyer de messages.
 
     @param state
         Données de l'état modifié.
+    @param reader
+        Identifiant du lecteur modifié.
     @param deviceChange
         Si `true`, alors le changement concerne une modification du nombre d'appareils, et non
         de la carte dans l'appareil.
@@ -70,17 +84,27 @@ public:
         `true` si la tâche a attendu l'événement qui l'intéresse et doit être supprimée
         de la file d'attente des tâches, sinon `false`.
     */
-    virtual bool match(const SCARD_READERSTATE& state, bool deviceChange) const = 0;
+    virtual bool match(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange) const = 0;
+    /** Termine la tâche après que `match` a retourné `true` : construit le résultat et
+        notifie l'auditeur XFS. Appelé hors du verrou du conteneur de tâches.
+    @param state
+        Données de l'état modifié, pour lequel `match` a retourné `true`.
+    */
+    virtual void complete(const SCARD_READERSTATE& state) const = 0;
     /// Notifie l'auditeur XFS de la fin de l'attente.
     /// @param result Code de réponse pour la fin.
     void complete(HRESULT result) const;
     /// Appelé si la requête a été annulée par un appel à WFPCancelAsyncRequest.
     inline void cancel() const { complete(WFS_ERR_CANCELED); }
     inline void timeout() const { complete(WFS_ERR_TIMEOUT); }
-    HSERVICE serviceHandle() const;
+    inline HSERVICE serviceHandle() const { return hService; }
 };
-/// Contient la liste des tâches et les méthodes pour leur ajout, annulation et traitement thread-safe.
+/** Contient la liste des tâches et les méthodes pour leur ajout, annulation et traitement thread-safe.
+    Le verrou ne protège que la liste elle-même : les tâches terminées en sont retirées sous le verrou,
+    et les notifications XFS correspondantes sont envoyées après sa libération.
+*/
 class TaskContainer {
+    typedef std::vector<Task::Ptr> TaskVector;
     typedef mi::multi_index_container<
         Task::Ptr,
         mi::indexed_by<
@@ -89,20 +113,25 @@ class TaskContainer {
             // au même moment, donc l'index n'est pas unique.
             mi::ordered_non_unique<mi::identity<Task> >,
             // Tri par less<REQUESTID> sur ReqID -- pour supprimer les tâches annulées,
-            // mais ReqID est unique dans les limites du service.
+            // mais ReqID est unique dans les limites du service. Toutes les tâches d'un service
+            // y sont contiguës, ce qui permet aussi de les annuler toutes d'un coup.
             mi::ordered_unique<mi::composite_key<
                 Task,
                 BOOST_MULTI_INDEX_CONST_MEM_FUN(Task, HSERVICE, serviceHandle),
                 mi::member<Task, REQUESTID, &Task::ReqID>
-            > >
+            > >,
+            // Tri par lecteur attendu -- pour ne vérifier, lors d'un changement, que les tâches
+            // qui attendent ce lecteur et celles qui attendent n'importe quel lecteur.
+            mi::ordered_non_unique<mi::member<Task, ReaderId, &Task::reader> >
         >
     > TaskList;
 private:
     /// Liste des tâches, ordonnée par temps de deadline croissant.
     /// Plus le deadline est proche, plus la tâche est proche du début de la liste.
     TaskList tasks;
-    /// Mutex pour protéger `tasks` contre les modifications simultanées.
-    mutable boost::recursive_mutex tasksMutex;
+    /// Mutex pour protéger `tasks` contre les modifications simultanées. N'est jamais
+    /// tenu pendant l'appel de code externe (allocation XFS, envoi de messages).
+    mutable boost::mutex tasksMutex;
 public:
     /// À la destruction du conteneur, toutes les tâches sont annulées.
     ~TaskContainer();
@@ -131,6 +160,22 @@ public:
         ce qui signifie qu'aucune tâche avec ces paramètres n'existe dans la file d'attente.
     */
     bool cancelTask(HSERVICE hService, REQUESTID ReqID);
+    /** Annule toutes les tâches créées par le service spécifié. Appelé à la fermeture du service.
+    @param hService
+        Service dont les tâches doivent être annulées.
+
+    @return
+        `true` si au moins une tâche a été annulée, sinon `false`.
+    */
+    bool cancelTasks(HSERVICE hService);
+    /** Rattache les tâches du service au lecteur auquel il vient d'être lié. Appelé après la
+        modification de la liaison : une tâche ajoutée entre-temps a déjà lu la nouvelle liaison.
+    @param hService
+        Service dont la liaison a changé.
+    @param reader
+        Lecteur auquel le service est maintenant lié, ou `ReaderNames::none`.
+    */
+    void rebind(HSERVICE hService, ReaderId reader);
 
     /// Calcule le timeout jusqu'au prochain deadline de manière thread-safe.
     DWORD getTimeout() const;
@@ -140,11 +185,18 @@ public:
         Temps pour lequel on considère si le timeout est atteint ou non.
     */
     void processTimeouts(bc::steady_clock::time_point now);
-    /** Notifie toutes les tâches d'un changement dans le lecteur. En conséquence, certaines tâches peuvent se terminer.
+    /** Notifie les tâches intéressées d'un changement dans le lecteur. En conséquence, certaines tâches
+        peuvent se terminer. Seules les tâches attendant ce lecteur ou n'importe quel lecteur sont vérifiées.
     @param state
         État du lecteur modifié, y compris cela peut être un changement
         du nombre de lecteurs.
+    @param reader
+        Identifiant du lecteur modifié.
     */
-    void notifyChanges(const SCARD_READERSTATE& state, bool deviceChange);
+    void notifyChanges(const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange);
+private:
+    /// Retire les tâches attendant le lecteur `key` qui se sont terminées et les ajoute à `matched`.
+    /// Appelé sous `tasksMutex`.
+    void collectMatched(ReaderId key, const SCARD_READERSTATE& state, ReaderId reader, bool deviceChange, TaskVector& matched);
 };
 #endif // PCSC_CENXFS_BRIDGE_Task_H
\ No newline at end of file
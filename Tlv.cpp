@@ -0,0 +1,202 @@
+#include "Tlv.h"
+
+namespace Tlv {
+    static const char digits[] = "0123456789ABCDEF";
+
+    bool Parser::next(Element& element) {
+        // Octets de remplissage avant, entre et après les éléments.
+        while (mPos < mEnd && (*mPos == 0x00 || *mPos == 0xFF)) {
+            ++mPos;
+        }
+        if (mPos >= mEnd) {
+            return false;
+        }
+        const BYTE* p = mPos;
+        // Étiquette : les 5 bits de poids faible à 1 annoncent des octets suivants, chacun
+        // suivi d'un autre tant que son bit de poids fort est à 1.
+        DWORD tag = *p++;
+        DWORD tagSize = 1;
+        if ((tag & 0x1F) == 0x1F) {
+            do {
+                if (p >= mEnd || tagSize >= tagSizeLimit) {
+                    return fail();
+                }
+                tag = (tag << 8) | *p;
+                ++tagSize;
+            } while (*p++ & 0x80);
+        }
+        // Longueur : forme courte sur un octet, ou forme longue 81..84 suivie de 1 à 4 octets.
+        if (p >= mEnd) {
+            return fail();
+        }
+        DWORD length = *p++;
+        if (length & 0x80) {
+            const DWORD count = length & 0x7F;
+            // 80 (longueur indéfinie) n'est pas permis en BER-TLV de cartes à puce.
+            if (count == 0 || count > 4 || (DWORD)(mEnd - p) < count) {
+                return fail();
+            }
+            length = 0;
+            for (DWORD i = 0; i < count; ++i) {
+                length = (length << 8) | *p++;
+            }
+        }
+        if ((DWORD)(mEnd - p) < length) {
+            return fail();
+        }
+        element.tag = tag;
+        element.tagSize = tagSize;
+        element.value = p;
+        element.length = length;
+        mPos = p + length;
+        return true;
+    }
+    //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    static bool valid(Parser& p, unsigned depth) {
+        Element e;
+        while (p.next(e)) {
+            if (e.constructed()) {
+                if (depth + 1 >= depthLimit) {
+                    return false;
+                }
+                Parser inner(e);
+                if (!valid(inner, depth + 1)) {
+                    return false;
+                }
+            }
+        }
+        return !p.failed();
+    }
+    bool valid(const BYTE* data, DWORD size) {
+        Parser p(data, size);
+        return valid(p, 0);
+    }
+    static bool find(Parser& p, DWORD tag, Element& result, unsigned depth) {
+        Element e;
+        while (p.next(e)) {
+            if (e.tag == tag) {
+                result = e;
+                return true;
+            }
+            if (e.constructed() && depth + 1 < depthLimit) {
+                Parser inner(e);
+                if (find(inner, tag, result, depth + 1)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    bool find(const BYTE* data, DWORD size, DWORD tag, Element& result) {
+        Parser p(data, size);
+        return find(p, tag, result, 0);
+    }
+    static bool appendFields(std::string& out, Parser& p, unsigned depth) {
+        Element e;
+        while (p.next(e)) {
+            if (!e.constructed()) {
+                appendField(out, e);
+                continue;
+            }
+            if (depth + 1 >= depthLimit) {
+                return false;
+            }
+            Parser inner(e);
+            if (!appendFields(out, inner, depth + 1)) {
+                return false;
+            }
+        }
+        return !p.failed();
+    }
+    bool appendFields(std::string& out, const BYTE* data, DWORD size) {
+        Parser p(data, size);
+        return appendFields(out, p, 0);
+    }
+    bool dolLength(const BYTE* data, DWORD size, DWORD& length) {
+        length = 0;
+        const BYTE* p = data;
+        const BYTE* end = data + size;
+        while (p < end) {
+            // Même codage des étiquettes que dans Parser::next, suivi d'une longueur sur un octet.
+            DWORD tagSize = 1;
+            if ((*p++ & 0x1F) == 0x1F) {
+                do {
+                    if (p >= end || tagSize >= tagSizeLimit) {
+                        return false;
+                    }
+                    ++tagSize;
+                } while (*p++ & 0x80);
+            }
+            if (p >= end) {
+                return false;
+            }
+            length += *p++;
+        }
+        return true;
+    }
+    void appendField(std::string& out, const Element& element) {
+        for (DWORD i = element.tagSize; i > 0; --i) {
+            const BYTE b = (BYTE)(element.tag >> (8 * (i - 1)));
+            out += digits[b >> 4];
+            out += digits[b & 0x0F];
+        }
+        out += '=';
+        for (DWORD i = 0; i < element.length; ++i) {
+            out += digits[element.value[i] >> 4];
+            out += digits[element.value[i] & 0x0F];
+        }
+        out += '\0';
+    }
+    static bool parseTag(const char* begin, const char* end, DWORD& tag) {
+        // L'étiquette doit être lue par le parseur en entier, sans octet en trop : elle est
+        // analysée suivie d'une longueur nulle.
+        BYTE probe[tagSizeLimit + 1];
+        const DWORD size = (DWORD)(end - begin) / 2;
+        if (begin >= end || (end - begin) % 2 != 0 || size > tagSizeLimit) {
+            return false;
+        }
+        for (DWORD i = 0; i < size; ++i) {
+            BYTE b = 0;
+            for (int j = 0; j < 2; ++j) {
+                const char c = begin[2 * i + j];
+                const BYTE d = c >= '0' && c <= '9' ? c - '0'
+                             : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                             : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                             : 0xFF;
+                if (d == 0xFF) {
+                    return false;
+                }
+                b = (BYTE)((b << 4) | d);
+            }
+            probe[i] = b;
+        }
+        probe[size] = 0x00;
+        Parser check(probe, size + 1);
+        Element e;
+        if (!check.next(e) || e.tagSize != size || e.length != 0) {
+            return false;
+        }
+        tag = e.tag;
+        return true;
+    }
+    bool parseTags(const char* text, std::vector<DWORD>& tags) {
+        const char* p = text;
+        for (;;) {
+            while (*p == ' ' || *p == ',') {
+                ++p;
+            }
+            if (*p == '\0') {
+                return true;
+            }
+            const char* begin = p;
+            while (*p != '\0' && *p != ' ' && *p != ',') {
+                ++p;
+            }
+            DWORD tag;
+            if (!parseTag(begin, p, tag)) {
+                return false;
+            }
+            tags.push_back(tag);
+        }
+    }
+} // namespace Tlv
@@ -0,0 +1,95 @@
+#ifndef PCSC_CENXFS_BRIDGE_Tlv_H
+#define PCSC_CENXFS_BRIDGE_Tlv_H
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Pour BYTE et DWORD
+#include <windef.h>
+
+/** Analyse des données BER-TLV (ISO/IEC 7816-4 annexe D, EMV Book 3 annexe B), sans allocation :
+    les éléments sont des vues sur le tampon analysé, valables tant que celui-ci l'est.
+@par
+    Toute erreur de format (étiquette ou longueur tronquée, longueur indéfinie ou sur plus de 4 octets,
+    valeur dépassant le tampon) arrête l'analyse du niveau concerné ; aucun octet hors du tampon n'est lu.
+    Les octets `00` et `FF` entre les éléments sont ignorés, comme le permet EMV.
+*/
+namespace Tlv {
+    enum {
+        /// Nombre maximal d'octets d'une étiquette, et de niveaux d'imbrication parcourus par `find`.
+        tagSizeLimit = 4,
+        depthLimit = 16
+    };
+
+    /// Élément BER-TLV.
+    struct Element {
+        /// Octets de l'étiquette en gros-boutiste, par exemple `0x9F27`.
+        DWORD tag;
+        /// Nombre d'octets de l'étiquette.
+        DWORD tagSize;
+        const BYTE* value;
+        DWORD length;
+
+        /// `true` si la valeur est elle-même une suite d'éléments.
+        inline bool constructed() const {
+            return ((tag >> (8 * (tagSize - 1))) & 0x20) != 0;
+        }
+    };
+
+    /** Parcourt les éléments d'un niveau, dans l'ordre.
+    @code
+        Tlv::Parser p(data, size);
+        Tlv::Element e;
+        while (p.next(e)) {
+            ...
+        }
+    @endcode
+    */
+    class Parser {
+        const BYTE* mPos;
+        const BYTE* mEnd;
+        bool mFailed;
+    public:
+        Parser(const BYTE* data, DWORD size) : mPos(data), mEnd(data + size), mFailed(false) {}
+        /// Parcourt les éléments contenus dans l'élément construit spécifié.
+        explicit Parser(const Element& parent) : mPos(parent.value), mEnd(parent.value + parent.length), mFailed(false) {}
+
+        /// Lit l'élément suivant. Retourne `false` à la fin du niveau ou en cas d'erreur de format.
+        bool next(Element& element);
+        /// `true` si l'analyse s'est arrêtée sur une erreur de format.
+        inline bool failed() const { return mFailed; }
+    private:
+        inline bool fail() {
+            mFailed = true;
+            return false;
+        }
+    };
+
+    /// `true` si le tampon est une suite d'éléments bien formée à tous ses niveaux.
+    bool valid(const BYTE* data, DWORD size);
+    /** Cherche en profondeur, dans l'ordre du tampon, le premier élément d'étiquette `tag`.
+    @return `true` si l'élément est trouvé, il est alors écrit dans `result`.
+    */
+    bool find(const BYTE* data, DWORD size, DWORD tag, Element& result);
+    /** Ajoute à `out` les éléments primitifs, en descendant dans les éléments construits, sous forme
+        de paires `étiquette=valeur` terminées par zéro, en hexadécimal, par exemple `9F27=80`.
+    @return `false` si une erreur de format a été rencontrée, les éléments lus avant sont ajoutés.
+    */
+    bool appendFields(std::string& out, const BYTE* data, DWORD size);
+    /// Ajoute à `out` la paire `étiquette=valeur` de l'élément, terminée par zéro.
+    void appendField(std::string& out, const Element& element);
+    /** Longueur totale des données décrites par une liste d'objets de données (DOL, EMV Book 3 5.4) :
+        suite de paires étiquette-longueur, sans valeurs, par exemple le PDOL (étiquette `9F38`).
+    @return `false` si la liste est mal formée.
+    */
+    bool dolLength(const BYTE* data, DWORD size, DWORD& length);
+    /** Lit une liste d'étiquettes écrites en hexadécimal, séparées par des espaces ou des virgules,
+        par exemple `57 5A 9F27`.
+    @return `false` si un élément de la liste n'est pas une étiquette BER-TLV valide.
+    */
+    bool parseTags(const char* text, std::vector<DWORD>& tags);
+} // namespace Tlv
+
+#endif // PCSC_CENXFS_BRIDGE_Tlv_H
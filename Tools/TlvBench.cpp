@@ -0,0 +1,83 @@
+/** Mesure de l'analyseur BER-TLV sur les réponses EMV enregistrées (`TlvSamples.h`) : validation,
+    recherche des étiquettes demandées par les applications et mise en forme de `WFS_CMD_IDC_PARSE_DATA`.
+@code
+TlvBench [itérations]
+@endcode
+    Le programme échoue si une réponse enregistrée n'est pas reconnue comme bien formée : il sert
+    aussi de test de non-régression.
+*/
+#include "Tlv.h"
+#include "Tools/TlvSamples.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <boost/chrono/chrono.hpp>
+
+namespace bc = boost::chrono;
+
+/// Étiquettes cherchées dans chaque réponse, celles de `WFS_INF_IDC_PCSC_CHIP_TAGS` les plus courantes.
+static const DWORD tags[] = {0x57, 0x5A, 0x5F24, 0x9F27, 0x9F36, 0x94, 0x9F4D};
+static const std::size_t tagCount = sizeof(tags) / sizeof(tags[0]);
+
+/// Affiche la durée moyenne d'une opération, en nanosecondes par réponse.
+static void report(const char* operation, bc::steady_clock::duration elapsed, unsigned long operations) {
+    const double ns = (double)bc::duration_cast<bc::nanoseconds>(elapsed).count() / operations;
+    std::printf("%-14s %10.1f ns/response\n", operation, ns);
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned long iterations = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 100000;
+    if (iterations == 0) {
+        std::fprintf(stderr, "usage: TlvBench [iterations]\n");
+        return 2;
+    }
+    for (std::size_t i = 0; i < TlvSamples::count; ++i) {
+        const TlvSamples::Sample& s = TlvSamples::all[i];
+        if (!Tlv::valid(s.data, s.size)) {
+            std::fprintf(stderr, "%s: recorded response is rejected\n", s.name);
+            return 1;
+        }
+    }
+    const unsigned long operations = iterations * TlvSamples::count;
+    // Le résultat est accumulé pour que le compilateur ne supprime pas les appels.
+    unsigned long checksum = 0;
+
+    bc::steady_clock::time_point start = bc::steady_clock::now();
+    for (unsigned long n = 0; n < iterations; ++n) {
+        for (std::size_t i = 0; i < TlvSamples::count; ++i) {
+            checksum += Tlv::valid(TlvSamples::all[i].data, TlvSamples::all[i].size);
+        }
+    }
+    report("valid", bc::steady_clock::now() - start, operations);
+
+    start = bc::steady_clock::now();
+    for (unsigned long n = 0; n < iterations; ++n) {
+        for (std::size_t i = 0; i < TlvSamples::count; ++i) {
+            for (std::size_t t = 0; t < tagCount; ++t) {
+                Tlv::Element e;
+                if (Tlv::find(TlvSamples::all[i].data, TlvSamples::all[i].size, tags[t], e)) {
+                    checksum += e.length;
+                }
+            }
+        }
+    }
+    report("find x7", bc::steady_clock::now() - start, operations);
+
+    // Le tampon est réutilisé, comme celui d'une commande : seule l'analyse et la mise en forme sont mesurées.
+    std::string out;
+    out.reserve(4096);
+    start = bc::steady_clock::now();
+    for (unsigned long n = 0; n < iterations; ++n) {
+        for (std::size_t i = 0; i < TlvSamples::count; ++i) {
+            out.clear();
+            Tlv::appendFields(out, TlvSamples::all[i].data, TlvSamples::all[i].size);
+            checksum += out.size();
+        }
+    }
+    report("appendFields", bc::steady_clock::now() - start, operations);
+
+    std::printf("%lu responses x %lu iterations, checksum %lu\n", (unsigned long)TlvSamples::count, iterations, checksum);
+    return 0;
+}
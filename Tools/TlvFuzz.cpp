@@ -0,0 +1,116 @@
+/** Cible de fuzzing libFuzzer de l'analyseur BER-TLV. Vérifie qu'aucune fonction de `Tlv` ne lit hors du
+    tampon (avec AddressSanitizer) et que les éléments rendus sont des vues à l'intérieur de celui-ci.
+@code
+TlvFuzz corpus/                  # avec libFuzzer (clang -fsanitize=fuzzer, MSVC /fsanitize=fuzzer)
+TlvFuzz [fichier...]             # sans libFuzzer (TLV_FUZZ_MAIN) : rejoue les fichiers, ou les réponses
+                                 # enregistrées de TlvSamples.h et leurs troncatures
+@endcode
+*/
+#include "Tlv.h"
+#include "Tools/TlvSamples.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+/// Arrête le programme si l'élément ne se trouve pas entièrement dans `[begin, end)`.
+static void checkInside(const Tlv::Element& e, const BYTE* begin, const BYTE* end) {
+    if (e.value < begin || e.value > end || e.length > (DWORD)(end - e.value)) {
+        std::abort();
+    }
+    if (e.tagSize == 0 || e.tagSize > Tlv::tagSizeLimit) {
+        std::abort();
+    }
+}
+/// Parcourt le niveau et, récursivement, les éléments construits, comme `Tlv::find`.
+static void walk(Tlv::Parser& parser, const BYTE* begin, const BYTE* end, unsigned depth) {
+    Tlv::Element e;
+    while (parser.next(e)) {
+        checkInside(e, begin, end);
+        if (e.constructed() && depth < Tlv::depthLimit) {
+            Tlv::Parser child(e);
+            walk(child, e.value, e.value + e.length, depth + 1);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const boost::uint8_t* data, std::size_t size) {
+    const BYTE* begin = (const BYTE*)data;
+    const DWORD n = (DWORD)size;
+
+    Tlv::Parser parser(begin, n);
+    walk(parser, begin, begin + n, 0);
+
+    const bool valid = Tlv::valid(begin, n);
+    std::string fields;
+    const bool parsed = Tlv::appendFields(fields, begin, n);
+    // Une suite bien formée à tous ses niveaux se met toujours en forme sans erreur.
+    if (valid && !parsed) {
+        std::abort();
+    }
+    Tlv::Element e;
+    if (Tlv::find(begin, n, 0x57, e)) {
+        checkInside(e, begin, begin + n);
+    }
+    DWORD length;
+    Tlv::dolLength(begin, n, length);
+
+    const std::string text(data, data + size);
+    std::vector<DWORD> tags;
+    Tlv::parseTags(text.c_str(), tags);
+    return 0;
+}
+
+#ifdef TLV_FUZZ_MAIN
+/// Lit le fichier entier, `false` s'il ne peut pas être ouvert.
+static bool readFile(const char* path, std::vector<boost::uint8_t>& data) {
+    std::FILE* f = std::fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    boost::uint8_t buffer[4096];
+    std::size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), f)) != 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+    std::fclose(f);
+    return true;
+}
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            std::vector<boost::uint8_t> data;
+            if (!readFile(argv[i], data)) {
+                std::fprintf(stderr, "%s: cannot be read\n", argv[i]);
+                return 1;
+            }
+            LLVMFuzzerTestOneInput(data.empty() ? NULL : &data[0], data.size());
+        }
+        return 0;
+    }
+    // Sans corpus : chaque réponse enregistrée, toutes ses troncatures et un octet modifié à chaque position.
+    for (std::size_t i = 0; i < TlvSamples::count; ++i) {
+        const TlvSamples::Sample& s = TlvSamples::all[i];
+        std::vector<boost::uint8_t> data(s.data, s.data + s.size);
+        for (std::size_t size = 0; size <= data.size(); ++size) {
+            // Copie exacte, pour que AddressSanitizer voie toute lecture après la fin.
+            std::vector<boost::uint8_t> prefix(data.begin(), data.begin() + size);
+            LLVMFuzzerTestOneInput(prefix.empty() ? NULL : &prefix[0], prefix.size());
+        }
+        for (std::size_t pos = 0; pos < data.size(); ++pos) {
+            const boost::uint8_t saved = data[pos];
+            static const boost::uint8_t values[] = {0x00, 0x1F, 0x7F, 0x80, 0x81, 0x84, 0xFF};
+            for (std::size_t v = 0; v < sizeof(values); ++v) {
+                data[pos] = values[v];
+                LLVMFuzzerTestOneInput(&data[0], data.size());
+            }
+            data[pos] = saved;
+        }
+    }
+    std::printf("%lu recorded responses replayed with truncations and mutations\n", (unsigned long)TlvSamples::count);
+    return 0;
+}
+#endif
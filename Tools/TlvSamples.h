@@ -0,0 +1,83 @@
+#ifndef PCSC_CENXFS_BRIDGE_Tools_TlvSamples_H
+#define PCSC_CENXFS_BRIDGE_Tools_TlvSamples_H
+
+#pragma once
+
+// Pour std::size_t
+#include <cstddef>
+
+// Pour BYTE et DWORD
+#include <windef.h>
+
+/** Réponses EMV enregistrées (sans SW1 SW2) d'une transaction complète avec une carte de test Visa :
+    sélection du PPSE et de l'application, GET PROCESSING OPTIONS, lecture des enregistrements et
+    GENERATE AC aux deux formats. Servent de mesure à `TlvBench` et de corpus initial à `TlvFuzz`.
+*/
+namespace TlvSamples {
+    static const BYTE selectPpse[] = {
+        0x6F, 0x2F, 0x84, 0x0E, 0x32, 0x50, 0x41, 0x59, 0x2E, 0x53, 0x59, 0x53, 0x2E, 0x44, 0x44, 0x46,
+        0x30, 0x31, 0xA5, 0x1D, 0xBF, 0x0C, 0x1A, 0x61, 0x18, 0x4F, 0x07, 0xA0, 0x00, 0x00, 0x00, 0x03,
+        0x10, 0x10, 0x87, 0x01, 0x01, 0x50, 0x0A, 0x56, 0x49, 0x53, 0x41, 0x20, 0x44, 0x45, 0x42, 0x49,
+        0x54,
+    };
+    static const BYTE selectAid[] = {
+        0x6F, 0x38, 0x84, 0x07, 0xA0, 0x00, 0x00, 0x00, 0x03, 0x10, 0x10, 0xA5, 0x2D, 0x50, 0x0A, 0x56,
+        0x49, 0x53, 0x41, 0x20, 0x44, 0x45, 0x42, 0x49, 0x54, 0x87, 0x01, 0x01, 0x9F, 0x38, 0x0C, 0x9F,
+        0x66, 0x04, 0x9F, 0x02, 0x06, 0x9F, 0x37, 0x04, 0x5F, 0x2A, 0x02, 0x5F, 0x2D, 0x04, 0x65, 0x6E,
+        0x66, 0x72, 0xBF, 0x0C, 0x05, 0x9F, 0x4D, 0x02, 0x0B, 0x0A,
+    };
+    static const BYTE gpo[] = {
+        0x77, 0x2D, 0x82, 0x02, 0x20, 0x00, 0x94, 0x08, 0x08, 0x01, 0x01, 0x00, 0x10, 0x01, 0x02, 0x00,
+        0x9F, 0x36, 0x02, 0x00, 0x11, 0x9F, 0x26, 0x08, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+        0x9F, 0x10, 0x07, 0x06, 0x01, 0x0A, 0x03, 0xA0, 0x00, 0x00, 0x9F, 0x6C, 0x02, 0x16, 0x00,
+    };
+    static const BYTE readRecord1[] = {
+        0x70, 0x3A, 0x57, 0x13, 0x47, 0x61, 0x73, 0x90, 0x01, 0x01, 0x00, 0x10, 0xD2, 0x21, 0x22, 0x01,
+        0x11, 0x43, 0x80, 0x44, 0x00, 0x00, 0x0F, 0x5F, 0x20, 0x0F, 0x43, 0x41, 0x52, 0x44, 0x48, 0x4F,
+        0x4C, 0x44, 0x45, 0x52, 0x2F, 0x56, 0x49, 0x53, 0x41, 0x9F, 0x1F, 0x10, 0x31, 0x31, 0x34, 0x33,
+        0x38, 0x30, 0x34, 0x34, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+    };
+    static const BYTE readRecord2[] = {
+        0x70, 0x81, 0xE3, 0x5A, 0x08, 0x47, 0x61, 0x73, 0x90, 0x01, 0x01, 0x00, 0x10, 0x5F, 0x24, 0x03,
+        0x22, 0x12, 0x31, 0x5F, 0x25, 0x03, 0x20, 0x01, 0x01, 0x5F, 0x28, 0x02, 0x08, 0x40, 0x5F, 0x34,
+        0x01, 0x01, 0x8C, 0x15, 0x9F, 0x02, 0x06, 0x9F, 0x03, 0x06, 0x9F, 0x1A, 0x02, 0x95, 0x05, 0x5F,
+        0x2A, 0x02, 0x9A, 0x03, 0x9C, 0x01, 0x9F, 0x37, 0x04, 0x8D, 0x05, 0x8A, 0x02, 0x9F, 0x37, 0x04,
+        0x8E, 0x0E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x03, 0x1E, 0x03, 0x1F, 0x03,
+        0x8F, 0x01, 0x92, 0x90, 0x81, 0x90, 0x03, 0x0A, 0x11, 0x18, 0x1F, 0x26, 0x2D, 0x34, 0x3B, 0x42,
+        0x49, 0x50, 0x57, 0x5E, 0x65, 0x6C, 0x73, 0x7A, 0x81, 0x88, 0x8F, 0x96, 0x9D, 0xA4, 0xAB, 0xB2,
+        0xB9, 0xC0, 0xC7, 0xCE, 0xD5, 0xDC, 0xE3, 0xEA, 0xF1, 0xF8, 0xFF, 0x06, 0x0D, 0x14, 0x1B, 0x22,
+        0x29, 0x30, 0x37, 0x3E, 0x45, 0x4C, 0x53, 0x5A, 0x61, 0x68, 0x6F, 0x76, 0x7D, 0x84, 0x8B, 0x92,
+        0x99, 0xA0, 0xA7, 0xAE, 0xB5, 0xBC, 0xC3, 0xCA, 0xD1, 0xD8, 0xDF, 0xE6, 0xED, 0xF4, 0xFB, 0x02,
+        0x09, 0x10, 0x17, 0x1E, 0x25, 0x2C, 0x33, 0x3A, 0x41, 0x48, 0x4F, 0x56, 0x5D, 0x64, 0x6B, 0x72,
+        0x79, 0x80, 0x87, 0x8E, 0x95, 0x9C, 0xA3, 0xAA, 0xB1, 0xB8, 0xBF, 0xC6, 0xCD, 0xD4, 0xDB, 0xE2,
+        0xE9, 0xF0, 0xF7, 0xFE, 0x05, 0x0C, 0x13, 0x1A, 0x21, 0x28, 0x2F, 0x36, 0x3D, 0x44, 0x4B, 0x52,
+        0x59, 0x60, 0x67, 0x6E, 0x75, 0x7C, 0x83, 0x8A, 0x91, 0x98, 0x9F, 0xA6, 0xAD, 0xB4, 0xBB, 0xC2,
+        0xC9, 0xD0, 0xD7, 0xDE, 0xE5, 0xEC,
+    };
+    static const BYTE generateAc[] = {
+        0x77, 0x1E, 0x9F, 0x27, 0x01, 0x80, 0x9F, 0x36, 0x02, 0x00, 0x12, 0x9F, 0x26, 0x08, 0xA1, 0xB2,
+        0xC3, 0xD4, 0xE5, 0xF6, 0x07, 0x18, 0x9F, 0x10, 0x07, 0x06, 0x01, 0x0A, 0x03, 0xA0, 0xB8, 0x00,
+    };
+    static const BYTE generateAcFormat1[] = {
+        0x80, 0x12, 0x80, 0x00, 0x13, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x06, 0x01, 0x0A,
+        0x03, 0xA0, 0x00, 0x00,
+    };
+
+    struct Sample {
+        const char* name;
+        const BYTE* data;
+        DWORD size;
+    };
+    static const Sample all[] = {
+        {"SELECT PPSE", selectPpse, sizeof(selectPpse)},
+        {"SELECT AID", selectAid, sizeof(selectAid)},
+        {"GET PROCESSING OPTIONS", gpo, sizeof(gpo)},
+        {"READ RECORD 1", readRecord1, sizeof(readRecord1)},
+        {"READ RECORD 2", readRecord2, sizeof(readRecord2)},
+        {"GENERATE AC", generateAc, sizeof(generateAc)},
+        {"GENERATE AC (format 1)", generateAcFormat1, sizeof(generateAcFormat1)},
+    };
+    static const std::size_t count = sizeof(all) / sizeof(all[0]);
+} // namespace TlvSamples
+
+#endif // PCSC_CENXFS_BRIDGE_Tools_TlvSamples_H
@@ -0,0 +1,138 @@
+#include "Tracer.h"
+
+#include "XFS/Logger.h"
+
+// Pour std::getenv
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+// Pour GetCurrentThreadId et GetCurrentProcessId
+#include <windows.h>
+
+/// Période d'écriture des intervalles dans le fichier, en secondes.
+static const int dumpPeriod = 30;
+
+Tracer::Tracer() : mEnabled(false), mEpoch(now()), lost(0) {
+    const char* path = std::getenv("PCSC_CENXFS_BRIDGE_TRACE");
+    if (path != NULL && *path != '\0') {
+        dumpPath = path;
+        mEnabled = true;
+        dumpThread.reset(new boost::thread(&Tracer::run, this));
+    }
+}
+Tracer::~Tracer() {
+    if (dumpThread) {
+        dumpThread->interrupt();
+        dumpThread->join();
+        dump();
+    }
+    for (std::size_t i = 0; i < ringCount; ++i) {
+        delete[] rings[i].events;
+    }
+}
+Tracer::Ring* Tracer::ring() {
+    const DWORD tid = GetCurrentThreadId();
+    // Les tampons ne sont jamais rendus : celui du thread se trouve toujours avant le premier tampon libre.
+    for (std::size_t i = 0; i < ringCount; ++i) {
+        Ring& r = rings[(tid + i) % ringCount];
+        DWORD owner = r.owner.load(boost::memory_order_relaxed);
+        if (owner == tid) {
+            return &r;
+        }
+        if (owner == 0) {
+            if (r.owner.compare_exchange_strong(owner, tid, boost::memory_order_relaxed)) {
+                r.events = new Event[ringSize];
+                return &r;
+            }
+            // Pris par un autre thread entre-temps.
+        }
+    }
+    return NULL;
+}
+void Tracer::record(const char* category, const char* name, boost::int64_t begin, boost::int64_t end, HSERVICE hService, REQUESTID ReqID) {
+    Ring* r = ring();
+    if (r == NULL) {
+        lost.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+    const boost::uint32_t h = r->head.load(boost::memory_order_relaxed);
+    Event& e = r->events[h % ringSize];
+    e.category = category;
+    e.name = name;
+    e.begin = begin;
+    e.end = end;
+    e.reqId = ReqID;
+    e.hService = hService;
+    // Publie l'événement pour le thread d'écriture.
+    r->head.store(h + 1, boost::memory_order_release);
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/// Écrit la durée en nanosecondes comme des microsecondes avec trois décimales.
+static void micros(std::ostream& os, boost::int64_t ns) {
+    if (ns < 0) {
+        os << '-';
+        ns = -ns;
+    }
+    os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000;
+}
+std::string Tracer::json() const {
+    const DWORD pid = GetCurrentProcessId();
+    std::ostringstream os;
+    os << "{\"traceEvents\":[";
+    bool first = true;
+    std::vector<Event> events;
+    for (std::size_t i = 0; i < ringCount; ++i) {
+        const Ring& r = rings[i];
+        const DWORD tid = r.owner.load(boost::memory_order_relaxed);
+        const boost::uint32_t head = r.head.load(boost::memory_order_acquire);
+        if (tid == 0 || head == 0) {
+            continue;
+        }
+        const boost::uint32_t from = head > ringSize ? head - ringSize : 0;
+        events.clear();
+        for (boost::uint32_t k = from; k != head; ++k) {
+            events.push_back(r.events[k % ringSize]);
+        }
+        // Le propriétaire a pu continuer à écrire pendant la copie, y compris dans l'emplacement
+        // qui suit le dernier événement publié : tous les événements écrasés sont écartés.
+        const boost::uint32_t after = r.head.load(boost::memory_order_acquire);
+        const boost::uint32_t valid = after + 1 > ringSize ? after + 1 - ringSize : 0;
+        for (boost::uint32_t k = from; k != head; ++k) {
+            if ((boost::int32_t)(k - valid) < 0) {
+                continue;
+            }
+            const Event& e = events[k - from];
+            os << (first ? "" : ",")
+               << "{\"cat\":\"" << e.category << "\",\"name\":\"" << e.name << "\",\"ph\":\"X\",\"ts\":";
+            micros(os, e.begin - mEpoch);
+            os << ",\"dur\":";
+            micros(os, e.end - e.begin);
+            os << std::setfill(' ') << ",\"pid\":" << pid << ",\"tid\":" << tid
+               << ",\"args\":{\"hService\":" << e.hService << ",\"ReqID\":" << e.reqId << "}}";
+            first = false;
+        }
+    }
+    os << "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"lost\":" << lost.load(boost::memory_order_relaxed) << "}}";
+    return os.str();
+}
+void Tracer::dump() const {
+    std::ofstream file(dumpPath.c_str(), std::ios::out | std::ios::trunc);
+    if (!file) {
+        {XFS::Logger() << "Tracer: cannot write " << dumpPath; }
+        return;
+    }
+    file << json();
+}
+void Tracer::run() const {
+    try {
+        for (;;) {
+            boost::this_thread::sleep_for(boost::chrono::seconds(dumpPeriod));
+            dump();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Arrêt demandé par le destructeur.
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef PCSC_CENXFS_BRIDGE_Tracer_H
+#define PCSC_CENXFS_BRIDGE_Tracer_H
+
+#pragma once
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- pour HSERVICE et REQUESTID
+#include <XFSIDC.h>
+
+/** Traceur d'intervalles (spans) : début et fin des appels SPI, des appels PC/SC et de l'envoi des
+    messages XFS, avec le thread, le service et la requête concernés. Permet de voir où une lecture
+    de carte lente passe son temps.
+@par
+    Désactivé par défaut. Si la variable d'environnement `PCSC_CENXFS_BRIDGE_TRACE` contient un chemin
+    de fichier, les intervalles y sont écrits toutes les 30 secondes et au déchargement de la bibliothèque,
+    au format JSON des événements de trace de Chrome, lisible par `chrome://tracing` et Perfetto.
+@par
+    Chaque thread écrit dans son propre tampon circulaire, sans verrou : seul le thread propriétaire
+    y écrit, et le thread d'écriture du fichier copie les événements publiés, en écartant ceux qui ont
+    été écrasés pendant la copie. Seuls les derniers `ringSize` intervalles de chaque thread sont gardés.
+*/
+class Tracer : private boost::noncopyable {
+public:
+    enum {
+        /// Nombre maximal de threads tracés. Les intervalles des threads suivants sont perdus.
+        ringCount = 64,
+        /// Nombre d'intervalles gardés par thread.
+        ringSize = 4096
+    };
+    struct Event {
+        /// Catégorie et nom de l'intervalle. Chaînes littérales.
+        const char* category;
+        const char* name;
+        /// Début et fin, en nanosecondes de `steady_clock`.
+        boost::int64_t begin;
+        boost::int64_t end;
+        REQUESTID reqId;
+        HSERVICE hService;
+    };
+    class Span;
+private:
+    struct Ring {
+        /// Thread propriétaire, 0 si le tampon est libre. Un tampon pris n'est jamais rendu.
+        boost::atomic<DWORD> owner;
+        /// Nombre d'événements écrits depuis la création du tampon.
+        boost::atomic<boost::uint32_t> head;
+        /// Alloué par le propriétaire avant la publication du premier événement.
+        Event* events;
+
+        Ring() : owner(0), head(0), events(NULL) {}
+    };
+private:
+    bool mEnabled;
+    /// Origine des horodatages du fichier.
+    boost::int64_t mEpoch;
+    std::string dumpPath;
+    Ring rings[ringCount];
+    /// Nombre d'intervalles perdus faute de tampon libre.
+    boost::atomic<boost::uint32_t> lost;
+    boost::shared_ptr<boost::thread> dumpThread;
+public:
+    Tracer();
+    /// Arrête l'écriture périodique et écrit une dernière fois les intervalles.
+    ~Tracer();
+
+    inline bool enabled() const { return mEnabled; }
+    static inline boost::int64_t now() {
+        return boost::chrono::steady_clock::now().time_since_epoch().count();
+    }
+    /// Enregistre l'intervalle dans le tampon du thread appelant.
+    void record(const char* category, const char* name, boost::int64_t begin, boost::int64_t end, HSERVICE hService, REQUESTID ReqID);
+    /// Retourne les intervalles gardés au format JSON des événements de trace de Chrome.
+    std::string json() const;
+private:
+    /// Tampon du thread appelant, pris à son premier appel. `NULL` s'il n'y a plus de tampon libre.
+    Ring* ring();
+    void dump() const;
+    void run() const;
+};
+
+/** Traceur du processus. Défini dans `PCSCspi.cpp` avant le gestionnaire, il est détruit après lui
+    et trace donc aussi les déconnexions faites au déchargement de la bibliothèque.
+*/
+extern Tracer tracer;
+
+/** Intervalle couvrant la portée de l'objet. Ne coûte qu'un test si le traceur est désactivé. */
+class Tracer::Span : private boost::noncopyable {
+    const char* mCategory;
+    const char* mName;
+    HSERVICE mService;
+    REQUESTID mReqId;
+    boost::int64_t mBegin;
+    bool mActive;
+public:
+    /**
+    @param category
+        Catégorie de l'intervalle : `spi` pour les fonctions exportées, `pcsc` pour les appels PC/SC,
+        `xfs` pour l'envoi des messages, `provider` pour le travail interne du fournisseur.
+    @param name
+        Nom de l'intervalle. Doit être une chaîne littérale.
+    */
+    Span(const char* category, const char* name, HSERVICE hService = 0, REQUESTID ReqID = 0)
+        : mCategory(category), mName(name), mService(hService), mReqId(ReqID)
+        , mBegin(0), mActive(tracer.enabled())
+    {
+        if (mActive) {
+            mBegin = Tracer::now();
+        }
+    }
+    ~Span() {
+        if (mActive) {
+            tracer.record(mCategory, mName, mBegin, Tracer::now(), mService, mReqId);
+        }
+    }
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Tracer_H
@@ -0,0 +1,147 @@
+#ifndef PCSC_CENXFS_BRIDGE_Utils_Epoch_H
+#define PCSC_CENXFS_BRIDGE_Utils_Epoch_H
+
+#pragma once
+
+#include <cassert>
+// Pour std::size_t
+#include <cstddef>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+/** Domaine de récupération mémoire par époques (epoch-based reclamation). Permet aux lecteurs
+    d'une structure publiée par pointeur atomique de la parcourir sans verrou, tandis que les
+    écrivains remplacent la structure par une copie modifiée et confient l'ancienne au domaine,
+    qui ne la détruit que lorsqu'aucun lecteur ne peut plus la voir.
+@par
+    Chaque thread lecteur occupe un emplacement dans un tableau de taille fixe. En entrant dans une
+    section de lecture (`Guard`), il y publie l'époque courante ; en sortant, il y remet 0. Un objet
+    retiré à l'époque `e` est détruit dès que tous les lecteurs actifs ont une époque supérieure à `e`.
+@par
+    Les sections de lecture peuvent être imbriquées dans un même thread. Les écrivains doivent être
+    sérialisés par l'appelant : `retire` et `reclaim` ne sont pas thread-safe entre eux.
+*/
+class EpochDomain : private boost::noncopyable {
+    /// Emplacement d'un thread lecteur.
+    struct Slot {
+        /// Époque publiée par le lecteur, 0 s'il n'est pas dans une section de lecture.
+        boost::atomic<unsigned long> epoch;
+        /// Indique que l'emplacement est occupé par un thread.
+        boost::atomic<bool> owned;
+        /// Profondeur d'imbrication des sections de lecture. N'est modifié que par le thread propriétaire.
+        unsigned depth;
+
+        Slot() : epoch(0), owned(false), depth(0) {}
+    };
+    /// Objet retiré, en attente de destruction.
+    struct Retired {
+        unsigned long epoch;
+        void* ptr;
+        void (*deleter)(void*);
+    };
+    typedef std::vector<Retired> RetiredList;
+public:
+    /// Nombre maximal de threads pouvant se trouver simultanément dans des sections de lecture.
+    static const std::size_t MaxThreads = 128;
+private:
+    Slot slots[MaxThreads];
+    /// Époque globale, incrémentée à chaque retrait.
+    boost::atomic<unsigned long> globalEpoch;
+    /// Emplacement occupé par le thread courant. À la fin du thread, l'emplacement est libéré.
+    boost::thread_specific_ptr<Slot> threadSlot;
+    /// Objets retirés qui peuvent encore être vus par un lecteur.
+    RetiredList retired;
+public:
+    /// Section de lecture : tant que l'objet existe, aucun objet vu par le thread ne sera détruit.
+    class Guard : private boost::noncopyable {
+        Slot& slot;
+    public:
+        explicit Guard(EpochDomain& domain) : slot(domain.acquire()) {
+            if (slot.depth++ == 0) {
+                slot.epoch.store(domain.globalEpoch.load());
+            }
+        }
+        ~Guard() {
+            assert(slot.depth > 0 && "Unbalanced epoch guard");
+            if (--slot.depth == 0) {
+                slot.epoch.store(0);
+            }
+        }
+    };
+public:
+    EpochDomain() : globalEpoch(1), threadSlot(&EpochDomain::release) {}
+    /// À la destruction, aucun lecteur ne doit plus exister : tous les objets retirés sont détruits.
+    ~EpochDomain() {
+        for (RetiredList::const_iterator it = retired.begin(); it != retired.end(); ++it) {
+            it->deleter(it->ptr);
+        }
+    }
+
+    /** Confie au domaine un objet qui n'est plus accessible depuis la structure publiée.
+        Il sera détruit par `delete` dès qu'aucun lecteur ne pourra plus le voir.
+    */
+    template<typename T>
+    void retire(T* ptr) {
+        if (ptr == 0) {
+            return;
+        }
+        Retired r;
+        r.epoch = globalEpoch.fetch_add(1);
+        r.ptr = const_cast<void*>(static_cast<const void*>(ptr));
+        r.deleter = &EpochDomain::destroy<T>;
+        retired.push_back(r);
+    }
+    /// Détruit tous les objets retirés qui ne peuvent plus être vus par aucun lecteur.
+    void reclaim() {
+        unsigned long minEpoch = globalEpoch.load();
+        for (std::size_t i = 0; i < MaxThreads; ++i) {
+            unsigned long e = slots[i].epoch.load();
+            if (e != 0 && e < minEpoch) {
+                minEpoch = e;
+            }
+        }
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < retired.size(); ++i) {
+            if (retired[i].epoch < minEpoch) {
+                retired[i].deleter(retired[i].ptr);
+            } else {
+                retired[kept++] = retired[i];
+            }
+        }
+        retired.resize(kept);
+    }
+private:
+    Slot& acquire() {
+        Slot* slot = threadSlot.get();
+        if (slot != 0) {
+            return *slot;
+        }
+        // Premier passage du thread : cherche un emplacement libre. Si tous sont occupés,
+        // attend qu'un thread se termine.
+        for (;;) {
+            for (std::size_t i = 0; i < MaxThreads; ++i) {
+                bool expected = false;
+                if (slots[i].owned.compare_exchange_strong(expected, true)) {
+                    threadSlot.reset(&slots[i]);
+                    return slots[i];
+                }
+            }
+            boost::this_thread::yield();
+        }
+    }
+    static void release(Slot* slot) {
+        slot->depth = 0;
+        slot->epoch.store(0);
+        slot->owned.store(false);
+    }
+    template<typename T>
+    static void destroy(void* ptr) {
+        delete static_cast<T*>(ptr);
+    }
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Utils_Epoch_H
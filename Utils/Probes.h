@@ -0,0 +1,61 @@
+#ifndef PCSC_CENXFS_BRIDGE_Utils_Probes_H
+#define PCSC_CENXFS_BRIDGE_Utils_Probes_H
+
+#pragma once
+
+/** Points de trace statiques (USDT, au format SystemTap `sys/sdt.h`), pour attacher bpftrace ou perf
+    à un processus en cours d'exécution sans le reconstruire ni le redémarrer, par exemple :
+@code
+    bpftrace -e 'usdt:./PCSCbroker:pcsc_cenxfs_bridge:pcsc_return { @[str(arg0)] = hist(arg1); }'
+@endcode
+    Les points ne sont compilés que si `PCSC_CENXFS_BRIDGE_USDT` est défini (option CMake `ENABLE_USDT`),
+    sinon les macros ne produisent aucun code. Compilé, un point désactivé n'est qu'une instruction `nop`.
+    Les arguments doivent être des entiers ou des pointeurs ; les chaînes sont lues par `str(argN)`.
+@par
+    Points disponibles (fournisseur `pcsc_cenxfs_bridge`) :
+    - `wfp_entry(name, hService, ReqID)`, `wfp_return(name, hService, ReqID, hResult)` : fonctions `WFP*` ;
+    - `pcsc_entry(name, reader)`, `pcsc_return(name, status)` : appels PC/SC, `reader` peut être `NULL` ;
+    - `task_add(hService, ReqID)`, `task_complete(hService, ReqID)`, `task_cancel(hService, ReqID)`,
+      `task_timeout(hService, ReqID)` : tâches en attente de carte ;
+    - `dispatch_entry(reader, eventState, deviceChange)`, `dispatch_return(reader)` : distribution
+      d'un changement de lecteur.
+*/
+#if defined(PCSC_CENXFS_BRIDGE_USDT)
+    #include <sys/sdt.h>
+
+    #define PCSC_PROBE1(name, a1)                 DTRACE_PROBE1(pcsc_cenxfs_bridge, name, a1)
+    #define PCSC_PROBE2(name, a1, a2)             DTRACE_PROBE2(pcsc_cenxfs_bridge, name, a1, a2)
+    #define PCSC_PROBE3(name, a1, a2, a3)         DTRACE_PROBE3(pcsc_cenxfs_bridge, name, a1, a2, a3)
+    #define PCSC_PROBE4(name, a1, a2, a3, a4)     DTRACE_PROBE4(pcsc_cenxfs_bridge, name, a1, a2, a3, a4)
+#else
+    #define PCSC_PROBE1(name, a1)                 ((void)0)
+    #define PCSC_PROBE2(name, a1, a2)             ((void)0)
+    #define PCSC_PROBE3(name, a1, a2, a3)         ((void)0)
+    #define PCSC_PROBE4(name, a1, a2, a3, a4)     ((void)0)
+#endif
+
+/** Encadre un appel PC/SC par les points `pcsc_entry` et `pcsc_return`. L'expression `call` est
+    évaluée une seule fois, son résultat est celui de la macro.
+@code
+    PCSC::Status st = PCSC_PROBED_CALL("SCardTransmit", mName.c_str(), SCardTransmit(hCard, ...));
+@endcode
+*/
+#if defined(PCSC_CENXFS_BRIDGE_USDT)
+    namespace Probes {
+        // Les points sont des instructions : les fonctions permettent de les placer dans une expression.
+        inline void enter(const char* name, const char* reader) {
+            PCSC_PROBE2(pcsc_entry, name, reader);
+        }
+        /// Déclenche `pcsc_return` et retourne le résultat de l'appel.
+        inline long leave(const char* name, long status) {
+            PCSC_PROBE2(pcsc_return, name, status);
+            return status;
+        }
+    } // namespace Probes
+    #define PCSC_PROBED_CALL(name, reader, call) \
+        (::Probes::enter(name, reader), ::Probes::leave(name, (long)(call)))
+#else
+    #define PCSC_PROBED_CALL(name, reader, call)  (call)
+#endif
+
+#endif // PCSC_CENXFS_BRIDGE_Utils_Probes_H
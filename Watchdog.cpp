@@ -0,0 +1,140 @@
+#include "Watchdog.h"
+
+#include "Manager.h"
+
+#include "PCSC/Status.h"
+
+#include "Utils/Probes.h"
+
+#include "XFS/Logger.h"
+
+#include <cassert>
+
+namespace bc = boost::chrono;
+
+static DWORD millis(bc::steady_clock::duration d) {
+    return (DWORD)bc::duration_cast<bc::milliseconds>(d).count();
+}
+
+Watchdog::Watchdog() : manager(NULL), lastId(0), timed(false), stopping(false) {}
+Watchdog::~Watchdog() {
+    stop();
+}
+void Watchdog::start(Manager& manager) {
+    assert(!thread && "Watchdog already started");
+    this->manager = &manager;
+    thread.reset(new boost::thread(&Watchdog::run, this));
+}
+void Watchdog::stop() {
+    if (!thread) {
+        return;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_one();
+    thread->join();
+    thread.reset();
+}
+const char* Watchdog::name(Operation operation) {
+    static const char* names[operationCount] = {
+        "SCardConnect",
+        "SCardTransmit",
+        "SCardReconnect",
+        "SCardStatus",
+    };
+    return names[operation];
+}
+const char* Watchdog::metric(Operation operation) {
+    static const char* names[operationCount] = {
+        "slow_connects",
+        "slow_transmits",
+        "slow_reconnects",
+        "slow_statuses",
+    };
+    return names[operation];
+}
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+boost::uint32_t Watchdog::enter(Operation operation, ReaderId reader, HSERVICE hService, DWORD threshold, SCARDCONTEXT cancelContext) {
+    Call call;
+    call.operation = operation;
+    call.reader = reader;
+    call.hService = hService;
+    call.threshold = threshold;
+    call.start = bc::steady_clock::now();
+    call.cancelContext = cancelContext;
+    call.reported = false;
+    const bc::steady_clock::time_point deadline = call.start + bc::milliseconds(threshold);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    // 0 désigne l'absence de surveillance, voir Guard.
+    if (++lastId == 0) {
+        ++lastId;
+    }
+    calls.insert(std::make_pair(lastId, call));
+    // Le thread n'est réveillé que si le nouveau seuil précède celui qu'il attend.
+    if (!timed || deadline < wakeAt) {
+        changed.notify_one();
+    }
+    return lastId;
+}
+void Watchdog::leave(boost::uint32_t id) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    CallMap::iterator it = calls.find(id);
+    assert(it != calls.end() && "Watchdog: unknown call");
+    const Call& call = it->second;
+    const bc::steady_clock::duration elapsed = bc::steady_clock::now() - call.start;
+    if (!call.reported && elapsed >= bc::milliseconds(call.threshold)) {
+        // Terminé en retard avant le réveil du thread : celui-ci le signale hors de l'appel.
+        Report r = {call.operation, call.reader, call.hService, call.threshold, millis(elapsed), true, false};
+        late.push_back(r);
+        changed.notify_one();
+    }
+    calls.erase(it);
+}
+void Watchdog::run() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping) {
+        const bc::steady_clock::time_point now = bc::steady_clock::now();
+        std::vector<Report> reports;
+        reports.swap(late);
+        timed = false;
+        for (CallMap::iterator it = calls.begin(); it != calls.end(); ++it) {
+            Call& call = it->second;
+            if (call.reported) {
+                continue;
+            }
+            const bc::steady_clock::time_point deadline = call.start + bc::milliseconds(call.threshold);
+            if (deadline <= now) {
+                call.reported = true;
+                // Le contexte reste valide tant que l'appel est enregistré, donc sous le verrou.
+                bool cancelled = false;
+                if (call.cancelContext != 0) {
+                    PCSC::Status st = PCSC_PROBED_CALL("SCardCancel", NULL, SCardCancel(call.cancelContext));
+                    {XFS::Logger() << "Watchdog: SCardCancel(hContext=" << call.cancelContext << ") = " << st; }
+                    cancelled = st;
+                }
+                Report r = {call.operation, call.reader, call.hService, call.threshold, millis(now - call.start), false, cancelled};
+                reports.push_back(r);
+            } else if (!timed || deadline < wakeAt) {
+                timed = true;
+                wakeAt = deadline;
+            }
+        }
+        if (!reports.empty()) {
+            // Le gestionnaire notifie les services : les appels surveillés ne doivent pas attendre.
+            lock.unlock();
+            for (std::vector<Report>::const_iterator it = reports.begin(); it != reports.end(); ++it) {
+                manager->slowCall(*it);
+            }
+            lock.lock();
+            continue;
+        }
+        if (timed) {
+            changed.wait_until(lock, wakeAt);
+        } else {
+            changed.wait(lock);
+        }
+    }
+}
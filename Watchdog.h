@@ -0,0 +1,139 @@
+#ifndef PCSC_CENXFS_BRIDGE_Watchdog_H
+#define PCSC_CENXFS_BRIDGE_Watchdog_H
+
+#pragma once
+
+#include "ReaderNames.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// PC/CS API
+#include <winscard.h>
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- pour HSERVICE
+#include <XFSIDC.h>
+
+class Manager;
+/** Surveille la durée des appels PC/SC en cours et signale au gestionnaire (`Manager::slowCall`)
+    ceux qui dépassent leur seuil (voir `Settings::Watchdog`) : la dérive des durées révèle un lecteur
+    qui se dégrade (contacts sales, concentrateur USB défaillant) avant les échecs.
+@par
+    Un appel est signalé une seule fois : par le thread de surveillance dès que son seuil est atteint,
+    même s'il ne se termine jamais, ou à sa fin s'il s'est terminé en retard avant le réveil du thread.
+    Le thread dort jusqu'au plus proche seuil des appels en cours, sans interrogation périodique.
+@par
+    Si l'interruption est demandée, le thread appelle `SCardCancel` sur le contexte du lecteur, propre
+    à lui : les autres lecteurs et le thread de surveillance des lecteurs ne sont pas touchés.
+*/
+class Watchdog : private boost::noncopyable {
+public:
+    /// Appels PC/SC surveillés.
+    enum Operation {
+        Connect,
+        Transmit,
+        Reconnect,
+        Status,
+        operationCount
+    };
+    /// Appel lent, transmis au gestionnaire.
+    struct Report {
+        Operation operation;
+        ReaderId reader;
+        /// Service pour lequel l'appel est fait, 0 s'il est fait pour le lecteur lui-même.
+        HSERVICE hService;
+        /// Seuil dépassé, en millisecondes.
+        DWORD threshold;
+        /// Durée de l'appel au moment du signalement, en millisecondes.
+        DWORD elapsed;
+        /// `true` si l'appel était déjà terminé.
+        bool completed;
+        /// `true` si l'appel a été interrompu par `SCardCancel`.
+        bool cancelled;
+    };
+    class Guard;
+private:
+    struct Call {
+        Operation operation;
+        ReaderId reader;
+        HSERVICE hService;
+        DWORD threshold;
+        boost::chrono::steady_clock::time_point start;
+        /// Contexte à interrompre au dépassement du seuil, 0 si l'interruption n'est pas demandée.
+        SCARDCONTEXT cancelContext;
+        /// `true` si l'appel a déjà été signalé.
+        bool reported;
+    };
+    typedef std::map<boost::uint32_t, Call> CallMap;
+private:
+    /// Destinataire des signalements. `NULL` tant que la surveillance n'est pas démarrée.
+    Manager* manager;
+    /// Protège tous les champs suivants.
+    boost::mutex mutex;
+    /// Réveille le thread de surveillance.
+    boost::condition_variable changed;
+    /// Appels en cours, par numéro.
+    CallMap calls;
+    boost::uint32_t lastId;
+    /// Appels terminés en retard, pas encore signalés.
+    std::vector<Report> late;
+    /// `true` si le thread attend jusqu'à `wakeAt`, `false` s'il attend sans limite.
+    bool timed;
+    boost::chrono::steady_clock::time_point wakeAt;
+    bool stopping;
+    boost::scoped_ptr<boost::thread> thread;
+public:
+    Watchdog();
+    ~Watchdog();
+
+    /// Démarre le thread de surveillance, qui transmet les appels lents au gestionnaire spécifié.
+    void start(Manager& manager);
+    /** Arrête le thread de surveillance. Appelé par le gestionnaire avant la destruction des services :
+        les appels faits ensuite ne sont plus signalés.
+    */
+    void stop();
+
+    /// Nom de la fonction PC/SC surveillée.
+    static const char* name(Operation operation);
+    /// Nom du compteur des appels lents dans les métriques.
+    static const char* metric(Operation operation);
+private:
+    boost::uint32_t enter(Operation operation, ReaderId reader, HSERVICE hService, DWORD threshold, SCARDCONTEXT cancelContext);
+    void leave(boost::uint32_t id);
+    void run();
+};
+
+/** Surveille l'appel PC/SC fait dans la portée de l'objet. Ne coûte qu'un test si le seuil est nul.
+@code
+    Watchdog::Guard guard(pcsc.watchdog(), Watchdog::Transmit, mId, hService, mLimits.transmit, cancelContext());
+    st = SCardTransmit(...);
+@endcode
+*/
+class Watchdog::Guard : private boost::noncopyable {
+    Watchdog& mWatchdog;
+    boost::uint32_t mId;
+public:
+    /**
+    @param threshold
+        Seuil en millisecondes, `0` désactive la surveillance.
+    @param cancelContext
+        Contexte à interrompre au dépassement du seuil, `0` si l'interruption n'est pas demandée.
+    */
+    Guard(Watchdog& watchdog, Operation operation, ReaderId reader, HSERVICE hService, DWORD threshold, SCARDCONTEXT cancelContext)
+        : mWatchdog(watchdog)
+        , mId(threshold != 0 ? watchdog.enter(operation, reader, hService, threshold, cancelContext) : 0) {}
+    ~Guard() {
+        if (mId != 0) {
+            mWatchdog.leave(mId);
+        }
+    }
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Watchdog_H
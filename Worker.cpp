@@ -0,0 +1,39 @@
+#include "Worker.h"
+
+Worker::Worker() : stopping(false) {
+    thread.reset(new boost::thread(&Worker::run, this));
+}
+Worker::~Worker() {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_one();
+    thread->join();
+}
+void Worker::post(const Job& job) {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    changed.notify_one();
+}
+void Worker::run() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (;;) {
+        if (jobs.empty()) {
+            if (stopping) {
+                return;
+            }
+            changed.wait(lock);
+            continue;
+        }
+        Job job;
+        job.swap(jobs.front());
+        jobs.pop_front();
+        // Le travail est exécuté hors du verrou : les nouveaux travaux sont acceptés pendant ce temps.
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PCSC_CENXFS_BRIDGE_Worker_H
+#define PCSC_CENXFS_BRIDGE_Worker_H
+
+#pragma once
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/** Exécute dans son propre thread, dans l'ordre d'arrivée, les travaux que le thread de surveillance
+    des lecteurs ne doit pas faire lui-même : les échanges avec la puce peuvent durer plusieurs
+    secondes, pendant lesquelles les changements des autres lecteurs ne seraient pas distribués.
+*/
+class Worker : private boost::noncopyable {
+public:
+    typedef boost::function<void()> Job;
+private:
+    /// Protège tous les champs suivants.
+    boost::mutex mutex;
+    /// Réveille le thread.
+    boost::condition_variable changed;
+    /// Travaux en attente.
+    std::deque<Job> jobs;
+    bool stopping;
+    boost::scoped_ptr<boost::thread> thread;
+public:
+    /// Démarre le thread.
+    Worker();
+    /// Arrête le thread après l'exécution des travaux déjà confiés.
+    ~Worker();
+
+    /// Confie le travail au thread. Ne bloque pas.
+    void post(const Job& job);
+private:
+    void run();
+};
+
+#endif // PCSC_CENXFS_BRIDGE_Worker_H
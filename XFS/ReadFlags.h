@@ -6,6 +6,8 @@
 #include "Utils/CTString.h"
 #include "Utils/Flags.h"
 
+#include "XFS/Vendor.h"
+
 #include <vector>
 // Для DWORD
 #include <windef.h>
@@ -34,6 +36,9 @@ namespace XFS {
                 // If the IDC Flux Sensor is programmable it will be disabled in order
                 // to allow chip data to be read on cards which have no magnetic stripes.
                 CTString("WFS_IDC_FLUXINACTIVE"), // 0x0020
+                // Расширения поставщика, см. XFS/Vendor.h
+                CTString("WFS_IDC_PCSC_UID"    ), // 0x1000
+                CTString("WFS_IDC_PCSC_ATS"    ), // 0x2000
                 CTString("WFS_IDC_TRACK_WM"    ), // 0x8000
             };
             std::vector<CTString> result;
@@ -44,6 +49,8 @@ namespace XFS {
             ++i; if (value() & WFS_IDC_CHIP        ) result.push_back(names[i]);
             ++i; if (value() & WFS_IDC_SECURITY    ) result.push_back(names[i]);
             ++i; if (value() & WFS_IDC_FLUXINACTIVE) result.push_back(names[i]);
+            ++i; if (value() & WFS_IDC_PCSC_UID    ) result.push_back(names[i]);
+            ++i; if (value() & WFS_IDC_PCSC_ATS    ) result.push_back(names[i]);
             ++i; if (value() & WFS_IDC_TRACK_WM    ) result.push_back(names[i]);
             return result;
         }
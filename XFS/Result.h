@@ -8,9 +8,12 @@
 
 #include "PCSC/Status.h"
 
+#include "Tracer.h"
+
 #include "XFS/Logger.h"
 #include "XFS/Memory.h"
 #include "XFS/Status.h"
+#include "XFS/Vendor.h"
 
 #include <cassert>
 #include <sstream>
@@ -72,6 +75,10 @@ namespace XFS {
         Result(REQUESTID ReqID, HSERVICE hService, HRESULT result) {
             init(ReqID, hService, result);
         }
+        /// Prend en charge un résultat déjà rempli, alloué par `WFMAllocateBuffer`.
+        explicit Result(WFSRESULT* result) : pResult(result) {
+            assert(pResult != NULL);
+        }
     public:// Remplissage des résultats des commandes WFPGetInfo
         /// Attache les données de statut spécifiées au résultat.
         inline Result& attach(WFSIDCSTATUS* data) {
@@ -87,6 +94,27 @@ namespace XFS {
             pResult->lpBuffer = data;
             return *this;
         }
+        /// Attache le texte des métriques du fournisseur (catégorie `WFS_INF_IDC_PCSC_METRICS`) au résultat.
+        inline Result& metrics(LPSTR text) {
+            assert(pResult != NULL);
+            pResult->u.dwCommandCode = WFS_INF_IDC_PCSC_METRICS;
+            pResult->lpBuffer = text;
+            return *this;
+        }
+        /// Attache la liste des formes (catégorie `WFS_INF_IDC_FORM_LIST`) au résultat.
+        inline Result& formList(LPSTR names) {
+            assert(pResult != NULL);
+            pResult->u.dwCommandCode = WFS_INF_IDC_FORM_LIST;
+            pResult->lpBuffer = names;
+            return *this;
+        }
+        /// Attache les éléments de la puce (catégorie `WFS_INF_IDC_PCSC_CHIP_TAGS`) au résultat.
+        inline Result& chipTags(LPSTR fields) {
+            assert(pResult != NULL);
+            pResult->u.dwCommandCode = WFS_INF_IDC_PCSC_CHIP_TAGS;
+            pResult->lpBuffer = fields;
+            return *this;
+        }
     public:// Remplissage des résultats des commandes WFPExecute
         /// Attache les données de lecture de carte spécifiées au résultat.
         inline Result& attach(WFSIDCCARDDATA** data) {
@@ -111,6 +139,36 @@ namespace XFS {
             pResult->lpBuffer = data;
             return *this;
         }
+        /// Attache les champs analysés (commande `WFS_CMD_IDC_PARSE_DATA`) au résultat.
+        inline Result& parsed(LPSTR fields) {
+            assert(pResult != NULL);
+            assert(pResult->lpBuffer == NULL && "Result already has data!");
+            pResult->u.dwCommandCode = WFS_CMD_IDC_PARSE_DATA;
+            pResult->lpBuffer = fields;
+            return *this;
+        }
+        /// Attache la liste des fonctions du lecteur (catégorie `WFS_INF_IDC_PCSC_FEATURES`) au résultat.
+        inline Result& features(LPSTR fields) {
+            assert(pResult != NULL);
+            pResult->u.dwCommandCode = WFS_INF_IDC_PCSC_FEATURES;
+            pResult->lpBuffer = fields;
+            return *this;
+        }
+        inline Result& attach(WFSIDCPCSCCONTROLOUT* data) {
+            assert(pResult != NULL);
+            assert(pResult->lpBuffer == NULL && "Result already has data!");
+            pResult->u.dwCommandCode = WFS_CMD_IDC_PCSC_CONTROL;
+            pResult->lpBuffer = data;
+            return *this;
+        }
+        /// Attache le texte de l'enregistreur de vol (commande `WFS_CMD_IDC_PCSC_DUMP_RECORDER`) au résultat.
+        inline Result& recorderDump(LPSTR text) {
+            assert(pResult != NULL);
+            assert(pResult->lpBuffer == NULL && "Result already has data!");
+            pResult->u.dwCommandCode = WFS_CMD_IDC_PCSC_DUMP_RECORDER;
+            pResult->lpBuffer = text;
+            return *this;
+        }
     public:
         /// Attache les données de capacités de l'appareil spécifiées au résultat.
         inline Result& attach(WFSDEVSTATUS* data) {
@@ -154,8 +212,15 @@ namespace XFS {
             pResult->u.dwEventID = WFS_CMD_IDC_EJECT_CARD;
             return *this;
         }
+        inline Result& reset() {
+            assert(pResult != NULL);
+            assert(pResult->lpBuffer == NULL && "Result already has data!");
+            pResult->u.dwCommandCode = WFS_CMD_IDC_RESET;
+            return *this;
+        }
         void send(HWND hWnd, DWORD messageType) {
             assert(pResult != NULL);
+            Tracer::Span span("xfs", "Result::send", pResult->hService, pResult->RequestID);
             Logger() << "Result::send(hWnd=" << hWnd << ", type=" << MsgType(messageType)
                      << ") with result " << Status(pResult->hResult) << " for ReqID=" << pResult->RequestID;
             PostMessage(hWnd, messageType, NULL, (LPARAM)pResult);
@@ -0,0 +1,117 @@
+#ifndef PCSC_CENXFS_BRIDGE_XFS_ResultTemplate_H
+#define PCSC_CENXFS_BRIDGE_XFS_ResultTemplate_H
+
+#pragma once
+
+#include "XFS/Result.h"
+
+#include <cassert>
+// Pour std::size_t et offsetof
+#include <cstddef>
+// Pour std::memcpy et std::strlen
+#include <cstring>
+#include <vector>
+
+// Pour GetSystemTime
+#include <WinBase.h>
+// Pour WFMAllocateBuffer
+#include <xfsadmin.h>
+
+namespace XFS {
+    /** Modèle d'un résultat XFS, construit une seule fois par événement et copié pour chaque abonné.
+    @par
+        Le `WFSRESULT` et toutes les données qui lui sont attachées sont placés dans un seul bloc
+        contigu : la copie pour un abonné ne demande donc qu'un appel à `WFMAllocateBuffer` et un
+        `memcpy`, suivis de la correction des pointeurs internes au bloc. L'application libère le
+        tout par `WFSFreeResult`, comme un résultat ordinaire.
+    @par
+        L'horodatage est pris une seule fois, à la construction du modèle : tous les abonnés reçoivent
+        le même instant d'occurrence de l'événement.
+    */
+    class ResultTemplate {
+        /// Alignement des données ajoutées au bloc, suffisant pour toutes les structures XFS.
+        static const std::size_t Alignment = 8;
+        /// Pointeur interne au bloc : emplacement du pointeur et position de la donnée pointée.
+        struct Link {
+            std::size_t field;
+            std::size_t target;
+        };
+        typedef std::vector<Link> LinkList;
+    private:
+        /// Contenu du bloc. Commence toujours par `WFSRESULT`.
+        std::vector<char> mData;
+        /// Pointeurs à corriger dans chaque copie.
+        LinkList mLinks;
+    public:
+        ResultTemplate(REQUESTID ReqID, HSERVICE hService, HRESULT result) : mData(sizeof(WFSRESULT)) {
+            WFSRESULT& r = header();
+            r.RequestID = ReqID;
+            r.hService = hService;
+            r.hResult = result;
+            GetSystemTime(&r.tsTimestamp);
+        }
+    public:
+        /// Définit l'identifiant de l'événement transporté par le résultat.
+        inline ResultTemplate& event(DWORD dwEventID) {
+            header().u.dwEventID = dwEventID;
+            return *this;
+        }
+        /** Ajoute une copie de la structure au bloc.
+        @return Position de la copie dans le bloc, à utiliser avec `at`, `attach` et `link`.
+        */
+        template<typename T>
+        std::size_t append(const T& value) {
+            std::size_t offset = reserve(sizeof(T));
+            std::memcpy(&mData[offset], &value, sizeof(T));
+            return offset;
+        }
+        /// Ajoute une copie de la chaîne, y compris le zéro final, au bloc.
+        std::size_t append(const char* str) {
+            std::size_t len = std::strlen(str) + 1;
+            std::size_t offset = reserve(len);
+            std::memcpy(&mData[offset], str, len);
+            return offset;
+        }
+        /// Accès à une structure précédemment ajoutée. Le pointeur n'est valable que jusqu'au prochain ajout.
+        template<typename T>
+        inline T* at(std::size_t offset) {
+            assert(offset + sizeof(T) <= mData.size());
+            return reinterpret_cast<T*>(&mData[offset]);
+        }
+        /** Indique que le pointeur situé à la position `field` doit, dans chaque copie,
+            pointer sur la donnée ajoutée à la position `target`.
+        */
+        inline ResultTemplate& link(std::size_t field, std::size_t target) {
+            assert(field + sizeof(void*) <= mData.size() && target < mData.size());
+            Link l = { field, target };
+            mLinks.push_back(l);
+            return *this;
+        }
+        /// Fait de la donnée ajoutée à la position `offset` le `lpBuffer` du résultat.
+        inline ResultTemplate& attach(std::size_t offset) {
+            return link(offsetof(WFSRESULT, lpBuffer), offset);
+        }
+    public:
+        /// Crée une copie indépendante du résultat, à transmettre à un abonné.
+        Result clone() const {
+            char* block = 0;
+            HRESULT h = WFMAllocateBuffer((ULONG)mData.size(), WFS_MEM_ZEROINIT, (void**)&block);
+            assert(h >= 0 && "Cannot allocate memory");
+            std::memcpy(block, &mData[0], mData.size());
+            for (LinkList::const_iterator it = mLinks.begin(); it != mLinks.end(); ++it) {
+                char* target = block + it->target;
+                std::memcpy(block + it->field, &target, sizeof(target));
+            }
+            return Result(reinterpret_cast<WFSRESULT*>(block));
+        }
+    private:
+        inline WFSRESULT& header() { return *reinterpret_cast<WFSRESULT*>(&mData[0]); }
+        /// Agrandit le bloc pour y placer `size` octets alignés et retourne leur position.
+        std::size_t reserve(std::size_t size) {
+            std::size_t offset = (mData.size() + Alignment - 1) / Alignment * Alignment;
+            mData.resize(offset + size);
+            return offset;
+        }
+    };
+} // namespace XFS
+#endif // PCSC_CENXFS_BRIDGE_XFS_ResultTemplate_H
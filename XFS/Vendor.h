@@ -0,0 +1,94 @@
+#ifndef PCSC_CENXFS_BRIDGE_XFS_Vendor_H
+#define PCSC_CENXFS_BRIDGE_XFS_Vendor_H
+
+#pragma once
+
+// Définitions pour les lecteurs de cartes (Identification card unit (IDC)) -- pour IDC_SERVICE_OFFSET
+#include <XFSIDC.h>
+
+/** Extensions propres au fournisseur, en dehors de la norme CEN/XFS. Les valeurs sont choisies
+    dans la plage de la classe IDC, au-delà des valeurs utilisées par la norme.
+*/
+
+/** Catégorie `WFPGetInfo` : métriques du fournisseur (voir `Metrics`). Pas de paramètres,
+    `lpBuffer` du résultat est une chaîne `LPSTR` terminée par zéro, au format JSON.
+*/
+#define WFS_INF_IDC_PCSC_METRICS    (IDC_SERVICE_OFFSET + 90)
+/** Commande `WFPExecute` : vide l'enregistreur de vol du fournisseur (voir `FlightRecorder`) dans
+    la trace XFS et dans son fichier. Pas de paramètres, `lpBuffer` du résultat est une chaîne `LPSTR`
+    terminée par zéro, avec un événement par ligne.
+*/
+#define WFS_CMD_IDC_PCSC_DUMP_RECORDER  (IDC_SERVICE_OFFSET + 91)
+/** Indicateurs de `WFS_CMD_IDC_READ_RAW_DATA` : identifiant (UID) de la carte sans contact et octets
+    historiques de son ATS, lus par la pseudo-commande GET DATA de PC/SC 2.01 partie 3 (`FF CA`) si le
+    paramètre `Contactless` du fournisseur est activé (voir `Settings::contactless`). Chacun ajoute
+    une structure `WFSIDCCARDDATA` au résultat, avec `wDataSource` égal à l'indicateur.
+*/
+#define WFS_IDC_PCSC_UID    0x1000
+#define WFS_IDC_PCSC_ATS    0x2000
+
+/** Événement `WFS_USER_EVENT` : un appel PC/SC sur le lecteur du service a dépassé son seuil
+    (voir `Watchdog`). `lpBuffer` pointe sur une structure `WFSIDCPCSCSLOWCALL`.
+*/
+#define WFS_USRE_IDC_PCSC_SLOW_CALL     (IDC_SERVICE_OFFSET + 92)
+
+/** Catégorie `WFPGetInfo` : éléments BER-TLV des réponses de la puce de la carte présente, gardées
+    depuis sa dernière réinitialisation. `lpQueryDetails` est une chaîne `LPSTR` d'étiquettes en
+    hexadécimal séparées par des espaces ou des virgules, par exemple `"57 5A 9F27"`. `lpBuffer` du
+    résultat est une liste de paires `étiquette=valeur` (valeur en hexadécimal) terminées par zéro,
+    la liste étant terminée par un zéro supplémentaire ; les étiquettes introuvables sont omises.
+*/
+#define WFS_INF_IDC_PCSC_CHIP_TAGS  (IDC_SERVICE_OFFSET + 93)
+/** Forme de `WFS_CMD_IDC_PARSE_DATA`, la seule connue du fournisseur : les données `WFS_IDC_CHIP`
+    sont analysées en BER-TLV et le résultat contient leurs éléments primitifs, au format de
+    `WFS_INF_IDC_PCSC_CHIP_TAGS`. Le mot d'état SW1 SW2 final est ignoré s'il est présent.
+*/
+#define WFS_IDC_PCSC_FORM_TLV   "PCSC_TLV"
+
+/** Commande `WFPExecute` : envoie au lecteur de la carte présente un code de contrôle par `SCardControl`
+    (PC/SC partie 10 : saisie sécurisée du code PIN, affichage, commandes d'échappement du fabricant).
+    `lpCmdData` pointe sur une structure `WFSIDCPCSCCONTROL`, `lpBuffer` du résultat sur une structure
+    `WFSIDCPCSCCONTROLOUT`. Supportée si le paramètre `Control` du fournisseur est activé (voir
+    `Settings::control`) ; seuls les codes annoncés par `WFS_INF_IDC_PCSC_FEATURES` et les codes des
+    fabricants (fonctions 2048 à 4095 de `SCARD_CTL_CODE`) sont transmis.
+*/
+#define WFS_CMD_IDC_PCSC_CONTROL    (IDC_SERVICE_OFFSET + 94)
+/** Catégorie `WFPGetInfo` : fonctions du lecteur du service, obtenues par `CM_IOCTL_GET_FEATURE_REQUEST`
+    une seule fois par lecteur. Pas de paramètres, `lpBuffer` du résultat est une liste de paires
+    `nom=code` (code de contrôle en hexadécimal), par exemple `FEATURE_VERIFY_PIN_DIRECT=42330006`,
+    terminées par zéro, la liste étant terminée par un zéro supplémentaire.
+*/
+#define WFS_INF_IDC_PCSC_FEATURES   (IDC_SERVICE_OFFSET + 95)
+
+#pragma pack(push, 1)
+typedef struct _wfs_idc_pcsc_slow_call {
+    /// Nom PC/SC du lecteur.
+    LPSTR lpszPhysicalName;
+    /// Fonction PC/SC, par exemple `SCardTransmit`.
+    LPSTR lpszOperation;
+    /// Seuil dépassé, en millisecondes.
+    ULONG ulThreshold;
+    /// Durée de l'appel au moment du signalement, en millisecondes.
+    ULONG ulElapsed;
+    /// `TRUE` si l'appel était déjà terminé au moment du signalement.
+    BOOL bCompleted;
+    /// `TRUE` si l'appel a été interrompu par `SCardCancel`.
+    BOOL bCancelled;
+} WFSIDCPCSCSLOWCALL, *LPWFSIDCPCSCSLOWCALL;
+
+typedef struct _wfs_idc_pcsc_control {
+    /// Code de contrôle, l'un de ceux de `WFS_INF_IDC_PCSC_FEATURES`.
+    DWORD dwControlCode;
+    /// Données passées au lecteur, par exemple la structure `PIN_VERIFY_STRUCTURE`.
+    ULONG ulInDataLength;
+    LPBYTE lpbInData;
+} WFSIDCPCSCCONTROL, *LPWFSIDCPCSCCONTROL;
+
+typedef struct _wfs_idc_pcsc_control_out {
+    /// Réponse du lecteur, par exemple SW1 SW2 de la vérification du code PIN.
+    ULONG ulOutDataLength;
+    LPBYTE lpbOutData;
+} WFSIDCPCSCCONTROLOUT, *LPWFSIDCPCSCCONTROLOUT;
+#pragma pack(pop)
+
+#endif // PCSC_CENXFS_BRIDGE_XFS_Vendor_H
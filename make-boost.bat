@@ -1,2 +1,2 @@
 rem Параметры сборки библиотек буста, требуемые для проекта
-b2 --with-chrono --with-thread --with-date_time toolset=msvc link=static runtime-link=static threading=multi variant=release
\ No newline at end of file
+b2 --with-atomic --with-chrono --with-thread --with-date_time toolset=msvc link=static runtime-link=static threading=multi variant=release
\ No newline at end of file